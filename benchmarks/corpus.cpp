@@ -0,0 +1,86 @@
+#include "corpus.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+
+namespace {
+
+uint64_t splitMix64(uint64_t& state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Incompressible bytes that depend only on the seed
+void fillContent(std::string& data, size_t size, uint64_t seed) {
+    data.resize(size);
+    uint64_t state = seed;
+    for (size_t offset = 0; offset < size; offset += sizeof(uint64_t)) {
+        const uint64_t value = splitMix64(state);
+        std::memcpy(&data[offset], &value, std::min(sizeof(value), size - offset));
+    }
+}
+
+// An original file whose content later files may copy
+struct Source {
+    uint64_t seed;
+    size_t size;
+};
+
+} // namespace
+
+// Function to write a deterministic corpus of originals, copies and near copies
+Corpus generateCorpus(const std::filesystem::path& root, const CorpusSpec& spec) {
+    std::mt19937_64 rng(spec.seed);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    const double log_min = std::log(static_cast<double>(std::max<size_t>(1, spec.smallMin)));
+    const double log_max = std::log(static_cast<double>(std::max(spec.smallMin, spec.smallMax)));
+    const size_t fanout = std::max<size_t>(1, spec.filesPerDirectory);
+
+    Corpus corpus;
+    std::vector<Source> small_sources;
+    std::vector<Source> large_sources;
+    std::string data;
+    const size_t total = spec.smallFiles + spec.largeFiles;
+    for (size_t i = 0; i < total; ++i) {
+        const bool large = i >= spec.smallFiles;
+        std::vector<Source>& sources = large ? large_sources : small_sources;
+
+        const double roll = unit(rng);
+        bool near = false;
+        Source source;
+        if (!sources.empty() && roll < spec.duplicateRatio + spec.nearDuplicateRatio) {
+            source = sources[rng() % sources.size()];
+            near = roll >= spec.duplicateRatio;
+            (near ? corpus.nearDuplicates : corpus.duplicates)++;
+        } else {
+            source.seed = rng();
+            source.size = large ? spec.largeSize
+                                : static_cast<size_t>(std::exp(log_min + unit(rng) * (log_max - log_min)));
+            sources.push_back(source);
+        }
+        fillContent(data, source.size, source.seed);
+        if (near && !data.empty()) data[data.size() / 2] ^= 0x5A;
+
+        char relative[96];  // Room for three full-width size_t fields
+        std::snprintf(relative, sizeof(relative), "d%03zu/d%03zu/f%06zu.bin", i / (fanout * fanout),
+                      (i / fanout) % fanout, i);
+        const std::filesystem::path file = root / relative;
+        std::filesystem::create_directories(file.parent_path());
+        std::ofstream out(file, std::ios::binary | std::ios::trunc);
+        out.write(data.data(), static_cast<std::streamsize>(data.size()));
+        if (!out) {
+            std::cerr << "Cannot write corpus file " << file << std::endl;
+            continue;
+        }
+        corpus.files.push_back(file);
+        corpus.bytes += data.size();
+    }
+    return corpus;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+// Shape of a synthetic corpus. Every byte follows from the seed, so one
+// spec always produces the same tree.
+struct CorpusSpec {
+    uint64_t seed = 1;
+    size_t smallFiles = 4000;              // Sizes spread log-uniformly over [smallMin, smallMax]
+    size_t smallMin = 64;
+    size_t smallMax = 256 * 1024;
+    size_t largeFiles = 2;                 // Files of exactly largeSize bytes
+    size_t largeSize = 64 * 1024 * 1024;
+    double duplicateRatio = 0.25;          // Share of files that copy an earlier file
+    double nearDuplicateRatio = 0.05;      // Share that copy an earlier file except one byte mid-file
+    size_t filesPerDirectory = 64;         // Files are spread over a two-level tree
+};
+
+// What was written, for checking results and sizing throughput counters
+struct Corpus {
+    std::vector<std::filesystem::path> files;
+    uintmax_t bytes = 0;
+    size_t duplicates = 0;      // Files written as exact copies
+    size_t nearDuplicates = 0;  // Files differing from their source by one byte
+};
+
+// Write the corpus under root, which is created if needed. Copies are taken
+// from files of the same class (small or large), so a near duplicate shares
+// its source's size, head and tail: only a full hash tells them apart.
+Corpus generateCorpus(const std::filesystem::path& root, const CorpusSpec& spec);
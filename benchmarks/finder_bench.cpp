@@ -0,0 +1,202 @@
+// Google Benchmark suite for the dedupe pipeline: hash engines by buffer
+// size, whole-file digests by engine and read backend, directory traversal,
+// and end-to-end duplicate finding on a synthetic corpus (see corpus.h).
+//
+// Usage: DuplicateFinderBench [--corpus_seed=N] [--corpus_scale=X] [benchmark flags]
+//        DuplicateFinderBench --generate_corpus=DIR [--corpus_seed=N] [--corpus_scale=X]
+//
+// The corpus is written to a temporary directory on first use and read warm.
+// --corpus_scale multiplies the number of small files. To compare commits,
+// save each run with --benchmark_out=FILE.json --benchmark_out_format=json
+// and diff the two with Google Benchmark's tools/compare.py.
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include "DirectoryWalker.h"
+#include "DuplicateFinder.h"
+#include "FileUtils.h"
+#include "corpus.h"
+
+namespace {
+
+CorpusSpec corpusSpec;
+
+// The shared corpus, generated on first use and removed at exit
+class BenchCorpus {
+public:
+    static const BenchCorpus& get() {
+        static BenchCorpus corpus;
+        return corpus;
+    }
+
+    ~BenchCorpus() { std::filesystem::remove_all(root); }
+
+    std::filesystem::path root;
+    Corpus corpus;
+    std::filesystem::path largest;  // Biggest file, for the whole-file digest benchmarks
+
+private:
+    BenchCorpus() : root(std::filesystem::temp_directory_path() / "dupefinder_bench_corpus") {
+        std::filesystem::remove_all(root);
+        corpus = generateCorpus(root, corpusSpec);
+        uintmax_t largest_size = 0;
+        for (const auto& file : corpus.files) {
+            const uintmax_t size = std::filesystem::file_size(file);
+            if (size > largest_size) {
+                largest_size = size;
+                largest = file;
+            }
+        }
+        // Warm the page cache so every benchmark starts from the same state
+        for (const auto& file : corpus.files) computeFileDigest(file, HashAlgorithm::XXH3);
+    }
+};
+
+// Engine throughput on memory: 16 MiB fed in chunks of the given size
+void BM_HashEngine(benchmark::State& state) {
+    const auto algorithm = static_cast<HashAlgorithm>(state.range(0));
+    const size_t chunk = static_cast<size_t>(state.range(1));
+    const size_t total = 16 << 20;
+    std::vector<char> buffer(chunk, 'x');
+    std::unique_ptr<Hasher> hasher = createHasher(algorithm);
+    for (auto _ : state) {
+        hasher->reset();
+        for (size_t done = 0; done < total; done += chunk) hasher->update(buffer.data(), chunk);
+        benchmark::DoNotOptimize(hasher->finish());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * total);
+    state.SetLabel(hashAlgorithmName(algorithm));
+}
+BENCHMARK(BM_HashEngine)
+    ->ArgNames({"engine", "chunk"})
+    ->ArgsProduct({{0, 1, 2}, {4 << 10, 64 << 10, 1 << 20}})
+    ->Unit(benchmark::kMillisecond);
+
+// computeFileHash on the largest corpus file for each engine
+void BM_ComputeFileHash(benchmark::State& state) {
+    const auto algorithm = static_cast<HashAlgorithm>(state.range(0));
+    const BenchCorpus& corpus = BenchCorpus::get();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(computeFileHash(corpus.largest, algorithm));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * std::filesystem::file_size(corpus.largest));
+    state.SetLabel(hashAlgorithmName(algorithm));
+}
+BENCHMARK(BM_ComputeFileHash)->ArgName("engine")->DenseRange(0, 2)->Unit(benchmark::kMillisecond);
+
+// Whole-file XXH3 digest of the largest file through each read backend
+void BM_ReadBackend(benchmark::State& state) {
+    const auto backend = static_cast<ReadBackend>(state.range(0));
+    const BenchCorpus& corpus = BenchCorpus::get();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(computeFileDigest(corpus.largest, HashAlgorithm::XXH3, backend));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * std::filesystem::file_size(corpus.largest));
+    state.SetLabel(readBackendName(backend));
+}
+BENCHMARK(BM_ReadBackend)->ArgName("backend")->DenseRange(0, 3)->Unit(benchmark::kMillisecond);
+
+void BM_GetAllFiles(benchmark::State& state) {
+    const BenchCorpus& corpus = BenchCorpus::get();
+    // getAllFiles announces the directory on std::cout
+    std::ostringstream silent;
+    std::streambuf* saved = std::cout.rdbuf(silent.rdbuf());
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(getAllFiles(corpus.root.string()));
+    }
+    std::cout.rdbuf(saved);
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * corpus.corpus.files.size());
+}
+BENCHMARK(BM_GetAllFiles)->Unit(benchmark::kMillisecond);
+
+// The parallel walker with stat, by thread count
+void BM_WalkDirectories(benchmark::State& state) {
+    const BenchCorpus& corpus = BenchCorpus::get();
+    WalkOptions options;
+    options.threads = static_cast<unsigned>(state.range(0));
+    for (auto _ : state) {
+        FileCatalogue catalogue;
+        walkDirectories({corpus.root.string()}, options, catalogue);
+        benchmark::DoNotOptimize(catalogue.size());
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * corpus.corpus.files.size());
+}
+BENCHMARK(BM_WalkDirectories)->ArgName("threads")->RangeMultiplier(2)->Range(1, 8)
+    ->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// findDuplicateFiles over the corpus list, with and without the head/tail prefilter
+void BM_FindDuplicateFiles(benchmark::State& state) {
+    const BenchCorpus& corpus = BenchCorpus::get();
+    FinderOptions options;
+    options.partialHash = state.range(0) != 0;
+    std::ostringstream silent;
+    size_t groups = 0;
+    for (auto _ : state) {
+        ProgressBar progress(0, "Comparing Files", silent);
+        groups = findDuplicateFiles(corpus.corpus.files, progress, options).size();
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * corpus.corpus.files.size());
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * corpus.corpus.bytes);
+    state.counters["groups"] = static_cast<double>(groups);
+}
+BENCHMARK(BM_FindDuplicateFiles)->ArgName("partial")->Arg(0)->Arg(1)
+    ->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// Walk and find in one pass, as the command line tool runs
+void BM_FindDuplicatesInDirectories(benchmark::State& state) {
+    const BenchCorpus& corpus = BenchCorpus::get();
+    std::ostringstream silent;
+    size_t groups = 0;
+    for (auto _ : state) {
+        ProgressBar progress(0, "Comparing Files", silent);
+        groups = findDuplicatesInDirectories({corpus.root.string()}, progress, FinderOptions()).size();
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * corpus.corpus.files.size());
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * corpus.corpus.bytes);
+    state.counters["groups"] = static_cast<double>(groups);
+}
+BENCHMARK(BM_FindDuplicatesInDirectories)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// Take "--name=value" out of the arguments, leaving the rest for the library
+bool takeFlag(int& argc, char** argv, const char* name, std::string& value) {
+    const size_t length = std::strlen(name);
+    for (int i = 1; i < argc; ++i) {
+        if (std::strncmp(argv[i], name, length) == 0 && argv[i][length] == '=') {
+            value = argv[i] + length + 1;
+            for (int j = i; j + 1 < argc; ++j) argv[j] = argv[j + 1];
+            --argc;
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string value;
+    if (takeFlag(argc, argv, "--corpus_seed", value)) corpusSpec.seed = std::stoull(value);
+    if (takeFlag(argc, argv, "--corpus_scale", value)) {
+        corpusSpec.smallFiles = static_cast<size_t>(corpusSpec.smallFiles * std::stod(value));
+    }
+    if (takeFlag(argc, argv, "--generate_corpus", value)) {
+        Corpus corpus = generateCorpus(value, corpusSpec);
+        std::cout << "Wrote " << corpus.files.size() << " files (" << formatBytes(corpus.bytes) << ", "
+                  << corpus.duplicates << " copies, " << corpus.nearDuplicates << " near copies) to "
+                  << value << std::endl;
+        return 0;
+    }
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+    benchmark::AddCustomContext("corpus_seed", std::to_string(corpusSpec.seed));
+    benchmark::AddCustomContext("corpus_small_files", std::to_string(corpusSpec.smallFiles));
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,80 @@
+// Scalability of the full-hash and grouping stage from 1 to N threads on a
+// corpus of small files, where per-file overhead rather than bandwidth
+// dominates. Usage: HashScalingBenchmark [FILES] [MAX_THREADS]
+//
+// The corpus lives in a temporary directory and is hashed once before timing,
+// so every run reads from a warm page cache.
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <omp.h>
+#include "DuplicateFinder.h"
+#include "FileUtils.h"
+
+namespace {
+
+// Half of the files are pairs of identical content, all share one size so
+// the size stage keeps every file
+std::vector<std::filesystem::path> createCorpus(const std::filesystem::path& dir, size_t count) {
+    std::filesystem::create_directories(dir);
+    std::vector<std::filesystem::path> files;
+    for (size_t i = 0; i < count; ++i) {
+        std::filesystem::path file = dir / ("file" + std::to_string(i) + ".bin");
+        const size_t content = i < count / 2 ? i / 2 : i;
+        std::string data(2048, '\0');
+        for (size_t j = 0; j < data.size(); ++j) data[j] = static_cast<char>((content * 2654435761u) >> (j % 24));
+        std::ofstream(file, std::ios::binary) << data;
+        files.push_back(file);
+    }
+    return files;
+}
+
+double runOnce(const std::vector<std::filesystem::path>& files, const FinderOptions& options) {
+    // Silence the progress bar while timing
+    std::ostringstream sink;
+    ProgressBar progress(0, "Comparing Files", sink);
+    auto start = std::chrono::steady_clock::now();
+    auto duplicates = findDuplicateFiles(files, progress, options);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    if (duplicates.size() != files.size() / 4) {
+        std::cerr << "Unexpected group count " << duplicates.size() << std::endl;
+    }
+    return elapsed.count();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const size_t count = argc > 1 ? std::stoul(argv[1]) : 50000;
+    const int max_threads = argc > 2 ? std::stoi(argv[2]) : omp_get_max_threads();
+
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "dupefinder_hash_scaling";
+    std::filesystem::remove_all(dir);
+    std::vector<std::filesystem::path> files = createCorpus(dir, count);
+
+    FinderOptions options;
+    options.partialHash = false;      // Time only the full-hash and grouping stage
+    options.scheduleByDevice = false;  // One pool of OpenMP's size, whatever the disk
+    runOnce(files, options);
+
+    std::cout << "Hashing " << files.size() << " files of 2 KiB\n";
+    std::cout << std::setw(8) << "threads" << std::setw(14) << "files/s" << std::setw(10) << "speedup" << "\n";
+    double baseline = 0.0;
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        omp_set_num_threads(threads);
+        double best = runOnce(files, options);
+        for (int repeat = 0; repeat < 2; ++repeat) best = std::min(best, runOnce(files, options));
+        if (threads == 1) baseline = best;
+        std::cout << std::setw(8) << threads << std::setw(14) << std::fixed << std::setprecision(0)
+                  << files.size() / best << std::setw(9) << std::setprecision(2) << baseline / best << "x\n";
+        if (threads < max_threads && threads * 2 > max_threads) threads = max_threads / 2;
+    }
+
+    std::filesystem::remove_all(dir);
+    return 0;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "DuplicateFinder.h"
+#include "FileCatalogue.h"
+#include "ProgressBar.h"
+#include "ResultSink.h"
+
+// A catalogue shard is what one node knows about its own files: the size,
+// full-content digest and path of every file under its roots, sorted by
+// (size, digest, path). Shards from any number of nodes merge into global
+// duplicate groups without reading a single file again.
+
+// Walk the directories into the catalogue and give every file its full
+// digest: one path per inode, tree-hashed past options.treeChunkBytes, read
+// on the per-device readers and reusing options.cache. Files whose size
+// wanted rejects are left out without being opened. Returns the files
+// hashed, leaving out those that could not be read; stats receives the
+// walk, the size filter (with wanted), the hash stage and the devices read.
+std::vector<FileCatalogue::Index> hashEveryFile(const std::vector<std::string>& directories,
+                                                FileCatalogue& catalogue, ProgressBar& progress,
+                                                const FinderOptions& options,
+                                                const std::function<bool(uintmax_t size)>& wanted = {},
+                                                PipelineStats* stats = nullptr);
+
+// Walk the directories, hash every file (tree-hashed past
+// options.treeChunkBytes, on the per-device readers, reusing options.cache)
+// and write the shard. Only one path per inode is recorded. node labels the
+// shard's paths in merged groups. Returns false if the shard could not be
+// written. stats receives the walk, the hash stage and the devices read.
+bool writeCatalogueShard(const std::vector<std::string>& directories, const std::string& shardPath,
+                         const std::string& node, ProgressBar& progress, const FinderOptions& options,
+                         PipelineStats* stats = nullptr);
+
+// Totals from merging shards
+struct ShardMergeStats {
+    size_t shards = 0;
+    uint64_t files = 0;         // Records read from all shards
+    size_t groups = 0;
+    uint64_t duplicateFiles = 0;  // Files in the groups
+    uintmax_t wastedBytes = 0;    // Bytes freed by keeping one copy per group
+};
+
+// Merge sorted shards with a k-way merge, streaming each group of two or
+// more equal files to sink in order of size. Paths are written as
+// "node:path". Every shard must be hashed with algorithm and one chunk
+// size. Returns false for no shards or a missing, corrupt, unsorted or
+// incompatible shard.
+bool mergeCatalogueShards(const std::vector<std::string>& shardPaths, HashAlgorithm algorithm,
+                          ResultSink& sink, ShardMergeStats* stats = nullptr);
+
+void printShardMergeStats(const ShardMergeStats& stats, std::ostream& out);
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+#include "FileReader.h"
+
+// Chunk size bounds for content-defined chunking. Cut points depend only on
+// the 64 bytes before them, so an insertion or deletion moves the chunk
+// boundaries around it and leaves the rest of the file's chunks unchanged.
+struct ChunkingParams {
+    size_t minSize = 2 * 1024;       // No cut before this many bytes (at least 64)
+    size_t averageSize = 8 * 1024;   // Target mean, a power of two
+    size_t maxSize = 64 * 1024;      // Forced cut at this many bytes
+};
+
+// Gear hash scanning loops. The hash at a byte depends only on the 64 bytes
+// ending there, so long runs can be split into lanes hashed side by side.
+enum class GearKernel {
+    Portable,  // Four interleaved lanes in plain C++
+    Avx2,      // Eight lanes in two AVX2 registers, table lookups by gather
+};
+
+// The fastest kernel this CPU supports
+GearKernel bestGearKernel();
+const char* gearKernelName(GearKernel kernel);
+
+// A position where the Gear hash allows a cut
+struct GearCandidate {
+    size_t position;  // Offset of the last byte before the cut
+    bool strict;      // Enough bits clear to cut below the average size
+};
+
+// One chunk of a file and the XXH3-64 fingerprint of its bytes
+struct ContentChunk {
+    uint64_t offset = 0;
+    uint32_t length = 0;
+    uint64_t fingerprint = 0;
+};
+
+// FastCDC chunker with normalised chunking: below the average size a cut
+// needs more hash bits clear than above it, which narrows the spread of
+// chunk sizes. Feed a file with update() in any pieces, then call finish();
+// the chunks are the same however the input is split. Each piece is chunked
+// where it lies; only the unfinished chunk at its end, shorter than maxSize,
+// is copied and carried into the next call.
+class ContentChunker {
+public:
+    explicit ContentChunker(const ChunkingParams& params = ChunkingParams(),
+                            GearKernel kernel = bestGearKernel());
+
+    // Append every chunk completed by these bytes to chunks
+    void update(const void* data, size_t length, std::vector<ContentChunk>& chunks);
+    // Append the remaining chunks and start over for the next file
+    void finish(std::vector<ContentChunk>& chunks);
+
+private:
+    // Add the cut candidates of bytes[begin, end)
+    void scan(const uint8_t* bytes, size_t begin, size_t end);
+    // Length of the chunk at start once bytes up to end settle it, else 0
+    size_t nextCut(size_t start, size_t end, bool final) const;
+    void emit(const uint8_t* bytes, size_t start, size_t length, std::vector<ContentChunk>& chunks);
+
+    ChunkingParams params;
+    GearKernel kernel;
+    uint64_t looseMask;
+    uint64_t strictMask;
+    std::vector<uint8_t> tail;    // Unfinished chunk carried between calls
+    std::vector<GearCandidate> candidates;  // Positions in the bytes being chunked, in order
+    size_t nextCandidate = 0;     // First candidate of the chunk in progress
+    uint64_t offset = 0;          // File offset of the chunk in progress
+};
+
+// Chunk a whole file. Returns false if it could not be read.
+bool chunkFile(const std::filesystem::path& file_path, const ChunkingParams& params,
+               std::vector<ContentChunk>& chunks, ReadBackend backend = ReadBackend::Pread);
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "FileCatalogue.h"
+#include "Profiler.h"
+#include "Telemetry.h"
+#include "WalkFilter.h"
+
+// Tuning for the parallel directory walker
+struct WalkOptions {
+    unsigned threads = 0;   // Walker threads; 0 uses the hardware thread count
+    bool statFiles = true;  // Record size, mtime and identity of each file with one fstatat()
+    const TreeSnapshot* previous = nullptr;  // Replay directories unchanged since this snapshot
+    TreeSnapshot* snapshot = nullptr;        // Filled with every directory the walk reaches
+    Metrics* metrics = nullptr;              // Counts files as each directory is listed
+    Profiler* profiler = nullptr;            // Times each directory listing and file stat
+    const WalkFilter* filter = nullptr;      // Entries to skip; without one, names containing '$'
+    // When set, each walker thread hands its files to onFiles (from its own
+    // thread, identified by worker, below walkerThreadCount) whenever it
+    // holds batchFiles of them, and the catalogue is left empty. A batch's
+    // directory column indexes its own directory paths, or is kNoDirectory
+    // for a root given as a file. Both are cleared after each call.
+    std::function<void(unsigned worker, const FileColumns& files, const std::vector<std::string>& directories)>
+        onFiles;
+    size_t batchFiles = 1024;
+};
+
+// Directory counts from one walk
+struct WalkStats {
+    size_t directories = 0;  // Directories reached
+    size_t unchanged = 0;    // Directories replayed from the previous snapshot
+};
+
+unsigned walkerThreadCount(const WalkOptions& options);
+
+// Walk the given roots with a work-stealing pool, adding every regular file
+// found to the catalogue. Directories are listed with getdents64 and
+// classified by d_type, so only files (and entries whose type the filesystem
+// does not report) are stat'ed. Symbolic links are not followed. A root may
+// also be a file.
+//
+// With a filter, name and path rules are tested on the d_type alone, so an
+// excluded file is never stat'ed and an excluded directory never opened.
+// Size bounds need the file's stat, and one-file-system one stat per
+// directory. Without a filter, names containing '$' are skipped.
+//
+// With a previous snapshot, each directory is stat'ed first; one whose mtime,
+// device and inode are unchanged is replayed from the snapshot instead of
+// being read. A file rewritten in place does not touch its directory's
+// mtime, so the files of a replayed directory are still stat'ed when
+// statFiles or a size bound needs them; otherwise an unchanged tree costs
+// one stat() per directory. Directories modified within two seconds of the
+// walk are always read on the next walk.
+WalkStats walkDirectories(const std::vector<std::string>& roots, const WalkOptions& options,
+                     FileCatalogue& catalogue);
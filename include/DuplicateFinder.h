@@ -1,13 +1,96 @@
 #ifndef DUPLICATEFINDER_H
 #define DUPLICATEFINDER_H
 
+#include <cstdint>
+#include <ostream>
+#include <string>
 #include <vector>
 #include <filesystem>
+#include "DirectoryWalker.h"
+#include "FileUtils.h"
+#include "Hasher.h"
+#include "IoScheduler.h"
 #include "ProgressBar.h"
+#include "Profiler.h"
+#include "ResultSink.h"
+#include "UringHasher.h"
 
-// Function declaration: Find duplicate files, print them, but don't return any value
+// Counters for one stage of the duplicate-finding pipeline
+struct StageStats {
+    std::string name;
+    size_t filesIn = 0;          // Files that entered the stage
+    size_t filesEliminated = 0;  // Files proven unique (or unreadable) by the stage
+    uintmax_t bytesEliminated = 0;  // Total size of the eliminated files
+    uintmax_t bytesRead = 0;     // Bytes the stage read from disk
+    uintmax_t bytesAvoided = 0;  // Bytes of eliminated files that were never read
+};
+
+// Tuning knobs for the duplicate-finding pipeline
+struct FinderOptions {
+    HashAlgorithm hashAlgorithm = HashAlgorithm::XXH3;  // Engine for the partial and full hashes
+    bool partialHash = true;       // Run the head/tail prefilter before full hashing
+    size_t headBlockSize = 4096;   // Bytes hashed from the start of each candidate
+    size_t tailBlockSize = 4096;   // Bytes hashed from the end (0 disables the tail block)
+    ReadBackend readBackend = ReadBackend::Pread;  // I/O strategy for full-content hashing
+    uint64_t treeChunkBytes = 64 << 20;  // Files larger than this are tree-hashed in chunks (0: never)
+    bool ioUring = false;          // Read candidates through io_uring, falling back to readBackend
+    UringOptions uring;            // Queue depth and hashing threads for ioUring
+    bool collapseLinks = true;     // Read each inode (and each reflinked extent map) only once
+    bool scheduleByDevice = true;  // Give each device a worker pool sized from sysfs
+    bool verify = false;           // Compare hash-matched groups byte for byte before reporting
+    FileCache* cache = nullptr;    // Digest cache consulted before hashing and updated after
+    bool pruneCache = false;       // Drop cache entries for files not seen in this run
+    WalkOptions walk;              // Walker threads and tree snapshots for findDuplicatesInDirectories
+    ResultSink* sink = nullptr;    // Receives each group as soon as it is confirmed
+    Profiler* profiler = nullptr;  // Records stage times, thread busy time and per-file latencies
+};
+
+// Per-stage report filled in by findDuplicateFiles, in pipeline order
+struct PipelineStats {
+    std::vector<StageStats> stages;
+    size_t cacheHits = 0;  // Candidates whose digest came from the cache
+    WalkStats walk;        // Directories reached by findDuplicatesInDirectories
+    // With collapseLinks, only one path of each set below takes part
+    // in the duplicate groups; the rest are reported here instead
+    std::vector<std::vector<std::filesystem::path>> hardLinks;  // Paths of one inode
+    std::vector<std::vector<std::filesystem::path>> reflinks;   // Files already sharing all extents
+    std::vector<std::pair<uint64_t, DeviceProfile>> devices;     // Devices read, by st_dev
+    // External grouping and shards count hard links instead of listing
+    // them; external grouping also summarises the runs it spilled to disk
+    size_t hardLinksSkipped = 0;  // Paths skipped as further links to an inode already seen
+    size_t spillRuns = 0;         // Sorted runs written
+    uintmax_t spillBytes = 0;     // Bytes written to runs, including merge passes
+    size_t mergePasses = 0;       // Intermediate merges needed to fit the fan-in
+};
+
+// Find duplicate files and return them grouped by identical content.
+// Files are first bucketed by size, then split on a head/tail block hash;
+// only the survivors are hashed in full. With options.verify, groups are
+// then confirmed byte for byte. Hard links to one inode, and files whose
+// data is already shared through reflinks, count as a single file. The
+// returned groups are sorted; options.sink sees them in confirmation order.
+std::vector<std::vector<std::filesystem::path>> findDuplicateFiles(
+    const std::vector<std::filesystem::path>& files, ProgressBar& progress,
+    PipelineStats* stats = nullptr);
 std::vector<std::vector<std::filesystem::path>> findDuplicateFiles(
-    const std::vector<std::filesystem::path>& files, ProgressBar& progress);
+    const std::vector<std::filesystem::path>& files, ProgressBar& progress,
+    const FinderOptions& options, PipelineStats* stats = nullptr);
+// Without a progress bar: only the counters are updated, nothing is drawn
+std::vector<std::vector<std::filesystem::path>> findDuplicateFiles(
+    const std::vector<std::filesystem::path>& files, Metrics& metrics,
+    const FinderOptions& options, PipelineStats* stats = nullptr);
 
-#endif // DUPLICATEFINDER_H
+// Walk the directories in parallel and find duplicates among the files
+// found. Files are stat'ed and bucketed by size as the walk discovers them,
+// so no intermediate file list is built.
+std::vector<std::vector<std::filesystem::path>> findDuplicatesInDirectories(
+    const std::vector<std::string>& directories, ProgressBar& progress,
+    const FinderOptions& options, PipelineStats* stats = nullptr);
+std::vector<std::vector<std::filesystem::path>> findDuplicatesInDirectories(
+    const std::vector<std::string>& directories, Metrics& metrics,
+    const FinderOptions& options, PipelineStats* stats = nullptr);
 
+// Write a human-readable summary of each pipeline stage
+void printPipelineStats(const PipelineStats& stats, std::ostream& out);
+
+#endif // DUPLICATEFINDER_H
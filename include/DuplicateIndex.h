@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "DuplicateFinder.h"
+#include "FileUtils.h"
+
+// Duplicate groups over a set of directory trees, kept current by applying
+// the paths that changed. Queries may run on any thread while one thread
+// builds and updates the index; updates hash outside the lock, so queries
+// never wait for disk I/O. Scans report to the caller's metrics and draw
+// nothing, so a daemon can keep its output to itself.
+class DuplicateIndex {
+public:
+    DuplicateIndex(const FinderOptions& options, Metrics& metrics);
+
+    // Scan the roots and group every file found. Returns the directories
+    // reached, so the caller can watch them.
+    std::vector<std::string> build(const std::vector<std::string>& roots);
+
+    // Re-stat each touched path (created, modified or removed file) and
+    // regroup the size buckets it left and joined. A file the walk filter
+    // rejects is dropped like a removed one. Unchanged members of
+    // those buckets are served from the digest cache.
+    void update(const std::vector<std::string>& touched);
+
+    // Fill others with the indexed files whose content equals file's;
+    // empty when it is unique. Returns false when file is not indexed.
+    bool duplicatesOf(const std::string& file, std::vector<std::string>& others) const;
+
+    // Indexed files anywhere below directory
+    std::vector<std::string> filesUnder(const std::string& directory) const;
+
+    size_t fileCount() const;
+
+private:
+    using Group = std::shared_ptr<const std::vector<std::string>>;
+
+    // Whether the walk filter keeps a file; snapshots list filtered files too
+    bool admits(const std::filesystem::path& directory, const std::string& name, uintmax_t size) const;
+
+    // Drop the groups of members and file the new duplicates; names in a
+    // hard-link set share the group of whichever name was grouped
+    void installGroups(const std::vector<std::vector<std::filesystem::path>>& duplicates,
+                       const std::vector<std::vector<std::filesystem::path>>& hard_links,
+                       const std::vector<std::string>& members);
+
+    FinderOptions options;
+    Metrics& metrics;
+    FileCache cache;  // Digests of fully hashed files; owned by the updating thread
+
+    mutable std::shared_mutex mutex;  // Guards the maps below
+    std::unordered_map<std::string, uintmax_t> sizeOf;
+    std::unordered_map<uintmax_t, std::vector<std::string>> bucketOf;
+    std::unordered_map<std::string, Group> groupOf;  // Only files with a duplicate
+};
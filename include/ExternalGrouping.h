@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "DuplicateFinder.h"
+#include "ProgressBar.h"
+
+// Budget for grouping files through sorted runs on disk
+struct ExternalOptions {
+    uint64_t memoryLimit = 256ull << 20;   // Bytes of file records held in memory at once
+    std::filesystem::path spillDirectory;  // Where runs are written; empty for the system temp directory
+};
+
+// Walk the directories and find duplicates without holding the file list
+// in memory. The walk spills a (size, device, inode, path) record per file
+// to sorted runs; a k-way merge of those runs streams files in size order
+// into batches that are head/tail hashed on the device pools, whose
+// (size, digest) records are spilled and merged the same way, and so on
+// for the full hash. Records in memory stay within external.memoryLimit
+// whatever the file count or group size. Walker threads each write their
+// own runs and path spill file, and no directory table is kept. Spill files
+// are unlinked as soon as they are created.
+//
+// Groups go only to options.sink, in order of size, streamed through
+// beginGroup() and groupFile() with their paths in the order the walk found
+// them rather than sorted. Hard links are collapsed but only counted,
+// reflinked copies are reported as duplicates, and options.cache,
+// options.verify and the walk snapshot are not used.
+// Returns false when the spill files could not be written or read.
+bool findDuplicatesExternal(const std::vector<std::string>& directories, ProgressBar& progress,
+                            const FinderOptions& options, const ExternalOptions& external,
+                            PipelineStats* stats = nullptr);
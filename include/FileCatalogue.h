@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "FileUtils.h"
+
+// Per-file columns filled by a single thread. Walker threads each fill one
+// and hand it to FileCatalogue::appendFiles when they finish.
+struct FileColumns {
+    std::vector<uint32_t> directory;   // Index into the catalogue's directory table
+    std::vector<uint64_t> nameOffset;  // Start of the name in names
+    std::vector<uint16_t> nameLength;
+    std::vector<uintmax_t> size;
+    std::vector<int64_t> lastModified;
+    std::vector<uint64_t> device;
+    std::vector<uint64_t> inode;
+    std::vector<char> names;           // Arena of name bytes, not NUL-terminated
+
+    size_t count() const { return directory.size(); }
+    void add(uint32_t dir, std::string_view name, const FileStat& st);
+};
+
+// Struct-of-arrays catalogue of the files in a scan. Files are referenced by
+// 32-bit index and their paths are rebuilt on demand from an interned
+// directory tree, so a file costs about 50 bytes plus its name instead of a
+// heap-allocated std::filesystem::path.
+class FileCatalogue {
+public:
+    using Index = uint32_t;
+    static constexpr uint32_t kNoDirectory = UINT32_MAX;  // Parent of a root; directory of a bare file
+    static constexpr size_t kMaxFiles = UINT32_MAX;
+
+    // Intern a directory. A root (parent kNoDirectory) is named by its full
+    // path, any other directory by its own name. Safe to call concurrently.
+    uint32_t addDirectory(uint32_t parent, std::string_view name);
+
+    // Add files; both drop (and report) files beyond kMaxFiles
+    void addFile(uint32_t directory, std::string_view name, const FileStat& st);
+    void appendFiles(FileColumns&& columns);
+
+    size_t size() const { return files.count(); }
+    size_t directoryCount() const { return directoryParent.size(); }
+
+    uintmax_t fileSize(Index i) const { return files.size[i]; }
+    uint64_t device(Index i) const { return files.device[i]; }
+    FileStat stat(Index i) const;
+    std::string pathString(Index i) const;
+    std::filesystem::path path(Index i) const { return pathString(i); }
+    // Path of an interned directory; safe to call while others are added
+    std::string directoryPath(uint32_t directory) const;
+
+    // Digest column, empty until allocateDigests() gives every file an empty
+    // entry. setDigest may be called concurrently for distinct files.
+    void allocateDigests() { digests.assign(size(), Digest()); }
+    const Digest& digest(Index i) const { return digests[i]; }
+    void setDigest(Index i, const Digest& digest) { digests[i] = digest; }
+
+private:
+    void appendDirectoryPath(uint32_t directory, std::string& out) const;
+
+    mutable std::mutex directoryMutex;
+    std::vector<uint32_t> directoryParent;
+    std::vector<uint64_t> directoryNameOffset;
+    std::vector<uint16_t> directoryNameLength;
+    std::vector<char> directoryNames;
+    FileColumns files;
+    std::vector<Digest> digests;
+};
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+
+// I/O strategies for reading whole files, selectable at runtime
+enum class ReadBackend {
+    Stream,  // std::ifstream with a 4 KiB buffer (the original path)
+    Pread,   // Large aligned pread() buffer with POSIX_FADV_SEQUENTIAL; default
+    Mmap,    // mmap() with MADV_SEQUENTIAL, hashed straight from the mapping
+    Direct,  // O_DIRECT pread() bypassing the page cache; falls back to Pread
+};
+
+// Receives each chunk of a file's contents in order. The pointer is only
+// valid during the call. Return false to stop reading.
+using ChunkSink = std::function<bool(const void* data, size_t length)>;
+
+// Time spent in each phase of reading and hashing one file. With mmap the
+// page faults land in the sink, so they count as hashing.
+struct ReadTimings {
+    int64_t openNs = 0;
+    int64_t readNs = 0;
+    int64_t hashNs = 0;  // Time in the sink and, for digests, finishing the hash
+};
+
+// Read a file from start to end with the given backend, handing every chunk
+// to the sink without copying it. Returns false if the file could not be
+// read or the sink stopped early. With timings, the time spent opening,
+// reading and in the sink is added to it.
+//
+// The pread and direct backends read sparse files extent by extent: holes
+// found with SEEK_DATA/SEEK_HOLE go to the sink as zeros without being read,
+// so the sink sees exactly the bytes of a dense read.
+bool readFileContents(const std::filesystem::path& file_path, ReadBackend backend,
+                      const ChunkSink& sink, ReadTimings* timings = nullptr);
+
+// Read length bytes from offset in the same way, stopping early at EOF.
+// O_DIRECT reads need an offset aligned to 4 KiB and fall back to pread
+// otherwise.
+bool readFileRange(const std::filesystem::path& file_path, ReadBackend backend, uintmax_t offset,
+                   uintmax_t length, const ChunkSink& sink, ReadTimings* timings = nullptr);
+
+// Where the next stored data at or after offset begins and ends, from
+// lseek(SEEK_DATA/SEEK_HOLE). Both are UINTMAX_MAX when only a hole is left.
+// Returns false when the filesystem cannot report holes.
+bool nextDataExtent(int fd, uintmax_t offset, uintmax_t& dataBegin, uintmax_t& dataEnd);
+// Whether a file has fewer blocks allocated than its size needs, and so
+// probably holes worth skipping; size receives its size
+bool mayBeSparse(int fd, uintmax_t& size);
+// Whether every byte of the block is zero
+bool isZeroBlock(const void* data, size_t length);
+
+const char* readBackendName(ReadBackend backend);
+bool parseReadBackend(const std::string& name, ReadBackend& backend);
@@ -1,21 +1,119 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
+#include <system_error>
 #include <unordered_map>
 #include <filesystem>
 #include <vector>
+#include "FileReader.h"
+#include "Hasher.h"
 
+// Attributes gathered with a single stat() per file
+struct FileStat {
+    uintmax_t size = 0;
+    int64_t lastModified = 0;  // st_mtim in nanoseconds since the Unix epoch
+    uint64_t device = 0;
+    uint64_t inode = 0;
+};
+
+// Cached digests of a file, valid while size, mtime, device and inode match.
+// A file the partial stage ruled out has only its partial digest.
 struct FileMetadata {
-    uintmax_t fileSize;
-    std::filesystem::file_time_type lastModified;
-    std::string fileHash;
+    uintmax_t fileSize = 0;
+    int64_t lastModified = 0;  // st_mtim in nanoseconds since the Unix epoch
+    Digest fileHash;           // Empty when the file was never hashed in full
+    uint64_t device = 0;
+    uint64_t inode = 0;
+    uint64_t chunkBytes = 0;          // Chunk size of a tree hash; 0 when fileHash is flat
+    std::vector<Digest> chunkHashes;  // Digest of each chunk of a tree hash, in file order
+    Digest partialHash;               // Head and tail block digest; empty when not taken
+    uint64_t partialHead = 0;         // Block sizes partialHash was taken with
+    uint64_t partialTail = 0;
+
+    bool matches(const FileStat& st) const {
+        return fileSize == st.size && lastModified == st.lastModified &&
+               device == st.device && inode == st.inode;
+    }
+
+    // Start over from st unless the digests held are still valid for it
+    void refresh(const FileStat& st) {
+        if (matches(st)) return;
+        *this = FileMetadata();
+        fileSize = st.size;
+        lastModified = st.lastModified;
+        device = st.device;
+        inode = st.inode;
+    }
 };
 
+// One mapped range of a file, as reported by FIEMAP
+struct FileExtent {
+    uint64_t logical = 0;   // Offset within the file
+    uint64_t physical = 0;  // Offset on the device
+    uint64_t length = 0;
+
+    bool operator==(const FileExtent& other) const {
+        return logical == other.logical && physical == other.physical && length == other.length;
+    }
+};
+
+// Digest cache keyed by path
 using FileCache = std::unordered_map<std::string, FileMetadata>;
 
+// Listing of one directory as of the scan that recorded it. While the
+// directory's mtime, device and inode are unchanged no entry has been added,
+// removed or renamed in it, so the listing can be replayed without reading
+// the directory or stat'ing its files.
+struct DirectorySnapshot {
+    int64_t lastModified = 0;  // Directory st_mtim in nanoseconds since the Unix epoch
+    uint64_t device = 0;
+    uint64_t inode = 0;
+    std::vector<std::string> subdirectories;               // Names of child directories
+    std::vector<std::pair<std::string, FileStat>> files;  // Names and attributes of regular files
+
+    bool matches(const FileStat& st) const {
+        return lastModified == st.lastModified && device == st.device && inode == st.inode;
+    }
+};
+
+// Tree snapshot keyed by directory path, as the walker reached it
+using TreeSnapshot = std::unordered_map<std::string, DirectorySnapshot>;
+
 std::vector<std::filesystem::path> getAllFiles(const std::string& directory);
-std::string computeFileHash(const std::filesystem::path& file_path);
-FileCache loadCache(const std::string& cacheFilePath);
-void saveCache(const FileCache& cache, const std::string& cacheFilePath);
+std::string formatBytes(uintmax_t bytes);  // "1.5 MiB"
+bool statFile(const std::filesystem::path& file_path, FileStat& st, std::error_code& ec);
+// Read the extent map of a file whose data is entirely in extents the
+// filesystem reports as shared (reflinked on btrfs or XFS). Returns false for
+// files with any private, inline or unknown extent, or when FIEMAP is not
+// supported; two files of equal size with equal shared maps hold the same data.
+bool readSharedExtents(const std::filesystem::path& file_path, std::vector<FileExtent>& extents);
+// Physical byte offset of the first extent of a file, for ordering reads on
+// a spinning disk. Returns false for empty files or without FIEMAP support.
+bool readFirstPhysicalOffset(const std::filesystem::path& file_path, uint64_t& offset);
+Digest computeFileDigest(const std::filesystem::path& file_path, HashAlgorithm algorithm,
+                         ReadBackend backend = ReadBackend::Pread, ReadTimings* timings = nullptr);
+// Tree hashing: a file larger than chunkBytes is split into chunkBytes
+// segments (the last one shorter) that are hashed independently and folded
+// with combineChunkDigests. treeChunkCount is 0 for files hashed flat.
+uint64_t treeChunkCount(uintmax_t file_size, uint64_t chunkBytes);
+Digest computeChunkDigest(const std::filesystem::path& file_path, HashAlgorithm algorithm, uint64_t chunk,
+                          uint64_t chunkBytes, ReadBackend backend = ReadBackend::Pread,
+                          ReadTimings* timings = nullptr);
+// Hash every chunk in turn; chunks, when given, receives the chunk digests.
+// A file too small to split gets its flat digest and no chunks.
+Digest computeTreeDigest(const std::filesystem::path& file_path, uintmax_t file_size, HashAlgorithm algorithm,
+                         uint64_t chunkBytes, ReadBackend backend = ReadBackend::Pread,
+                         std::vector<Digest>* chunks = nullptr);
+std::string computeFileHash(const std::filesystem::path& file_path,
+                            HashAlgorithm algorithm = HashAlgorithm::MD5);
+Digest computePartialDigest(const std::filesystem::path& file_path, uintmax_t file_size,
+                            size_t headBytes, size_t tailBytes, HashAlgorithm algorithm);
 
+// Binary on-disk cache. A missing, corrupt or other-engine cache loads empty.
+FileCache loadCache(const std::string& cacheFilePath, HashAlgorithm algorithm);
+bool saveCache(const FileCache& cache, const std::string& cacheFilePath, HashAlgorithm algorithm);
 
+// Binary on-disk tree snapshot. A missing or corrupt snapshot loads empty.
+TreeSnapshot loadSnapshot(const std::string& snapshotFilePath);
+bool saveSnapshot(const TreeSnapshot& snapshot, const std::string& snapshotFilePath);
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Content hash engines selectable at runtime
+enum class HashAlgorithm {
+    XXH3,    // XXH3 128-bit, vendored xxHash; fast non-cryptographic default
+    MD5,     // OpenSSL MD5
+    SHA256,  // OpenSSL SHA-256
+};
+
+// Fixed-size binary digest, wide enough for the largest supported engine.
+// An empty digest (size 0) signals that hashing failed.
+struct Digest {
+    static constexpr size_t kMaxSize = 32;
+
+    std::array<uint8_t, kMaxSize> bytes{};
+    uint8_t size = 0;
+
+    bool empty() const { return size == 0; }
+    std::string toHex() const;
+
+    bool operator==(const Digest& other) const {
+        return size == other.size && std::memcmp(bytes.data(), other.bytes.data(), size) == 0;
+    }
+    bool operator!=(const Digest& other) const { return !(*this == other); }
+    bool operator<(const Digest& other) const {
+        if (size != other.size) return size < other.size;
+        return std::memcmp(bytes.data(), other.bytes.data(), size) < 0;
+    }
+};
+
+// Hash functor for unordered containers; digests are already well mixed
+struct DigestHash {
+    size_t operator()(const Digest& digest) const {
+        uint64_t value = 0;
+        std::memcpy(&value, digest.bytes.data(), sizeof(value));
+        return static_cast<size_t>(value);
+    }
+};
+
+// Incremental hash engine: feed bytes with update(), then call finish()
+class Hasher {
+public:
+    virtual ~Hasher() = default;
+    virtual void reset() = 0;
+    virtual bool update(const void* data, size_t length) = 0;
+    virtual Digest finish() = 0;
+};
+
+std::unique_ptr<Hasher> createHasher(HashAlgorithm algorithm);
+// Root digest of a file hashed as a tree of chunkBytes segments: the engine
+// run over a tag, the file size, the chunk size and every chunk digest in
+// order, so it never equals the flat digest of the same bytes. Empty if any
+// chunk digest is.
+Digest combineChunkDigests(HashAlgorithm algorithm, uint64_t fileSize, uint64_t chunkBytes,
+                           const std::vector<Digest>& chunks);
+const char* hashAlgorithmName(HashAlgorithm algorithm);
+bool parseHashAlgorithm(const std::string& name, HashAlgorithm& algorithm);
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// What sysfs says about the block device behind a st_dev, and how many
+// reads the scheduler keeps in flight on it
+struct DeviceProfile {
+    bool known = false;       // Found under /sys/dev/block
+    bool rotational = false;  // queue/rotational
+    unsigned queueDepth = 0;  // queue/nr_requests, 0 if unreadable
+    std::string name;         // Whole-disk name, e.g. "sda" or "nvme0n1"
+    unsigned workers = 1;     // Threads reading from the device at once
+};
+
+// Look up a device in sysfs and size its worker pool for cpuThreads hashing
+// threads: one worker for a spinning disk, and for an SSD or NVMe drive
+// cpuThreads, capped by the queue depth. Devices without a block queue
+// (tmpfs, network and overlay filesystems) get cpuThreads.
+DeviceProfile probeDevice(uint64_t device, unsigned cpuThreads);
+
+// One file to read: item is handed back to the work function, offset orders
+// the reads on rotational devices
+struct IoTask {
+    size_t item;
+    uint64_t device;
+    uint64_t offset;
+};
+
+using DeviceProfiler = std::function<DeviceProfile(uint64_t device)>;
+
+// Where a task's data lies on disk, replacing its offset. Called only for
+// rotational devices, by that device's pool, on one thread and in task order.
+using IoLocator = std::function<uint64_t(const IoTask& task)>;
+
+// Run work(item) for every task. Tasks are grouped by device and every
+// device gets its own pool of profile.workers threads, so a slow disk never
+// holds up the others. With threadBudget, pools are shrunk so their threads
+// add up to at most the budget, every device keeping at least one. On
+// rotational devices tasks are located, if locate is given, and then taken
+// in offset order; elsewhere in the order given. Returns once every task
+// has run.
+void runIoTasks(std::vector<IoTask> tasks, const DeviceProfiler& profile,
+                const std::function<void(size_t item)>& work, unsigned threadBudget = 0,
+                const IoLocator& locate = nullptr);
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <ostream>
+#include <vector>
+#include "ContentChunker.h"
+#include "Telemetry.h"
+
+// Tuning knobs for the chunk index
+struct NearDuplicateOptions {
+    ChunkingParams chunking;
+    double minSharedRatio = 0.5;  // Report pairs sharing at least this share of the larger file
+    size_t maxPostingFiles = 64;  // Chunks found in more files (zero pages, headers) are not paired on
+    ReadBackend readBackend = ReadBackend::Pread;
+};
+
+// Two files with chunks in common
+struct NearDuplicatePair {
+    std::filesystem::path first;
+    std::filesystem::path second;
+    uintmax_t sharedBytes = 0;  // Bytes of the distinct chunks both contain
+    double ratio = 0;           // sharedBytes over the larger file's distinct chunk bytes
+};
+
+// What the chunk index found across the files
+struct NearDuplicateReport {
+    std::vector<NearDuplicatePair> pairs;  // Most similar first
+    size_t files = 0;                      // Files chunked
+    size_t unreadable = 0;
+    uintmax_t bytes = 0;                   // Bytes chunked
+    size_t chunks = 0;
+    size_t uniqueChunks = 0;
+    uintmax_t reclaimableBytes = 0;        // Bytes in repeated chunks beyond their first copy
+};
+
+// Split every file into content-defined chunks and index them by
+// fingerprint. Reclaimable bytes count every repeat of a chunk, within or
+// across files, as a chunk-level deduplicating store would. Files are read
+// on each device's worker pool; metrics, when given, follow a "chunk" stage.
+NearDuplicateReport findNearDuplicates(const std::vector<std::filesystem::path>& files,
+                                       const NearDuplicateOptions& options, Metrics* metrics = nullptr);
+
+// Write the pairs and a summary of the index
+void printNearDuplicates(const NearDuplicateReport& report, std::ostream& out);
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "FileReader.h"
+
+// Per-file operations timed by the profiler
+enum class Operation {
+    Stat,      // One fstatat() in the walker
+    Open,      // Opening a file for hashing
+    Read,      // Read syscalls for one file
+    Hash,      // Hashing one file's contents
+    LockWait,  // Waiting for the lock that collects confirmed groups
+};
+constexpr size_t kOperationCount = 5;
+
+const char* operationName(Operation operation);
+
+// Latency histogram with four sub-buckets per power of two, so percentiles
+// are accurate to within 25%
+class LatencyHistogram {
+public:
+    void add(int64_t nanoseconds);
+    void merge(const LatencyHistogram& other);
+
+    uint64_t count() const { return samples; }
+    int64_t max() const { return maxNs; }
+    // Upper bound of the bucket holding the given fraction of samples
+    int64_t percentile(double fraction) const;
+
+private:
+    static constexpr size_t kBuckets = 252;
+    static size_t bucketOf(uint64_t value);
+    static uint64_t bucketLimit(size_t bucket);
+
+    std::array<uint64_t, kBuckets> buckets = {};
+    uint64_t samples = 0;
+    int64_t maxNs = 0;
+};
+
+// Opt-in instrumentation for a scan: wall and CPU time per stage, busy time
+// of every thread in each stage, bytes read per device and per-file latency
+// histograms, plus an optional timeline in Chrome trace-event format.
+//
+// Each thread records into its own log, found through a thread-local
+// pointer, so recording takes no lock; logs are merged for the report.
+// Stages are begun and ended by the thread driving the scan, between
+// parallel regions.
+class Profiler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit Profiler(bool trace = false);
+    ~Profiler();
+
+    // End the running stage, if any, and start the next one
+    void beginStage(const char* name);
+    void endStage();
+
+    // Nanoseconds since the profiler was created
+    int64_t now() const;
+
+    // Record work done by the calling thread from start to now. detail, when
+    // tracing, labels the timeline event (usually a path).
+    void recordBusy(const char* name, int64_t start, const std::string& detail = std::string());
+    void recordLatency(Operation operation, int64_t nanoseconds);
+    void recordFile(const ReadTimings& timings);
+    void recordDeviceBytes(uint64_t device, uint64_t bytes);
+
+    bool tracing() const { return trace; }
+
+    void printReport(std::ostream& out) const;
+    // Write the timeline as {"traceEvents":[...]} for chrome://tracing or Perfetto
+    bool writeTrace(const std::string& path) const;
+
+private:
+    struct TraceEvent {
+        const char* name;
+        int64_t start;
+        int64_t duration;
+        std::string detail;
+    };
+
+    struct ThreadLog {
+        unsigned id = 0;
+        std::vector<int64_t> busyByStage;
+        std::array<LatencyHistogram, kOperationCount> latencies;
+        std::unordered_map<uint64_t, uint64_t> deviceBytes;
+        std::vector<TraceEvent> events;
+    };
+
+    struct StageRecord {
+        const char* name;
+        int64_t wallStart = 0;
+        int64_t wallEnd = 0;
+        int64_t cpuStart = 0;
+        int64_t cpuEnd = 0;
+    };
+
+    ThreadLog& local();
+
+    const bool trace;
+    const uint64_t generation;  // Tells apart profilers reusing one address
+    const Clock::time_point start;
+    std::atomic<int> currentStage{-1};
+    std::vector<StageRecord> stages;
+    mutable std::mutex logsMutex;
+    std::vector<std::unique_ptr<ThreadLog>> logs;
+};
+
+// Nanoseconds as "850 ns", "3.2 us", "1.25 ms" or "2.10 s"
+std::string formatDuration(int64_t nanoseconds);
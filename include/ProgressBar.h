@@ -1,20 +1,32 @@
 #ifndef PROGRESSBAR_H
 #define PROGRESSBAR_H
 
+#include <chrono>
+#include <iostream>
 #include <string>
+#include "Telemetry.h"
 
+// Draws the progress of a scan from its metrics on a renderer thread, at a
+// fixed rate, so the threads doing the work never write to the terminal.
 class ProgressBar {
 public:
-    ProgressBar(unsigned int total, const std::string& taskDescription);
+    static constexpr std::chrono::milliseconds kRefreshInterval{100};
+
+    ProgressBar(unsigned int total, const std::string& taskDescription, std::ostream& out = std::cout);
+    ~ProgressBar();
     void update(unsigned int progress);
     void complete();
 
+    // Counters the pipeline updates; the bar shows the running stage
+    Metrics& metrics() { return counters; }
+
 private:
-    unsigned int total;
-    unsigned int current;
+    Metrics counters;
     std::string taskDescription;
+    std::ostream& out;
+    bool completed = false;
+    PeriodicTask renderer;  // Last, so it stops before the members it reads go away
     void display() const;
 };
 
 #endif // PROGRESSBAR_H
-
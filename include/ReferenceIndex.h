@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "DuplicateFinder.h"
+#include "Hasher.h"
+#include "ProgressBar.h"
+#include "ResultSink.h"
+
+struct IndexHeader;
+
+// Read-only view of a digest index built by buildReferenceIndex. The file
+// is memory-mapped: fixed-size (size, digest, path) entries sorted by size
+// then digest, followed by the paths, so opening costs nothing and every
+// lookup is a binary search over the mapping.
+class ReferenceIndex {
+public:
+    ReferenceIndex() = default;
+    ~ReferenceIndex();
+    ReferenceIndex(const ReferenceIndex&) = delete;
+    ReferenceIndex& operator=(const ReferenceIndex&) = delete;
+
+    // Map the index, replacing any index already open; false if it is
+    // missing or not a valid index, leaving none open
+    bool open(const std::string& indexPath);
+
+    HashAlgorithm algorithm() const;
+    uint64_t chunkBytes() const;  // Tree hash chunk size the digests were computed with
+    uint64_t size() const;        // Entries
+
+    // O(log n) membership tests
+    bool containsSize(uintmax_t size) const;
+    // Paths of every reference file with this size and digest
+    std::vector<std::string> find(uintmax_t size, const Digest& digest) const;
+
+private:
+    void close();
+    const uint8_t* entry(uint64_t i) const;
+    uint64_t entryFileSize(uint64_t i) const;
+    uint64_t lowerBound(uintmax_t size) const;
+
+    void* mapping = nullptr;
+    size_t length = 0;
+    const IndexHeader* header = nullptr;
+};
+
+// Walk the reference directories, hash every file (one path per inode,
+// tree-hashed past options.treeChunkBytes, reusing options.cache) and write
+// the index, replacing indexPath atomically. stats receives the walk, the
+// hash stage and the devices read.
+bool buildReferenceIndex(const std::vector<std::string>& directories, const std::string& indexPath,
+                         ProgressBar& progress, const FinderOptions& options, PipelineStats* stats = nullptr);
+
+// What a query found
+struct ReferenceQueryStats {
+    uint64_t matched = 0;       // New files already in the reference tree
+    uintmax_t matchedBytes = 0;
+};
+
+// Walk the new directories and report every file whose contents are in the
+// index. Files of a size the index does not hold are never opened; the rest
+// are hashed the way the index was (its engine and chunk size override
+// options). Each match goes to sink as a group listing the new file first,
+// then its reference copies. stats receives the size filter and the hash stage.
+bool queryReferenceIndex(const ReferenceIndex& index, const std::vector<std::string>& directories,
+                         ProgressBar& progress, const FinderOptions& options, ResultSink& sink,
+                         PipelineStats* stats = nullptr, ReferenceQueryStats* matches = nullptr);
+
+void printReferenceQueryStats(const ReferenceQueryStats& stats, std::ostream& out);
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "Hasher.h"
+
+// One confirmed set of files with identical content
+struct DuplicateGroup {
+    uintmax_t size = 0;  // Size of each file
+    Digest digest;       // Full-content digest shared by the files
+    std::vector<std::filesystem::path> files;  // Sorted; a reference index query lists the new file first
+
+    // Bytes that would be freed by keeping a single copy
+    uintmax_t wastedBytes() const { return wastedBytes(size, files.size()); }
+    static uintmax_t wastedBytes(uintmax_t size, uint64_t files) { return files == 0 ? 0 : size * (files - 1); }
+};
+
+// Receives duplicate groups as the pipeline confirms them, while the scan
+// is still running. Calls are serialised by the caller. A group arrives
+// whole through group(), or, from callers that never hold one in memory,
+// as beginGroup(), a groupFile() per file and endGroup(). Each form
+// defaults to the other, so a sink overrides either group() or the three
+// streaming calls.
+class ResultSink {
+public:
+    virtual ~ResultSink() = default;
+    virtual void group(const DuplicateGroup& group);
+    virtual void beginGroup(uintmax_t size, const Digest& digest, uint64_t files);
+    virtual void groupFile(const std::filesystem::path& file);
+    virtual void endGroup();
+    // Called once after the last group
+    virtual void finish() {}
+
+private:
+    DuplicateGroup pending;  // Collected by the default streaming calls
+};
+
+enum class OutputFormat {
+    Text,       // The human-readable listing
+    JsonLines,  // One JSON object per group
+    Csv,        // One row per file, with a header row
+    Binary,     // Length-prefixed records, see ResultSink.cpp
+};
+
+const char* outputFormatName(OutputFormat format);
+bool parseOutputFormat(const std::string& name, OutputFormat& format);
+
+// Write text as a JSON string, escaping quotes, backslashes and control
+// characters. Well-formed UTF-8 passes through; any other byte is written
+// as \u00XX, so the output stays valid JSON for any file name.
+void writeJsonString(std::ostream& out, const std::string& text);
+
+// Create a sink writing the format to out, flushing after every group. The
+// algorithm is recorded by formats that carry digests.
+std::unique_ptr<ResultSink> createResultSink(OutputFormat format, std::ostream& out,
+                                             HashAlgorithm algorithm);
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <thread>
+
+// Counters read by the reporters at one instant
+struct MetricsSnapshot {
+    const char* stage = "";     // Name of the running stage
+    uint64_t filesDone = 0;
+    uint64_t filesTotal = 0;    // 0 while the total is unknown (the walk)
+    uint64_t bytesDone = 0;
+    uint64_t bytesTotal = 0;
+    double stageSeconds = 0;    // Time since the stage began
+    double elapsedSeconds = 0;  // Time since the counters were created
+
+    // Average read rate of the running stage
+    double bytesPerSecond() const { return stageSeconds > 0 ? bytesDone / stageSeconds : 0; }
+};
+
+// Lock-free progress counters shared by the pipeline threads and the
+// reporters. Workers only add to counters with relaxed atomics; each
+// counter sits on its own cache line so threads adding to one do not slow
+// those adding to another. A snapshot may mix values from either side of a
+// concurrent update, which is harmless for display.
+class Metrics {
+public:
+    Metrics();
+
+    // Start a stage, resetting the done counters. The name must outlive
+    // the counters (a string literal).
+    void beginStage(const char* name, uint64_t files, uint64_t bytes);
+    void addFiles(uint64_t count) { filesDone.value.fetch_add(count, std::memory_order_relaxed); }
+    void addBytes(uint64_t count) { bytesDone.value.fetch_add(count, std::memory_order_relaxed); }
+    void setFilesDone(uint64_t count) { filesDone.value.store(count, std::memory_order_relaxed); }
+
+    MetricsSnapshot snapshot() const;
+
+private:
+    struct alignas(64) Counter {
+        std::atomic<uint64_t> value{0};
+    };
+
+    int64_t sinceStart() const;
+
+    const std::chrono::steady_clock::time_point start;
+    std::atomic<const char*> stage{""};
+    std::atomic<int64_t> stageStart{0};  // Nanoseconds after start
+    Counter filesTotal;
+    Counter bytesTotal;
+    Counter filesDone;
+    Counter bytesDone;
+};
+
+// Calls tick every interval on its own thread until stopped, then once more
+// so the final values are always reported
+class PeriodicTask {
+public:
+    PeriodicTask(std::chrono::milliseconds interval, std::function<void()> tick);
+    ~PeriodicTask();
+    void stop();
+
+private:
+    void run();
+
+    const std::chrono::milliseconds interval;
+    std::function<void()> tick;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::thread worker;
+};
+
+// Write the counters as one JSON object on a single line:
+// {"elapsed":S,"stage":"..","files_done":N,"files_total":N,
+//  "bytes_done":N,"bytes_total":N,"bytes_per_second":N}
+void writeStatsLine(std::ostream& out, const MetricsSnapshot& snapshot);
+
+// Writes a stats line for monitoring every interval while a scan runs,
+// and a last one when stopped
+class StatsReporter {
+public:
+    StatsReporter(const Metrics& metrics, std::ostream& out, std::chrono::milliseconds interval);
+    void stop() { task.stop(); }
+
+private:
+    const Metrics& metrics;
+    std::ostream& out;
+    PeriodicTask task;  // Last, so it stops before the members it reads go away
+};
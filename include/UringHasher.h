@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <vector>
+#include "Hasher.h"
+#include "Telemetry.h"
+
+// Tuning for the io_uring hashing engine
+struct UringOptions {
+    unsigned queueDepth = 64;      // Reads kept in flight across all open files
+    unsigned hashThreads = 0;      // Hashing workers; 0 picks min(4, hardware threads)
+    size_t chunkSize = 256 * 1024; // Bytes per read request
+};
+
+// Hash the full contents of many files through one io_uring. Up to
+// queueDepth / 2 files are open at once, each double-buffered, and completed
+// reads are hashed in file order by a small worker pool. digests[i] is empty
+// when files[i] could not be read. With metrics, each file is counted as
+// it finishes, along with the bytes read from it.
+//
+// Returns false when io_uring is unavailable (kernel older than 5.6, seccomp,
+// container policy) or the ring fails mid-run; callers then hash synchronously.
+bool computeFileDigestsUring(const std::vector<std::filesystem::path>& files,
+                             HashAlgorithm algorithm, const UringOptions& options,
+                             std::vector<Digest>& digests, Metrics* metrics = nullptr);
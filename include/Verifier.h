@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+// Outcome of verifying one group of files believed to be identical
+struct VerifyResult {
+    std::vector<std::vector<size_t>> groups;  // Indices into the input, two or more per group
+    uintmax_t bytesRead = 0;
+};
+
+// Compare files of the given size byte for byte. All members are read in
+// lock-step, one block at a time; after each block the group is split into
+// classes of equal content and members left on their own stop being read,
+// so each file is read at most once. Unreadable files are dropped. Blocks
+// in holes of sparse files are not read: they equal each other and any
+// block read that is all zeros.
+//
+// At most maxOpenFiles files are open at once. A larger group is verified in
+// rounds: the members equal to the first are gathered batch by batch, and the
+// others are verified again among themselves, so only groups too large to
+// open at once are read more than once.
+VerifyResult verifyIdenticalFiles(const std::vector<std::filesystem::path>& files, uintmax_t size,
+                                  size_t maxOpenFiles);
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <ostream>
+#include <regex>
+#include <string>
+#include <vector>
+
+// Which files and directories a walk skips. Excludes apply to both and
+// prune whole subtrees; includes and size bounds apply to files only. A
+// glob without '/' is matched against the entry name, one with '/' against
+// its full path; regexes are searched for in the full path.
+struct FilterRules {
+    uintmax_t minSize = 0;            // Smaller files are skipped
+    uintmax_t maxSize = UINTMAX_MAX;  // Larger files are skipped
+    std::vector<std::string> includeGlobs;  // With any include, files must match one of them
+    std::vector<std::string> includeRegexes;
+    std::vector<std::string> excludeGlobs = {"*$*"};  // Windows system and recycle-bin names
+    std::vector<std::string> excludeRegexes;
+    bool oneFileSystem = false;  // Stay on the device of each root
+};
+
+// Entries one rule kept out of a walk
+struct FilterCount {
+    std::string rule;
+    uint64_t files = 0;
+    uint64_t directories = 0;
+};
+
+// Rules compiled for the walker. Globs are reduced to literal, prefix,
+// suffix and substring tests where they allow it, and regexes are compiled
+// once, so each directory entry costs a few comparisons. Safe to share
+// between walker threads; the counters are atomic.
+class WalkFilter {
+public:
+    // Compile the rules; false if a pattern is invalid
+    bool compile(const FilterRules& rules);
+
+    bool needsSize() const { return minSize > 0 || maxSize != UINTMAX_MAX; }
+    bool oneFileSystem() const { return sameDevice; }
+
+    // Name and path rules, needing only the entry's d_type
+    bool admits(const std::filesystem::path& parent, const char* name, bool directory) const;
+    bool admitsSize(uintmax_t size) const;
+    // Record a directory left alone for being on another device
+    void countOtherDevice() const;
+
+    // Every rule with what it pruned so far, in rule order
+    std::vector<FilterCount> counts() const;
+
+private:
+    struct Pattern {
+        enum Kind { Literal, Prefix, Suffix, Contains, Glob, Regex } kind;
+        bool wholePath;  // Tested against the full path rather than the name
+        std::string text;
+        std::regex regex;
+        size_t rule;
+    };
+
+    bool addPattern(std::vector<Pattern>& patterns, const std::string& text, bool regex, const std::string& rule);
+    static bool matches(const Pattern& pattern, const char* name, size_t length, const std::string& path);
+    // Index of the first matching pattern, or -1; path is built on first use
+    static int firstMatch(const std::vector<Pattern>& patterns, const std::filesystem::path& parent,
+                          const char* name, std::string& path);
+    void count(size_t rule, bool directory) const;
+
+    uintmax_t minSize = 0;
+    uintmax_t maxSize = UINTMAX_MAX;
+    bool sameDevice = false;
+    std::vector<Pattern> includes;
+    std::vector<Pattern> excludes;
+    std::vector<std::string> rules;  // Names of the rules the counters belong to
+    size_t minRule = 0, maxRule = 0, deviceRule = 0, includeRule = 0;
+    std::unique_ptr<std::atomic<uint64_t>[]> fileCounts;
+    std::unique_ptr<std::atomic<uint64_t>[]> directoryCounts;
+};
+
+// Print the rules that pruned anything
+void printFilterCounts(const std::vector<FilterCount>& counts, std::ostream& out);
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include "DuplicateFinder.h"
+
+// Index the roots once, then keep the index current from inotify events and
+// answer queries on a Unix stream socket until SIGINT or SIGTERM. Changed
+// paths are applied in batches once events have been quiet for settleMs.
+// Returns false when the socket or inotify cannot be set up.
+//
+// Protocol: the client writes one absolute path per line; each is answered
+// with "duplicate N" followed by N paths, one per line, or with "unique" or
+// "unknown" (not indexed).
+bool runWatchDaemon(const std::vector<std::string>& roots, const FinderOptions& options,
+                    const std::string& socketPath, unsigned settleMs = 200);
+
+// Ask a running daemon about each file and print the answers
+bool queryWatchDaemon(const std::string& socketPath, const std::vector<std::string>& files,
+                      std::ostream& out);
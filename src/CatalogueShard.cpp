@@ -0,0 +1,436 @@
+#include "CatalogueShard.h"
+#include "DirectoryWalker.h"
+#include "FileCatalogue.h"
+#include "IoScheduler.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <omp.h>
+
+namespace {
+
+using Index = FileCatalogue::Index;
+
+const char kShardMagic[8] = {'D', 'F', 'F', 'S', 'H', 'A', 'R', 'D'};
+const uint32_t kShardVersion = 1;
+
+// Shards are read and written through buffers this large
+constexpr size_t kShardBuffer = 1 << 20;
+
+struct ShardHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t algorithm;
+    uint64_t chunkBytes;  // Tree hash chunk size the digests were computed with
+    uint64_t count;
+    uint32_t nodeLength;
+    uint32_t padding;
+};
+
+// Followed by the digest and path bytes
+struct ShardEntryHeader {
+    uint64_t size;
+    uint32_t pathLength;
+    uint8_t digestSize;
+    uint8_t padding[3];
+};
+
+// (size, digest, path) order, the order of every shard
+bool shardOrder(uint64_t size_a, const Digest& digest_a, const std::string& path_a,
+                uint64_t size_b, const Digest& digest_b, const std::string& path_b) {
+    if (size_a != size_b) return size_a < size_b;
+    if (digest_a != digest_b) return digest_a < digest_b;
+    return path_a < path_b;
+}
+
+// Sequential reader over one shard file
+class ShardReader {
+public:
+    bool open(const std::string& path) {
+        name = path;
+        buffer.reset(new char[kShardBuffer]);
+        in.rdbuf()->pubsetbuf(buffer.get(), kShardBuffer);
+        in.open(path, std::ios::binary);
+        if (!in) {
+            std::cerr << "Cannot open shard " << path << std::endl;
+            return false;
+        }
+        if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+            std::memcmp(header.magic, kShardMagic, sizeof(kShardMagic)) != 0 || header.version != kShardVersion) {
+            std::cerr << "Not a catalogue shard: " << path << std::endl;
+            return false;
+        }
+        node.resize(header.nodeLength);
+        if (!in.read(node.data(), node.size())) {
+            std::cerr << "Truncated shard " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Load the next entry into the current fields; false at the end or on error
+    bool next() {
+        if (read == header.count) {
+            done = true;
+            return false;
+        }
+        ShardEntryHeader entry;
+        std::string path_bytes;
+        if (!in.read(reinterpret_cast<char*>(&entry), sizeof(entry)) || entry.digestSize > Digest::kMaxSize) {
+            return fail("Truncated");
+        }
+        Digest next_digest;
+        next_digest.size = entry.digestSize;
+        path_bytes.resize(entry.pathLength);
+        if (!in.read(reinterpret_cast<char*>(next_digest.bytes.data()), entry.digestSize) ||
+            !in.read(path_bytes.data(), path_bytes.size())) {
+            return fail("Truncated");
+        }
+        if (read > 0 && !shardOrder(size, digest, path, entry.size, next_digest, path_bytes)) {
+            return fail("Unsorted");
+        }
+        size = entry.size;
+        digest = next_digest;
+        path = std::move(path_bytes);
+        read++;
+        return true;
+    }
+
+    std::string name;
+    ShardHeader header{};
+    std::string node;
+    bool done = false;
+    bool failed = false;
+    uint64_t size = 0;
+    Digest digest;
+    std::string path;
+
+private:
+    bool fail(const char* what) {
+        std::cerr << what << " shard " << name << " at entry " << read << std::endl;
+        failed = true;
+        return false;
+    }
+
+    std::unique_ptr<char[]> buffer;
+    std::ifstream in;
+    uint64_t read = 0;
+};
+
+// Ends the profiler stage it began on every way out of the scope
+class ProfiledStage {
+public:
+    ProfiledStage(Profiler* profiler, const char* name) : profiler(profiler) {
+        if (profiler) profiler->beginStage(name);
+    }
+    ~ProfiledStage() {
+        if (profiler) profiler->endStage();
+    }
+    ProfiledStage(const ProfiledStage&) = delete;
+    ProfiledStage& operator=(const ProfiledStage&) = delete;
+
+private:
+    Profiler* profiler;
+};
+
+} // namespace
+
+// Function to walk directories and hash every file found
+std::vector<FileCatalogue::Index> hashEveryFile(const std::vector<std::string>& directories,
+                                                FileCatalogue& catalogue, ProgressBar& progress,
+                                                const FinderOptions& options,
+                                                const std::function<bool(uintmax_t size)>& wanted,
+                                                PipelineStats* stats) {
+    Metrics& metrics = progress.metrics();
+    Profiler* profiler = options.profiler;
+    auto begin_stage = [&](const char* name, uint64_t files, uint64_t bytes) {
+        metrics.beginStage(name, files, bytes);
+        if (profiler) profiler->beginStage(name);
+    };
+
+    WalkOptions walk = options.walk;
+    walk.statFiles = true;
+    walk.metrics = &metrics;
+    walk.profiler = profiler;
+    begin_stage("walk", 0, 0);
+    WalkStats walked = walkDirectories(directories, walk, catalogue);
+
+    // One path per inode; in inode order, which is also the read order on
+    // a spinning disk without FIEMAP
+    std::vector<Index> files(catalogue.size());
+    for (size_t i = 0; i < files.size(); ++i) files[i] = static_cast<Index>(i);
+    std::sort(files.begin(), files.end(), [&](Index a, Index b) {
+        const FileStat sa = catalogue.stat(a);
+        const FileStat sb = catalogue.stat(b);
+        if (sa.device != sb.device) return sa.device < sb.device;
+        return sa.inode != sb.inode ? sa.inode < sb.inode : a < b;
+    });
+    size_t links = 0;
+    if (options.collapseLinks) {
+        auto same_inode = [&](Index a, Index b) {
+            const FileStat sa = catalogue.stat(a);
+            const FileStat sb = catalogue.stat(b);
+            return sa.inode != 0 && sa.device == sb.device && sa.inode == sb.inode;
+        };
+        const size_t before = files.size();
+        files.erase(std::unique(files.begin(), files.end(), same_inode), files.end());
+        links = before - files.size();
+    }
+
+    // Files of unwanted sizes are left out without being opened
+    StageStats size_stage{"size"};
+    size_stage.filesIn = files.size();
+    if (wanted) {
+        files.erase(std::remove_if(files.begin(), files.end(), [&](Index file) {
+            if (wanted(catalogue.fileSize(file))) return false;
+            size_stage.filesEliminated++;
+            size_stage.bytesEliminated += catalogue.fileSize(file);
+            size_stage.bytesAvoided += catalogue.fileSize(file);
+            return true;
+        }), files.end());
+    }
+
+    // Digests from the cache where it has them for the same tree layout
+    catalogue.allocateDigests();
+    StageStats hash_stage{"full hash"};
+    hash_stage.filesIn = files.size();
+    std::vector<char> cached(files.size());
+    size_t cache_hits = 0;
+    uintmax_t bytes_to_read = 0;
+    const Digest empty_digest = createHasher(options.hashAlgorithm)->finish();
+    for (size_t i = 0; i < files.size(); ++i) {
+        const FileStat st = catalogue.stat(files[i]);
+        if (st.size == 0) {
+            catalogue.setDigest(files[i], empty_digest);
+            cached[i] = true;
+            continue;
+        }
+        if (options.cache) {
+            auto it = options.cache->find(catalogue.pathString(files[i]));
+            const uint64_t chunks = treeChunkCount(st.size, options.treeChunkBytes);
+            if (it != options.cache->end() && it->second.matches(st) && !it->second.fileHash.empty() &&
+                it->second.chunkBytes == (chunks ? options.treeChunkBytes : 0) &&
+                it->second.chunkHashes.size() == chunks) {
+                catalogue.setDigest(files[i], it->second.fileHash);
+                cached[i] = true;
+                cache_hits++;
+                continue;
+            }
+        }
+        bytes_to_read += st.size;
+    }
+
+    // Hash the rest on each device's readers, in on-disk order on spinning disks
+    const unsigned cpu_threads = static_cast<unsigned>(omp_get_max_threads());
+    std::map<uint64_t, DeviceProfile> devices;
+    DeviceProfiler device_profile = [&](uint64_t device) {
+        if (!options.scheduleByDevice) {
+            DeviceProfile shared;
+            shared.workers = cpu_threads;
+            return shared;
+        }
+        auto it = devices.find(device);
+        if (it == devices.end()) it = devices.emplace(device, probeDevice(device, cpu_threads)).first;
+        return it->second;
+    };
+    std::vector<IoTask> tasks;
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (cached[i]) continue;
+        const FileStat st = catalogue.stat(files[i]);
+        tasks.push_back({i, options.scheduleByDevice ? st.device : 0, st.inode});
+    }
+    // Looked up by the disk's own pool, so other devices start reading at once
+    IoLocator locate = [&](const IoTask& task) {
+        uint64_t physical = 0;
+        return readFirstPhysicalOffset(catalogue.path(files[task.item]), physical) ? physical : task.offset;
+    };
+    begin_stage("full hash", tasks.size(), bytes_to_read);
+    std::vector<std::vector<Digest>> chunk_digests(files.size());
+    std::atomic<size_t> unreadable{0};
+    runIoTasks(std::move(tasks), device_profile, [&](size_t i) {
+        const int64_t start = profiler ? profiler->now() : 0;
+        const std::filesystem::path path = catalogue.path(files[i]);
+        const uintmax_t size = catalogue.fileSize(files[i]);
+        const Digest digest = computeTreeDigest(path, size, options.hashAlgorithm, options.treeChunkBytes,
+                                                options.readBackend, &chunk_digests[i]);
+        if (digest.empty()) unreadable++;
+        catalogue.setDigest(files[i], digest);
+        metrics.addFiles(1);
+        metrics.addBytes(size);
+        if (profiler) {
+            profiler->recordDeviceBytes(catalogue.device(files[i]), size);
+            profiler->recordBusy("full hash", start, profiler->tracing() ? path.string() : std::string());
+        }
+    }, cpu_threads, locate);
+    hash_stage.bytesRead = bytes_to_read;
+    hash_stage.filesEliminated = unreadable;
+
+    if (options.cache) {
+        for (size_t i = 0; i < files.size(); ++i) {
+            if (cached[i] || catalogue.digest(files[i]).empty()) continue;
+            FileMetadata& metadata = (*options.cache)[catalogue.pathString(files[i])];
+            metadata.refresh(catalogue.stat(files[i]));
+            metadata.fileHash = catalogue.digest(files[i]);
+            metadata.chunkBytes = chunk_digests[i].empty() ? 0 : options.treeChunkBytes;
+            metadata.chunkHashes = std::move(chunk_digests[i]);
+        }
+    }
+    std::vector<std::vector<Digest>>().swap(chunk_digests);
+    files.erase(std::remove_if(files.begin(), files.end(), [&](Index file) { return catalogue.digest(file).empty(); }),
+                files.end());
+
+    if (stats) {
+        stats->walk = walked;
+        if (wanted) stats->stages.push_back(size_stage);
+        stats->stages.push_back(hash_stage);
+        stats->cacheHits += cache_hits;
+        stats->hardLinksSkipped += links;
+        for (const auto& entry : devices) stats->devices.emplace_back(entry.first, entry.second);
+    }
+    return files;
+}
+
+// Function to scan local roots and write their sorted catalogue shard
+bool writeCatalogueShard(const std::vector<std::string>& directories, const std::string& shardPath,
+                         const std::string& node, ProgressBar& progress, const FinderOptions& options,
+                         PipelineStats* stats) {
+    FileCatalogue catalogue;
+    std::vector<Index> files = hashEveryFile(directories, catalogue, progress, options, {}, stats);
+
+    // Sort into shard order and stream the entries out
+    Metrics& metrics = progress.metrics();
+    metrics.beginStage("write shard", files.size(), 0);
+    ProfiledStage profiled(options.profiler, "write shard");
+    std::vector<std::string> paths(catalogue.size());
+    for (Index file : files) paths[file] = catalogue.pathString(file);
+    std::sort(files.begin(), files.end(), [&](Index a, Index b) {
+        return shardOrder(catalogue.fileSize(a), catalogue.digest(a), paths[a],
+                          catalogue.fileSize(b), catalogue.digest(b), paths[b]);
+    });
+
+    const std::string tmp_path = shardPath + ".tmp";
+    bool written = false;
+    {
+        std::unique_ptr<char[]> buffer(new char[kShardBuffer]);
+        std::ofstream out;
+        out.rdbuf()->pubsetbuf(buffer.get(), kShardBuffer);
+        out.open(tmp_path, std::ios::binary | std::ios::trunc);
+        ShardHeader header = {};
+        std::memcpy(header.magic, kShardMagic, sizeof(kShardMagic));
+        header.version = kShardVersion;
+        header.algorithm = static_cast<uint32_t>(options.hashAlgorithm);
+        header.chunkBytes = options.treeChunkBytes;
+        header.count = files.size();
+        header.nodeLength = static_cast<uint32_t>(node.size());
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(node.data(), node.size());
+        for (Index file : files) {
+            const Digest& digest = catalogue.digest(file);
+            ShardEntryHeader entry = {};
+            entry.size = catalogue.fileSize(file);
+            entry.pathLength = static_cast<uint32_t>(paths[file].size());
+            entry.digestSize = digest.size;
+            out.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+            out.write(reinterpret_cast<const char*>(digest.bytes.data()), digest.size);
+            out.write(paths[file].data(), paths[file].size());
+            metrics.addFiles(1);
+        }
+        written = static_cast<bool>(out.flush());
+    }
+    if (!written) {
+        std::cerr << "Error writing shard " << tmp_path << std::endl;
+        return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, shardPath, ec);
+    if (ec) {
+        std::cerr << "Error replacing shard " << shardPath << ": " << ec.message() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Function to merge sorted shards into global duplicate groups
+bool mergeCatalogueShards(const std::vector<std::string>& shardPaths, HashAlgorithm algorithm,
+                          ResultSink& sink, ShardMergeStats* stats) {
+    if (shardPaths.empty()) {
+        std::cerr << "No shards to merge" << std::endl;
+        return false;
+    }
+    std::vector<std::unique_ptr<ShardReader>> readers;
+    for (const auto& path : shardPaths) {
+        readers.push_back(std::make_unique<ShardReader>());
+        if (!readers.back()->open(path)) return false;
+        const ShardHeader& header = readers.back()->header;
+        if (header.algorithm != static_cast<uint32_t>(algorithm)) {
+            std::cerr << "Shard " << path << " was hashed with the "
+                      << hashAlgorithmName(static_cast<HashAlgorithm>(header.algorithm)) << " engine" << std::endl;
+            return false;
+        }
+        if (header.chunkBytes != readers.front()->header.chunkBytes) {
+            std::cerr << "Shard " << path << " was tree-hashed in " << formatBytes(header.chunkBytes)
+                      << " chunks, unlike " << shardPaths.front() << std::endl;
+            return false;
+        }
+    }
+
+    // Min-heap of shards on their current entry; ties go to the earlier shard
+    auto after = [&](size_t a, size_t b) {
+        const ShardReader& x = *readers[a];
+        const ShardReader& y = *readers[b];
+        if (x.size != y.size) return x.size > y.size;
+        if (x.digest != y.digest) return y.digest < x.digest;
+        return a > b;
+    };
+    std::vector<size_t> heap;
+    for (size_t r = 0; r < readers.size(); ++r) {
+        if (readers[r]->next()) heap.push_back(r);
+        if (readers[r]->failed) return false;
+    }
+    std::make_heap(heap.begin(), heap.end(), after);
+
+    ShardMergeStats totals;
+    totals.shards = readers.size();
+    DuplicateGroup group;
+    auto close_group = [&] {
+        if (group.files.size() > 1) {
+            std::sort(group.files.begin(), group.files.end());
+            sink.group(group);
+            totals.groups++;
+            totals.duplicateFiles += group.files.size();
+            totals.wastedBytes += group.wastedBytes();
+        }
+        group.files.clear();
+    };
+    while (!heap.empty()) {
+        std::pop_heap(heap.begin(), heap.end(), after);
+        ShardReader& reader = *readers[heap.back()];
+        if (!group.files.empty() && (reader.size != group.size || reader.digest != group.digest)) close_group();
+        group.size = reader.size;
+        group.digest = reader.digest;
+        group.files.emplace_back(reader.node.empty() ? reader.path : reader.node + ":" + reader.path);
+        totals.files++;
+        if (reader.next()) {
+            std::push_heap(heap.begin(), heap.end(), after);
+        } else if (reader.failed) {
+            return false;
+        } else {
+            heap.pop_back();
+        }
+    }
+    close_group();
+    sink.finish();
+    if (stats) *stats = totals;
+    return true;
+}
+
+// Function to print what a shard merge found
+void printShardMergeStats(const ShardMergeStats& stats, std::ostream& out) {
+    out << "Merged " << stats.shards << " shards, " << stats.files << " files: " << stats.groups
+        << " duplicate groups of " << stats.duplicateFiles << " files, " << formatBytes(stats.wastedBytes)
+        << " reclaimable" << std::endl;
+}
@@ -0,0 +1,280 @@
+#include "ContentChunker.h"
+#include <algorithm>
+#include <cstring>
+#include <immintrin.h>
+
+#define XXH_INLINE_ALL
+#include "xxhash.h"
+
+namespace {
+
+// Bytes that feed the hash at each position
+constexpr size_t kGearWindow = 64;
+
+// Runs shorter than this per lane are scanned in one lane
+constexpr size_t kMinLaneBytes = 4096;
+
+// Bytes scanned for candidates before settled chunks are cut
+constexpr size_t kScanSlice = 1 << 20;
+
+// Random 64-bit value per byte value, fixed so chunks are stable across runs
+struct GearTable {
+    uint64_t values[256];
+
+    GearTable() {
+        uint64_t state = 0x6765617274616231ull;
+        for (uint64_t& value : values) {
+            uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            value = z ^ (z >> 31);
+        }
+    }
+};
+
+const uint64_t* gearTable() {
+    static const GearTable table;
+    return table.values;
+}
+
+// The top bits of the hash mix in the whole window; the low ones only the
+// last few bytes
+uint64_t topBits(unsigned bits) {
+    return bits == 0 ? 0 : ~uint64_t(0) << (64 - std::min(bits, 64u));
+}
+
+unsigned log2Floor(size_t value) {
+    unsigned bits = 0;
+    while (value > 1) {
+        value >>= 1;
+        ++bits;
+    }
+    return bits;
+}
+
+// Hash state just before data[position], from the window ahead of it
+uint64_t gearBefore(const uint8_t* data, size_t position) {
+    const uint64_t* gear = gearTable();
+    uint64_t hash = 0;
+    for (size_t i = position - std::min(position, kGearWindow - 1); i < position; ++i) {
+        hash = (hash << 1) + gear[data[i]];
+    }
+    return hash;
+}
+
+void scanSerial(const uint8_t* data, size_t begin, size_t end, uint64_t loose, uint64_t strict,
+                std::vector<GearCandidate>& out) {
+    const uint64_t* gear = gearTable();
+    uint64_t hash = gearBefore(data, begin);
+    for (size_t i = begin; i < end; ++i) {
+        hash = (hash << 1) + gear[data[i]];
+        if ((hash & loose) == 0) out.push_back({i, (hash & strict) == 0});
+    }
+}
+
+// Four lanes stepped together: independent shift-add chains keep the
+// pipeline full where a single chain waits on each lookup
+void scanPortable(const uint8_t* data, size_t begin, size_t end, uint64_t loose, uint64_t strict,
+                  std::vector<GearCandidate>& out) {
+    constexpr size_t kLanes = 4;
+    const size_t lane_bytes = (end - begin) / kLanes;
+    if (lane_bytes < kMinLaneBytes) return scanSerial(data, begin, end, loose, strict, out);
+
+    const uint64_t* gear = gearTable();
+    thread_local std::vector<GearCandidate> found[kLanes];
+    const uint8_t* lane[kLanes];
+    uint64_t hash[kLanes];
+    for (size_t l = 0; l < kLanes; ++l) {
+        lane[l] = data + begin + l * lane_bytes;
+        hash[l] = gearBefore(data, begin + l * lane_bytes);
+        found[l].clear();
+    }
+    for (size_t i = 0; i < lane_bytes; ++i) {
+        unsigned hits = 0;
+        for (size_t l = 0; l < kLanes; ++l) {
+            hash[l] = (hash[l] << 1) + gear[lane[l][i]];
+            hits |= static_cast<unsigned>((hash[l] & loose) == 0) << l;
+        }
+        if (hits == 0) continue;
+        for (size_t l = 0; l < kLanes; ++l) {
+            if (hits >> l & 1) found[l].push_back({begin + l * lane_bytes + i, (hash[l] & strict) == 0});
+        }
+    }
+    for (const auto& lane_found : found) out.insert(out.end(), lane_found.begin(), lane_found.end());
+    scanSerial(data, begin + kLanes * lane_bytes, end, loose, strict, out);
+}
+
+// Eight lanes in two registers. Each lane's next eight bytes are gathered
+// as one word and peeled a byte per step; the table is read by gather.
+__attribute__((target("avx2")))
+void scanAvx2(const uint8_t* data, size_t begin, size_t end, uint64_t loose, uint64_t strict,
+              std::vector<GearCandidate>& out) {
+    constexpr size_t kLanes = 8;
+    const size_t lane_bytes = (end - begin) / kLanes / 8 * 8;
+    if (lane_bytes < kMinLaneBytes) return scanSerial(data, begin, end, loose, strict, out);
+
+    const long long* gear = reinterpret_cast<const long long*>(gearTable());
+    thread_local std::vector<GearCandidate> found[kLanes];
+    alignas(32) uint64_t start_hash[kLanes];
+    for (size_t l = 0; l < kLanes; ++l) {
+        start_hash[l] = gearBefore(data, begin + l * lane_bytes);
+        found[l].clear();
+    }
+    __m256i low = _mm256_load_si256(reinterpret_cast<const __m256i*>(start_hash));
+    __m256i high = _mm256_load_si256(reinterpret_cast<const __m256i*>(start_hash + 4));
+    const long long stride = static_cast<long long>(lane_bytes);
+    const __m256i low_offsets = _mm256_set_epi64x(3 * stride, 2 * stride, stride, 0);
+    const __m256i high_offsets = _mm256_set_epi64x(7 * stride, 6 * stride, 5 * stride, 4 * stride);
+    const __m256i loose_mask = _mm256_set1_epi64x(static_cast<long long>(loose));
+    const __m256i byte_mask = _mm256_set1_epi64x(0xff);
+    const __m256i zero = _mm256_setzero_si256();
+
+    for (size_t i = 0; i < lane_bytes; i += 8) {
+        const long long* base = reinterpret_cast<const long long*>(data + begin + i);
+        __m256i low_bytes = _mm256_i64gather_epi64(base, low_offsets, 1);
+        __m256i high_bytes = _mm256_i64gather_epi64(base, high_offsets, 1);
+        for (size_t step = 0; step < 8; ++step) {
+            low = _mm256_add_epi64(_mm256_slli_epi64(low, 1),
+                                   _mm256_i64gather_epi64(gear, _mm256_and_si256(low_bytes, byte_mask), 8));
+            high = _mm256_add_epi64(_mm256_slli_epi64(high, 1),
+                                    _mm256_i64gather_epi64(gear, _mm256_and_si256(high_bytes, byte_mask), 8));
+            low_bytes = _mm256_srli_epi64(low_bytes, 8);
+            high_bytes = _mm256_srli_epi64(high_bytes, 8);
+            const __m256i low_hit = _mm256_cmpeq_epi64(_mm256_and_si256(low, loose_mask), zero);
+            const __m256i high_hit = _mm256_cmpeq_epi64(_mm256_and_si256(high, loose_mask), zero);
+            const int hits = _mm256_movemask_pd(_mm256_castsi256_pd(low_hit)) |
+                             _mm256_movemask_pd(_mm256_castsi256_pd(high_hit)) << 4;
+            if (hits == 0) continue;
+            alignas(32) uint64_t hash[kLanes];
+            _mm256_store_si256(reinterpret_cast<__m256i*>(hash), low);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(hash + 4), high);
+            for (size_t l = 0; l < kLanes; ++l) {
+                if (hits >> l & 1) found[l].push_back({begin + l * lane_bytes + i + step, (hash[l] & strict) == 0});
+            }
+        }
+    }
+    for (const auto& lane_found : found) out.insert(out.end(), lane_found.begin(), lane_found.end());
+    scanSerial(data, begin + kLanes * lane_bytes, end, loose, strict, out);
+}
+
+} // namespace
+
+// Function to pick the fastest Gear kernel the CPU supports
+GearKernel bestGearKernel() {
+    static const GearKernel kernel = __builtin_cpu_supports("avx2") ? GearKernel::Avx2 : GearKernel::Portable;
+    return kernel;
+}
+
+const char* gearKernelName(GearKernel kernel) {
+    switch (kernel) {
+    case GearKernel::Portable: return "portable";
+    case GearKernel::Avx2: return "avx2";
+    }
+    return "unknown";
+}
+
+ContentChunker::ContentChunker(const ChunkingParams& params, GearKernel kernel)
+    : params(params), kernel(kernel) {
+    // Cut positions below the window would depend on bytes before the chunk
+    this->params.minSize = std::max(params.minSize, kGearWindow);
+    this->params.maxSize = std::max(this->params.maxSize, this->params.minSize);
+    const unsigned bits = log2Floor(params.averageSize);
+    strictMask = topBits(bits + 2);
+    looseMask = topBits(bits > 2 ? bits - 2 : 1);
+    if (kernel == GearKernel::Avx2 && bestGearKernel() != GearKernel::Avx2) this->kernel = GearKernel::Portable;
+}
+
+void ContentChunker::update(const void* data, size_t length, std::vector<ContentChunk>& chunks) {
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    size_t start = 0;
+    if (!tail.empty()) {
+        // The carried chunk ends within maxSize, so no more than that is copied
+        const size_t kept = tail.size();
+        const size_t taken = std::min(length, params.maxSize - kept);
+        tail.insert(tail.end(), bytes, bytes + taken);
+        scan(tail.data(), kept, tail.size());
+        const size_t cut_length = nextCut(0, tail.size(), false);
+        if (cut_length == 0) return;
+        emit(tail.data(), 0, cut_length, chunks);
+        // Cuts inside the carried bytes were settled by the previous call
+        start = cut_length - kept;
+        tail.clear();
+        candidates.clear();
+        nextCandidate = 0;
+    }
+
+    // The rest is chunked in place, a slice at a time so the candidate list
+    // stays short however large the piece is
+    for (size_t scanned = start; scanned < length;) {
+        const size_t end = std::min(length, scanned + kScanSlice);
+        scan(bytes, scanned, end);
+        scanned = end;
+        for (size_t cut_length; (cut_length = nextCut(start, scanned, false)) > 0; start += cut_length) {
+            emit(bytes, start, cut_length, chunks);
+        }
+        candidates.erase(candidates.begin(), candidates.begin() + static_cast<std::ptrdiff_t>(nextCandidate));
+        nextCandidate = 0;
+    }
+    tail.assign(bytes + start, bytes + length);
+    for (GearCandidate& candidate : candidates) candidate.position -= start;
+}
+
+void ContentChunker::finish(std::vector<ContentChunk>& chunks) {
+    for (size_t start = 0, cut_length; (cut_length = nextCut(start, tail.size(), true)) > 0; start += cut_length) {
+        emit(tail.data(), start, cut_length, chunks);
+    }
+    tail.clear();
+    candidates.clear();
+    nextCandidate = 0;
+    offset = 0;
+}
+
+void ContentChunker::scan(const uint8_t* bytes, size_t begin, size_t end) {
+    if (kernel == GearKernel::Avx2) {
+        scanAvx2(bytes, begin, end, looseMask, strictMask, candidates);
+    } else {
+        scanPortable(bytes, begin, end, looseMask, strictMask, candidates);
+    }
+}
+
+// The end of a chunk is the first candidate past minSize that is strict
+// enough for its length, or maxSize; once final, whatever is left is the
+// last chunk.
+size_t ContentChunker::nextCut(size_t start, size_t end, bool final) const {
+    const size_t available = end - start;
+    if (available == 0) return 0;
+    for (size_t c = nextCandidate; c < candidates.size(); ++c) {
+        const size_t candidate_length = candidates[c].position + 1 - start;
+        if (candidate_length < params.minSize) continue;
+        if (candidate_length > params.maxSize) break;
+        if (candidates[c].strict || candidate_length >= params.averageSize) return candidate_length;
+    }
+    if (available >= params.maxSize) return params.maxSize;
+    return final ? available : 0;
+}
+
+void ContentChunker::emit(const uint8_t* bytes, size_t start, size_t length, std::vector<ContentChunk>& chunks) {
+    ContentChunk chunk;
+    chunk.offset = offset;
+    chunk.length = static_cast<uint32_t>(length);
+    chunk.fingerprint = XXH3_64bits(bytes + start, length);
+    chunks.push_back(chunk);
+    offset += length;
+    const size_t end = start + length;
+    while (nextCandidate < candidates.size() && candidates[nextCandidate].position < end) ++nextCandidate;
+}
+
+// Function to split a file into content-defined chunks
+bool chunkFile(const std::filesystem::path& file_path, const ChunkingParams& params,
+               std::vector<ContentChunk>& chunks, ReadBackend backend) {
+    ContentChunker chunker(params);
+    chunks.clear();
+    if (!readFileContents(file_path, backend, [&](const void* data, size_t length) {
+            chunker.update(data, length, chunks);
+            return true;
+        })) {
+        return false;
+    }
+    chunker.finish(chunks);
+    return true;
+}
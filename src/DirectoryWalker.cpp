@@ -0,0 +1,409 @@
+#include "DirectoryWalker.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+// Record layout returned by getdents64; d_reclen bounds the name
+struct LinuxDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+
+constexpr size_t kDirentBufferSize = 64 * 1024;
+
+// A directory modified this close to the walk may change again within the
+// same timestamp tick, so its listing is recorded but never replayed
+constexpr int64_t kRacyWindowNs = 2000000000;
+
+int64_t nowNs() {
+    struct timespec ts;
+    ::clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+FileStat toFileStat(const struct stat& sb) {
+    FileStat st;
+    st.size = static_cast<uintmax_t>(sb.st_size);
+    st.lastModified = static_cast<int64_t>(sb.st_mtim.tv_sec) * 1000000000 + sb.st_mtim.tv_nsec;
+    st.device = static_cast<uint64_t>(sb.st_dev);
+    st.inode = static_cast<uint64_t>(sb.st_ino);
+    return st;
+}
+
+void reportError(const std::filesystem::path& path, int error) {
+    std::cerr << "Cannot read " << path << ": "
+              << std::error_code(error, std::generic_category()).message() << std::endl;
+}
+
+// Each worker owns a deque of directories. It pushes and pops at the back
+// (depth-first, so recently listed directories are still warm) and idle
+// workers steal from the front of other deques, taking the shallowest and
+// usually largest subtrees.
+class Walker {
+public:
+    Walker(unsigned threads, const WalkOptions& options, FileCatalogue& catalogue)
+        : options(options), catalogue(catalogue), found(threads), batchDirectories(threads),
+          batchHasCurrent(threads), listings(threads),
+          racyAfter(nowNs() - kRacyWindowNs) {
+        for (unsigned i = 0; i < threads; ++i) queues.push_back(std::make_unique<Queue>());
+    }
+
+    WalkStats run(const std::vector<std::string>& roots) {
+        for (const auto& root : roots) addRoot(root);
+
+        std::vector<std::thread> workers;
+        for (unsigned i = 1; i < queues.size(); ++i) {
+            workers.emplace_back([this, i] { work(i); });
+        }
+        work(0);
+        for (auto& worker : workers) worker.join();
+
+        for (unsigned i = 0; i < found.size(); ++i) {
+            if (options.onFiles) {
+                handOver(i);
+            } else {
+                catalogue.appendFiles(std::move(found[i]));
+            }
+        }
+
+        WalkStats stats;
+        stats.directories = reached.load(std::memory_order_relaxed);
+        stats.unchanged = unchanged.load(std::memory_order_relaxed);
+        if (options.snapshot) {
+            for (auto& listed : listings) {
+                for (auto& entry : listed) options.snapshot->insert(std::move(entry));
+            }
+        }
+        return stats;
+    }
+
+private:
+    // A directory waiting to be listed: its catalogue id, the path to open
+    // and the device of the root it was reached from
+    struct PendingDirectory {
+        uint32_t id;
+        std::filesystem::path path;
+        uint64_t rootDevice;
+    };
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<PendingDirectory> dirs;
+    };
+
+    void addRoot(const std::string& root) {
+        struct stat sb;
+        if (::stat(root.c_str(), &sb) != 0) {
+            reportError(root, errno);
+        } else if (S_ISDIR(sb.st_mode)) {
+            push(0, {addDirectory(FileCatalogue::kNoDirectory, root), root,
+                     static_cast<uint64_t>(sb.st_dev)});
+        } else if (S_ISREG(sb.st_mode)) {
+            found[0].add(FileCatalogue::kNoDirectory, root, options.statFiles ? toFileStat(sb) : FileStat());
+        }
+    }
+
+    void push(unsigned id, PendingDirectory dir) {
+        pending.fetch_add(1, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(queues[id]->mutex);
+        queues[id]->dirs.push_back(std::move(dir));
+    }
+
+    // Pass a worker's files to the caller once it holds a full batch
+    void handOver(unsigned id) {
+        if (found[id].count() == 0) return;
+        options.onFiles(id, found[id], batchDirectories[id]);
+        found[id] = FileColumns();
+        batchDirectories[id].clear();
+        batchHasCurrent[id] = false;
+    }
+
+    // With onFiles the catalogue stays empty: each batch carries the paths
+    // of its own directories, so the walk holds no table of every directory
+    uint32_t addDirectory(uint32_t parent, std::string_view name) {
+        return options.onFiles ? FileCatalogue::kNoDirectory : catalogue.addDirectory(parent, name);
+    }
+
+    // Directory to file dir's files under: its catalogue id, or with onFiles
+    // its index among the paths of the worker's batch
+    uint32_t fileDirectory(unsigned id, const PendingDirectory& dir) {
+        if (!options.onFiles) return dir.id;
+        if (!batchHasCurrent[id]) {
+            batchDirectories[id].push_back(dir.path.string());
+            batchHasCurrent[id] = true;
+        }
+        return static_cast<uint32_t>(batchDirectories[id].size() - 1);
+    }
+
+    void handOverIfFull(unsigned id) {
+        if (options.onFiles && found[id].count() >= options.batchFiles) handOver(id);
+    }
+
+    bool pop(unsigned id, PendingDirectory& dir) {
+        {
+            Queue& own = *queues[id];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.dirs.empty()) {
+                dir = std::move(own.dirs.back());
+                own.dirs.pop_back();
+                return true;
+            }
+        }
+        for (size_t step = 1; step < queues.size(); ++step) {
+            Queue& victim = *queues[(id + step) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.dirs.empty()) {
+                dir = std::move(victim.dirs.front());
+                victim.dirs.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // pending counts directories queued or being listed; children are pushed
+    // before their parent is retired, so zero means the walk is complete
+    void work(unsigned id) {
+        std::vector<char> buffer(kDirentBufferSize);
+        PendingDirectory dir;
+        unsigned idle = 0;
+        for (;;) {
+            if (pop(id, dir)) {
+                const int64_t start = options.profiler ? options.profiler->now() : 0;
+                listDirectory(id, dir, buffer);
+                if (options.profiler) {
+                    options.profiler->recordBusy("list directory", start,
+                                                 options.profiler->tracing() ? dir.path.string() : std::string());
+                }
+                pending.fetch_sub(1, std::memory_order_acq_rel);
+                idle = 0;
+            } else if (pending.load(std::memory_order_acquire) == 0) {
+                return;
+            } else if (++idle < 64) {
+                std::this_thread::yield();
+            } else {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        }
+    }
+
+    // Queue the children and add the files of a directory unchanged since
+    // the previous snapshot. Returns false when it has to be read instead.
+    // The listing is reused, but a file rewritten in place leaves its
+    // directory's mtime alone, so files are stat'ed again when their
+    // attributes or sizes are needed.
+    bool replayDirectory(unsigned id, const PendingDirectory& dir, const FileStat& st) {
+        auto it = options.previous->find(dir.path.string());
+        if (it == options.previous->end() || !it->second.matches(st)) return false;
+
+        // The snapshot holds the unfiltered listing
+        const DirectorySnapshot& listing = it->second;
+        const WalkFilter* filter = options.filter;
+        const bool restat = options.statFiles || (filter && filter->needsSize());
+        int dir_fd = -1;
+        if (restat && !listing.files.empty()) {
+            dir_fd = ::open(dir.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (dir_fd < 0) return false;
+        }
+        for (const auto& name : listing.subdirectories) {
+            if (filter && !filter->admits(dir.path, name.c_str(), true)) continue;
+            push(id, {addDirectory(dir.id, name), dir.path / name, dir.rootDevice});
+        }
+        DirectorySnapshot refreshed;
+        if (options.snapshot && dir_fd >= 0) {
+            refreshed.lastModified = listing.lastModified;
+            refreshed.device = listing.device;
+            refreshed.inode = listing.inode;
+            refreshed.subdirectories = listing.subdirectories;
+        }
+        const size_t files_before = found[id].count();
+        for (const auto& file : listing.files) {
+            FileStat file_st = file.second;
+            if (dir_fd >= 0) {
+                struct stat sb;
+                const int64_t start = options.profiler ? options.profiler->now() : 0;
+                const int result = ::fstatat(dir_fd, file.first.c_str(), &sb, AT_SYMLINK_NOFOLLOW);
+                if (options.profiler) options.profiler->recordLatency(Operation::Stat, options.profiler->now() - start);
+                if (result != 0) {
+                    // Removed since the directory was last read
+                    if (errno != ENOENT) reportError(dir.path / file.first, errno);
+                    continue;
+                }
+                if (!S_ISREG(sb.st_mode)) continue;
+                file_st = toFileStat(sb);
+                if (options.snapshot) refreshed.files.emplace_back(file.first, options.statFiles ? file_st : FileStat());
+            }
+            if (filter && (!filter->admits(dir.path, file.first.c_str(), false) ||
+                           !filter->admitsSize(file_st.size))) {
+                continue;
+            }
+            found[id].add(fileDirectory(id, dir), file.first, options.statFiles ? file_st : FileStat());
+        }
+        if (dir_fd >= 0) ::close(dir_fd);
+        if (options.metrics) options.metrics->addFiles(found[id].count() - files_before);
+        if (options.snapshot) {
+            if (dir_fd >= 0) listings[id].emplace_back(it->first, std::move(refreshed));
+            else listings[id].emplace_back(it->first, listing);
+        }
+        unchanged.fetch_add(1, std::memory_order_relaxed);
+        handOverIfFull(id);
+        return true;
+    }
+
+    void listDirectory(unsigned id, const PendingDirectory& dir, std::vector<char>& buffer) {
+        reached.fetch_add(1, std::memory_order_relaxed);
+        batchHasCurrent[id] = false;
+        DirectorySnapshot listing;
+        DirectorySnapshot* recording = nullptr;
+        const bool same_device = options.filter && options.filter->oneFileSystem();
+        if (options.previous || options.snapshot || same_device) {
+            struct stat sb;
+            if (::stat(dir.path.c_str(), &sb) != 0) {
+                reportError(dir.path, errno);
+                return;
+            }
+            const FileStat st = toFileStat(sb);
+            // A mount point is left unopened
+            if (same_device && st.device != dir.rootDevice) {
+                options.filter->countOtherDevice();
+                return;
+            }
+            if (options.previous && replayDirectory(id, dir, st)) return;
+            listing.lastModified = st.lastModified < racyAfter ? st.lastModified : INT64_MIN;
+            listing.device = st.device;
+            listing.inode = st.inode;
+            if (options.snapshot) recording = &listing;
+        }
+
+        int fd = ::open(dir.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) {
+            reportError(dir.path, errno);
+            return;
+        }
+        size_t files_before = found[id].count();
+        for (;;) {
+            long n = ::syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                reportError(dir.path, errno);
+                break;
+            }
+            if (n == 0) break;
+            for (long offset = 0; offset < n;) {
+                const auto* entry = reinterpret_cast<const LinuxDirent64*>(buffer.data() + offset);
+                offset += entry->d_reclen;
+                visitEntry(id, fd, dir, entry->d_name, entry->d_type, recording);
+            }
+            // A huge directory is handed over a getdents buffer at a time
+            if (options.onFiles && found[id].count() >= options.batchFiles) {
+                if (options.metrics) options.metrics->addFiles(found[id].count() - files_before);
+                handOver(id);
+                files_before = 0;
+            }
+        }
+        ::close(fd);
+        if (options.metrics) options.metrics->addFiles(found[id].count() - files_before);
+        handOverIfFull(id);
+        if (recording) listings[id].emplace_back(dir.path.string(), std::move(listing));
+    }
+
+    void visitEntry(unsigned id, int dir_fd, const PendingDirectory& dir,
+                    const char* name, unsigned char type, DirectorySnapshot* recording) {
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) return;
+        const WalkFilter* filter = options.filter;
+        if (!filter && std::strchr(name, '$') != nullptr) return;
+        if (type != DT_REG && type != DT_DIR && type != DT_UNKNOWN) return;
+
+        // Name and path rules need only the d_type, so an excluded entry is
+        // dropped before any stat, unless the snapshot records it: the
+        // snapshot keeps unfiltered listings, which replay filters again
+        bool admitted = true;
+        bool tested = false;
+        if (filter && type != DT_UNKNOWN) {
+            admitted = filter->admits(dir.path, name, type == DT_DIR);
+            tested = true;
+            if (!admitted && !recording) return;
+        }
+
+        // Only stat when the filesystem did not report the type, or the
+        // caller wants the attributes or the size bounds need the size
+        struct stat sb;
+        const bool need_stat = type == DT_UNKNOWN ||
+                               (type == DT_REG && (options.statFiles || (filter && filter->needsSize())));
+        if (need_stat) {
+            const int64_t start = options.profiler ? options.profiler->now() : 0;
+            const int result = ::fstatat(dir_fd, name, &sb, AT_SYMLINK_NOFOLLOW);
+            if (options.profiler) options.profiler->recordLatency(Operation::Stat, options.profiler->now() - start);
+            if (result != 0) {
+                reportError(dir.path / name, errno);
+                return;
+            }
+            if (S_ISDIR(sb.st_mode)) type = DT_DIR;
+            else if (S_ISREG(sb.st_mode)) type = DT_REG;
+            else return;
+        }
+
+        const FileStat st = type == DT_REG && options.statFiles ? toFileStat(sb) : FileStat();
+        if (recording) {
+            if (type == DT_DIR) recording->subdirectories.emplace_back(name);
+            else recording->files.emplace_back(name, st);
+        }
+        if (filter) {
+            if (!tested) admitted = filter->admits(dir.path, name, type == DT_DIR);
+            if (!admitted) return;
+            if (type == DT_REG && !filter->admitsSize(static_cast<uintmax_t>(sb.st_size))) return;
+        }
+        if (type == DT_DIR) {
+            push(id, {addDirectory(dir.id, name), dir.path / name, dir.rootDevice});
+        } else {
+            found[id].add(fileDirectory(id, dir), name, st);
+        }
+    }
+
+    const WalkOptions& options;
+    FileCatalogue& catalogue;
+    std::vector<FileColumns> found;  // Files found by each worker, appended when the walk ends
+    std::vector<std::vector<std::string>> batchDirectories;  // Per worker, with onFiles
+    std::vector<char> batchHasCurrent;  // The directory being listed is in the worker's batch
+    std::vector<std::vector<std::pair<std::string, DirectorySnapshot>>> listings;  // Per worker, for the snapshot
+    const int64_t racyAfter;  // Directories modified later are not trusted for replay
+    std::atomic<size_t> reached{0};
+    std::atomic<size_t> unchanged{0};
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::atomic<size_t> pending{0};
+};
+
+} // namespace
+
+unsigned walkerThreadCount(const WalkOptions& options) {
+    if (options.threads > 0) return options.threads;
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Function to walk directory trees in parallel, cataloguing every regular file
+WalkStats walkDirectories(const std::vector<std::string>& roots, const WalkOptions& options,
+                          FileCatalogue& catalogue) {
+    Walker walker(walkerThreadCount(options), options, catalogue);
+    return walker.run(roots);
+}
@@ -1,49 +1,886 @@
 #include "FileUtils.h"
 #include "DuplicateFinder.h"
 #include "ProgressBar.h"
+#include "DirectoryWalker.h"
+#include "FileCatalogue.h"
+#include "Verifier.h"
+#include "IoScheduler.h"
 #include <fstream>
 #include <iostream>
-#include <openssl/evp.h>
+#include <iomanip>
+#include <map>
+#include <sstream>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
 #include <filesystem>
 #include <omp.h>
+#include <sys/resource.h>
+#include <sys/sysmacros.h>
 
-// Function to find duplicate files and return them as a vector of vectors
-std::vector<std::vector<std::filesystem::path>> findDuplicateFiles(
-    const std::vector<std::filesystem::path>& files, ProgressBar& progress) {
+namespace {
 
-    std::unordered_map<std::string, std::vector<std::filesystem::path>> file_hashes;
-    size_t total_files = files.size();
-    size_t processed_files = 0;
+using Index = FileCatalogue::Index;
 
-    // Use OpenMP to parallelize MD5 computation across multiple threads
-    #pragma omp parallel for
-    for (size_t i = 0; i < total_files; ++i) {
-        std::string file_hash = computeFileHash(files[i]);
+// Record a freshly computed full-content digest in the cache, with its
+// chunk digests when it is the root of a tree hash
+void rememberDigest(FileCache& cache, const FileCatalogue& catalogue, Index file, const Digest& digest,
+                    const std::vector<Digest>& chunks = {}, uint64_t chunkBytes = 0) {
+    FileMetadata& metadata = cache[catalogue.pathString(file)];
+    metadata.refresh(catalogue.stat(file));
+    metadata.fileHash = digest;
+    metadata.chunkBytes = chunks.empty() ? 0 : chunkBytes;
+    metadata.chunkHashes = chunks;
+}
+
+// Record a freshly computed head and tail digest in the cache, so a later
+// partial stage can compare the file without reading it
+void rememberPartial(FileCache& cache, const FileCatalogue& catalogue, Index file, const Digest& digest,
+                     uint64_t headBytes, uint64_t tailBytes) {
+    FileMetadata& metadata = cache[catalogue.pathString(file)];
+    metadata.refresh(catalogue.stat(file));
+    metadata.partialHash = digest;
+    metadata.partialHead = headBytes;
+    metadata.partialTail = tailBytes;
+}
+
+// Materialise a group of catalogue entries as sorted paths for the caller
+std::vector<std::filesystem::path> toPaths(const FileCatalogue& catalogue, const std::vector<Index>& group) {
+    std::vector<std::filesystem::path> paths;
+    paths.reserve(group.size());
+    for (Index file : group) paths.push_back(catalogue.path(file));
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+// Replace every run of paths sharing one (device, inode) with its first
+// path, recording runs of two or more in links. Returns the survivors in
+// index order.
+std::vector<Index> collapseHardLinks(const FileCatalogue& catalogue, std::vector<Index> bucket,
+                                     std::vector<std::vector<Index>>& links) {
+    std::stable_sort(bucket.begin(), bucket.end(), [&](Index a, Index b) {
+        const FileStat sa = catalogue.stat(a);
+        const FileStat sb = catalogue.stat(b);
+        return sa.device != sb.device ? sa.device < sb.device : sa.inode < sb.inode;
+    });
+    std::vector<Index> survivors;
+    for (size_t begin = 0; begin < bucket.size();) {
+        const FileStat first = catalogue.stat(bucket[begin]);
+        size_t end = begin + 1;
+        while (first.inode != 0 && end < bucket.size() &&
+               catalogue.stat(bucket[end]).device == first.device &&
+               catalogue.stat(bucket[end]).inode == first.inode) {
+            ++end;
+        }
+        survivors.push_back(bucket[begin]);
+        if (end - begin > 1) links.emplace_back(bucket.begin() + begin, bucket.begin() + end);
+        begin = end;
+    }
+    std::sort(survivors.begin(), survivors.end());
+    return survivors;
+}
+
+// Collapse files of one size bucket whose data sits entirely in the same
+// shared extents: they are already deduplicated, and equal by construction.
+// Sets of two or more are recorded in reflinks. Returns the survivors in
+// bucket order.
+std::vector<Index> collapseReflinks(const FileCatalogue& catalogue, const std::vector<Index>& bucket,
+                                    const std::vector<std::vector<FileExtent>>& extents,
+                                    std::vector<std::vector<Index>>& reflinks) {
+    std::unordered_map<std::string, size_t> set_of;
+    std::vector<std::vector<Index>> sets;
+    std::vector<Index> survivors;
+    for (size_t i = 0; i < bucket.size(); ++i) {
+        if (extents[i].empty()) {
+            survivors.push_back(bucket[i]);
+            continue;
+        }
+        // Key on the device and the raw extent list
+        const uint64_t device = catalogue.stat(bucket[i]).device;
+        std::string key(reinterpret_cast<const char*>(&device), sizeof(device));
+        key.append(reinterpret_cast<const char*>(extents[i].data()), extents[i].size() * sizeof(FileExtent));
+        auto inserted = set_of.emplace(std::move(key), sets.size());
+        if (inserted.second) {
+            sets.emplace_back();
+            survivors.push_back(bucket[i]);
+        }
+        sets[inserted.first->second].push_back(bucket[i]);
+    }
+    for (auto& set : sets) {
+        if (set.size() > 1) reflinks.push_back(std::move(set));
+    }
+    return survivors;
+}
+
+// Hash every candidate not marked in skip through io_uring, storing the
+// results in the catalogue. Returns false when the engine is unavailable, in
+// which case the caller hashes synchronously.
+bool hashWithUring(FileCatalogue& catalogue, const std::vector<Index>& candidates,
+                   const std::vector<char>& skip, const FinderOptions& options, Metrics& metrics) {
+    std::vector<std::filesystem::path> paths;
+    std::vector<Index> files;
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        if (!skip[i]) {
+            paths.push_back(catalogue.path(candidates[i]));
+            files.push_back(candidates[i]);
+        }
+    }
+    std::vector<Digest> digests;
+    if (!computeFileDigestsUring(paths, options.hashAlgorithm, options.uring, digests, &metrics)) {
+        std::cerr << "io_uring unavailable; hashing with the "
+                  << readBackendName(options.readBackend) << " backend" << std::endl;
+        return false;
+    }
+    for (size_t i = 0; i < files.size(); ++i) catalogue.setDigest(files[i], digests[i]);
+    return true;
+}
+
+// Read tasks for the files, by device. Files on a rotational disk are
+// ordered by inode number, which ext4 and XFS allocate near the data, or
+// with physical by where their data starts (one FIEMAP call per file, worth
+// it before whole-file reads) plus the task's offset within the file, if
+// given. The FIEMAP lookups are left to the disk's own pool through locate,
+// so they never delay reads elsewhere. Unscheduled tasks all land on one pool.
+constexpr uint64_t kSharedPool = UINT64_MAX;
 
-        // Thread-safe update of the file_hashes map
-        #pragma omp critical
-        file_hashes[file_hash].push_back(files[i]);
+struct ReadTasks {
+    std::vector<IoTask> tasks;
+    IoLocator locate;  // Empty unless physical
+};
 
-        // Update progress
-        #pragma omp atomic
-        processed_files++;
+ReadTasks ioTasks(const FileCatalogue& catalogue, const std::vector<Index>& files, bool schedule,
+                  bool physical, const std::vector<uint64_t>& within = {}) {
+    ReadTasks reads;
+    reads.tasks.resize(files.size());
+    for (size_t i = 0; i < files.size(); ++i) {
+        reads.tasks[i].item = i;
+        reads.tasks[i].device = schedule ? catalogue.device(files[i]) : kSharedPool;
+        reads.tasks[i].offset = schedule ? catalogue.stat(files[i]).inode : 0;
+    }
+    if (!schedule || !physical) return reads;
 
-        // Update progress bar periodically or asynchronously
-        if (processed_files % 10 == 0) {
-            progress.update(processed_files / static_cast<double>(total_files));
+    // Tasks of one file are consecutive and located in order on one
+    // thread, so each reuses the lookup of the task before it
+    constexpr uint64_t kUnmapped = UINT64_MAX;
+    auto bases = std::make_shared<std::vector<uint64_t>>(files.size(), kUnmapped);
+    const std::vector<uint64_t>* offsets = within.empty() ? nullptr : &within;
+    reads.locate = [&catalogue, &files, offsets, bases](const IoTask& task) {
+        const size_t i = task.item;
+        uint64_t& base = (*bases)[i];
+        if (i > 0 && files[i] == files[i - 1]) {
+            base = (*bases)[i - 1];
+        } else if (!readFirstPhysicalOffset(catalogue.path(files[i]), base)) {
+            base = kUnmapped;
         }
+        if (base == kUnmapped) return task.offset;
+        return base + (offsets ? (*offsets)[i] : 0);
+    };
+    return reads;
+}
+
+// Report a confirmed group to the sink
+void emitGroup(ResultSink& sink, const FileCatalogue& catalogue, const std::vector<Index>& group) {
+    DuplicateGroup result;
+    result.size = catalogue.fileSize(group.front());
+    result.digest = catalogue.digest(group.front());
+    result.files = toPaths(catalogue, group);
+    sink.group(result);
+}
+
+// Files each verifying thread may hold open, from RLIMIT_NOFILE with
+// headroom for the rest of the process
+size_t verifyOpenFileBudget() {
+    struct rlimit limit;
+    size_t available = 1024;
+    if (::getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+        available = static_cast<size_t>(limit.rlim_cur);
     }
+    const size_t threads = static_cast<size_t>(omp_get_max_threads());
+    return std::max<size_t>(2, (available > 64 ? available - 64 : 0) / threads);
+}
+
+// Run every stage over the catalogue. size_stage arrives with filesIn set
+// and any files that could not be stat'ed already counted as eliminated.
+std::vector<std::vector<std::filesystem::path>> runPipeline(
+    FileCatalogue& catalogue, StageStats size_stage, Metrics& metrics,
+    const FinderOptions& options, PipelineStats* stats) {
 
-    // Collect duplicates into a vector of vectors
     std::vector<std::vector<std::filesystem::path>> duplicates;
-    for (const auto& entry : file_hashes) {
-        if (entry.second.size() > 1) {
-            duplicates.push_back(entry.second);
+    Profiler* profiler = options.profiler;
+
+    // Reads are scheduled per device, each device sized once from sysfs;
+    // without scheduleByDevice every file shares one pool of OpenMP's size
+    const unsigned cpu_threads = static_cast<unsigned>(omp_get_max_threads());
+    std::map<uint64_t, DeviceProfile> devices;
+    DeviceProfiler device_profile = [&](uint64_t device) {
+        if (device == kSharedPool) {
+            DeviceProfile shared;
+            shared.workers = cpu_threads;
+            return shared;
+        }
+        auto it = devices.find(device);
+        if (it == devices.end()) it = devices.emplace(device, probeDevice(device, cpu_threads)).first;
+        return it->second;
+    };
+    auto begin_stage = [&](const char* name, uint64_t files, uint64_t bytes) {
+        metrics.beginStage(name, files, bytes);
+        if (profiler) profiler->beginStage(name);
+    };
+
+    // Stage 1: bucket by size. A file whose size is unique cannot have a
+    // duplicate, so it is dropped here without ever being opened. Sorting
+    // 32-bit indices by the size column keeps the buckets contiguous.
+    begin_stage("size", catalogue.size(), 0);
+    std::vector<Index> by_size(catalogue.size());
+    for (size_t i = 0; i < by_size.size(); ++i) by_size[i] = static_cast<Index>(i);
+    std::sort(by_size.begin(), by_size.end(), [&](Index a, Index b) {
+        return catalogue.fileSize(a) != catalogue.fileSize(b) ? catalogue.fileSize(a) < catalogue.fileSize(b)
+                                                               : a < b;
+    });
+
+    // The cache is consulted only for files in a bucket of two or more, but
+    // when pruning every file marks its entry as still in use
+    catalogue.allocateDigests();
+    std::unordered_set<const FileMetadata*> seen;
+    auto lookup = [&](Index file) -> const FileMetadata* {
+        auto it = options.cache->find(catalogue.pathString(file));
+        if (it == options.cache->end()) return nullptr;
+        if (options.pruneCache) seen.insert(&it->second);
+        return &it->second;
+    };
+
+    std::vector<std::vector<Index>> buckets;
+    // Groups with equal full-content hashes. Without a verify stage they are
+    // final and go to the sink as soon as they are found.
+    std::vector<std::vector<Index>> matched;
+    std::mutex matched_mutex;
+    auto confirm = [&](std::vector<Index> group) {
+        const int64_t wait_start = profiler ? profiler->now() : 0;
+        std::lock_guard<std::mutex> lock(matched_mutex);
+        if (profiler) profiler->recordLatency(Operation::LockWait, profiler->now() - wait_start);
+        if (options.sink && !options.verify) emitGroup(*options.sink, catalogue, group);
+        matched.push_back(std::move(group));
+    };
+    std::vector<std::vector<Index>> hard_links;
+    size_t cache_hits = 0;
+    // Digest of the first chunk of tree-hashed files, from the cache or the
+    // partial stage; the full hash does not read those chunks again
+    std::unordered_map<Index, Digest> first_chunks;
+    // Head and tail digests of files that are not tree-hashed, from the
+    // cache or the partial stage
+    std::unordered_map<Index, Digest> partials;
+    for (size_t begin = 0; begin < by_size.size();) {
+        const uintmax_t size = catalogue.fileSize(by_size[begin]);
+        size_t end = begin + 1;
+        while (end < by_size.size() && catalogue.fileSize(by_size[end]) == size) ++end;
+        std::vector<Index> bucket(by_size.begin() + begin, by_size.begin() + end);
+        metrics.addFiles(end - begin);
+        begin = end;
+
+        // Paths to one inode are the same file, not duplicates of it; the
+        // further links are never read, so the size stage eliminates them
+        if (options.collapseLinks && bucket.size() > 1) {
+            const size_t paths = bucket.size();
+            bucket = collapseHardLinks(catalogue, std::move(bucket), hard_links);
+            const size_t links = paths - bucket.size();
+            size_stage.filesEliminated += links;
+            size_stage.bytesEliminated += links * size;
+            size_stage.bytesAvoided += links * size;
+        }
+
+        if (bucket.size() < 2) {
+            size_stage.filesEliminated++;
+            size_stage.bytesEliminated += size;
+            size_stage.bytesAvoided += size;
+            if (options.cache && options.pruneCache) lookup(bucket.front());
+        } else if (size == 0) {
+            // Empty files are trivially identical; no need to hash them
+            if (options.cache && options.pruneCache) {
+                for (Index file : bucket) lookup(file);
+            }
+            const Digest empty_digest = createHasher(options.hashAlgorithm)->finish();
+            for (Index file : bucket) catalogue.setDigest(file, empty_digest);
+            confirm(std::move(bucket));
+        } else {
+            if (options.cache) {
+                // A cached digest only compares with ours if it was hashed the same way
+                const uint64_t chunks = treeChunkCount(size, options.treeChunkBytes);
+                const uint64_t chunk_bytes = chunks ? options.treeChunkBytes : 0;
+                for (Index file : bucket) {
+                    const FileMetadata* metadata = lookup(file);
+                    if (!metadata || !metadata->matches(catalogue.stat(file))) continue;
+                    if (!metadata->fileHash.empty() && metadata->chunkBytes == chunk_bytes &&
+                        metadata->chunkHashes.size() == chunks) {
+                        catalogue.setDigest(file, metadata->fileHash);
+                        if (chunks) first_chunks[file] = metadata->chunkHashes.front();
+                        cache_hits++;
+                    }
+                    if (!chunks && !metadata->partialHash.empty() && metadata->partialHead == options.headBlockSize &&
+                        metadata->partialTail == options.tailBlockSize) {
+                        partials[file] = metadata->partialHash;
+                    }
+                }
+            }
+            buckets.push_back(std::move(bucket));
+        }
+    }
+    std::vector<Index>().swap(by_size);
+
+    // Forget cached digests of files that are no longer part of the scan
+    if (options.cache && options.pruneCache) {
+        for (auto it = options.cache->begin(); it != options.cache->end();) {
+            it = seen.count(&it->second) ? std::next(it) : options.cache->erase(it);
+        }
+    }
+
+    // Stage 2: hash a small head (and tail) block of each candidate and split
+    // the size buckets on it. Most same-size files already differ here.
+    // Files whose head and tail digest is cached are not read, so touching
+    // one file of a large bucket reads only the blocks of that file. Buckets
+    // whose every file has a cached full digest skip the stage. Buckets of
+    // tree-hashed files holding cached ones are split on their first chunk
+    // instead, which the cache keeps and the full hash reuses.
+    StageStats partial_stage{"partial hash"};
+    if (options.partialHash) {
+        auto has_cached = [&](const std::vector<Index>& bucket) {
+            return std::any_of(bucket.begin(), bucket.end(),
+                               [&](Index file) { return !catalogue.digest(file).empty(); });
+        };
+        auto all_cached = [&](const std::vector<Index>& bucket) {
+            return std::all_of(bucket.begin(), bucket.end(),
+                               [&](Index file) { return !catalogue.digest(file).empty(); });
+        };
+
+        std::vector<std::vector<Index>> survivors;
+        std::vector<std::vector<Index>> sampled;
+        std::vector<std::vector<Index>> chunked;
+        for (auto& bucket : buckets) {
+            if (treeChunkCount(catalogue.fileSize(bucket.front()), options.treeChunkBytes) && has_cached(bucket)) {
+                chunked.push_back(std::move(bucket));
+            } else if (all_cached(bucket)) {
+                survivors.push_back(std::move(bucket));
+            } else {
+                sampled.push_back(std::move(bucket));
+            }
+        }
+
+        std::vector<Index> candidates;
+        for (const auto& bucket : sampled) {
+            for (Index file : bucket) {
+                if (!partials.count(file)) candidates.push_back(file);
+            }
+            partial_stage.filesIn += bucket.size();
+        }
+        std::vector<Index> chunk_candidates;
+        for (const auto& bucket : chunked) {
+            for (Index file : bucket) {
+                if (catalogue.digest(file).empty()) chunk_candidates.push_back(file);
+            }
+            partial_stage.filesIn += bucket.size();
+        }
+
+        const uintmax_t block_bytes = static_cast<uintmax_t>(options.headBlockSize) + options.tailBlockSize;
+        uintmax_t block_total = 0;
+        for (Index file : candidates) block_total += std::min(catalogue.fileSize(file), block_bytes);
+        block_total += chunk_candidates.size() * options.treeChunkBytes;
+        begin_stage("partial hash", candidates.size() + chunk_candidates.size(), block_total);
+
+        std::vector<Digest> partial_hashes(candidates.size());
+        runIoTasks(ioTasks(catalogue, candidates, options.scheduleByDevice, false).tasks, device_profile, [&](size_t i) {
+            const int64_t start = profiler ? profiler->now() : 0;
+            const std::filesystem::path path = catalogue.path(candidates[i]);
+            const uintmax_t bytes = std::min(catalogue.fileSize(candidates[i]), block_bytes);
+            partial_hashes[i] = computePartialDigest(path, catalogue.fileSize(candidates[i]),
+                                                     options.headBlockSize, options.tailBlockSize,
+                                                     options.hashAlgorithm);
+            metrics.addFiles(1);
+            metrics.addBytes(bytes);
+            if (profiler) {
+                profiler->recordDeviceBytes(catalogue.device(candidates[i]), bytes);
+                profiler->recordBusy("partial hash", start, profiler->tracing() ? path.string() : std::string());
+            }
+        }, cpu_threads);
+
+        std::vector<Digest> chunk_hashes(chunk_candidates.size());
+        ReadTasks chunk_reads = ioTasks(catalogue, chunk_candidates, options.scheduleByDevice, true);
+        runIoTasks(std::move(chunk_reads.tasks), device_profile, [&](size_t i) {
+            const int64_t start = profiler ? profiler->now() : 0;
+            const std::filesystem::path path = catalogue.path(chunk_candidates[i]);
+            chunk_hashes[i] = computeChunkDigest(path, options.hashAlgorithm, 0, options.treeChunkBytes,
+                                                 options.readBackend);
+            metrics.addFiles(1);
+            metrics.addBytes(options.treeChunkBytes);
+            if (profiler) {
+                profiler->recordDeviceBytes(catalogue.device(chunk_candidates[i]), options.treeChunkBytes);
+                profiler->recordBusy("partial hash", start, profiler->tracing() ? path.string() : std::string());
+            }
+        }, cpu_threads, chunk_reads.locate);
+        for (size_t i = 0; i < chunk_candidates.size(); ++i) {
+            if (!chunk_hashes[i].empty()) first_chunks[chunk_candidates[i]] = chunk_hashes[i];
+        }
+
+        for (auto& bucket : chunked) {
+            const uintmax_t size = catalogue.fileSize(bucket.front());
+            std::unordered_map<Digest, std::vector<Index>, DigestHash> split;
+            for (Index file : bucket) {
+                const bool read = catalogue.digest(file).empty();
+                if (read) partial_stage.bytesRead += options.treeChunkBytes;
+                auto it = first_chunks.find(file);
+                if (it == first_chunks.end()) {
+                    partial_stage.filesEliminated++;
+                    partial_stage.bytesEliminated += size;
+                    continue;
+                }
+                split[it->second].push_back(file);
+            }
+            for (auto& entry : split) {
+                if (entry.second.size() > 1) {
+                    survivors.push_back(std::move(entry.second));
+                    continue;
+                }
+                const bool read = catalogue.digest(entry.second.front()).empty();
+                partial_stage.filesEliminated++;
+                partial_stage.bytesEliminated += size;
+                partial_stage.bytesAvoided += size - (read ? options.treeChunkBytes : 0);
+            }
+        }
+
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            if (partial_hashes[i].empty()) continue;
+            const Index file = candidates[i];
+            partials[file] = partial_hashes[i];
+            if (!options.cache) continue;
+            rememberPartial(*options.cache, catalogue, file, partial_hashes[i], options.headBlockSize,
+                            options.tailBlockSize);
+            // Blocks covering the whole file read it in order, so the
+            // partial digest equals the full digest and can be cached
+            if (catalogue.fileSize(file) <= block_bytes) {
+                rememberDigest(*options.cache, catalogue, file, partial_hashes[i]);
+            }
+        }
+        const std::unordered_set<Index> sampled_reads(candidates.begin(), candidates.end());
+
+        for (const auto& bucket : sampled) {
+            const uintmax_t size = catalogue.fileSize(bucket.front());
+            const uintmax_t bytes_per_file = std::min(size, block_bytes);
+            std::unordered_map<Digest, std::vector<Index>, DigestHash> split;
+            for (Index file : bucket) {
+                if (sampled_reads.count(file)) partial_stage.bytesRead += bytes_per_file;
+                auto it = partials.find(file);
+                if (it == partials.end()) {
+                    partial_stage.filesEliminated++;
+                    partial_stage.bytesEliminated += size;
+                    continue;
+                }
+                split[it->second].push_back(file);
+            }
+
+            for (auto& entry : split) {
+                if (entry.second.size() < 2) {
+                    const bool read = sampled_reads.count(entry.second.front()) > 0;
+                    partial_stage.filesEliminated++;
+                    partial_stage.bytesEliminated += size;
+                    partial_stage.bytesAvoided += size - (read ? bytes_per_file : 0);
+                } else if (size <= block_bytes) {
+                    // The blocks covered the whole file, so the hash covers all of it
+                    for (Index file : entry.second) catalogue.setDigest(file, entry.first);
+                    confirm(std::move(entry.second));
+                } else {
+                    survivors.push_back(std::move(entry.second));
+                }
+            }
+        }
+        buckets = std::move(survivors);
+    }
+
+    // Stage 3: full-content hash of the files that survived the prefilters.
+    // Files already sharing every extent are equal without being read, so
+    // each reflinked set is hashed through one member.
+    std::vector<std::vector<Index>> reflinks;
+    StageStats hash_stage{"full hash"};
+    if (options.collapseLinks) {
+        std::vector<Index> members;
+        for (const auto& bucket : buckets) members.insert(members.end(), bucket.begin(), bucket.end());
+        begin_stage("extent map", members.size(), 0);
+        std::vector<std::vector<FileExtent>> extents(members.size());
+        #pragma omp parallel for schedule(dynamic, 16)
+        for (size_t i = 0; i < members.size(); ++i) {
+            const int64_t start = profiler ? profiler->now() : 0;
+            readSharedExtents(catalogue.path(members[i]), extents[i]);
+            metrics.addFiles(1);
+            if (profiler) profiler->recordBusy("extent map", start);
         }
+
+        size_t next = 0;
+        std::vector<std::vector<Index>> survivors;
+        for (auto& bucket : buckets) {
+            std::vector<std::vector<FileExtent>> bucket_extents(extents.begin() + next,
+                                                                 extents.begin() + next + bucket.size());
+            next += bucket.size();
+            std::vector<Index> kept = collapseReflinks(catalogue, bucket, bucket_extents, reflinks);
+            if (kept.size() > 1) {
+                survivors.push_back(std::move(kept));
+            } else {
+                // Every copy shares one set of extents; nothing left to compare
+                hash_stage.filesEliminated++;
+                hash_stage.bytesEliminated += catalogue.fileSize(kept.front());
+                hash_stage.bytesAvoided += catalogue.fileSize(kept.front());
+            }
+        }
+        buckets = std::move(survivors);
+    }
+
+    // Candidates stay in bucket order. Each bucket is grouped by whichever
+    // thread hashes its last member, so groups are confirmed (and streamed)
+    // while other buckets are still being read.
+    std::vector<Index> candidates;
+    std::vector<uint32_t> bucket_of;
+    std::vector<size_t> bucket_begin;
+    for (const auto& bucket : buckets) {
+        bucket_of.insert(bucket_of.end(), bucket.size(), static_cast<uint32_t>(bucket_begin.size()));
+        bucket_begin.push_back(candidates.size());
+        candidates.insert(candidates.end(), bucket.begin(), bucket.end());
+    }
+    bucket_begin.push_back(candidates.size());
+    std::vector<std::atomic<size_t>> remaining(buckets.size());
+    for (size_t b = 0; b < buckets.size(); ++b) remaining[b].store(buckets[b].size(), std::memory_order_relaxed);
+    std::vector<std::vector<Index>>().swap(buckets);
+
+    hash_stage.filesIn += candidates.size();
+
+    size_t total_files = candidates.size();
+    std::vector<char> cached(total_files);
+    for (size_t i = 0; i < total_files; ++i) cached[i] = !catalogue.digest(candidates[i]).empty();
+
+    // Files larger than a chunk are hashed as trees. Every chunk still to be
+    // read is a task of its own, so the chunks of one huge file are spread
+    // over the device's workers; the task finishing a file's last chunk
+    // folds its root digest. Other files are one task each.
+    std::vector<std::vector<Digest>> chunk_digests(total_files);
+    std::vector<char> skip_uring(total_files);
+    std::vector<std::atomic<uint64_t>> pieces_left(total_files);
+    std::vector<size_t> piece_file;    // Candidate position of each task
+    std::vector<Index> piece_index;    // Catalogue index of each task's file
+    std::vector<uint64_t> piece_chunk;
+    std::vector<uint64_t> piece_offset;
+    auto add_piece = [&](size_t i, uint64_t chunk) {
+        piece_file.push_back(i);
+        piece_index.push_back(candidates[i]);
+        piece_chunk.push_back(chunk);
+        piece_offset.push_back(chunk * options.treeChunkBytes);
+        pieces_left[i].fetch_add(1, std::memory_order_relaxed);
+    };
+    uintmax_t bytes_to_read = 0;
+    for (size_t i = 0; i < total_files; ++i) {
+        const uintmax_t size = catalogue.fileSize(candidates[i]);
+        const uint64_t chunks = cached[i] ? 0 : treeChunkCount(size, options.treeChunkBytes);
+        skip_uring[i] = cached[i] || chunks > 0;
+        if (chunks == 0) {
+            if (!cached[i]) bytes_to_read += size;
+            add_piece(i, 0);
+            continue;
+        }
+        chunk_digests[i].resize(chunks);
+        auto known = first_chunks.find(candidates[i]);
+        if (known != first_chunks.end()) chunk_digests[i][0] = known->second;
+        for (uint64_t chunk = known != first_chunks.end() ? 1 : 0; chunk < chunks; ++chunk) {
+            bytes_to_read += std::min<uintmax_t>(options.treeChunkBytes, size - chunk * options.treeChunkBytes);
+            add_piece(i, chunk);
+        }
+    }
+    begin_stage("full hash", total_files, bytes_to_read);
+
+    // The io_uring engine reads every flat file up front and counts each file
+    // as it finishes; the loop below then only tallies what it read
+    const int64_t uring_start = profiler ? profiler->now() : 0;
+    const bool use_uring = options.ioUring && hashWithUring(catalogue, candidates, skip_uring, options, metrics);
+    if (profiler && use_uring) profiler->recordBusy("io_uring", uring_start);
+
+    // Hash on each device's worker pool. Each task writes only its own
+    // file's digest or chunk digest, so no lock is needed until a finished
+    // bucket hands over its groups.
+    std::atomic<uintmax_t> bytes_read{0};
+    std::atomic<size_t> hash_eliminated{0};
+    std::atomic<uintmax_t> hash_bytes_eliminated{0};
+    ReadTasks piece_reads = ioTasks(catalogue, piece_index, options.scheduleByDevice && !use_uring, true,
+                                    piece_offset);
+    runIoTasks(std::move(piece_reads.tasks), device_profile, [&](size_t p) {
+        const size_t i = piece_file[p];
+        const Index file = candidates[i];
+        const int64_t start = profiler ? profiler->now() : 0;
+        const bool tree = !chunk_digests[i].empty();
+        if (!cached[i] && (tree || !use_uring)) {
+            ReadTimings timings;
+            uintmax_t bytes = catalogue.fileSize(file);
+            if (tree) {
+                const uint64_t chunk = piece_chunk[p];
+                chunk_digests[i][chunk] = computeChunkDigest(catalogue.path(file), options.hashAlgorithm, chunk,
+                                                             options.treeChunkBytes, options.readBackend,
+                                                             profiler ? &timings : nullptr);
+                bytes = std::min<uintmax_t>(options.treeChunkBytes, bytes - piece_offset[p]);
+            } else {
+                catalogue.setDigest(file, computeFileDigest(catalogue.path(file), options.hashAlgorithm,
+                                                            options.readBackend, profiler ? &timings : nullptr));
+            }
+            metrics.addBytes(bytes);
+            bytes_read += bytes;
+            if (profiler) {
+                profiler->recordFile(timings);
+                profiler->recordDeviceBytes(catalogue.device(file), bytes);
+            }
+        } else if (!cached[i]) {
+            bytes_read += catalogue.fileSize(file);
+            if (profiler) profiler->recordDeviceBytes(catalogue.device(file), catalogue.fileSize(file));
+        }
+
+        // The release/acquire pairs make every chunk digest visible to the
+        // task finishing the file, and every member's digest to the task
+        // finishing the bucket
+        if (pieces_left[i].fetch_sub(1, std::memory_order_acq_rel) != 1) {
+            if (profiler) profiler->recordBusy("full hash", start);
+            return;
+        }
+        if (tree) {
+            catalogue.setDigest(file, combineChunkDigests(options.hashAlgorithm, catalogue.fileSize(file),
+                                                          options.treeChunkBytes, chunk_digests[i]));
+        }
+        if (!use_uring || cached[i] || tree) metrics.addFiles(1);
+
+        const uint32_t bucket = bucket_of[i];
+        if (remaining[bucket].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            const uintmax_t size = catalogue.fileSize(file);  // Shared by the whole bucket
+            std::unordered_map<Digest, std::vector<Index>, DigestHash> split;
+            for (size_t j = bucket_begin[bucket]; j < bucket_begin[bucket + 1]; ++j) {
+                const Digest& digest = catalogue.digest(candidates[j]);
+                if (digest.empty()) {
+                    hash_eliminated++;
+                    hash_bytes_eliminated += size;
+                } else {
+                    split[digest].push_back(candidates[j]);
+                }
+            }
+            for (auto& entry : split) {
+                if (entry.second.size() > 1) {
+                    confirm(std::move(entry.second));
+                } else {
+                    hash_eliminated++;
+                    hash_bytes_eliminated += size;
+                }
+            }
+        }
+        if (profiler && (!use_uring || tree)) {
+            profiler->recordBusy("full hash", start, profiler->tracing() ? catalogue.pathString(file) : std::string());
+        }
+    }, cpu_threads, piece_reads.locate);
+    hash_stage.bytesRead += bytes_read;
+    hash_stage.filesEliminated += hash_eliminated;
+    hash_stage.bytesEliminated += hash_bytes_eliminated;
+
+    if (options.cache) {
+        for (size_t i = 0; i < total_files; ++i) {
+            const Index file = candidates[i];
+            if (!cached[i] && !catalogue.digest(file).empty()) {
+                rememberDigest(*options.cache, catalogue, file, catalogue.digest(file), chunk_digests[i],
+                               options.treeChunkBytes);
+            }
+        }
+    }
+
+    // Stage 4 (optional): compare every matched group byte for byte, so a
+    // hash collision can never be reported as a duplicate
+    StageStats verify_stage{"verify"};
+    if (options.verify) {
+        const size_t open_budget = verifyOpenFileBudget();
+        size_t verify_files = 0;
+        uintmax_t verify_bytes = 0;
+        for (const auto& group : matched) {
+            verify_files += group.size();
+            verify_bytes += group.size() * catalogue.fileSize(group.front());
+        }
+        begin_stage("verify", verify_files, verify_bytes);
+        std::vector<std::vector<std::vector<Index>>> verified(matched.size());
+        size_t files_in = 0;
+        size_t files_eliminated = 0;
+        uintmax_t bytes_eliminated = 0;
+        uintmax_t verify_read = 0;
+        #pragma omp parallel for schedule(dynamic) \
+            reduction(+ : files_in, files_eliminated, bytes_eliminated, verify_read)
+        for (size_t g = 0; g < matched.size(); ++g) {
+            const std::vector<Index>& group = matched[g];
+            const int64_t start = profiler ? profiler->now() : 0;
+            const uintmax_t size = catalogue.fileSize(group.front());
+            std::vector<std::filesystem::path> paths;
+            for (Index file : group) paths.push_back(catalogue.path(file));
+
+            VerifyResult result = verifyIdenticalFiles(paths, size, open_budget);
+            size_t kept = 0;
+            for (const auto& positions : result.groups) {
+                std::vector<Index> same;
+                for (size_t position : positions) same.push_back(group[position]);
+                kept += same.size();
+                if (options.sink) {
+                    std::lock_guard<std::mutex> lock(matched_mutex);
+                    emitGroup(*options.sink, catalogue, same);
+                }
+                verified[g].push_back(std::move(same));
+            }
+            metrics.addFiles(group.size());
+            metrics.addBytes(result.bytesRead);
+            if (profiler) {
+                profiler->recordDeviceBytes(catalogue.device(group.front()), result.bytesRead);
+                profiler->recordBusy("verify", start, profiler->tracing() ? paths.front().string() : std::string());
+            }
+            files_in += group.size();
+            files_eliminated += group.size() - kept;
+            bytes_eliminated += (group.size() - kept) * size;
+            verify_read += result.bytesRead;
+        }
+        verify_stage.filesIn = files_in;
+        verify_stage.filesEliminated = files_eliminated;
+        verify_stage.bytesEliminated = bytes_eliminated;
+        verify_stage.bytesRead = verify_read;
+
+        matched.clear();
+        for (auto& groups : verified) {
+            for (auto& group : groups) matched.push_back(std::move(group));
+        }
+    }
+    for (const auto& group : matched) duplicates.push_back(toPaths(catalogue, group));
+    std::sort(duplicates.begin(), duplicates.end());
+    if (options.sink) options.sink->finish();
+    if (profiler) profiler->endStage();
+
+    if (stats) {
+        for (const auto& entry : devices) stats->devices.emplace_back(entry.first, entry.second);
+        stats->stages.push_back(size_stage);
+        if (options.partialHash) stats->stages.push_back(partial_stage);
+        stats->stages.push_back(hash_stage);
+        if (options.verify) stats->stages.push_back(verify_stage);
+        stats->cacheHits += cache_hits;
+        for (const auto& set : hard_links) stats->hardLinks.push_back(toPaths(catalogue, set));
+        for (const auto& set : reflinks) stats->reflinks.push_back(toPaths(catalogue, set));
     }
 
     return duplicates;
 }
 
+} // namespace
+
+std::vector<std::vector<std::filesystem::path>> findDuplicateFiles(
+    const std::vector<std::filesystem::path>& files, ProgressBar& progress,
+    PipelineStats* stats) {
+    return findDuplicateFiles(files, progress.metrics(), FinderOptions(), stats);
+}
+
+std::vector<std::vector<std::filesystem::path>> findDuplicateFiles(
+    const std::vector<std::filesystem::path>& files, ProgressBar& progress,
+    const FinderOptions& options, PipelineStats* stats) {
+    return findDuplicateFiles(files, progress.metrics(), options, stats);
+}
+
+// Function to find duplicate files and return them as a vector of vectors
+std::vector<std::vector<std::filesystem::path>> findDuplicateFiles(
+    const std::vector<std::filesystem::path>& files, Metrics& metrics,
+    const FinderOptions& options, PipelineStats* stats) {
+
+    StageStats size_stage{"size"};
+    size_stage.filesIn = files.size();
+    if (options.profiler) options.profiler->beginStage("stat");
+
+    // Catalogue the files, interning each parent directory once. This is
+    // the only stat() of a file; its result also validates the cache.
+    FileCatalogue catalogue;
+    std::unordered_map<std::string, uint32_t> directories;
+    for (const auto& file : files) {
+        std::error_code ec;
+        FileStat st;
+        const int64_t start = options.profiler ? options.profiler->now() : 0;
+        const bool found = statFile(file, st, ec);
+        if (options.profiler) options.profiler->recordLatency(Operation::Stat, options.profiler->now() - start);
+        if (!found) {
+            std::cerr << "Cannot stat " << file << ": " << ec.message() << std::endl;
+            size_stage.filesEliminated++;
+            continue;
+        }
+        uint32_t directory = FileCatalogue::kNoDirectory;
+        if (file.has_parent_path()) {
+            auto inserted = directories.emplace(file.parent_path().string(), 0);
+            if (inserted.second) {
+                inserted.first->second = catalogue.addDirectory(FileCatalogue::kNoDirectory, inserted.first->first);
+            }
+            directory = inserted.first->second;
+        }
+        catalogue.addFile(directory, file.filename().string(), st);
+    }
+
+    return runPipeline(catalogue, size_stage, metrics, options, stats);
+}
+
+std::vector<std::vector<std::filesystem::path>> findDuplicatesInDirectories(
+    const std::vector<std::string>& directories, ProgressBar& progress,
+    const FinderOptions& options, PipelineStats* stats) {
+    return findDuplicatesInDirectories(directories, progress.metrics(), options, stats);
+}
+
+// Function to walk directories and find duplicates among the files found
+std::vector<std::vector<std::filesystem::path>> findDuplicatesInDirectories(
+    const std::vector<std::string>& directories, Metrics& metrics,
+    const FinderOptions& options, PipelineStats* stats) {
+
+    // Stage 1 starts inside the walker: each thread stats what it finds into
+    // its own catalogue columns, merged once the walk completes
+    FileCatalogue catalogue;
+    WalkOptions walk = options.walk;
+    walk.statFiles = true;
+    walk.metrics = &metrics;
+    walk.profiler = options.profiler;
+    metrics.beginStage("walk", 0, 0);
+    if (options.profiler) options.profiler->beginStage("walk");
+    WalkStats walk_stats = walkDirectories(directories, walk, catalogue);
+    if (stats) stats->walk = walk_stats;
+
+    StageStats size_stage{"size"};
+    size_stage.filesIn = catalogue.size();
+    return runPipeline(catalogue, size_stage, metrics, options, stats);
+}
+
+// Function to print how many files and bytes each pipeline stage eliminated
+void printPipelineStats(const PipelineStats& stats, std::ostream& out) {
+    out << "Pipeline stages:\n";
+    for (const auto& stage : stats.stages) {
+        out << "  " << std::left << std::setw(14) << stage.name << std::right
+            << stage.filesIn << " files in, "
+            << stage.filesEliminated << " eliminated ("
+            << formatBytes(stage.bytesEliminated) << "), read "
+            << formatBytes(stage.bytesRead) << ", avoided "
+            << formatBytes(stage.bytesAvoided) << "\n";
+    }
+    if (stats.cacheHits > 0) {
+        out << "  Digest cache hits: " << stats.cacheHits << "\n";
+    }
+    if (stats.hardLinksSkipped > 0) {
+        out << "  Hard links skipped: " << stats.hardLinksSkipped << "\n";
+    }
+    if (stats.spillRuns > 0) {
+        out << "  Spilled " << stats.spillRuns << " sorted runs (" << formatBytes(stats.spillBytes) << " written, "
+            << stats.mergePasses << " intermediate merges)\n";
+    }
+    if (stats.walk.unchanged > 0) {
+        out << "  Directories unchanged since the snapshot: " << stats.walk.unchanged
+            << " of " << stats.walk.directories << "\n";
+    }
+    for (const auto& entry : stats.devices) {
+        const DeviceProfile& device = entry.second;
+        out << "  Device " << major(entry.first) << ":" << minor(entry.first);
+        if (device.known) {
+            out << " " << device.name << ": " << (device.rotational ? "rotational" : "solid state")
+                << ", queue depth " << device.queueDepth;
+        } else {
+            out << ": no block queue";
+        }
+        out << ", " << device.workers << (device.workers == 1 ? " reader" : " readers") << "\n";
+    }
+}
@@ -0,0 +1,156 @@
+#include "DuplicateIndex.h"
+#include <algorithm>
+#include <mutex>
+
+DuplicateIndex::DuplicateIndex(const FinderOptions& options, Metrics& metrics)
+    : options(options), metrics(metrics) {
+    // The index owns the cache so unchanged bucket members are never rehashed
+    this->options.cache = &cache;
+    this->options.pruneCache = false;
+    this->options.sink = nullptr;
+}
+
+// Function to scan the roots and install the first set of groups
+std::vector<std::string> DuplicateIndex::build(const std::vector<std::string>& roots) {
+    TreeSnapshot tree;
+    FinderOptions scan = options;
+    scan.walk.snapshot = &tree;
+
+    PipelineStats stats;
+    auto duplicates = findDuplicatesInDirectories(roots, metrics, scan, &stats);
+
+    std::vector<std::string> directories;
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    sizeOf.clear();
+    bucketOf.clear();
+    groupOf.clear();
+    for (const auto& entry : tree) {
+        directories.push_back(entry.first);
+        for (const auto& file : entry.second.files) {
+            // The snapshot lists every file; index only those the walk kept
+            if (!admits(entry.first, file.first, file.second.size)) continue;
+            std::string path = (std::filesystem::path(entry.first) / file.first).string();
+            bucketOf[file.second.size].push_back(path);
+            sizeOf.emplace(std::move(path), file.second.size);
+        }
+    }
+    lock.unlock();
+
+    installGroups(duplicates, stats.hardLinks, {});
+    return directories;
+}
+
+// Function to apply a batch of created, modified and removed paths
+void DuplicateIndex::update(const std::vector<std::string>& touched) {
+    std::vector<uintmax_t> sizes;
+    std::vector<std::string> removed;
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        for (const auto& path : touched) {
+            auto it = sizeOf.find(path);
+            if (it != sizeOf.end()) {
+                auto& bucket = bucketOf[it->second];
+                bucket.erase(std::remove(bucket.begin(), bucket.end(), path), bucket.end());
+                if (bucket.empty()) bucketOf.erase(it->second);
+                sizes.push_back(it->second);
+                sizeOf.erase(it);
+            }
+
+            // Symbolic links and filtered files are not indexed, as in the walk
+            std::error_code ec;
+            FileStat st;
+            const std::filesystem::path file(path);
+            if (std::filesystem::is_regular_file(std::filesystem::symlink_status(path, ec)) &&
+                statFile(path, st, ec) && admits(file.parent_path(), file.filename().string(), st.size)) {
+                sizeOf.emplace(path, st.size);
+                bucketOf[st.size].push_back(path);
+                sizes.push_back(st.size);
+            } else {
+                cache.erase(path);
+                removed.push_back(path);
+            }
+        }
+    }
+
+    std::sort(sizes.begin(), sizes.end());
+    sizes.erase(std::unique(sizes.begin(), sizes.end()), sizes.end());
+
+    // Only this thread changes the buckets, so they can be read unlocked
+    std::vector<std::string> members = removed;
+    std::vector<std::filesystem::path> candidates;
+    for (uintmax_t size : sizes) {
+        auto it = bucketOf.find(size);
+        if (it == bucketOf.end()) continue;
+        members.insert(members.end(), it->second.begin(), it->second.end());
+        if (it->second.size() > 1) candidates.insert(candidates.end(), it->second.begin(), it->second.end());
+    }
+
+    std::vector<std::vector<std::filesystem::path>> duplicates;
+    PipelineStats stats;
+    if (!candidates.empty()) duplicates = findDuplicateFiles(candidates, metrics, options, &stats);
+    installGroups(duplicates, stats.hardLinks, members);
+}
+
+bool DuplicateIndex::admits(const std::filesystem::path& directory, const std::string& name, uintmax_t size) const {
+    const WalkFilter* filter = options.walk.filter;
+    return !filter || (filter->admits(directory, name.c_str(), false) && filter->admitsSize(size));
+}
+
+// Function to replace the groups of the given members with fresh results
+void DuplicateIndex::installGroups(const std::vector<std::vector<std::filesystem::path>>& duplicates,
+                                   const std::vector<std::vector<std::filesystem::path>>& hard_links,
+                                   const std::vector<std::string>& members) {
+    std::vector<Group> groups;
+    for (const auto& duplicate : duplicates) {
+        auto group = std::make_shared<std::vector<std::string>>();
+        for (const auto& file : duplicate) group->push_back(file.string());
+        groups.push_back(std::move(group));
+    }
+
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    for (const auto& member : members) groupOf.erase(member);
+    for (const auto& group : groups) {
+        for (const auto& file : *group) groupOf[file] = group;
+    }
+    // Other names of a grouped inode answer with that inode's group
+    for (const auto& links : hard_links) {
+        Group group;
+        for (const auto& file : links) {
+            auto it = groupOf.find(file.string());
+            if (it != groupOf.end()) group = it->second;
+        }
+        if (!group) continue;
+        for (const auto& file : links) groupOf.emplace(file.string(), group);
+    }
+}
+
+// Function to list the indexed files with the same content as a file
+bool DuplicateIndex::duplicatesOf(const std::string& file, std::vector<std::string>& others) const {
+    others.clear();
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    if (sizeOf.find(file) == sizeOf.end()) return false;
+    auto it = groupOf.find(file);
+    if (it != groupOf.end()) {
+        for (const auto& other : *it->second) {
+            if (other != file) others.push_back(other);
+        }
+    }
+    return true;
+}
+
+// Function to list the indexed files below a directory
+std::vector<std::string> DuplicateIndex::filesUnder(const std::string& directory) const {
+    std::string prefix = directory;
+    if (prefix.empty() || prefix.back() != '/') prefix += '/';
+    std::vector<std::string> files;
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    for (const auto& entry : sizeOf) {
+        if (entry.first.compare(0, prefix.size(), prefix) == 0) files.push_back(entry.first);
+    }
+    return files;
+}
+
+size_t DuplicateIndex::fileCount() const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return sizeOf.size();
+}
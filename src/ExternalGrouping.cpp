@@ -0,0 +1,752 @@
+#include "ExternalGrouping.h"
+#include "DirectoryWalker.h"
+#include "FileCatalogue.h"
+#include "IoScheduler.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <system_error>
+#include <fcntl.h>
+#include <omp.h>
+#include <unistd.h>
+
+namespace {
+
+// Smallest read buffer a run gets during a merge; the fan-in is the budget
+// divided by this, so a merge never degenerates into tiny reads
+constexpr size_t kMinRunBuffer = 64 * 1024;
+
+// Files hashed per batch handed to the device pools
+constexpr size_t kHashBatch = 4096;
+
+// Smallest path buffer of a walker thread, however many threads share the
+// budget
+constexpr size_t kMinPathBuffer = 4096;
+
+// A path id holds the walker thread's store above this bit and the offset
+// in it below
+constexpr unsigned kStoreShift = 48;
+
+void reportError(const char* what, int error) {
+    std::cerr << "Spill file " << what << " failed: "
+              << std::error_code(error, std::generic_category()).message() << std::endl;
+}
+
+// An unlinked temporary file: it has no name once created, so it goes away
+// with the process however the process ends
+class SpillFile {
+public:
+    SpillFile() = default;
+    ~SpillFile() { if (fd >= 0) ::close(fd); }
+    SpillFile(const SpillFile&) = delete;
+    SpillFile& operator=(const SpillFile&) = delete;
+
+    bool create(const std::filesystem::path& directory) {
+        std::string name = (directory / "dff-spill-XXXXXX").string();
+        fd = ::mkstemp(name.data());
+        if (fd < 0) {
+            reportError("creation", errno);
+            return false;
+        }
+        ::unlink(name.c_str());
+        return true;
+    }
+
+    bool append(const void* data, size_t length) {
+        const char* bytes = static_cast<const char*>(data);
+        while (length > 0) {
+            const ssize_t n = ::pwrite(fd, bytes, length, static_cast<off_t>(written));
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                reportError("write", errno);
+                return false;
+            }
+            bytes += n;
+            length -= static_cast<size_t>(n);
+            written += static_cast<uint64_t>(n);
+        }
+        return true;
+    }
+
+    // Safe to call from several threads at once
+    bool read(uint64_t offset, void* data, size_t length) const {
+        char* bytes = static_cast<char*>(data);
+        while (length > 0) {
+            const ssize_t n = ::pread(fd, bytes, length, static_cast<off_t>(offset));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                reportError("read", n < 0 ? errno : EIO);
+                return false;
+            }
+            bytes += n;
+            length -= static_cast<size_t>(n);
+            offset += static_cast<uint64_t>(n);
+        }
+        return true;
+    }
+
+    uint64_t size() const { return written; }
+
+private:
+    int fd = -1;
+    uint64_t written = 0;
+};
+
+// Paths found by one walker thread, length-prefixed; a file is identified
+// by the offset of its path
+class PathStore {
+public:
+    explicit PathStore(size_t bufferBytes) : bufferBytes(bufferBytes) {}
+
+    bool create(const std::filesystem::path& directory) { return file.create(directory); }
+
+    // One thread appends; reads are safe from any thread once flushed
+    bool append(std::string_view directory, std::string_view name, uint64_t& id) {
+        id = file.size() + buffer.size();
+        const uint32_t length = static_cast<uint32_t>(directory.size() + name.size());
+        buffer.append(reinterpret_cast<const char*>(&length), sizeof(length));
+        buffer.append(directory);
+        buffer.append(name);
+        return buffer.size() < bufferBytes || flush();
+    }
+
+    bool flush() {
+        const bool ok = file.append(buffer.data(), buffer.size());
+        buffer.clear();
+        return ok;
+    }
+
+    // Flush and hand the buffer back once the walk is over
+    bool close() {
+        const bool ok = flush();
+        std::string().swap(buffer);
+        return ok;
+    }
+
+    bool read(uint64_t id, std::string& path) const {
+        uint32_t length = 0;
+        if (!file.read(id, &length, sizeof(length))) return false;
+        path.resize(length);
+        return file.read(id + sizeof(length), path.data(), length);
+    }
+
+private:
+    SpillFile file;
+    std::string buffer;
+    const size_t bufferBytes;
+};
+
+struct SpillCounters {
+    size_t runs = 0;
+    uintmax_t bytes = 0;
+    size_t passes = 0;
+};
+
+// Sorts more records than fit in memory: full buffers are sorted and
+// written as runs, and merge() streams every record back in order through a
+// k-way merge, after merging the oldest runs together while there are more
+// than the budget can buffer at once. Records are trivially copyable.
+// Each writer fills its own share of the budget, so writers on different
+// threads only meet when one of them spills a run.
+template <typename Record>
+class ExternalSorter {
+public:
+    using Less = bool (*)(const Record&, const Record&);
+
+    ExternalSorter(std::filesystem::path directory, size_t memory, Less less, SpillCounters& counters,
+                   size_t writers = 1)
+        : directory(std::move(directory)), memory(memory), less(less), counters(counters),
+          capacity(std::max<size_t>(16, memory / std::max<size_t>(1, writers) / sizeof(Record))),
+          fanIn(std::max<size_t>(2, memory / kMinRunBuffer)), buffers(std::max<size_t>(1, writers)) {}
+
+    // Safe to call concurrently for distinct writers
+    bool add(const Record& record, size_t writer = 0) {
+        Buffer& buffer = buffers[writer];
+        if (buffer.records.empty()) buffer.records.reserve(std::min<size_t>(capacity, 4096));
+        buffer.records.push_back(record);
+        buffer.added++;
+        return buffer.records.size() < capacity || spill(buffer.records);
+    }
+
+    uint64_t count() const {
+        uint64_t total = 0;
+        for (const Buffer& buffer : buffers) total += buffer.added;
+        return total;
+    }
+
+    // Call visit for every record in order; visit returns false to stop
+    template <typename Visit>
+    bool merge(Visit visit) {
+        if (runs.empty()) {
+            // Everything fits: one in-memory sort of the writers' records
+            std::vector<Record> all = std::move(buffers[0].records);
+            for (size_t w = 1; w < buffers.size(); ++w) {
+                all.insert(all.end(), buffers[w].records.begin(), buffers[w].records.end());
+                std::vector<Record>().swap(buffers[w].records);
+            }
+            std::sort(all.begin(), all.end(), less);
+            for (const Record& record : all) {
+                if (!visit(record)) return false;
+            }
+            return true;
+        }
+        for (Buffer& buffer : buffers) {
+            if (!buffer.records.empty() && !spill(buffer.records)) return false;
+            std::vector<Record>().swap(buffer.records);
+        }
+
+        while (runs.size() > fanIn) {
+            auto merged = std::make_unique<SpillFile>();
+            if (!merged->create(directory)) return false;
+            std::vector<Record> out;
+            const size_t out_capacity = std::max<size_t>(1, memory / (fanIn + 1) / sizeof(Record));
+            bool ok = mergeRuns(fanIn, [&](const Record& record) {
+                out.push_back(record);
+                if (out.size() < out_capacity) return true;
+                const bool written = merged->append(out.data(), out.size() * sizeof(Record));
+                out.clear();
+                return written;
+            });
+            if (!ok || !merged->append(out.data(), out.size() * sizeof(Record))) return false;
+            counters.bytes += merged->size();
+            counters.passes++;
+            runs.erase(runs.begin(), runs.begin() + static_cast<std::ptrdiff_t>(fanIn));
+            runs.push_back(std::move(merged));
+        }
+        const bool ok = mergeRuns(runs.size(), visit);
+        runs.clear();
+        return ok;
+    }
+
+private:
+    // Buffered reader over one run
+    struct RunReader {
+        const SpillFile* file;
+        uint64_t offset = 0;
+        std::vector<Record> records;
+        size_t next = 0;
+
+        bool fill(size_t batch) {
+            const uint64_t left = (file->size() - offset) / sizeof(Record);
+            records.resize(static_cast<size_t>(std::min<uint64_t>(batch, left)));
+            next = 0;
+            if (records.empty()) return true;
+            const size_t bytes = records.size() * sizeof(Record);
+            if (!file->read(offset, records.data(), bytes)) return false;
+            offset += bytes;
+            return true;
+        }
+    };
+
+    // Sorted and written outside the lock; only adding the run is shared
+    bool spill(std::vector<Record>& records) {
+        std::sort(records.begin(), records.end(), less);
+        auto run = std::make_unique<SpillFile>();
+        if (!run->create(directory) || !run->append(records.data(), records.size() * sizeof(Record))) return false;
+        records.clear();
+        std::lock_guard<std::mutex> lock(runsMutex);
+        counters.runs++;
+        counters.bytes += run->size();
+        runs.push_back(std::move(run));
+        return true;
+    }
+
+    // Merge the first count runs; the budget is shared by their buffers and
+    // one for the output
+    template <typename Visit>
+    bool mergeRuns(size_t count, Visit visit) {
+        const size_t batch = std::max<size_t>(1, memory / (count + 1) / sizeof(Record));
+        std::vector<RunReader> readers(count);
+        std::vector<size_t> heap;
+        for (size_t r = 0; r < count; ++r) {
+            readers[r].file = runs[r].get();
+            if (!readers[r].fill(batch)) return false;
+            if (!readers[r].records.empty()) heap.push_back(r);
+        }
+        // Min-heap on each reader's next record; ties go to the older run
+        auto after = [&](size_t a, size_t b) {
+            const Record& x = readers[a].records[readers[a].next];
+            const Record& y = readers[b].records[readers[b].next];
+            if (less(y, x)) return true;
+            return !less(x, y) && a > b;
+        };
+        std::make_heap(heap.begin(), heap.end(), after);
+        while (!heap.empty()) {
+            std::pop_heap(heap.begin(), heap.end(), after);
+            RunReader& reader = readers[heap.back()];
+            if (!visit(reader.records[reader.next])) return false;
+            if (++reader.next == reader.records.size()) {
+                if (!reader.fill(batch)) return false;
+                if (reader.records.empty()) {
+                    heap.pop_back();
+                    continue;
+                }
+            }
+            std::push_heap(heap.begin(), heap.end(), after);
+        }
+        return true;
+    }
+
+    const std::filesystem::path directory;
+    const size_t memory;
+    const Less less;
+    SpillCounters& counters;
+    struct alignas(64) Buffer {
+        std::vector<Record> records;
+        uint64_t added = 0;
+    };
+
+    const size_t capacity;  // Records per writer's run
+    const size_t fanIn;     // Runs merged at once
+    std::vector<Buffer> buffers;
+    std::mutex runsMutex;   // Guards runs and counters while writers spill
+    std::vector<std::unique_ptr<SpillFile>> runs;
+};
+
+// Path ids of the group being emitted, counted before its header is
+// written and then replayed in order. Ids beyond the budget go to a spill
+// file, so a group of any size is streamed in bounded memory.
+class GroupSpool {
+public:
+    GroupSpool(std::filesystem::path directory, size_t memory)
+        : directory(std::move(directory)), capacity(std::max<size_t>(16, memory / sizeof(uint64_t))) {}
+
+    bool add(uint64_t id) {
+        held.push_back(id);
+        total++;
+        if (held.size() < capacity) return true;
+        if (!spill) {
+            spill = std::make_unique<SpillFile>();
+            if (!spill->create(directory)) return false;
+        }
+        const bool ok = spill->append(held.data(), held.size() * sizeof(uint64_t));
+        held.clear();
+        return ok;
+    }
+
+    uint64_t count() const { return total; }
+
+    // Call visit for every id in the order added; visit returns false to stop
+    template <typename Visit>
+    bool replay(Visit visit) {
+        if (spill) {
+            std::vector<uint64_t> ids;
+            for (uint64_t offset = 0; offset < spill->size();) {
+                const size_t bytes = static_cast<size_t>(std::min<uint64_t>(capacity * sizeof(uint64_t),
+                                                                            spill->size() - offset));
+                ids.resize(bytes / sizeof(uint64_t));
+                if (!spill->read(offset, ids.data(), bytes)) return false;
+                offset += bytes;
+                for (uint64_t id : ids) {
+                    if (!visit(id)) return false;
+                }
+            }
+        }
+        for (uint64_t id : held) {
+            if (!visit(id)) return false;
+        }
+        return true;
+    }
+
+    void clear() {
+        held.clear();
+        spill.reset();
+        total = 0;
+    }
+
+private:
+    const std::filesystem::path directory;
+    const size_t capacity;
+    std::vector<uint64_t> held;
+    std::unique_ptr<SpillFile> spill;
+    uint64_t total = 0;
+};
+
+// A file as the walk found it; path is its id in the path stores
+struct FileRecord {
+    uint64_t size;
+    uint64_t device;
+    uint64_t inode;
+    uint64_t path;
+};
+
+bool bySizeAndInode(const FileRecord& a, const FileRecord& b) {
+    if (a.size != b.size) return a.size < b.size;
+    if (a.device != b.device) return a.device < b.device;
+    if (a.inode != b.inode) return a.inode < b.inode;
+    return a.path < b.path;
+}
+
+// A file and one of its digests
+struct DigestRecord {
+    uint64_t size;
+    uint64_t device;
+    uint64_t inode;
+    uint64_t path;
+    Digest digest;
+};
+
+bool bySizeAndDigest(const DigestRecord& a, const DigestRecord& b) {
+    if (a.size != b.size) return a.size < b.size;
+    if (a.digest != b.digest) return a.digest < b.digest;
+    return a.path < b.path;
+}
+
+bool sameContent(const DigestRecord& a, const DigestRecord& b) {
+    return a.size == b.size && a.digest == b.digest;
+}
+
+// The walk, the three hash/merge stages and their counters. Two sorters are
+// live at a time, one being merged while the next fills, so each gets a
+// quarter of the budget; the group being emitted gets an eighth. During the
+// walk every walker thread fills its own share of the first sorter and its
+// own path store, whose buffers share half of the budget and are released
+// when the walk ends.
+class ExternalGrouper {
+public:
+    ExternalGrouper(const FinderOptions& options, const ExternalOptions& external, Metrics& metrics)
+        : options(options), metrics(metrics),
+          directory(external.spillDirectory.empty() ? std::filesystem::temp_directory_path()
+                                                    : external.spillDirectory),
+          walkers(walkerThreadCount(options.walk)),
+          bySize(directory, external.memoryLimit / 4, bySizeAndInode, spilled, walkers),
+          byPartial(directory, external.memoryLimit / 4, bySizeAndDigest, spilled),
+          byFull(directory, external.memoryLimit / 4, bySizeAndDigest, spilled),
+          spool(directory, external.memoryLimit / 8),
+          pathBuffer(std::max<size_t>(external.memoryLimit / (2 * walkers), kMinPathBuffer)),
+          blockBytes(static_cast<uintmax_t>(options.headBlockSize) + options.tailBlockSize),
+          emptyDigest(createHasher(options.hashAlgorithm)->finish()),
+          cpuThreads(static_cast<unsigned>(omp_get_max_threads())) {
+        sizeStage.name = "size";
+        partialStage.name = "partial hash";
+        hashStage.name = "full hash";
+    }
+
+    bool run(const std::vector<std::string>& directories, PipelineStats* stats) {
+        for (unsigned w = 0; w < walkers; ++w) {
+            paths.push_back(std::make_unique<PathStore>(pathBuffer));
+            if (!paths.back()->create(directory)) return false;
+        }
+        bool ok = walk(directories, stats) && groupBySize() && (!options.partialHash || groupByPartial()) &&
+                  groupByFull();
+        options.sink->finish();
+        if (options.profiler) options.profiler->endStage();
+        if (stats) {
+            for (const auto& entry : devices) stats->devices.emplace_back(entry.first, entry.second);
+            stats->stages.push_back(sizeStage);
+            if (options.partialHash) stats->stages.push_back(partialStage);
+            stats->stages.push_back(hashStage);
+            stats->hardLinksSkipped += linksSkipped;
+            stats->spillRuns += spilled.runs;
+            stats->spillBytes += spilled.bytes;
+            stats->mergePasses += spilled.passes;
+        }
+        return ok;
+    }
+
+private:
+    void beginStage(const char* name, uint64_t files) {
+        metrics.beginStage(name, files, 0);
+        if (options.profiler) options.profiler->beginStage(name);
+    }
+
+    // Walker threads hand over their files in batches, each batch with its
+    // directory paths, and write them to their own path store and sorter
+    // buffer without taking a lock; no directory table is kept
+    bool walk(const std::vector<std::string>& roots, PipelineStats* stats) {
+        beginStage("walk", 0);
+        FileCatalogue catalogue;
+        std::atomic<bool> failed{false};
+        WalkOptions walk = options.walk;
+        walk.statFiles = true;
+        walk.previous = nullptr;
+        walk.snapshot = nullptr;
+        walk.metrics = &metrics;
+        walk.profiler = options.profiler;
+        walk.onFiles = [&](unsigned worker, const FileColumns& files, const std::vector<std::string>& directories) {
+            PathStore& store = *paths[worker];
+            std::string directory_path;
+            uint32_t directory = FileCatalogue::kNoDirectory;
+            for (size_t i = 0; i < files.count() && !failed; ++i) {
+                if (i == 0 || files.directory[i] != directory) {
+                    directory = files.directory[i];
+                    directory_path = directory == FileCatalogue::kNoDirectory ? std::string()
+                                                                               : directories[directory];
+                    if (!directory_path.empty() && directory_path.back() != '/') directory_path += '/';
+                }
+                uint64_t offset = 0;
+                if (!store.append(directory_path, std::string_view(files.names.data() + files.nameOffset[i],
+                                                                   files.nameLength[i]), offset) ||
+                    !bySize.add({files.size[i], files.device[i], files.inode[i],
+                                 static_cast<uint64_t>(worker) << kStoreShift | offset}, worker)) {
+                    failed = true;
+                }
+            }
+        };
+        WalkStats walked = walkDirectories(roots, walk, catalogue);
+        if (stats) stats->walk = walked;
+        sizeStage.filesIn = bySize.count();
+        for (auto& store : paths) {
+            if (!store->close()) failed = true;
+        }
+        return !failed;
+    }
+
+    bool readPath(uint64_t id, std::string& path) const {
+        return paths[id >> kStoreShift]->read(id & ((uint64_t(1) << kStoreShift) - 1), path);
+    }
+
+    DeviceProfile profile(uint64_t device) {
+        if (!options.scheduleByDevice) {
+            DeviceProfile shared;
+            shared.workers = cpuThreads;
+            return shared;
+        }
+        auto it = devices.find(device);
+        if (it == devices.end()) it = devices.emplace(device, probeDevice(device, cpuThreads)).first;
+        return it->second;
+    }
+
+    // Hash a batch on the device pools, in inode order on spinning disks.
+    // Unreadable files come back with an empty digest.
+    template <typename Record, typename Hash>
+    std::vector<Digest> hashBatch(const std::vector<Record>& batch, const char* stage, Hash hash) {
+        std::vector<IoTask> tasks(batch.size());
+        for (size_t i = 0; i < batch.size(); ++i) {
+            tasks[i] = {i, options.scheduleByDevice ? batch[i].device : 0, batch[i].inode};
+        }
+        std::vector<Digest> digests(batch.size());
+        std::atomic<bool> unreadable_path{false};
+        runIoTasks(std::move(tasks), [&](uint64_t device) { return profile(device); }, [&](size_t i) {
+            const int64_t start = options.profiler ? options.profiler->now() : 0;
+            std::string path;
+            if (!readPath(batch[i].path, path)) {
+                unreadable_path = true;
+                return;
+            }
+            uintmax_t bytes = 0;
+            digests[i] = batch[i].size == 0 ? emptyDigest : hash(path, batch[i].size, bytes);
+            metrics.addBytes(bytes);
+            if (options.profiler) {
+                options.profiler->recordDeviceBytes(batch[i].device, bytes);
+                options.profiler->recordBusy(stage, start, options.profiler->tracing() ? path : std::string());
+            }
+        }, cpuThreads);
+        if (unreadable_path) digests.clear();
+        return digests;
+    }
+
+    // Head and tail blocks of the batch into byPartial
+    bool flushPartial() {
+        std::vector<Digest> digests = hashBatch(partialBatch, "partial hash",
+                                                [&](const std::string& path, uintmax_t size, uintmax_t& bytes) {
+            bytes = std::min(size, blockBytes);
+            return computePartialDigest(path, size, options.headBlockSize, options.tailBlockSize,
+                                        options.hashAlgorithm);
+        });
+        if (digests.size() != partialBatch.size()) return false;
+        for (size_t i = 0; i < partialBatch.size(); ++i) {
+            const FileRecord& file = partialBatch[i];
+            partialStage.bytesRead += std::min(file.size, blockBytes);
+            if (digests[i].empty()) {
+                partialStage.filesEliminated++;
+                partialStage.bytesEliminated += file.size;
+            } else if (!byPartial.add({file.size, file.device, file.inode, file.path, digests[i]})) {
+                return false;
+            }
+        }
+        partialBatch.clear();
+        return true;
+    }
+
+    // Whole contents of the batch into byFull, tree-hashed past a chunk
+    bool flushFull() {
+        std::vector<Digest> digests = hashBatch(fullBatch, "full hash",
+                                                [&](const std::string& path, uintmax_t size, uintmax_t& bytes) {
+            bytes = size;
+            return computeTreeDigest(path, size, options.hashAlgorithm, options.treeChunkBytes,
+                                     options.readBackend);
+        });
+        if (digests.size() != fullBatch.size()) return false;
+        for (size_t i = 0; i < fullBatch.size(); ++i) {
+            DigestRecord& file = fullBatch[i];
+            hashStage.bytesRead += file.size;
+            if (digests[i].empty()) {
+                hashStage.filesEliminated++;
+                hashStage.bytesEliminated += file.size;
+                continue;
+            }
+            file.digest = digests[i];
+            if (!byFull.add(file)) return false;
+        }
+        fullBatch.clear();
+        return true;
+    }
+
+    bool toPartial(const FileRecord& file) {
+        partialStage.filesIn++;
+        partialBatch.push_back(file);
+        return partialBatch.size() < kHashBatch || flushPartial();
+    }
+
+    bool toFull(const DigestRecord& file) {
+        hashStage.filesIn++;
+        fullBatch.push_back(file);
+        return fullBatch.size() < kHashBatch || flushFull();
+    }
+
+    bool forward(const FileRecord& file) {
+        return options.partialHash ? toPartial(file) : toFull({file.size, file.device, file.inode, file.path, {}});
+    }
+
+    // Stage 1: merge the walk's runs in size order. A size seen once is
+    // unique; otherwise the bucket streams on to hashing, the first member
+    // held back until a second shows up.
+    bool groupBySize() {
+        beginStage(options.partialHash ? "partial hash" : "full hash", bySize.count());
+        size_t members = 0;
+        FileRecord first{};
+        FileRecord last{};
+        auto close_bucket = [&] {
+            if (members == 1) {
+                sizeStage.filesEliminated++;
+                sizeStage.bytesEliminated += first.size;
+                sizeStage.bytesAvoided += first.size;
+            }
+            members = 0;
+        };
+        const bool ok = bySize.merge([&](const FileRecord& file) {
+            metrics.addFiles(1);
+            if (members > 0 && file.size != first.size) close_bucket();
+            if (members > 0 && options.collapseLinks && file.inode != 0 && file.device == last.device &&
+                file.inode == last.inode) {
+                linksSkipped++;
+                return true;
+            }
+            last = file;
+            if (++members == 1) {
+                first = file;
+                return true;
+            }
+            return (members > 2 || forward(first)) && forward(file);
+        });
+        if (!ok) return false;
+        close_bucket();
+        return options.partialHash ? flushPartial() : flushFull();
+    }
+
+    // Stream the spooled group of files with equal contents to the sink:
+    // its header, then one path at a time
+    bool emit(uintmax_t size, const Digest& digest) {
+        options.sink->beginGroup(size, digest, spool.count());
+        std::string path;
+        const bool ok = spool.replay([&](uint64_t id) {
+            if (!readPath(id, path)) return false;
+            options.sink->groupFile(path);
+            return true;
+        });
+        options.sink->endGroup();
+        spool.clear();
+        return ok;
+    }
+
+    // Stage 2: merge on (size, head/tail digest). A file no larger than the
+    // blocks was hashed whole, so its group is final; members of other
+    // groups stream on to the full hash.
+    bool groupByPartial() {
+        beginStage("full hash", byPartial.count());
+        size_t members = 0;
+        DigestRecord first{};
+        auto close_group = [&] {
+            const uintmax_t size = first.size;
+            bool ok = true;
+            if (members == 1) {
+                partialStage.filesEliminated++;
+                partialStage.bytesEliminated += size;
+                partialStage.bytesAvoided += size - std::min(size, blockBytes);
+                spool.clear();
+            } else if (spool.count() > 0) {
+                ok = emit(first.size, first.digest);
+            }
+            members = 0;
+            return ok;
+        };
+        const bool ok = byPartial.merge([&](const DigestRecord& file) {
+            metrics.addFiles(1);
+            if (members > 0 && !sameContent(file, first) && !close_group()) return false;
+            if (++members == 1) first = file;
+            if (file.size <= blockBytes) return spool.add(file.path);
+            if (members == 1) return true;
+            return (members > 2 || toFull(first)) && toFull(file);
+        });
+        return ok && close_group() && flushFull();
+    }
+
+    // Stage 3: merge on (size, full digest); every run of two or more is a
+    // duplicate group
+    bool groupByFull() {
+        beginStage("group", byFull.count());
+        DigestRecord first{};
+        auto close_group = [&] {
+            bool ok = true;
+            if (spool.count() == 1) {
+                hashStage.filesEliminated++;
+                hashStage.bytesEliminated += first.size;
+                spool.clear();
+            } else if (spool.count() > 0) {
+                ok = emit(first.size, first.digest);
+            }
+            return ok;
+        };
+        const bool ok = byFull.merge([&](const DigestRecord& file) {
+            metrics.addFiles(1);
+            if (spool.count() > 0 && !sameContent(file, first) && !close_group()) return false;
+            if (spool.count() == 0) first = file;
+            return spool.add(file.path);
+        });
+        return ok && close_group();
+    }
+
+    const FinderOptions& options;
+    Metrics& metrics;
+    const std::filesystem::path directory;
+    const unsigned walkers;
+    SpillCounters spilled;
+    std::vector<std::unique_ptr<PathStore>> paths;  // One per walker thread
+    ExternalSorter<FileRecord> bySize;
+    ExternalSorter<DigestRecord> byPartial;
+    ExternalSorter<DigestRecord> byFull;
+    GroupSpool spool;
+    const size_t pathBuffer;  // Bytes each path store holds before appending to its file
+    const uintmax_t blockBytes;
+    const Digest emptyDigest;
+    const unsigned cpuThreads;
+    std::map<uint64_t, DeviceProfile> devices;
+    std::vector<FileRecord> partialBatch;
+    std::vector<DigestRecord> fullBatch;
+    StageStats sizeStage;
+    StageStats partialStage;
+    StageStats hashStage;
+    size_t linksSkipped = 0;
+};
+
+} // namespace
+
+// Function to find duplicates through sorted runs on disk under a memory budget
+bool findDuplicatesExternal(const std::vector<std::string>& directories, ProgressBar& progress,
+                            const FinderOptions& options, const ExternalOptions& external,
+                            PipelineStats* stats) {
+    if (!options.sink) {
+        std::cerr << "External grouping needs a result sink" << std::endl;
+        return false;
+    }
+    ExternalGrouper grouper(options, external, progress.metrics());
+    return grouper.run(directories, stats);
+}
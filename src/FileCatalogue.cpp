@@ -0,0 +1,109 @@
+#include "FileCatalogue.h"
+#include <algorithm>
+#include <iostream>
+
+namespace {
+
+// Join like std::filesystem::path::operator/ does for plain relative names
+void appendComponent(std::string& out, const char* name, size_t length) {
+    if (!out.empty() && out.back() != '/') out += '/';
+    out.append(name, length);
+}
+
+void reportFull(size_t dropped) {
+    std::cerr << "File catalogue is full; ignoring " << dropped << " files" << std::endl;
+}
+
+} // namespace
+
+void FileColumns::add(uint32_t dir, std::string_view name, const FileStat& st) {
+    directory.push_back(dir);
+    nameOffset.push_back(names.size());
+    nameLength.push_back(static_cast<uint16_t>(std::min<size_t>(name.size(), UINT16_MAX)));
+    names.insert(names.end(), name.begin(), name.begin() + nameLength.back());
+    size.push_back(st.size);
+    lastModified.push_back(st.lastModified);
+    device.push_back(st.device);
+    inode.push_back(st.inode);
+}
+
+// Function to intern a directory and return its id
+uint32_t FileCatalogue::addDirectory(uint32_t parent, std::string_view name) {
+    std::lock_guard<std::mutex> lock(directoryMutex);
+    const uint32_t id = static_cast<uint32_t>(directoryParent.size());
+    directoryParent.push_back(parent);
+    directoryNameOffset.push_back(directoryNames.size());
+    directoryNameLength.push_back(static_cast<uint16_t>(std::min<size_t>(name.size(), UINT16_MAX)));
+    directoryNames.insert(directoryNames.end(), name.begin(), name.begin() + directoryNameLength.back());
+    return id;
+}
+
+void FileCatalogue::addFile(uint32_t directory, std::string_view name, const FileStat& st) {
+    if (size() >= kMaxFiles) {
+        reportFull(1);
+        return;
+    }
+    files.add(directory, name, st);
+}
+
+// Function to move a batch of files onto the end of the catalogue
+void FileCatalogue::appendFiles(FileColumns&& columns) {
+    size_t count = columns.count();
+    if (size() + count > kMaxFiles) {
+        reportFull(size() + count - kMaxFiles);
+        count = kMaxFiles - size();
+    }
+    if (files.count() == 0 && count == columns.count()) {
+        files = std::move(columns);
+        return;
+    }
+
+    const uint64_t name_base = files.names.size();
+    files.names.insert(files.names.end(), columns.names.begin(), columns.names.end());
+    for (size_t i = 0; i < count; ++i) files.nameOffset.push_back(columns.nameOffset[i] + name_base);
+    auto append = [count](auto& to, auto& from) {
+        to.insert(to.end(), from.begin(), from.begin() + count);
+    };
+    append(files.directory, columns.directory);
+    append(files.nameLength, columns.nameLength);
+    append(files.size, columns.size);
+    append(files.lastModified, columns.lastModified);
+    append(files.device, columns.device);
+    append(files.inode, columns.inode);
+    columns = FileColumns();
+}
+
+FileStat FileCatalogue::stat(Index i) const {
+    FileStat st;
+    st.size = files.size[i];
+    st.lastModified = files.lastModified[i];
+    st.device = files.device[i];
+    st.inode = files.inode[i];
+    return st;
+}
+
+// Function to rebuild a file's path from its directory chain and name
+std::string FileCatalogue::pathString(Index i) const {
+    std::string out;
+    if (files.directory[i] != kNoDirectory) appendDirectoryPath(files.directory[i], out);
+    appendComponent(out, files.names.data() + files.nameOffset[i], files.nameLength[i]);
+    return out;
+}
+
+std::string FileCatalogue::directoryPath(uint32_t directory) const {
+    std::string out;
+    std::lock_guard<std::mutex> lock(directoryMutex);
+    if (directory != kNoDirectory) appendDirectoryPath(directory, out);
+    return out;
+}
+
+void FileCatalogue::appendDirectoryPath(uint32_t directory, std::string& out) const {
+    // Collect the chain up to the root, then emit it top-down
+    std::vector<uint32_t> chain;
+    for (uint32_t dir = directory; dir != kNoDirectory; dir = directoryParent[dir]) {
+        chain.push_back(dir);
+    }
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+        appendComponent(out, directoryNames.data() + directoryNameOffset[*it], directoryNameLength[*it]);
+    }
+}
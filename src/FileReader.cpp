@@ -0,0 +1,338 @@
+#include "FileReader.h"
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// Chunk size for the pread backends. Large enough to amortise the syscall,
+// small enough to stay in L2 while the hasher consumes it.
+constexpr size_t kChunkSize = 1 << 20;
+
+// O_DIRECT needs buffer, offset and length aligned to the logical block size;
+// 4 KiB covers every common device
+constexpr size_t kDirectAlignment = 4096;
+
+struct FreeDeleter {
+    void operator()(uint8_t* p) const { std::free(p); }
+};
+
+// One aligned buffer per thread, reused for every file the thread reads
+uint8_t* chunkBuffer() {
+    thread_local std::unique_ptr<uint8_t, FreeDeleter> buffer(
+        static_cast<uint8_t*>(std::aligned_alloc(kDirectAlignment, kChunkSize)));
+    return buffer.get();
+}
+
+// Handed to the sink in place of the holes of sparse files
+const uint8_t* zeroBuffer() {
+    static const std::unique_ptr<uint8_t, FreeDeleter> zeros(static_cast<uint8_t*>(std::calloc(1, kChunkSize)));
+    return zeros.get();
+}
+
+// Closes the descriptor when it goes out of scope
+class FileDescriptor {
+public:
+    explicit FileDescriptor(int fd) : fd(fd) {}
+    ~FileDescriptor() { if (fd >= 0) ::close(fd); }
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+
+    int get() const { return fd; }
+    bool valid() const { return fd >= 0; }
+
+private:
+    int fd;
+};
+
+enum class ReadResult { Done, Failed, Stopped };
+
+int64_t nanosecondsNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// open(), adding its latency to openNs when profiling
+int openFile(const std::filesystem::path& file_path, int flags, int64_t* openNs) {
+    if (!openNs) return ::open(file_path.c_str(), flags);
+    const int64_t start = nanosecondsNow();
+    const int fd = ::open(file_path.c_str(), flags);
+    *openNs += nanosecondsNow() - start;
+    return fd;
+}
+
+void reportError(const std::filesystem::path& file_path, const char* what, int error) {
+    std::cerr << "Error " << what << " " << file_path << ": "
+              << std::error_code(error, std::generic_category()).message() << std::endl;
+}
+
+// Bytes [begin, end) of a file; end is clamped to EOF
+struct ByteRange {
+    uintmax_t begin;
+    uintmax_t end;
+};
+
+constexpr ByteRange kWholeFile = {0, UINTMAX_MAX};
+
+// Read from offset to the end of the range in kChunkSize pieces. With
+// O_DIRECT requests are rounded up to the alignment, and a short read marks
+// EOF, since a further read at an unaligned offset fails. In a sparse file
+// only the data extents are read; the holes between them, up to EOF, are
+// passed on from a buffer of zeros.
+ReadResult preadAll(int fd, const ChunkSink& sink, bool direct, uintmax_t& offset, uintmax_t end) {
+    uint8_t* buffer = chunkBuffer();
+    const uint8_t* zeros = zeroBuffer();
+    if (buffer == nullptr || zeros == nullptr) {
+        errno = ENOMEM;
+        return ReadResult::Failed;
+    }
+    uintmax_t size = 0;
+    bool sparse = mayBeSparse(fd, size);
+    if (sparse) end = std::min(end, size);
+    uintmax_t data_begin = 0;
+    uintmax_t data_end = 0;
+    while (offset < end) {
+        if (sparse && offset >= data_end && !nextDataExtent(fd, offset, data_begin, data_end)) sparse = false;
+        if (sparse) {
+            // Direct reads start on an aligned offset, so a few zeros before
+            // an unaligned extent are read rather than skipped
+            uintmax_t hole_end = std::min(data_begin, end);
+            if (direct && hole_end < end) hole_end = hole_end / kDirectAlignment * kDirectAlignment;
+            while (offset < hole_end) {
+                const size_t zero = static_cast<size_t>(std::min<uintmax_t>(kChunkSize, hole_end - offset));
+                offset += zero;
+                if (!sink(zeros, zero)) return ReadResult::Stopped;
+            }
+            if (offset >= end) break;
+        }
+        // Direct reads also end on an aligned offset, past the extent if need be
+        uintmax_t extent_end = sparse ? data_end : end;
+        if (direct && sparse && extent_end < end) {
+            extent_end = (extent_end + kDirectAlignment - 1) / kDirectAlignment * kDirectAlignment;
+        }
+        const uintmax_t left = std::min(end, extent_end) - offset;
+        size_t want = static_cast<size_t>(std::min<uintmax_t>(kChunkSize, left));
+        if (direct) want = (want + kDirectAlignment - 1) / kDirectAlignment * kDirectAlignment;
+        ssize_t n = ::pread(fd, buffer, want, static_cast<off_t>(offset));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return ReadResult::Failed;
+        }
+        if (n == 0) return ReadResult::Done;
+        const size_t got = static_cast<size_t>(std::min<uintmax_t>(static_cast<uintmax_t>(n), left));
+        offset += got;
+        if (!sink(buffer, got)) return ReadResult::Stopped;
+        if (direct && static_cast<size_t>(n) < want) return ReadResult::Done;
+    }
+    return ReadResult::Done;
+}
+
+bool readStream(const std::filesystem::path& file_path, ByteRange range, const ChunkSink& sink,
+                int64_t* openNs) {
+    const int64_t start = openNs ? nanosecondsNow() : 0;
+    std::ifstream file(file_path, std::ios::binary);
+    if (openNs) *openNs += nanosecondsNow() - start;
+    if (!file) {
+        std::cerr << "Error opening " << file_path << std::endl;
+        return false;
+    }
+    if (range.begin > 0) file.seekg(static_cast<std::streamoff>(range.begin));
+    char buffer[4096];
+    for (uintmax_t left = range.end - range.begin; left > 0; left -= static_cast<uintmax_t>(file.gcount())) {
+        const auto want = static_cast<std::streamsize>(std::min<uintmax_t>(left, sizeof(buffer)));
+        if (!file.read(buffer, want) && file.gcount() == 0) break;
+        if (!sink(buffer, static_cast<size_t>(file.gcount()))) return false;
+    }
+    if (file.bad()) {
+        std::cerr << "Error reading " << file_path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool readPread(const std::filesystem::path& file_path, ByteRange range, const ChunkSink& sink,
+               int64_t* openNs) {
+    FileDescriptor fd(openFile(file_path, O_RDONLY | O_CLOEXEC, openNs));
+    if (!fd.valid()) {
+        reportError(file_path, "opening", errno);
+        return false;
+    }
+    // Ask for aggressive readahead; failure is harmless
+    const off_t advise_length = range.end == UINTMAX_MAX ? 0 : static_cast<off_t>(range.end - range.begin);
+    ::posix_fadvise(fd.get(), static_cast<off_t>(range.begin), advise_length, POSIX_FADV_SEQUENTIAL);
+
+    uintmax_t offset = range.begin;
+    ReadResult result = preadAll(fd.get(), sink, false, offset, range.end);
+    if (result == ReadResult::Failed) reportError(file_path, "reading", errno);
+    return result == ReadResult::Done;
+}
+
+bool readDirect(const std::filesystem::path& file_path, ByteRange range, const ChunkSink& sink,
+                int64_t* openNs) {
+    // Only aligned ranges can be read around the page cache
+    if (range.begin % kDirectAlignment != 0) return readPread(file_path, range, sink, openNs);
+    FileDescriptor fd(openFile(file_path, O_RDONLY | O_CLOEXEC | O_DIRECT, openNs));
+    if (!fd.valid()) {
+        // tmpfs and some network filesystems reject O_DIRECT
+        if (errno == EINVAL) return readPread(file_path, range, sink, openNs);
+        reportError(file_path, "opening", errno);
+        return false;
+    }
+
+    uintmax_t offset = range.begin;
+    ReadResult result = preadAll(fd.get(), sink, true, offset, range.end);
+    if (result == ReadResult::Failed && errno == EINVAL && offset == range.begin) {
+        // The filesystem accepted the flag but not the alignment
+        return readPread(file_path, range, sink, openNs);
+    }
+    if (result == ReadResult::Failed) reportError(file_path, "reading", errno);
+    return result == ReadResult::Done;
+}
+
+// The whole mapping goes to the sink in one call, so the hasher reads the
+// page cache directly. A file truncated while mapped raises SIGBUS, which is
+// why this is not the default.
+bool readMmap(const std::filesystem::path& file_path, ByteRange range, const ChunkSink& sink,
+              int64_t* openNs) {
+    FileDescriptor fd(openFile(file_path, O_RDONLY | O_CLOEXEC, openNs));
+    if (!fd.valid()) {
+        reportError(file_path, "opening", errno);
+        return false;
+    }
+    struct stat sb;
+    if (::fstat(fd.get(), &sb) != 0) {
+        reportError(file_path, "reading", errno);
+        return false;
+    }
+    const uintmax_t end = std::min<uintmax_t>(range.end, static_cast<uintmax_t>(sb.st_size));
+    if (range.begin >= end) return true;
+
+    // The mapping starts on a page boundary at or before the range
+    const uintmax_t page = static_cast<uintmax_t>(::sysconf(_SC_PAGESIZE));
+    const uintmax_t map_begin = range.begin / page * page;
+    const size_t length = static_cast<size_t>(end - map_begin);
+    void* data = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd.get(), static_cast<off_t>(map_begin));
+    if (data == MAP_FAILED) {
+        reportError(file_path, "mapping", errno);
+        return false;
+    }
+    ::madvise(data, length, MADV_SEQUENTIAL);
+    bool ok = sink(static_cast<const uint8_t*>(data) + (range.begin - map_begin),
+                   static_cast<size_t>(end - range.begin));
+    ::munmap(data, length);
+    return ok;
+}
+
+bool readWith(ReadBackend backend, const std::filesystem::path& file_path, ByteRange range,
+              const ChunkSink& sink, int64_t* openNs) {
+    switch (backend) {
+    case ReadBackend::Stream: return readStream(file_path, range, sink, openNs);
+    case ReadBackend::Pread: return readPread(file_path, range, sink, openNs);
+    case ReadBackend::Mmap: return readMmap(file_path, range, sink, openNs);
+    case ReadBackend::Direct: return readDirect(file_path, range, sink, openNs);
+    }
+    return false;
+}
+
+// readWith, splitting the time between opening, reading and the sink
+bool readTimed(ReadBackend backend, const std::filesystem::path& file_path, ByteRange range,
+               const ChunkSink& sink, ReadTimings* timings) {
+    if (!timings) return readWith(backend, file_path, range, sink, nullptr);
+
+    // Whatever is not spent opening or in the sink is spent reading
+    int64_t open_ns = 0;
+    int64_t sink_ns = 0;
+    const ChunkSink timed = [&](const void* data, size_t length) {
+        const int64_t start = nanosecondsNow();
+        const bool more = sink(data, length);
+        sink_ns += nanosecondsNow() - start;
+        return more;
+    };
+    const int64_t start = nanosecondsNow();
+    const bool read = readWith(backend, file_path, range, timed, &open_ns);
+    timings->openNs += open_ns;
+    timings->hashNs += sink_ns;
+    timings->readNs += nanosecondsNow() - start - open_ns - sink_ns;
+    return read;
+}
+
+} // namespace
+
+// Function to find the next data extent of a file with holes
+bool nextDataExtent(int fd, uintmax_t offset, uintmax_t& dataBegin, uintmax_t& dataEnd) {
+    const off_t data = ::lseek(fd, static_cast<off_t>(offset), SEEK_DATA);
+    if (data < 0) {
+        if (errno != ENXIO) return false;
+        dataBegin = dataEnd = UINTMAX_MAX;
+        return true;
+    }
+    const off_t hole = ::lseek(fd, data, SEEK_HOLE);
+    if (hole < 0) return false;
+    dataBegin = static_cast<uintmax_t>(data);
+    dataEnd = static_cast<uintmax_t>(hole);
+    return true;
+}
+
+// Function to tell from the allocated blocks whether a file can have holes
+bool mayBeSparse(int fd, uintmax_t& size) {
+    struct stat sb;
+    if (::fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode)) return false;
+    size = static_cast<uintmax_t>(sb.st_size);
+    return static_cast<uintmax_t>(sb.st_blocks) * 512 < size;
+}
+
+// Function to test a block for zeros: after the first 16 bytes, each byte
+// equals the one 16 before it, which memcmp checks at full vector width
+bool isZeroBlock(const void* data, size_t length) {
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    const size_t head = std::min<size_t>(length, 16);
+    for (size_t i = 0; i < head; ++i) {
+        if (bytes[i] != 0) return false;
+    }
+    return length <= head || std::memcmp(bytes, bytes + head, length - head) == 0;
+}
+
+// Function to stream a file's contents to a sink using the chosen backend
+bool readFileContents(const std::filesystem::path& file_path, ReadBackend backend,
+                      const ChunkSink& sink, ReadTimings* timings) {
+    return readTimed(backend, file_path, kWholeFile, sink, timings);
+}
+
+// Function to stream one byte range of a file to a sink
+bool readFileRange(const std::filesystem::path& file_path, ReadBackend backend, uintmax_t offset,
+                   uintmax_t length, const ChunkSink& sink, ReadTimings* timings) {
+    const uintmax_t end = length > UINTMAX_MAX - offset ? UINTMAX_MAX : offset + length;
+    return readTimed(backend, file_path, {offset, end}, sink, timings);
+}
+
+const char* readBackendName(ReadBackend backend) {
+    switch (backend) {
+    case ReadBackend::Stream: return "stream";
+    case ReadBackend::Pread: return "pread";
+    case ReadBackend::Mmap: return "mmap";
+    case ReadBackend::Direct: return "direct";
+    }
+    return "unknown";
+}
+
+bool parseReadBackend(const std::string& name, ReadBackend& backend) {
+    for (ReadBackend candidate : {ReadBackend::Stream, ReadBackend::Pread, ReadBackend::Mmap,
+                                  ReadBackend::Direct}) {
+        if (name == readBackendName(candidate)) {
+            backend = candidate;
+            return true;
+        }
+    }
+    return false;
+}
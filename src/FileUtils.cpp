@@ -1,78 +1,583 @@
 #include "FileUtils.h"
+#include "DirectoryWalker.h"
 #include <fstream>
 #include <iostream>
-#include <openssl/evp.h>
 #include <filesystem>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <iomanip>
 #include <sstream>
+#include <cstring>
+#include <memory>
+#include <fcntl.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace fs = std::filesystem;
 
-// Function to compute the hash of a file using the EVP API (MD5)
-std::string computeFileHash(const std::filesystem::path& file_path) {
-    std::ifstream file(file_path, std::ios::binary);
-    if (!file) return "";
+// Function to compute the digest of a file's full contents
+Digest computeFileDigest(const std::filesystem::path& file_path, HashAlgorithm algorithm,
+                         ReadBackend backend, ReadTimings* timings) {
+    std::unique_ptr<Hasher> hasher = createHasher(algorithm);
 
-    // Create and initialize the EVP context for MD5
-    EVP_MD_CTX* mdctx = EVP_MD_CTX_new();
-    if (mdctx == nullptr) {
-        std::cerr << "Error creating file hash context." << std::endl;
-        return "";
+    // Chunks go straight from the read buffer or mapping into the hasher
+    bool hashed = true;
+    bool read = readFileContents(file_path, backend, [&](const void* data, size_t length) {
+        hashed = hasher->update(data, length);
+        return hashed;
+    }, timings);
+    if (!hashed) {
+        std::cerr << "Error updating file hash." << std::endl;
+        return Digest();
     }
+    if (!read) return Digest();
 
-    if (EVP_DigestInit_ex(mdctx, EVP_md5(), nullptr) != 1) {
-        EVP_MD_CTX_free(mdctx);
-        std::cerr << "Error initializing file hash." << std::endl;
-        return "";
-    }
+    if (!timings) return hasher->finish();
+    const auto start = std::chrono::steady_clock::now();
+    Digest digest = hasher->finish();
+    timings->hashNs += std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    return digest;
+}
 
-    char buffer[4096];  // Buffer for reading files in chunks
-    while (file.read(buffer, sizeof(buffer))) {
-        if (EVP_DigestUpdate(mdctx, buffer, file.gcount()) != 1) {
-            EVP_MD_CTX_free(mdctx);
-            std::cerr << "Error updating file hash." << std::endl;
-            return "";
-        }
+// Function to count the chunks of a tree hash
+uint64_t treeChunkCount(uintmax_t file_size, uint64_t chunkBytes) {
+    if (chunkBytes == 0 || file_size <= chunkBytes) return 0;
+    return (file_size + chunkBytes - 1) / chunkBytes;
+}
+
+// Function to compute the digest of one chunk of a file
+Digest computeChunkDigest(const std::filesystem::path& file_path, HashAlgorithm algorithm, uint64_t chunk,
+                          uint64_t chunkBytes, ReadBackend backend, ReadTimings* timings) {
+    std::unique_ptr<Hasher> hasher = createHasher(algorithm);
+    bool hashed = true;
+    bool read = readFileRange(file_path, backend, chunk * chunkBytes, chunkBytes,
+                              [&](const void* data, size_t length) {
+        hashed = hasher->update(data, length);
+        return hashed;
+    }, timings);
+    if (!hashed) {
+        std::cerr << "Error updating file hash." << std::endl;
+        return Digest();
     }
+    return read ? hasher->finish() : Digest();
+}
 
-    // Finalize the file hash computation
-    unsigned char hash_result[EVP_MAX_MD_SIZE];
-    unsigned int hash_len = 0;
-    if (EVP_DigestFinal_ex(mdctx, hash_result, &hash_len) != 1) {
-        EVP_MD_CTX_free(mdctx);
-        std::cerr << "Error finalizing file hash." << std::endl;
-        return "";
+// Function to compute the tree digest of a file one chunk at a time
+Digest computeTreeDigest(const std::filesystem::path& file_path, uintmax_t file_size, HashAlgorithm algorithm,
+                         uint64_t chunkBytes, ReadBackend backend, std::vector<Digest>* chunks) {
+    std::vector<Digest> digests(treeChunkCount(file_size, chunkBytes));
+    if (digests.empty()) {
+        if (chunks) chunks->clear();
+        return computeFileDigest(file_path, algorithm, backend);
+    }
+    for (uint64_t chunk = 0; chunk < digests.size(); ++chunk) {
+        digests[chunk] = computeChunkDigest(file_path, algorithm, chunk, chunkBytes, backend);
+        if (digests[chunk].empty()) return Digest();
     }
+    Digest root = combineChunkDigests(algorithm, file_size, chunkBytes, digests);
+    if (chunks) *chunks = std::move(digests);
+    return root;
+}
 
-    // Convert the result to a hexadecimal string
-    std::stringstream ss;
-    for (unsigned int i = 0; i < hash_len; ++i) {
-        ss << std::setw(2) << std::setfill('0') << std::hex << (int)hash_result[i];
+// Function to format a byte count with a binary unit suffix
+std::string formatBytes(uintmax_t bytes) {
+    const char* units[] = {"B", "KiB", "MiB", "GiB", "TiB", "PiB"};
+    double value = static_cast<double>(bytes);
+    size_t unit = 0;
+    while (value >= 1024.0 && unit + 1 < sizeof(units) / sizeof(units[0])) {
+        value /= 1024.0;
+        ++unit;
     }
+    std::ostringstream ss;
+    ss << std::fixed << std::setprecision(unit == 0 ? 0 : 1) << value << ' ' << units[unit];
+    return ss.str();
+}
 
-    EVP_MD_CTX_free(mdctx);  // Free the EVP context
-    return ss.str();  // Return the hexadecimal file hash
+// Function to compute the hash of a file as a hexadecimal string
+std::string computeFileHash(const std::filesystem::path& file_path, HashAlgorithm algorithm) {
+    return computeFileDigest(file_path, algorithm).toHex();
+}
+
+// Function to hash only the head block and, optionally, the tail block of a
+// file. Files no larger than headBytes + tailBytes are hashed in full, in
+// which case the result is conclusive for content equality.
+Digest computePartialDigest(const std::filesystem::path& file_path, uintmax_t file_size,
+                            size_t headBytes, size_t tailBytes, HashAlgorithm algorithm) {
+    const int fd = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return Digest();
+
+    std::unique_ptr<Hasher> hasher = createHasher(algorithm);
+
+    // The two ranges never overlap; a short file is covered by the head alone
+    uintmax_t head_len = std::min<uintmax_t>(headBytes, file_size);
+    uintmax_t tail_start = std::max<uintmax_t>(head_len, file_size > tailBytes ? file_size - tailBytes : 0);
+    std::pair<uintmax_t, uintmax_t> ranges[] = {{0, head_len}, {tail_start, file_size - tail_start}};
+
+    // A block lying in a hole of a sparse file (the zeroed tail of a disk
+    // image, say) is hashed as zeros without being read
+    uintmax_t current_size = 0;
+    const bool sparse = mayBeSparse(fd, current_size);
+    static const char zeros[4096] = {};
+    char buffer[4096];
+    bool ok = true;
+    for (const auto& range : ranges) {
+        for (uintmax_t done = 0; ok && done < range.second;) {
+            const uintmax_t offset = range.first + done;
+            const size_t want = static_cast<size_t>(std::min<uintmax_t>(range.second - done, sizeof(buffer)));
+            uintmax_t data_begin = 0;
+            uintmax_t data_end = 0;
+            if (sparse && offset + want <= current_size && nextDataExtent(fd, offset, data_begin, data_end) &&
+                data_begin >= offset + want) {
+                ok = hasher->update(zeros, want);
+                done += want;
+                continue;
+            }
+            const ssize_t n = ::pread(fd, buffer, want, static_cast<off_t>(offset));
+            if (n < 0 && errno == EINTR) continue;
+            ok = n > 0 && hasher->update(buffer, static_cast<size_t>(n));
+            done += n > 0 ? static_cast<uintmax_t>(n) : 0;
+        }
+    }
+    ::close(fd);
+    if (!ok) {
+        std::cerr << "Error reading " << file_path << " for partial hash." << std::endl;
+        return Digest();
+    }
+    return hasher->finish();
 }
 
 // Function to get all files in a directory
 std::vector<std::filesystem::path> getAllFiles(const std::string& directory) {
+    std::cout << "Directory to scan: " << directory << std::endl;
+
+    WalkOptions options;
+    options.statFiles = false;
+    FileCatalogue catalogue;
+    walkDirectories({directory}, options, catalogue);
+
     std::vector<std::filesystem::path> files;
-	std::cout << "Directory to scan: " << directory << std::endl;
-	for (const auto& entry : std::filesystem::recursive_directory_iterator(directory)) {
-		if (!(fs::status(entry).permissions() & fs::perms::owner_read)) {
-			std::cerr << "Cannot read " << entry << std::endl;
-		}
-
-		if (entry.path().string().find('$') != std::string::npos) continue;
-
-		std::cout << "Scanning folder: " << entry.path() << std::endl;
-		try {
-				if (std::filesystem::is_regular_file(entry.status())) {
-					files.push_back(entry.path());
-			}
-		} catch (const std::filesystem::filesystem_error& e) {
-			std::cerr << "Error reading directory: " << e.what() << std::endl;
-		}
-	}
+    files.reserve(catalogue.size());
+    for (FileCatalogue::Index i = 0; i < catalogue.size(); ++i) {
+        files.push_back(catalogue.path(i));
+    }
+    // Walk order is unspecified; sort for reproducible output
+    std::sort(files.begin(), files.end());
     return files;
 }
 
+// Function to gather size, mtime and identity of a file with one stat()
+bool statFile(const std::filesystem::path& file_path, FileStat& st, std::error_code& ec) {
+    struct stat sb;
+    if (::stat(file_path.c_str(), &sb) != 0) {
+        ec.assign(errno, std::generic_category());
+        return false;
+    }
+    st.size = static_cast<uintmax_t>(sb.st_size);
+    st.lastModified = static_cast<int64_t>(sb.st_mtim.tv_sec) * 1000000000 + sb.st_mtim.tv_nsec;
+    st.device = static_cast<uint64_t>(sb.st_dev);
+    st.inode = static_cast<uint64_t>(sb.st_ino);
+    ec.clear();
+    return true;
+}
+
+namespace {
+
+// Extents fetched per FIEMAP call, and the most a file may have before it is
+// treated as not worth comparing by extent map
+constexpr uint32_t kExtentsPerCall = 64;
+constexpr size_t kMaxExtents = 4096;
+
+// Extent flags that make the physical address meaningless for comparison
+constexpr uint32_t kUnusableExtentFlags = FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC |
+                                          FIEMAP_EXTENT_ENCODED | FIEMAP_EXTENT_DATA_ENCRYPTED |
+                                          FIEMAP_EXTENT_NOT_ALIGNED | FIEMAP_EXTENT_DATA_INLINE |
+                                          FIEMAP_EXTENT_DATA_TAIL | FIEMAP_EXTENT_UNWRITTEN;
+
+} // namespace
+
+// Function to read the extent map of a file whose data is fully reflinked
+bool readSharedExtents(const std::filesystem::path& file_path, std::vector<FileExtent>& extents) {
+    extents.clear();
+    int fd = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    const size_t request_size = sizeof(struct fiemap) + kExtentsPerCall * sizeof(struct fiemap_extent);
+    std::unique_ptr<uint64_t[]> storage(new uint64_t[(request_size + 7) / 8]);
+    auto* request = reinterpret_cast<struct fiemap*>(storage.get());
+
+    bool shared = true;
+    bool last = false;
+    uint64_t start = 0;
+    while (shared && !last) {
+        std::memset(request, 0, request_size);
+        request->fm_start = start;
+        request->fm_length = FIEMAP_MAX_OFFSET - start;
+        request->fm_extent_count = kExtentsPerCall;
+        if (::ioctl(fd, FS_IOC_FIEMAP, request) != 0 || request->fm_mapped_extents == 0) {
+            shared = false;
+            break;
+        }
+        for (uint32_t i = 0; i < request->fm_mapped_extents; ++i) {
+            const struct fiemap_extent& extent = request->fm_extents[i];
+            if (!(extent.fe_flags & FIEMAP_EXTENT_SHARED) || (extent.fe_flags & kUnusableExtentFlags) ||
+                extents.size() == kMaxExtents) {
+                shared = false;
+                break;
+            }
+            extents.push_back({extent.fe_logical, extent.fe_physical, extent.fe_length});
+            start = extent.fe_logical + extent.fe_length;
+            last = extent.fe_flags & FIEMAP_EXTENT_LAST;
+        }
+    }
+    ::close(fd);
+    if (!shared) extents.clear();
+    return shared;
+}
+
+// Function to read where a file's data starts on its device
+bool readFirstPhysicalOffset(const std::filesystem::path& file_path, uint64_t& offset) {
+    int fd = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    uint64_t storage[(sizeof(struct fiemap) + sizeof(struct fiemap_extent) + 7) / 8] = {};
+    auto* request = reinterpret_cast<struct fiemap*>(storage);
+    request->fm_length = FIEMAP_MAX_OFFSET;
+    request->fm_extent_count = 1;
+    const bool mapped = ::ioctl(fd, FS_IOC_FIEMAP, request) == 0 && request->fm_mapped_extents == 1;
+    ::close(fd);
+    if (mapped) offset = request->fm_extents[0].fe_physical;
+    return mapped;
+}
+
+namespace {
+
+// Cache file layout (native byte order):
+//   header:  magic[8] "DFFCACHE", u32 version, u32 hash algorithm, u64 entry count
+//   entry:   u64 size, i64 mtime, u64 device, u64 inode,
+//            u8 digest size, u8 partial digest size, u8[2] padding, u32 path length,
+//            u64 chunk size, u32 chunk count, u32 padding, u64 head block, u64 tail block,
+//            digest bytes, chunk count * digest size chunk digest bytes,
+//            partial digest bytes, path bytes
+const char kCacheMagic[8] = {'D', 'F', 'F', 'C', 'A', 'C', 'H', 'E'};
+const uint32_t kCacheVersion = 3;
+
+struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t algorithm;
+    uint64_t count;
+};
+
+struct CacheEntryHeader {
+    uint64_t size;
+    int64_t lastModified;
+    uint64_t device;
+    uint64_t inode;
+    uint8_t digestSize;
+    uint8_t partialSize;
+    uint8_t padding[2];
+    uint32_t pathLength;
+    uint64_t chunkBytes;
+    uint32_t chunkCount;
+    uint32_t chunkPadding;
+    uint64_t partialHead;
+    uint64_t partialTail;
+};
+
+// Snapshot file layout (native byte order):
+//   header:     magic[8] "DFFSNAPS", u32 version, u32 padding, u64 directory count
+//   directory:  i64 mtime, u64 device, u64 inode, u32 path length,
+//               u32 subdirectory count, u32 file count, u32 padding, path bytes,
+//               then per subdirectory: u16 name length, name bytes,
+//               then per file: u64 size, i64 mtime, u64 device, u64 inode,
+//                              u16 name length, name bytes
+const char kSnapshotMagic[8] = {'D', 'F', 'F', 'S', 'N', 'A', 'P', 'S'};
+const uint32_t kSnapshotVersion = 1;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t padding;
+    uint64_t count;
+};
+
+struct SnapshotDirectoryHeader {
+    int64_t lastModified;
+    uint64_t device;
+    uint64_t inode;
+    uint32_t pathLength;
+    uint32_t subdirectoryCount;
+    uint32_t fileCount;
+    uint32_t padding;
+};
+
+struct SnapshotFileHeader {
+    uint64_t size;
+    int64_t lastModified;
+    uint64_t device;
+    uint64_t inode;
+};
+
+template <typename T>
+void appendRaw(std::vector<char>& data, const T& value) {
+    data.insert(data.end(), reinterpret_cast<const char*>(&value),
+                reinterpret_cast<const char*>(&value) + sizeof(value));
+}
+
+// Bounds-checked reader over a file loaded into memory
+class RawReader {
+public:
+    explicit RawReader(const std::vector<char>& data) : data(data) {}
+
+    template <typename T>
+    bool read(T& value) {
+        if (data.size() - offset < sizeof(value)) return false;
+        std::memcpy(&value, data.data() + offset, sizeof(value));
+        offset += sizeof(value);
+        return true;
+    }
+
+    bool read(std::string& out, size_t length) {
+        if (data.size() - offset < length) return false;
+        out.assign(data.data() + offset, length);
+        offset += length;
+        return true;
+    }
+
+    // A digest of length bytes, at most Digest::kMaxSize
+    bool read(Digest& digest, uint8_t length) {
+        if (data.size() - offset < length) return false;
+        std::memcpy(digest.bytes.data(), data.data() + offset, length);
+        digest.size = length;
+        offset += length;
+        return true;
+    }
+
+private:
+    const std::vector<char>& data;
+    size_t offset = 0;
+};
+
+// Read a whole file into memory; a missing file yields false silently
+bool readWholeFile(const std::string& file_path, std::vector<char>& data) {
+    std::ifstream file(file_path, std::ios::binary | std::ios::ate);
+    if (!file) return false;
+    data.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    if (!file.read(data.data(), data.size())) {
+        std::cerr << "Error reading " << file_path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Write data next to the target and rename it into place, so readers never
+// see a partial file
+bool replaceFile(const std::vector<char>& data, const std::string& file_path, const char* what) {
+    std::string tmp_path = file_path + ".tmp";
+    {
+        std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!file.write(data.data(), data.size())) {
+            std::cerr << "Error writing " << what << " " << tmp_path << std::endl;
+            return false;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, file_path, ec);
+    if (ec) {
+        std::cerr << "Error replacing " << what << " " << file_path << ": " << ec.message() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+// Function to load the digest cache written by saveCache
+FileCache loadCache(const std::string& cacheFilePath, HashAlgorithm algorithm) {
+    FileCache cache;
+    std::vector<char> data;
+    if (!readWholeFile(cacheFilePath, data)) return cache;
+
+    RawReader reader(data);
+    CacheHeader header;
+    if (!reader.read(header) || std::memcmp(header.magic, kCacheMagic, sizeof(kCacheMagic)) != 0 ||
+        header.version != kCacheVersion) {
+        std::cerr << "Ignoring unrecognised cache " << cacheFilePath << std::endl;
+        return cache;
+    }
+    if (header.algorithm != static_cast<uint32_t>(algorithm)) {
+        std::cerr << "Ignoring cache " << cacheFilePath << " built with the "
+                  << hashAlgorithmName(static_cast<HashAlgorithm>(header.algorithm))
+                  << " engine" << std::endl;
+        return cache;
+    }
+
+    cache.reserve(header.count);
+    for (uint64_t i = 0; i < header.count; ++i) {
+        CacheEntryHeader entry;
+        if (!reader.read(entry) || entry.digestSize > Digest::kMaxSize || entry.partialSize > Digest::kMaxSize) break;
+
+        FileMetadata metadata;
+        metadata.fileSize = entry.size;
+        metadata.lastModified = entry.lastModified;
+        metadata.device = entry.device;
+        metadata.inode = entry.inode;
+        metadata.chunkBytes = entry.chunkBytes;
+        metadata.partialHead = entry.partialHead;
+        metadata.partialTail = entry.partialTail;
+        bool complete = reader.read(metadata.fileHash, entry.digestSize);
+        metadata.chunkHashes.resize(entry.chunkCount);
+        for (size_t c = 0; complete && c < metadata.chunkHashes.size(); ++c) {
+            complete = reader.read(metadata.chunkHashes[c], entry.digestSize);
+        }
+        std::string path;
+        if (!complete || !reader.read(metadata.partialHash, entry.partialSize) ||
+            !reader.read(path, entry.pathLength)) {
+            break;
+        }
+        cache.emplace(std::move(path), std::move(metadata));
+    }
+    if (cache.size() != header.count) {
+        std::cerr << "Cache " << cacheFilePath << " is truncated; loaded "
+                  << cache.size() << " of " << header.count << " entries" << std::endl;
+    }
+    return cache;
+}
+
+// Function to write the digest cache; the file is replaced atomically
+bool saveCache(const FileCache& cache, const std::string& cacheFilePath, HashAlgorithm algorithm) {
+    std::vector<char> data;
+    CacheHeader header;
+    std::memcpy(header.magic, kCacheMagic, sizeof(kCacheMagic));
+    header.version = kCacheVersion;
+    header.algorithm = static_cast<uint32_t>(algorithm);
+    header.count = cache.size();
+    data.insert(data.end(), reinterpret_cast<const char*>(&header),
+                reinterpret_cast<const char*>(&header) + sizeof(header));
+
+    for (const auto& item : cache) {
+        const FileMetadata& metadata = item.second;
+        CacheEntryHeader entry = {};
+        entry.size = metadata.fileSize;
+        entry.lastModified = metadata.lastModified;
+        entry.device = metadata.device;
+        entry.inode = metadata.inode;
+        entry.digestSize = metadata.fileHash.size;
+        entry.pathLength = static_cast<uint32_t>(item.first.size());
+        entry.chunkBytes = metadata.chunkBytes;
+        entry.chunkCount = static_cast<uint32_t>(metadata.chunkHashes.size());
+        entry.partialSize = metadata.partialHash.size;
+        entry.partialHead = metadata.partialHead;
+        entry.partialTail = metadata.partialTail;
+        data.insert(data.end(), reinterpret_cast<const char*>(&entry),
+                    reinterpret_cast<const char*>(&entry) + sizeof(entry));
+        data.insert(data.end(), metadata.fileHash.bytes.begin(),
+                    metadata.fileHash.bytes.begin() + metadata.fileHash.size);
+        for (const Digest& chunk : metadata.chunkHashes) {
+            data.insert(data.end(), chunk.bytes.begin(), chunk.bytes.begin() + metadata.fileHash.size);
+        }
+        data.insert(data.end(), metadata.partialHash.bytes.begin(),
+                    metadata.partialHash.bytes.begin() + metadata.partialHash.size);
+        data.insert(data.end(), item.first.begin(), item.first.end());
+    }
+
+    return replaceFile(data, cacheFilePath, "cache");
+}
+
+// Function to load the tree snapshot written by saveSnapshot
+TreeSnapshot loadSnapshot(const std::string& snapshotFilePath) {
+    TreeSnapshot snapshot;
+    std::vector<char> data;
+    if (!readWholeFile(snapshotFilePath, data)) return snapshot;
+
+    RawReader reader(data);
+    SnapshotHeader header;
+    if (!reader.read(header) || std::memcmp(header.magic, kSnapshotMagic, sizeof(kSnapshotMagic)) != 0 ||
+        header.version != kSnapshotVersion) {
+        std::cerr << "Ignoring unrecognised snapshot " << snapshotFilePath << std::endl;
+        return snapshot;
+    }
+
+    snapshot.reserve(header.count);
+    for (uint64_t i = 0; i < header.count; ++i) {
+        SnapshotDirectoryHeader entry;
+        std::string path;
+        if (!reader.read(entry) || !reader.read(path, entry.pathLength)) break;
+
+        DirectorySnapshot directory;
+        directory.lastModified = entry.lastModified;
+        directory.device = entry.device;
+        directory.inode = entry.inode;
+        bool complete = true;
+        directory.subdirectories.resize(entry.subdirectoryCount);
+        for (auto& name : directory.subdirectories) {
+            uint16_t length;
+            if (!(complete = reader.read(length) && reader.read(name, length))) break;
+        }
+        directory.files.resize(complete ? entry.fileCount : 0);
+        for (auto& file : directory.files) {
+            SnapshotFileHeader file_entry;
+            uint16_t length;
+            if (!(complete = reader.read(file_entry) && reader.read(length) && reader.read(file.first, length))) break;
+            file.second.size = file_entry.size;
+            file.second.lastModified = file_entry.lastModified;
+            file.second.device = file_entry.device;
+            file.second.inode = file_entry.inode;
+        }
+        // A partly read directory would replay an incomplete listing
+        if (!complete) break;
+        snapshot.emplace(std::move(path), std::move(directory));
+    }
+    if (snapshot.size() != header.count) {
+        std::cerr << "Snapshot " << snapshotFilePath << " is truncated; loaded "
+                  << snapshot.size() << " of " << header.count << " directories" << std::endl;
+    }
+    return snapshot;
+}
+
+// Function to write the tree snapshot; the file is replaced atomically
+bool saveSnapshot(const TreeSnapshot& snapshot, const std::string& snapshotFilePath) {
+    std::vector<char> data;
+    SnapshotHeader header = {};
+    std::memcpy(header.magic, kSnapshotMagic, sizeof(kSnapshotMagic));
+    header.version = kSnapshotVersion;
+    header.count = snapshot.size();
+    appendRaw(data, header);
+
+    for (const auto& item : snapshot) {
+        const DirectorySnapshot& directory = item.second;
+        SnapshotDirectoryHeader entry = {};
+        entry.lastModified = directory.lastModified;
+        entry.device = directory.device;
+        entry.inode = directory.inode;
+        entry.pathLength = static_cast<uint32_t>(item.first.size());
+        entry.subdirectoryCount = static_cast<uint32_t>(directory.subdirectories.size());
+        entry.fileCount = static_cast<uint32_t>(directory.files.size());
+        appendRaw(data, entry);
+        data.insert(data.end(), item.first.begin(), item.first.end());
+
+        // Names longer than a u16 cannot occur on Linux (NAME_MAX is 255)
+        for (const auto& name : directory.subdirectories) {
+            appendRaw(data, static_cast<uint16_t>(name.size()));
+            data.insert(data.end(), name.begin(), name.end());
+        }
+        for (const auto& file : directory.files) {
+            SnapshotFileHeader file_entry = {};
+            file_entry.size = file.second.size;
+            file_entry.lastModified = file.second.lastModified;
+            file_entry.device = file.second.device;
+            file_entry.inode = file.second.inode;
+            appendRaw(data, file_entry);
+            appendRaw(data, static_cast<uint16_t>(file.first.size()));
+            data.insert(data.end(), file.first.begin(), file.first.end());
+        }
+    }
+
+    return replaceFile(data, snapshotFilePath, "snapshot");
+}
@@ -0,0 +1,142 @@
+#include "Hasher.h"
+#include <iostream>
+#include <openssl/evp.h>
+
+#define XXH_INLINE_ALL
+#include "xxhash.h"
+
+namespace {
+
+// XXH3 128-bit streaming hasher. Uses the widest SIMD path enabled at
+// compile time (SSE2 on any x86-64, AVX2/AVX-512 with the matching -m flags).
+class Xxh3Hasher : public Hasher {
+public:
+    Xxh3Hasher() : state(XXH3_createState()) { reset(); }
+    ~Xxh3Hasher() override { XXH3_freeState(state); }
+
+    void reset() override {
+        XXH3_128bits_reset(state);
+    }
+
+    bool update(const void* data, size_t length) override {
+        return XXH3_128bits_update(state, data, length) == XXH_OK;
+    }
+
+    Digest finish() override {
+        XXH128_canonical_t canonical;
+        XXH128_canonicalFromHash(&canonical, XXH3_128bits_digest(state));
+        Digest digest;
+        std::memcpy(digest.bytes.data(), canonical.digest, sizeof(canonical.digest));
+        digest.size = sizeof(canonical.digest);
+        return digest;
+    }
+
+private:
+    XXH3_state_t* state;
+};
+
+// OpenSSL EVP hasher for the cryptographic engines (MD5, SHA-256)
+class EvpHasher : public Hasher {
+public:
+    explicit EvpHasher(const EVP_MD* md) : md(md), mdctx(EVP_MD_CTX_new()) {
+        if (mdctx == nullptr) {
+            std::cerr << "Error creating file hash context." << std::endl;
+        }
+        reset();
+    }
+    ~EvpHasher() override { EVP_MD_CTX_free(mdctx); }
+
+    void reset() override {
+        ok = mdctx != nullptr && EVP_DigestInit_ex(mdctx, md, nullptr) == 1;
+        if (!ok) {
+            std::cerr << "Error initializing file hash." << std::endl;
+        }
+    }
+
+    bool update(const void* data, size_t length) override {
+        ok = ok && EVP_DigestUpdate(mdctx, data, length) == 1;
+        return ok;
+    }
+
+    Digest finish() override {
+        Digest digest;
+        unsigned char hash_result[EVP_MAX_MD_SIZE];
+        unsigned int hash_len = 0;
+        if (!ok || EVP_DigestFinal_ex(mdctx, hash_result, &hash_len) != 1 ||
+            hash_len > Digest::kMaxSize) {
+            std::cerr << "Error finalizing file hash." << std::endl;
+            return digest;
+        }
+        std::memcpy(digest.bytes.data(), hash_result, hash_len);
+        digest.size = static_cast<uint8_t>(hash_len);
+        return digest;
+    }
+
+private:
+    const EVP_MD* md;
+    EVP_MD_CTX* mdctx;
+    bool ok = false;
+};
+
+} // namespace
+
+// Function to convert a binary digest to lowercase hexadecimal
+std::string Digest::toHex() const {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex(size * 2, '0');
+    for (size_t i = 0; i < size; ++i) {
+        hex[2 * i] = digits[bytes[i] >> 4];
+        hex[2 * i + 1] = digits[bytes[i] & 0x0f];
+    }
+    return hex;
+}
+
+// Function to create a fresh hash engine of the requested kind
+std::unique_ptr<Hasher> createHasher(HashAlgorithm algorithm) {
+    switch (algorithm) {
+    case HashAlgorithm::XXH3:
+        return std::make_unique<Xxh3Hasher>();
+    case HashAlgorithm::MD5:
+        return std::make_unique<EvpHasher>(EVP_md5());
+    case HashAlgorithm::SHA256:
+        return std::make_unique<EvpHasher>(EVP_sha256());
+    }
+    return nullptr;
+}
+
+// Function to fold chunk digests into the root digest of a tree hash
+Digest combineChunkDigests(HashAlgorithm algorithm, uint64_t fileSize, uint64_t chunkBytes,
+                           const std::vector<Digest>& chunks) {
+    static const char kTreeTag[8] = {'D', 'F', 'F', 'T', 'R', 'E', 'E', '1'};
+    std::unique_ptr<Hasher> hasher = createHasher(algorithm);
+    bool ok = hasher->update(kTreeTag, sizeof(kTreeTag)) && hasher->update(&fileSize, sizeof(fileSize)) &&
+              hasher->update(&chunkBytes, sizeof(chunkBytes));
+    for (const Digest& chunk : chunks) {
+        if (chunk.empty()) return Digest();
+        ok = ok && hasher->update(chunk.bytes.data(), chunk.size);
+    }
+    if (!ok) {
+        std::cerr << "Error updating file hash." << std::endl;
+        return Digest();
+    }
+    return hasher->finish();
+}
+
+const char* hashAlgorithmName(HashAlgorithm algorithm) {
+    switch (algorithm) {
+    case HashAlgorithm::XXH3: return "xxh3";
+    case HashAlgorithm::MD5: return "md5";
+    case HashAlgorithm::SHA256: return "sha256";
+    }
+    return "unknown";
+}
+
+bool parseHashAlgorithm(const std::string& name, HashAlgorithm& algorithm) {
+    for (HashAlgorithm candidate : {HashAlgorithm::XXH3, HashAlgorithm::MD5, HashAlgorithm::SHA256}) {
+        if (name == hashAlgorithmName(candidate)) {
+            algorithm = candidate;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,152 @@
+#include "IoScheduler.h"
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <sys/sysmacros.h>
+
+namespace {
+
+// Deepest pools for SSDs and NVMe, before the CPU and queue-depth caps
+constexpr unsigned kSsdWorkers = 8;
+constexpr unsigned kNvmeWorkers = 32;
+
+unsigned readUnsigned(const std::filesystem::path& file) {
+    std::ifstream in(file);
+    unsigned value = 0;
+    in >> value;
+    return in ? value : 0;
+}
+
+// sysfs attributes of the device, before sizing; cached since they do not change
+DeviceProfile lookupDevice(uint64_t device) {
+    static std::mutex mutex;
+    static std::unordered_map<uint64_t, DeviceProfile> cache;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = cache.find(device);
+    if (it != cache.end()) return it->second;
+
+    DeviceProfile profile;
+    std::error_code ec;
+    const std::filesystem::path link = "/sys/dev/block/" + std::to_string(major(device)) + ":" +
+                                       std::to_string(minor(device));
+    std::filesystem::path dir = std::filesystem::canonical(link, ec);
+    if (!ec) {
+        // A partition has no queue of its own; its disk is the parent directory
+        if (!std::filesystem::exists(dir / "queue", ec)) dir = dir.parent_path();
+        if (std::filesystem::exists(dir / "queue" / "rotational", ec)) {
+            profile.known = true;
+            profile.rotational = readUnsigned(dir / "queue" / "rotational") != 0;
+            profile.queueDepth = readUnsigned(dir / "queue" / "nr_requests");
+            profile.name = dir.filename().string();
+        }
+    }
+    cache.emplace(device, profile);
+    return profile;
+}
+
+// Share out a thread budget between pools: each keeps at least one thread,
+// none gets more than it asked for, and the rest goes round the others
+std::vector<unsigned> shareThreads(const std::vector<unsigned>& wanted, unsigned budget) {
+    unsigned total = 0;
+    for (unsigned w : wanted) total += w;
+    if (budget == 0 || total <= budget) return wanted;
+    std::vector<unsigned> granted(wanted.size(), 1);
+    unsigned left = budget > wanted.size() ? budget - static_cast<unsigned>(wanted.size()) : 0;
+    for (bool grew = true; left > 0 && grew;) {
+        grew = false;
+        for (size_t q = 0; q < wanted.size() && left > 0; ++q) {
+            if (granted[q] < wanted[q]) {
+                granted[q]++;
+                left--;
+                grew = true;
+            }
+        }
+    }
+    return granted;
+}
+
+} // namespace
+
+// Function to profile a device from sysfs and size its worker pool
+DeviceProfile probeDevice(uint64_t device, unsigned cpuThreads) {
+    DeviceProfile profile = lookupDevice(device);
+    cpuThreads = std::max(1u, cpuThreads);
+    if (!profile.known) {
+        profile.workers = cpuThreads;
+    } else if (profile.rotational) {
+        profile.workers = 1;
+    } else {
+        const bool nvme = profile.name.rfind("nvme", 0) == 0;
+        unsigned depth = nvme ? kNvmeWorkers : kSsdWorkers;
+        if (profile.queueDepth > 0) depth = std::min(depth, profile.queueDepth);
+        // More readers than hashing threads would only contend for the CPU
+        profile.workers = std::max(1u, std::min(cpuThreads, depth));
+    }
+    return profile;
+}
+
+// Function to run tasks on a worker pool per device
+void runIoTasks(std::vector<IoTask> tasks, const DeviceProfiler& profile,
+                const std::function<void(size_t item)>& work, unsigned threadBudget,
+                const IoLocator& locate) {
+    // Ordered by device so every device owns one contiguous run of tasks
+    std::map<uint64_t, std::vector<IoTask>> by_device;
+    for (const IoTask& task : tasks) by_device[task.device].push_back(task);
+    std::vector<IoTask>().swap(tasks);
+
+    struct DeviceQueue {
+        std::vector<IoTask> tasks;
+        std::atomic<size_t> next{0};
+        bool rotational = false;
+        std::once_flag ordered;
+    };
+    std::vector<std::unique_ptr<DeviceQueue>> queues;
+    std::vector<unsigned> workers;
+    for (auto& entry : by_device) {
+        const DeviceProfile device = profile(entry.first);
+        queues.push_back(std::make_unique<DeviceQueue>());
+        queues.back()->tasks = std::move(entry.second);
+        queues.back()->rotational = device.rotational;
+        workers.push_back(std::max<size_t>(1, std::min<size_t>(device.workers, queues.back()->tasks.size())));
+    }
+    workers = shareThreads(workers, threadBudget);
+
+    // Runs on the device's own pool, so locating the files of one disk
+    // never holds up reads from the others
+    auto order = [&locate](DeviceQueue& queue) {
+        if (!queue.rotational) return;
+        if (locate) {
+            for (IoTask& task : queue.tasks) task.offset = locate(task);
+        }
+        // One sweep across the platter instead of seeking back and forth
+        std::stable_sort(queue.tasks.begin(), queue.tasks.end(),
+                         [](const IoTask& a, const IoTask& b) { return a.offset < b.offset; });
+    };
+
+    // A single worker overall runs on the calling thread
+    if (queues.size() == 1 && workers[0] == 1) {
+        order(*queues[0]);
+        for (const IoTask& task : queues[0]->tasks) work(task.item);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    for (size_t q = 0; q < queues.size(); ++q) {
+        DeviceQueue& queue = *queues[q];
+        for (unsigned w = 0; w < workers[q]; ++w) {
+            threads.emplace_back([&queue, &work, &order] {
+                std::call_once(queue.ordered, order, queue);
+                for (size_t i; (i = queue.next.fetch_add(1, std::memory_order_relaxed)) < queue.tasks.size();) {
+                    work(queue.tasks[i].item);
+                }
+            });
+        }
+    }
+    for (std::thread& thread : threads) thread.join();
+}
@@ -0,0 +1,131 @@
+#include "NearDuplicates.h"
+#include "FileUtils.h"
+#include "IoScheduler.h"
+#include <algorithm>
+#include <iomanip>
+#include <unordered_map>
+#include <omp.h>
+
+namespace {
+
+// One chunk occurrence; 16 bytes, so the whole index sorts in place
+struct ChunkRef {
+    uint64_t fingerprint;
+    uint32_t file;
+    uint32_t length;
+};
+
+} // namespace
+
+// Function to index the content-defined chunks of every file
+NearDuplicateReport findNearDuplicates(const std::vector<std::filesystem::path>& files,
+                                       const NearDuplicateOptions& options, Metrics* metrics) {
+    NearDuplicateReport report;
+    report.files = files.size();
+
+    // Chunk on each device's worker pool, in inode order on spinning disks
+    std::vector<IoTask> tasks(files.size());
+    uintmax_t total_bytes = 0;
+    for (size_t i = 0; i < files.size(); ++i) {
+        FileStat st;
+        std::error_code ec;
+        statFile(files[i], st, ec);
+        tasks[i] = {i, st.device, st.inode};
+        total_bytes += st.size;
+    }
+    if (metrics) metrics->beginStage("chunk", files.size(), total_bytes);
+    const unsigned cpu_threads = static_cast<unsigned>(omp_get_max_threads());
+    std::vector<std::vector<ChunkRef>> per_file(files.size());
+    std::vector<char> readable(files.size());
+    runIoTasks(std::move(tasks), [&](uint64_t device) { return probeDevice(device, cpu_threads); },
+               [&](size_t i) {
+        std::vector<ContentChunk> chunks;
+        readable[i] = chunkFile(files[i], options.chunking, chunks, options.readBackend);
+        uintmax_t bytes = 0;
+        per_file[i].reserve(chunks.size());
+        for (const ContentChunk& chunk : chunks) {
+            per_file[i].push_back({chunk.fingerprint, static_cast<uint32_t>(i), chunk.length});
+            bytes += chunk.length;
+        }
+        if (metrics) {
+            metrics->addFiles(1);
+            metrics->addBytes(bytes);
+        }
+    }, cpu_threads);
+
+    std::vector<ChunkRef> index;
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (!readable[i]) report.unreadable++;
+        index.insert(index.end(), per_file[i].begin(), per_file[i].end());
+        std::vector<ChunkRef>().swap(per_file[i]);
+    }
+    std::sort(index.begin(), index.end(), [](const ChunkRef& a, const ChunkRef& b) {
+        return a.fingerprint != b.fingerprint ? a.fingerprint < b.fingerprint : a.file < b.file;
+    });
+
+    // Each run of one fingerprint is a chunk and every place it occurs. Pairs
+    // are scored on distinct chunks, so a file repeating a block internally
+    // does not look more similar than it is.
+    std::vector<uintmax_t> distinct_bytes(files.size());
+    std::unordered_map<uint64_t, uintmax_t> shared;
+    std::vector<uint32_t> holders;
+    for (size_t begin = 0; begin < index.size();) {
+        size_t end = begin + 1;
+        while (end < index.size() && index[end].fingerprint == index[begin].fingerprint) ++end;
+        const uint32_t length = index[begin].length;
+        report.chunks += end - begin;
+        report.uniqueChunks++;
+        report.bytes += static_cast<uintmax_t>(length) * (end - begin);
+        report.reclaimableBytes += static_cast<uintmax_t>(length) * (end - begin - 1);
+
+        holders.clear();
+        for (size_t i = begin; i < end; ++i) {
+            if (holders.empty() || holders.back() != index[i].file) holders.push_back(index[i].file);
+        }
+        for (uint32_t file : holders) distinct_bytes[file] += length;
+        if (holders.size() > 1 && holders.size() <= options.maxPostingFiles) {
+            for (size_t a = 0; a < holders.size(); ++a) {
+                for (size_t b = a + 1; b < holders.size(); ++b) {
+                    shared[static_cast<uint64_t>(holders[a]) << 32 | holders[b]] += length;
+                }
+            }
+        }
+        begin = end;
+    }
+
+    for (const auto& entry : shared) {
+        uint32_t a = static_cast<uint32_t>(entry.first >> 32);
+        uint32_t b = static_cast<uint32_t>(entry.first);
+        const double ratio = static_cast<double>(entry.second) / std::max(distinct_bytes[a], distinct_bytes[b]);
+        if (ratio < options.minSharedRatio) continue;
+        if (files[b] < files[a]) std::swap(a, b);
+        report.pairs.push_back({files[a], files[b], entry.second, ratio});
+    }
+    std::sort(report.pairs.begin(), report.pairs.end(), [](const NearDuplicatePair& x, const NearDuplicatePair& y) {
+        if (x.ratio != y.ratio) return x.ratio > y.ratio;
+        if (x.sharedBytes != y.sharedBytes) return x.sharedBytes > y.sharedBytes;
+        return x.first != y.first ? x.first < y.first : x.second < y.second;
+    });
+    return report;
+}
+
+// Function to print near-duplicate pairs and the chunk index summary
+void printNearDuplicates(const NearDuplicateReport& report, std::ostream& out) {
+    if (report.pairs.empty()) {
+        out << "No near-duplicate files found." << std::endl;
+    } else {
+        out << "Near-duplicate files (share of the larger file's content):" << std::endl;
+        for (const auto& pair : report.pairs) {
+            out << "  " << std::fixed << std::setprecision(1) << pair.ratio * 100.0 << "%  "
+                << formatBytes(pair.sharedBytes) << " shared\n"
+                << "    " << pair.first << "\n"
+                << "    " << pair.second << std::endl;
+        }
+    }
+    out << "Chunk index: " << report.files << " files, " << formatBytes(report.bytes) << " in "
+        << report.chunks << " chunks, " << report.uniqueChunks << " distinct" << std::endl;
+    const double share = report.bytes ? 100.0 * report.reclaimableBytes / report.bytes : 0.0;
+    out << "Reclaimable by chunk-level deduplication: " << formatBytes(report.reclaimableBytes) << " ("
+        << std::fixed << std::setprecision(1) << share << "%)" << std::endl;
+    if (report.unreadable > 0) out << report.unreadable << " files could not be read" << std::endl;
+}
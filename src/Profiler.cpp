@@ -0,0 +1,249 @@
+#include "Profiler.h"
+#include "FileUtils.h"
+#include "ResultSink.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sys/sysmacros.h>
+#include <time.h>
+
+namespace {
+
+std::atomic<uint64_t> nextGeneration{1};
+
+int64_t processCpuTime() {
+    timespec ts;
+    ::clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// Which profiler the calling thread last recorded into, and its log there
+struct LocalLog {
+    uint64_t generation = 0;
+    void* log = nullptr;
+};
+thread_local LocalLog localLog;
+
+} // namespace
+
+const char* operationName(Operation operation) {
+    switch (operation) {
+    case Operation::Stat: return "stat";
+    case Operation::Open: return "open";
+    case Operation::Read: return "read";
+    case Operation::Hash: return "hash";
+    case Operation::LockWait: return "lock wait";
+    }
+    return "unknown";
+}
+
+// Values below 4 get a bucket each; above, each power of two is split in four
+size_t LatencyHistogram::bucketOf(uint64_t value) {
+    if (value < 4) return static_cast<size_t>(value);
+    const int exponent = 63 - __builtin_clzll(value);
+    const size_t sub = static_cast<size_t>(value >> (exponent - 2)) & 3;
+    return 4 * static_cast<size_t>(exponent - 1) + sub;
+}
+
+uint64_t LatencyHistogram::bucketLimit(size_t bucket) {
+    if (bucket < 4) return bucket;
+    const int exponent = static_cast<int>(bucket / 4) + 1;
+    const uint64_t width = uint64_t(1) << (exponent - 2);
+    return (4 + bucket % 4) * width + width - 1;
+}
+
+void LatencyHistogram::add(int64_t nanoseconds) {
+    const uint64_t value = nanoseconds > 0 ? static_cast<uint64_t>(nanoseconds) : 0;
+    buckets[bucketOf(value)]++;
+    samples++;
+    maxNs = std::max(maxNs, static_cast<int64_t>(value));
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+    for (size_t i = 0; i < kBuckets; ++i) buckets[i] += other.buckets[i];
+    samples += other.samples;
+    maxNs = std::max(maxNs, other.maxNs);
+}
+
+int64_t LatencyHistogram::percentile(double fraction) const {
+    if (samples == 0) return 0;
+    const uint64_t target = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(fraction * samples)));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBuckets; ++i) {
+        seen += buckets[i];
+        if (seen >= target) return std::min(static_cast<int64_t>(bucketLimit(i)), maxNs);
+    }
+    return maxNs;
+}
+
+Profiler::Profiler(bool trace)
+    : trace(trace), generation(nextGeneration.fetch_add(1)), start(Clock::now()) {}
+
+Profiler::~Profiler() = default;
+
+int64_t Profiler::now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+Profiler::ThreadLog& Profiler::local() {
+    if (localLog.generation != generation) {
+        std::lock_guard<std::mutex> lock(logsMutex);
+        logs.push_back(std::make_unique<ThreadLog>());
+        logs.back()->id = static_cast<unsigned>(logs.size());
+        localLog.generation = generation;
+        localLog.log = logs.back().get();
+    }
+    return *static_cast<ThreadLog*>(localLog.log);
+}
+
+void Profiler::beginStage(const char* name) {
+    endStage();
+    StageRecord stage{name};
+    stage.wallStart = now();
+    stage.cpuStart = processCpuTime();
+    stages.push_back(stage);
+    currentStage.store(static_cast<int>(stages.size()) - 1, std::memory_order_relaxed);
+}
+
+void Profiler::endStage() {
+    if (currentStage.load(std::memory_order_relaxed) < 0) return;
+    stages.back().wallEnd = now();
+    stages.back().cpuEnd = processCpuTime();
+    currentStage.store(-1, std::memory_order_relaxed);
+}
+
+void Profiler::recordBusy(const char* name, int64_t start, const std::string& detail) {
+    ThreadLog& log = local();
+    const int64_t end = now();
+    const int stage = currentStage.load(std::memory_order_relaxed);
+    if (stage >= 0) {
+        if (log.busyByStage.size() <= static_cast<size_t>(stage)) log.busyByStage.resize(stage + 1);
+        log.busyByStage[stage] += end - start;
+    }
+    if (trace) log.events.push_back({name, start, end - start, detail});
+}
+
+void Profiler::recordLatency(Operation operation, int64_t nanoseconds) {
+    local().latencies[static_cast<size_t>(operation)].add(nanoseconds);
+}
+
+void Profiler::recordFile(const ReadTimings& timings) {
+    ThreadLog& log = local();
+    log.latencies[static_cast<size_t>(Operation::Open)].add(timings.openNs);
+    log.latencies[static_cast<size_t>(Operation::Read)].add(timings.readNs);
+    log.latencies[static_cast<size_t>(Operation::Hash)].add(timings.hashNs);
+}
+
+void Profiler::recordDeviceBytes(uint64_t device, uint64_t bytes) {
+    local().deviceBytes[device] += bytes;
+}
+
+// Function to print stage times, thread utilisation, latencies and device reads
+void Profiler::printReport(std::ostream& out) const {
+    std::lock_guard<std::mutex> lock(logsMutex);
+    out << "Profile:\n"
+        << "  " << std::left << std::setw(16) << "Stage" << std::right
+        << std::setw(10) << "Wall" << std::setw(10) << "CPU" << "\n";
+    for (size_t s = 0; s < stages.size(); ++s) {
+        const StageRecord& stage = stages[s];
+        const int64_t wall = stage.wallEnd - stage.wallStart;
+        out << "  " << std::left << std::setw(16) << stage.name << std::right
+            << std::setw(10) << formatDuration(wall)
+            << std::setw(10) << formatDuration(stage.cpuEnd - stage.cpuStart) << "\n";
+        for (const auto& log : logs) {
+            if (log->busyByStage.size() <= s || log->busyByStage[s] == 0) continue;
+            const int64_t busy = log->busyByStage[s];
+            out << "    thread " << std::left << std::setw(5) << log->id << std::right
+                << "busy " << formatDuration(busy) << ", idle "
+                << formatDuration(std::max<int64_t>(0, wall - busy)) << "\n";
+        }
+    }
+
+    std::array<LatencyHistogram, kOperationCount> latencies;
+    std::map<uint64_t, uint64_t> deviceBytes;
+    for (const auto& log : logs) {
+        for (size_t op = 0; op < kOperationCount; ++op) latencies[op].merge(log->latencies[op]);
+        for (const auto& entry : log->deviceBytes) deviceBytes[entry.first] += entry.second;
+    }
+
+    out << "  " << std::left << std::setw(16) << "Latency" << std::right << std::setw(10) << "Count"
+        << std::setw(10) << "p50" << std::setw(10) << "p90" << std::setw(10) << "p99"
+        << std::setw(10) << "Max" << "\n";
+    for (size_t op = 0; op < kOperationCount; ++op) {
+        const LatencyHistogram& histogram = latencies[op];
+        if (histogram.count() == 0) continue;
+        out << "    " << std::left << std::setw(14) << operationName(static_cast<Operation>(op)) << std::right
+            << std::setw(10) << histogram.count()
+            << std::setw(10) << formatDuration(histogram.percentile(0.5))
+            << std::setw(10) << formatDuration(histogram.percentile(0.9))
+            << std::setw(10) << formatDuration(histogram.percentile(0.99))
+            << std::setw(10) << formatDuration(histogram.max()) << "\n";
+    }
+
+    if (!deviceBytes.empty()) {
+        out << "  Bytes read per device:\n";
+        for (const auto& entry : deviceBytes) {
+            const std::string device = std::to_string(major(entry.first)) + ":" + std::to_string(minor(entry.first));
+            out << "    " << std::left << std::setw(14) << device << std::right
+                << formatBytes(entry.second) << "\n";
+        }
+    }
+}
+
+// Function to write the recorded timeline in Chrome trace-event format
+bool Profiler::writeTrace(const std::string& path) const {
+    std::ofstream out(path, std::ios::trunc);
+    if (!out) {
+        std::cerr << "Cannot open trace file " << path << std::endl;
+        return false;
+    }
+
+    // Timestamps and durations are in microseconds
+    std::lock_guard<std::mutex> lock(logsMutex);
+    out << std::fixed << std::setprecision(3) << "{\"traceEvents\":[\n";
+    out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"stages\"}}";
+    for (const StageRecord& stage : stages) {
+        out << ",\n{\"name\":\"" << stage.name << "\",\"cat\":\"stage\",\"ph\":\"X\",\"pid\":1,\"tid\":0,\"ts\":"
+            << stage.wallStart / 1e3 << ",\"dur\":" << (stage.wallEnd - stage.wallStart) / 1e3 << "}";
+    }
+    for (const auto& log : logs) {
+        out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << log->id
+            << ",\"args\":{\"name\":\"thread " << log->id << "\"}}";
+        for (const TraceEvent& event : log->events) {
+            out << ",\n{\"name\":\"" << event.name << "\",\"cat\":\"work\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+                << log->id << ",\"ts\":" << event.start / 1e3 << ",\"dur\":" << event.duration / 1e3;
+            if (!event.detail.empty()) {
+                out << ",\"args\":{\"path\":";
+                writeJsonString(out, event.detail);
+                out << "}";
+            }
+            out << "}";
+        }
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    out.close();
+    if (!out) {
+        std::cerr << "Error writing trace file " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Function to format a duration with a unit suited to its magnitude
+std::string formatDuration(int64_t nanoseconds) {
+    char text[32];
+    if (nanoseconds < 1000) {
+        std::snprintf(text, sizeof(text), "%lld ns", static_cast<long long>(nanoseconds));
+    } else if (nanoseconds < 1000000) {
+        std::snprintf(text, sizeof(text), "%.1f us", nanoseconds / 1e3);
+    } else if (nanoseconds < 1000000000) {
+        std::snprintf(text, sizeof(text), "%.2f ms", nanoseconds / 1e6);
+    } else {
+        std::snprintf(text, sizeof(text), "%.2f s", nanoseconds / 1e9);
+    }
+    return text;
+}
@@ -1,35 +1,52 @@
 #include "ProgressBar.h"
+#include <algorithm>
+#include <cstdio>
 #include <iostream>
-#include <iomanip>
 
-ProgressBar::ProgressBar(unsigned int total, const std::string& taskDescription)
-    : total(total), current(0), taskDescription(taskDescription) {
-    display();
+ProgressBar::ProgressBar(unsigned int total, const std::string& taskDescription, std::ostream& out)
+    : taskDescription(taskDescription), out(out), renderer(kRefreshInterval, [this] { display(); }) {
+    counters.beginStage("", total, 0);
+}
+
+ProgressBar::~ProgressBar() {
+    renderer.stop();
 }
 
 void ProgressBar::update(unsigned int progress) {
-    current = progress;
-    display();
+    counters.setFilesDone(progress);
 }
 
 void ProgressBar::complete() {
-    current = total;
-    display();
-    std::cout << std::endl;
+    if (completed) return;
+    completed = true;
+    const MetricsSnapshot last = counters.snapshot();
+    if (last.filesTotal > 0) counters.setFilesDone(last.filesTotal);
+    renderer.stop();  // Draws the final frame
+    out << std::endl;
 }
 
 void ProgressBar::display() const {
-    const int barWidth = 70;
-    float progress = static_cast<float>(current) / total;
-    int pos = static_cast<int>(barWidth * progress);
+    const int barWidth = 50;
+    const MetricsSnapshot snapshot = counters.snapshot();
+    const bool known = snapshot.filesTotal > 0;
+    const double progress = known ? std::min(1.0, static_cast<double>(snapshot.filesDone) / snapshot.filesTotal) : 0;
+    const int pos = static_cast<int>(barWidth * progress);
 
-    std::cout << taskDescription << " [";
+    // Compose the whole frame first and write it at once
+    std::string frame = taskDescription + " [";
     for (int i = 0; i < barWidth; ++i) {
-        if (i < pos) std::cout << "=";
-        else if (i == pos) std::cout << ">";
-        else std::cout << " ";
+        frame += i < pos ? '=' : i == pos && known ? '>' : ' ';
     }
-    std::cout << "] " << std::fixed << std::setprecision(1) << (progress * 100.0) << " %\r";
-    std::cout.flush();
+    char numbers[160];
+    if (known) {
+        std::snprintf(numbers, sizeof(numbers), "] %5.1f %% %s %llu/%llu files %.1f MiB/s  \r",
+                      progress * 100.0, snapshot.stage, static_cast<unsigned long long>(snapshot.filesDone),
+                      static_cast<unsigned long long>(snapshot.filesTotal), snapshot.bytesPerSecond() / (1 << 20));
+    } else {
+        std::snprintf(numbers, sizeof(numbers), "] %s %llu files  \r", snapshot.stage,
+                      static_cast<unsigned long long>(snapshot.filesDone));
+    }
+    frame += numbers;
+    out << frame;
+    out.flush();
 }
-
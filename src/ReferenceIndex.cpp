@@ -0,0 +1,269 @@
+#include "ReferenceIndex.h"
+#include "CatalogueShard.h"
+#include "FileCatalogue.h"
+#include "FileUtils.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const char kIndexMagic[8] = {'D', 'F', 'F', 'I', 'N', 'D', 'E', 'X'};
+const uint32_t kIndexVersion = 1;
+
+// Entries start right after the header; paths follow the entries
+struct IndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t algorithm;
+    uint64_t chunkBytes;
+    uint64_t count;
+    uint32_t digestSize;  // Same for every entry: the engine's digest size
+    uint32_t entrySize;   // Bytes per entry, a multiple of 8
+    uint64_t pathsOffset;
+    uint64_t pathsBytes;
+};
+
+namespace {
+
+// Entry layout: file size, offset of its path in the path area, digest
+constexpr size_t kEntryDigest = 16;
+
+// Paths are written through a buffer this large
+constexpr size_t kIndexBuffer = 1 << 20;
+
+} // namespace
+
+ReferenceIndex::~ReferenceIndex() {
+    close();
+}
+
+void ReferenceIndex::close() {
+    if (mapping) ::munmap(mapping, length);
+    mapping = nullptr;
+    length = 0;
+    header = nullptr;
+}
+
+// Function to map an index and check its layout
+bool ReferenceIndex::open(const std::string& indexPath) {
+    close();
+    const int fd = ::open(indexPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        std::cerr << "Cannot open index " << indexPath << std::endl;
+        return false;
+    }
+    struct stat sb;
+    if (::fstat(fd, &sb) != 0 || static_cast<size_t>(sb.st_size) < sizeof(IndexHeader)) {
+        ::close(fd);
+        std::cerr << "Not a reference index: " << indexPath << std::endl;
+        return false;
+    }
+    length = static_cast<size_t>(sb.st_size);
+    mapping = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        mapping = nullptr;
+        std::cerr << "Cannot map index " << indexPath << std::endl;
+        return false;
+    }
+    // Lookups jump around the entries
+    ::madvise(mapping, length, MADV_RANDOM);
+
+    header = static_cast<const IndexHeader*>(mapping);
+    const uint64_t entries_end = sizeof(IndexHeader) + header->count * header->entrySize;
+    if (std::memcmp(header->magic, kIndexMagic, sizeof(kIndexMagic)) != 0 || header->version != kIndexVersion ||
+        header->algorithm > static_cast<uint32_t>(HashAlgorithm::SHA256) ||
+        header->digestSize != createHasher(static_cast<HashAlgorithm>(header->algorithm))->finish().size ||
+        header->entrySize < kEntryDigest + header->digestSize ||
+        header->count > (length - sizeof(IndexHeader)) / header->entrySize || header->pathsOffset < entries_end ||
+        header->pathsOffset > length || header->pathsBytes > length - header->pathsOffset) {
+        std::cerr << "Not a reference index: " << indexPath << std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+HashAlgorithm ReferenceIndex::algorithm() const { return static_cast<HashAlgorithm>(header->algorithm); }
+uint64_t ReferenceIndex::chunkBytes() const { return header->chunkBytes; }
+uint64_t ReferenceIndex::size() const { return header ? header->count : 0; }
+
+const uint8_t* ReferenceIndex::entry(uint64_t i) const {
+    return static_cast<const uint8_t*>(mapping) + sizeof(IndexHeader) + i * header->entrySize;
+}
+
+uint64_t ReferenceIndex::entryFileSize(uint64_t i) const {
+    uint64_t size;
+    std::memcpy(&size, entry(i), sizeof(size));
+    return size;
+}
+
+// First entry whose file size is not below size
+uint64_t ReferenceIndex::lowerBound(uintmax_t size) const {
+    uint64_t low = 0;
+    uint64_t high = header->count;
+    while (low < high) {
+        const uint64_t mid = low + (high - low) / 2;
+        if (entryFileSize(mid) < size) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+bool ReferenceIndex::containsSize(uintmax_t size) const {
+    const uint64_t i = lowerBound(size);
+    return i < header->count && entryFileSize(i) == size;
+}
+
+// Function to list the reference paths holding this content
+std::vector<std::string> ReferenceIndex::find(uintmax_t size, const Digest& digest) const {
+    std::vector<std::string> paths;
+    if (digest.size != header->digestSize) return paths;
+    // Within one size, entries are in digest byte order
+    auto compare = [&](uint64_t i) { return std::memcmp(entry(i) + kEntryDigest, digest.bytes.data(), digest.size); };
+    uint64_t low = lowerBound(size);
+    uint64_t high = lowerBound(size + 1);
+    while (low < high) {
+        const uint64_t mid = low + (high - low) / 2;
+        if (compare(mid) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    const auto* base = static_cast<const char*>(mapping) + header->pathsOffset;
+    for (uint64_t i = low; i < header->count && entryFileSize(i) == size && compare(i) == 0; ++i) {
+        uint64_t offset;
+        std::memcpy(&offset, entry(i) + sizeof(uint64_t), sizeof(offset));
+        uint32_t path_length = 0;
+        if (offset + sizeof(path_length) > header->pathsBytes) break;
+        std::memcpy(&path_length, base + offset, sizeof(path_length));
+        if (path_length > header->pathsBytes - offset - sizeof(path_length)) break;
+        paths.emplace_back(base + offset + sizeof(path_length), path_length);
+    }
+    return paths;
+}
+
+// Function to hash a reference tree into a sorted, memory-mappable index
+bool buildReferenceIndex(const std::vector<std::string>& directories, const std::string& indexPath,
+                         ProgressBar& progress, const FinderOptions& options, PipelineStats* stats) {
+    FileCatalogue catalogue;
+    std::vector<FileCatalogue::Index> files = hashEveryFile(directories, catalogue, progress, options, {}, stats);
+    progress.metrics().beginStage("write index", files.size(), 0);
+    if (options.profiler) options.profiler->beginStage("write index");
+    std::sort(files.begin(), files.end(), [&](FileCatalogue::Index a, FileCatalogue::Index b) {
+        if (catalogue.fileSize(a) != catalogue.fileSize(b)) return catalogue.fileSize(a) < catalogue.fileSize(b);
+        return catalogue.digest(a) < catalogue.digest(b);
+    });
+    std::vector<std::string> paths(catalogue.size());
+    for (FileCatalogue::Index file : files) paths[file] = catalogue.pathString(file);
+
+    IndexHeader header = {};
+    std::memcpy(header.magic, kIndexMagic, sizeof(kIndexMagic));
+    header.version = kIndexVersion;
+    header.algorithm = static_cast<uint32_t>(options.hashAlgorithm);
+    header.chunkBytes = options.treeChunkBytes;
+    header.count = files.size();
+    header.digestSize = createHasher(options.hashAlgorithm)->finish().size;
+    header.entrySize = static_cast<uint32_t>((kEntryDigest + header.digestSize + 7) / 8 * 8);
+    header.pathsOffset = sizeof(header) + header.count * header.entrySize;
+
+    // Entries first, each pointing at its path in the area after them
+    const std::string tmp_path = indexPath + ".tmp";
+    bool written = false;
+    {
+        std::unique_ptr<char[]> buffer(new char[kIndexBuffer]);
+        std::ofstream out;
+        out.rdbuf()->pubsetbuf(buffer.get(), kIndexBuffer);
+        out.open(tmp_path, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        std::vector<char> entry(header.entrySize);
+        uint64_t path_offset = 0;
+        for (FileCatalogue::Index file : files) {
+            const uint64_t size = catalogue.fileSize(file);
+            std::fill(entry.begin(), entry.end(), 0);
+            std::memcpy(entry.data(), &size, sizeof(size));
+            std::memcpy(entry.data() + sizeof(size), &path_offset, sizeof(path_offset));
+            std::memcpy(entry.data() + kEntryDigest, catalogue.digest(file).bytes.data(), header.digestSize);
+            out.write(entry.data(), entry.size());
+            path_offset += sizeof(uint32_t) + paths[file].size();
+        }
+        for (FileCatalogue::Index file : files) {
+            const std::string& path = paths[file];
+            const uint32_t path_length = static_cast<uint32_t>(path.size());
+            out.write(reinterpret_cast<const char*>(&path_length), sizeof(path_length));
+            out.write(path.data(), path.size());
+            progress.metrics().addFiles(1);
+        }
+        header.pathsBytes = path_offset;
+        out.seekp(0);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        written = static_cast<bool>(out.flush());
+    }
+    if (!written) {
+        std::cerr << "Error writing index " << tmp_path << std::endl;
+        return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, indexPath, ec);
+    if (ec) {
+        std::cerr << "Error replacing index " << indexPath << ": " << ec.message() << std::endl;
+        return false;
+    }
+    if (options.profiler) options.profiler->endStage();
+    return true;
+}
+
+// Function to report which files of a new tree are already indexed
+bool queryReferenceIndex(const ReferenceIndex& index, const std::vector<std::string>& directories,
+                         ProgressBar& progress, const FinderOptions& options, ResultSink& sink,
+                         PipelineStats* stats, ReferenceQueryStats* matches) {
+    FinderOptions hashing = options;
+    hashing.hashAlgorithm = index.algorithm();
+    hashing.treeChunkBytes = index.chunkBytes();
+    FileCatalogue catalogue;
+    std::vector<FileCatalogue::Index> files = hashEveryFile(
+        directories, catalogue, progress, hashing, [&](uintmax_t size) { return index.containsSize(size); }, stats);
+
+    progress.metrics().beginStage("lookup", files.size(), 0);
+    if (options.profiler) options.profiler->beginStage("lookup");
+    std::vector<std::pair<std::string, FileCatalogue::Index>> by_path;
+    for (FileCatalogue::Index file : files) by_path.emplace_back(catalogue.pathString(file), file);
+    std::sort(by_path.begin(), by_path.end());
+
+    ReferenceQueryStats totals;
+    for (const auto& entry : by_path) {
+        const FileCatalogue::Index file = entry.second;
+        std::vector<std::string> references = index.find(catalogue.fileSize(file), catalogue.digest(file));
+        progress.metrics().addFiles(1);
+        if (references.empty()) continue;
+        DuplicateGroup group;
+        group.size = catalogue.fileSize(file);
+        group.digest = catalogue.digest(file);
+        group.files.emplace_back(entry.first);
+        std::sort(references.begin(), references.end());
+        group.files.insert(group.files.end(), references.begin(), references.end());
+        sink.group(group);
+        totals.matched++;
+        totals.matchedBytes += group.size;
+    }
+    sink.finish();
+    if (options.profiler) options.profiler->endStage();
+    if (matches) *matches = totals;
+    return true;
+}
+
+// Function to print how much of a new tree the index already holds
+void printReferenceQueryStats(const ReferenceQueryStats& stats, std::ostream& out) {
+    out << "Already in the reference index: " << stats.matched << " files, " << formatBytes(stats.matchedBytes)
+        << std::endl;
+}
@@ -0,0 +1,284 @@
+#include "ResultSink.h"
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+namespace {
+
+// Lists groups the way the tool always has
+class TextSink : public ResultSink {
+public:
+    explicit TextSink(std::ostream& out) : out(out) {}
+
+    void beginGroup(uintmax_t, const Digest&, uint64_t) override {
+        if (groups++ == 0) out << "Duplicate files found:\n";
+    }
+
+    void groupFile(const std::filesystem::path& file) override {
+        out << "  " << file << '\n';
+    }
+
+    void endGroup() override {
+        out << std::endl;
+    }
+
+    void finish() override {
+        if (groups == 0) out << "No duplicate files found." << std::endl;
+    }
+
+private:
+    std::ostream& out;
+    size_t groups = 0;
+};
+
+// Length of the well-formed UTF-8 sequence starting at text[i], or 0 when
+// the byte there does not start one (overlong forms and surrogates included)
+size_t utf8Length(const std::string& text, size_t i) {
+    const auto byte = [&](size_t at) { return static_cast<unsigned char>(text[at]); };
+    const unsigned char lead = byte(i);
+    size_t length;
+    unsigned char low = 0x80, high = 0xBF;  // Bounds of the second byte
+    if (lead >= 0xC2 && lead <= 0xDF) {
+        length = 2;
+    } else if (lead >= 0xE0 && lead <= 0xEF) {
+        length = 3;
+        if (lead == 0xE0) low = 0xA0;
+        if (lead == 0xED) high = 0x9F;
+    } else if (lead >= 0xF0 && lead <= 0xF4) {
+        length = 4;
+        if (lead == 0xF0) low = 0x90;
+        if (lead == 0xF4) high = 0x8F;
+    } else {
+        return 0;
+    }
+    if (text.size() - i < length || byte(i + 1) < low || byte(i + 1) > high) return 0;
+    for (size_t k = 2; k < length; ++k) {
+        if (byte(i + k) < 0x80 || byte(i + k) > 0xBF) return 0;
+    }
+    return length;
+}
+
+} // namespace
+
+// Function to write text as a quoted, escaped JSON string
+void writeJsonString(std::ostream& out, const std::string& text) {
+    out << '"';
+    for (size_t i = 0; i < text.size();) {
+        const unsigned char c = static_cast<unsigned char>(text[i]);
+        const size_t length = c >= 0x80 ? utf8Length(text, i) : 0;
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (c >= 0x20 && c < 0x80) {
+            out << c;
+        } else if (length > 0) {
+            out.write(text.data() + i, length);
+            i += length;
+            continue;
+        } else {
+            // Control characters, and each byte of a name that is not UTF-8
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out << escaped;
+        }
+        ++i;
+    }
+    out << '"';
+}
+
+namespace {
+
+// {"size":N,"wasted":N,"algorithm":"xxh3","digest":"..","files":[..]}
+class JsonLinesSink : public ResultSink {
+public:
+    JsonLinesSink(std::ostream& out, HashAlgorithm algorithm) : out(out), algorithm(algorithm) {}
+
+    void beginGroup(uintmax_t size, const Digest& digest, uint64_t files) override {
+        out << "{\"size\":" << size << ",\"wasted\":" << DuplicateGroup::wastedBytes(size, files)
+            << ",\"algorithm\":\"" << hashAlgorithmName(algorithm) << "\",\"digest\":\""
+            << digest.toHex() << "\",\"files\":[";
+        first = true;
+    }
+
+    void groupFile(const std::filesystem::path& file) override {
+        if (!first) out << ',';
+        first = false;
+        writeJsonString(out, file.string());
+    }
+
+    void endGroup() override {
+        out << "]}" << std::endl;
+    }
+
+private:
+    std::ostream& out;
+    HashAlgorithm algorithm;
+    bool first = true;
+};
+
+// Quote a CSV field when it holds a separator, quote or line break
+void writeCsvField(std::ostream& out, const std::string& text) {
+    if (text.find_first_of(",\"\r\n") == std::string::npos) {
+        out << text;
+        return;
+    }
+    out << '"';
+    for (char c : text) {
+        if (c == '"') out << '"';
+        out << c;
+    }
+    out << '"';
+}
+
+// group,size,wasted,digest,path with one row per file
+class CsvSink : public ResultSink {
+public:
+    explicit CsvSink(std::ostream& out) : out(out) {
+        out << "group,size,wasted,digest,path\n";
+    }
+
+    void beginGroup(uintmax_t size, const Digest& digest, uint64_t files) override {
+        // Every row repeats the group's columns
+        std::ostringstream columns;
+        columns << groups << ',' << size << ',' << DuplicateGroup::wastedBytes(size, files) << ','
+                << digest.toHex() << ',';
+        prefix = columns.str();
+    }
+
+    void groupFile(const std::filesystem::path& file) override {
+        out << prefix;
+        writeCsvField(out, file.string());
+        out << '\n';
+    }
+
+    void endGroup() override {
+        out.flush();
+        groups++;
+    }
+
+private:
+    std::ostream& out;
+    size_t groups = 0;
+    std::string prefix;
+};
+
+// Binary stream layout (native byte order):
+//   header:  magic[8] "DFFGROUP", u32 version, u32 hash algorithm
+//   group:   u64 size, u64 wasted bytes, u8 digest size, u8[3] padding,
+//            u32 file count, digest bytes,
+//            then per file: u32 path length, path bytes
+//   trailer: a group record with a file count of zero
+const char kGroupMagic[8] = {'D', 'F', 'F', 'G', 'R', 'O', 'U', 'P'};
+const uint32_t kGroupVersion = 1;
+
+struct GroupStreamHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t algorithm;
+};
+
+struct GroupRecordHeader {
+    uint64_t size;
+    uint64_t wasted;
+    uint8_t digestSize;
+    uint8_t padding[3];
+    uint32_t fileCount;
+};
+
+class BinarySink : public ResultSink {
+public:
+    BinarySink(std::ostream& out, HashAlgorithm algorithm) : out(out) {
+        GroupStreamHeader header;
+        std::memcpy(header.magic, kGroupMagic, sizeof(kGroupMagic));
+        header.version = kGroupVersion;
+        header.algorithm = static_cast<uint32_t>(algorithm);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    }
+
+    void beginGroup(uintmax_t size, const Digest& digest, uint64_t files) override {
+        GroupRecordHeader record = {};
+        record.size = size;
+        record.wasted = DuplicateGroup::wastedBytes(size, files);
+        record.digestSize = digest.size;
+        record.fileCount = static_cast<uint32_t>(files);
+        out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+        out.write(reinterpret_cast<const char*>(digest.bytes.data()), digest.size);
+    }
+
+    void groupFile(const std::filesystem::path& file) override {
+        const std::string path = file.string();
+        const uint32_t length = static_cast<uint32_t>(path.size());
+        out.write(reinterpret_cast<const char*>(&length), sizeof(length));
+        out.write(path.data(), path.size());
+    }
+
+    void endGroup() override {
+        out.flush();
+    }
+
+    void finish() override {
+        GroupRecordHeader trailer = {};
+        out.write(reinterpret_cast<const char*>(&trailer), sizeof(trailer));
+        out.flush();
+    }
+
+private:
+    std::ostream& out;
+};
+
+} // namespace
+
+// Function to pass a whole group through the streaming calls
+void ResultSink::group(const DuplicateGroup& group) {
+    beginGroup(group.size, group.digest, group.files.size());
+    for (const auto& file : group.files) groupFile(file);
+    endGroup();
+}
+
+// Function to collect a streamed group for a sink that takes whole groups
+void ResultSink::beginGroup(uintmax_t size, const Digest& digest, uint64_t) {
+    pending = DuplicateGroup();
+    pending.size = size;
+    pending.digest = digest;
+}
+
+void ResultSink::groupFile(const std::filesystem::path& file) {
+    pending.files.push_back(file);
+}
+
+void ResultSink::endGroup() {
+    group(pending);
+    pending = DuplicateGroup();
+}
+
+const char* outputFormatName(OutputFormat format) {
+    switch (format) {
+    case OutputFormat::Text: return "text";
+    case OutputFormat::JsonLines: return "jsonl";
+    case OutputFormat::Csv: return "csv";
+    case OutputFormat::Binary: return "binary";
+    }
+    return "unknown";
+}
+
+bool parseOutputFormat(const std::string& name, OutputFormat& format) {
+    for (OutputFormat candidate : {OutputFormat::Text, OutputFormat::JsonLines, OutputFormat::Csv,
+                                   OutputFormat::Binary}) {
+        if (name == outputFormatName(candidate)) {
+            format = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Function to create the result sink for an output format
+std::unique_ptr<ResultSink> createResultSink(OutputFormat format, std::ostream& out,
+                                             HashAlgorithm algorithm) {
+    switch (format) {
+    case OutputFormat::Text: return std::make_unique<TextSink>(out);
+    case OutputFormat::JsonLines: return std::make_unique<JsonLinesSink>(out, algorithm);
+    case OutputFormat::Csv: return std::make_unique<CsvSink>(out);
+    case OutputFormat::Binary: return std::make_unique<BinarySink>(out, algorithm);
+    }
+    return nullptr;
+}
@@ -0,0 +1,74 @@
+#include "Telemetry.h"
+#include <cinttypes>
+#include <cstdio>
+
+Metrics::Metrics() : start(std::chrono::steady_clock::now()) {}
+
+int64_t Metrics::sinceStart() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+void Metrics::beginStage(const char* name, uint64_t files, uint64_t bytes) {
+    filesTotal.value.store(files, std::memory_order_relaxed);
+    bytesTotal.value.store(bytes, std::memory_order_relaxed);
+    filesDone.value.store(0, std::memory_order_relaxed);
+    bytesDone.value.store(0, std::memory_order_relaxed);
+    stageStart.store(sinceStart(), std::memory_order_relaxed);
+    stage.store(name, std::memory_order_release);
+}
+
+MetricsSnapshot Metrics::snapshot() const {
+    MetricsSnapshot result;
+    result.stage = stage.load(std::memory_order_acquire);
+    result.filesDone = filesDone.value.load(std::memory_order_relaxed);
+    result.filesTotal = filesTotal.value.load(std::memory_order_relaxed);
+    result.bytesDone = bytesDone.value.load(std::memory_order_relaxed);
+    result.bytesTotal = bytesTotal.value.load(std::memory_order_relaxed);
+    const int64_t now = sinceStart();
+    result.elapsedSeconds = now / 1e9;
+    result.stageSeconds = (now - stageStart.load(std::memory_order_relaxed)) / 1e9;
+    return result;
+}
+
+PeriodicTask::PeriodicTask(std::chrono::milliseconds interval, std::function<void()> tick)
+    : interval(interval), tick(std::move(tick)), worker(&PeriodicTask::run, this) {}
+
+PeriodicTask::~PeriodicTask() {
+    stop();
+}
+
+void PeriodicTask::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    if (worker.joinable()) worker.join();
+}
+
+void PeriodicTask::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!wake.wait_for(lock, interval, [this] { return stopping; })) {
+        lock.unlock();
+        tick();
+        lock.lock();
+    }
+    lock.unlock();
+    tick();
+}
+
+// Function to write the counters as a single-line JSON object
+void writeStatsLine(std::ostream& out, const MetricsSnapshot& snapshot) {
+    // Built in one buffer so concurrent writers never interleave within a line
+    char line[512];
+    std::snprintf(line, sizeof(line),
+                  "{\"elapsed\":%.3f,\"stage\":\"%s\",\"files_done\":%" PRIu64 ",\"files_total\":%" PRIu64
+                  ",\"bytes_done\":%" PRIu64 ",\"bytes_total\":%" PRIu64 ",\"bytes_per_second\":%.0f}\n",
+                  snapshot.elapsedSeconds, snapshot.stage, snapshot.filesDone, snapshot.filesTotal,
+                  snapshot.bytesDone, snapshot.bytesTotal, snapshot.bytesPerSecond());
+    out << line;
+    out.flush();
+}
+
+StatsReporter::StatsReporter(const Metrics& metrics, std::ostream& out, std::chrono::milliseconds interval)
+    : metrics(metrics), out(out), task(interval, [this] { writeStatsLine(this->out, this->metrics.snapshot()); }) {}
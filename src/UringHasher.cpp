@@ -0,0 +1,484 @@
+#include "UringHasher.h"
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+// Minimal io_uring wrapper over the raw syscalls, so the engine needs no
+// liburing. One thread owns the ring; nothing here is thread-safe.
+class Ring {
+public:
+    ~Ring() {
+        if (sqes != nullptr) ::munmap(sqes, sqesLength);
+        if (cqPtr != nullptr && cqPtr != sqPtr) ::munmap(cqPtr, cqLength);
+        if (sqPtr != nullptr) ::munmap(sqPtr, sqLength);
+        if (fd >= 0) ::close(fd);
+    }
+
+    bool init(unsigned entries) {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+        if (fd < 0) return false;
+
+        sqLength = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqLength = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single_mmap) sqLength = cqLength = std::max(sqLength, cqLength);
+
+        sqPtr = mapRegion(sqLength, IORING_OFF_SQ_RING);
+        if (sqPtr == nullptr) return false;
+        cqPtr = single_mmap ? sqPtr : mapRegion(cqLength, IORING_OFF_CQ_RING);
+        if (cqPtr == nullptr) return false;
+        sqesLength = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(mapRegion(sqesLength, IORING_OFF_SQES));
+        if (sqes == nullptr) return false;
+
+        char* sq = static_cast<char*>(sqPtr);
+        sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqEntries = params.sq_entries;
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        char* cq = static_cast<char*>(cqPtr);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        localTail = *sqTail;
+        return true;
+    }
+
+    // True when the kernel implements the opcode (probing needs 5.6+,
+    // the same release that added IORING_OP_READ)
+    bool supports(uint8_t opcode) const {
+        const size_t length = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+        std::unique_ptr<io_uring_probe, decltype(&std::free)> probe(
+            static_cast<io_uring_probe*>(std::calloc(1, length)), &std::free);
+        if (!probe || ::syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe.get(), 256) < 0) {
+            return false;
+        }
+        return opcode <= probe->last_op && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED) != 0;
+    }
+
+    // Next free submission entry, zeroed, or nullptr when the queue is full
+    io_uring_sqe* getSqe() {
+        if (localTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) return nullptr;
+        unsigned index = localTail & sqMask;
+        sqArray[index] = index;
+        io_uring_sqe* sqe = &sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        ++localTail;
+        return sqe;
+    }
+
+    // Publish queued entries and wait for at least waitCount completions
+    bool submitAndWait(unsigned waitCount) {
+        __atomic_store_n(sqTail, localTail, __ATOMIC_RELEASE);
+        for (;;) {
+            unsigned pending = localTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+            long ret = ::syscall(__NR_io_uring_enter, fd, pending, waitCount,
+                                 waitCount > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            if (ret >= 0) return true;
+            if (errno != EINTR) return false;
+        }
+    }
+
+    template <typename Handler>
+    void drainCompletions(Handler&& handler) {
+        unsigned head = *cqHead;
+        const unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            const io_uring_cqe& cqe = cqes[head & cqMask];
+            handler(cqe.user_data, cqe.res);
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    }
+
+private:
+    void* mapRegion(size_t length, off_t offset) {
+        void* ptr = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+        return ptr == MAP_FAILED ? nullptr : ptr;
+    }
+
+    int fd = -1;
+    void* sqPtr = nullptr;
+    void* cqPtr = nullptr;
+    size_t sqLength = 0;
+    size_t cqLength = 0;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqesLength = 0;
+    unsigned* sqHead = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned sqMask = 0;
+    unsigned sqEntries = 0;
+    unsigned localTail = 0;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe* cqes = nullptr;
+};
+
+enum class BufferState { Free, Reading, Ready, Hashing };
+
+struct Buffer {
+    uint8_t* data = nullptr;
+    BufferState state = BufferState::Free;
+    uintmax_t offset = 0;
+    size_t length = 0;
+};
+
+// One open file with two buffers: while one chunk is hashed, the next is read
+struct Slot {
+    static constexpr size_t kNoFile = SIZE_MAX;
+
+    size_t file = kNoFile;
+    int fd = -1;
+    uintmax_t size = 0;
+    uintmax_t readOffset = 0;  // Next offset to request
+    uintmax_t hashOffset = 0;  // Next offset the hasher expects
+    bool failed = false;
+    bool hashing = false;
+    std::unique_ptr<Hasher> hasher;
+    Buffer buffers[2];
+
+    bool busy() const {
+        for (const Buffer& buffer : buffers) {
+            if (buffer.state == BufferState::Reading || buffer.state == BufferState::Hashing) return true;
+        }
+        return false;
+    }
+};
+
+struct HashJob {
+    size_t slot;
+    size_t buffer;
+    bool ok;
+};
+
+// Worker threads hash completed chunks; results go back to the ring thread
+// through a queue and an eventfd that the ring is polling.
+class HashPool {
+public:
+    HashPool(std::vector<Slot>& slots, unsigned threads, int eventFd)
+        : slots(slots), eventFd(eventFd) {
+        for (unsigned i = 0; i < threads; ++i) workers.emplace_back([this] { run(); });
+    }
+
+    ~HashPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+
+    void push(size_t slot, size_t buffer) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.push_back({slot, buffer, true});
+        }
+        wake.notify_one();
+    }
+
+    std::deque<HashJob> takeFinished() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::deque<HashJob> result;
+        result.swap(finished);
+        return result;
+    }
+
+private:
+    void run() {
+        for (;;) {
+            HashJob job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !pending.empty(); });
+                if (pending.empty()) return;
+                job = pending.front();
+                pending.pop_front();
+            }
+            // Only one chunk per slot is hashed at a time, so the hasher is ours
+            Slot& slot = slots[job.slot];
+            const Buffer& buffer = slot.buffers[job.buffer];
+            job.ok = slot.hasher->update(buffer.data, buffer.length);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                finished.push_back(job);
+            }
+            uint64_t one = 1;
+            ssize_t ignored = ::write(eventFd, &one, sizeof(one));
+            (void)ignored;
+        }
+    }
+
+    std::vector<Slot>& slots;
+    int eventFd;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<HashJob> pending;
+    std::deque<HashJob> finished;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+};
+
+struct FreeDeleter {
+    void operator()(uint8_t* p) const { std::free(p); }
+};
+
+// user_data of the eventfd read and of cancellations; file reads use
+// slot * 2 + buffer
+constexpr uint64_t kEventTag = UINT64_MAX;
+constexpr uint64_t kCancelTag = UINT64_MAX - 1;
+
+void reportError(const std::filesystem::path& file_path, const char* what, int error) {
+    std::cerr << "Error " << what << " " << file_path << ": "
+              << std::error_code(error, std::generic_category()).message() << std::endl;
+}
+
+} // namespace
+
+// Function to hash many files with reads kept in flight through io_uring
+bool computeFileDigestsUring(const std::vector<std::filesystem::path>& files,
+                             HashAlgorithm algorithm, const UringOptions& options,
+                             std::vector<Digest>& digests, Metrics* metrics) {
+    const size_t slot_count = std::max<size_t>(1, options.queueDepth / 2);
+    const size_t chunk_size = std::max<size_t>(4096, options.chunkSize);
+    unsigned hash_threads = options.hashThreads;
+    if (hash_threads == 0) {
+        hash_threads = std::max(1u, std::min(4u, std::thread::hardware_concurrency()));
+    }
+
+    const size_t buffer_size = (chunk_size + 4095) & ~size_t(4095);
+
+    // All buffers come from one allocation, aligned for the block layer,
+    // followed by the eventfd counter the ring reads into. Declared before
+    // the ring so the ring is torn down first.
+    std::unique_ptr<uint8_t, FreeDeleter> memory(
+        static_cast<uint8_t*>(std::aligned_alloc(4096, slot_count * 2 * buffer_size + 4096)));
+    if (!memory) return false;
+
+    Ring ring;
+    if (!ring.init(static_cast<unsigned>(slot_count * 2 + 1)) || !ring.supports(IORING_OP_READ)) {
+        return false;
+    }
+    int event_fd = ::eventfd(0, EFD_CLOEXEC);
+    if (event_fd < 0) return false;
+    uint64_t* event_value = reinterpret_cast<uint64_t*>(memory.get() + slot_count * 2 * buffer_size);
+
+    std::vector<Slot> slots(slot_count);
+    uint8_t* next_buffer = memory.get();
+    for (Slot& slot : slots) {
+        slot.hasher = createHasher(algorithm);
+        for (Buffer& buffer : slot.buffers) {
+            buffer.data = next_buffer;
+            next_buffer += buffer_size;
+        }
+    }
+
+    digests.assign(files.size(), Digest());
+    bool ring_ok = true;
+    {
+        HashPool pool(slots, hash_threads, event_fd);
+
+        bool event_armed = false;
+        auto arm_event = [&] {
+            io_uring_sqe* sqe = ring.getSqe();
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = event_fd;
+            sqe->addr = reinterpret_cast<uint64_t>(event_value);
+            sqe->len = sizeof(*event_value);
+            sqe->user_data = kEventTag;
+            event_armed = true;
+        };
+        arm_event();
+
+        size_t next_file = 0;
+        size_t open_slots = 0;
+        while (ring_ok) {
+            // Open files into free slots; empty and unopenable files finish at once
+            for (Slot& slot : slots) {
+                while (slot.file == Slot::kNoFile && next_file < files.size()) {
+                    const size_t index = next_file++;
+                    int fd = ::open(files[index].c_str(), O_RDONLY | O_CLOEXEC);
+                    struct stat sb;
+                    if (fd < 0 || ::fstat(fd, &sb) != 0) {
+                        reportError(files[index], "opening", errno);
+                        if (fd >= 0) ::close(fd);
+                        if (metrics) metrics->addFiles(1);
+                        continue;
+                    }
+                    slot.hasher->reset();
+                    if (sb.st_size == 0) {
+                        ::close(fd);
+                        digests[index] = slot.hasher->finish();
+                        if (metrics) metrics->addFiles(1);
+                        continue;
+                    }
+                    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+                    slot.file = index;
+                    slot.fd = fd;
+                    slot.size = static_cast<uintmax_t>(sb.st_size);
+                    slot.readOffset = slot.hashOffset = 0;
+                    slot.failed = slot.hashing = false;
+                    ++open_slots;
+                }
+            }
+            if (open_slots == 0 && next_file == files.size()) break;
+
+            // Keep both buffers of every open file reading
+            for (size_t s = 0; s < slots.size(); ++s) {
+                Slot& slot = slots[s];
+                if (slot.file == Slot::kNoFile || slot.failed) continue;
+                for (size_t b = 0; b < 2 && slot.readOffset < slot.size; ++b) {
+                    Buffer& buffer = slot.buffers[b];
+                    if (buffer.state != BufferState::Free) continue;
+                    io_uring_sqe* sqe = ring.getSqe();
+                    if (sqe == nullptr) break;
+                    buffer.state = BufferState::Reading;
+                    buffer.offset = slot.readOffset;
+                    buffer.length = static_cast<size_t>(std::min<uintmax_t>(chunk_size, slot.size - slot.readOffset));
+                    slot.readOffset += buffer.length;
+                    sqe->opcode = IORING_OP_READ;
+                    sqe->fd = slot.fd;
+                    sqe->off = buffer.offset;
+                    sqe->addr = reinterpret_cast<uint64_t>(buffer.data);
+                    sqe->len = static_cast<uint32_t>(buffer.length);
+                    sqe->user_data = s * 2 + b;
+                }
+            }
+
+            if (!ring.submitAndWait(1)) {
+                std::cerr << "io_uring_enter failed: " << std::strerror(errno) << std::endl;
+                ring_ok = false;
+                break;
+            }
+
+            bool rearm = false;
+            ring.drainCompletions([&](uint64_t tag, int res) {
+                if (tag == kEventTag) {
+                    event_armed = false;
+                    rearm = true;
+                    return;
+                }
+                Slot& slot = slots[tag / 2];
+                Buffer& buffer = slot.buffers[tag % 2];
+                // A short read means the file shrank under us; treat it as unreadable
+                if (res < 0 || static_cast<size_t>(res) != buffer.length) {
+                    if (!slot.failed) {
+                        reportError(files[slot.file], "reading", res < 0 ? -res : EIO);
+                    }
+                    slot.failed = true;
+                    buffer.state = BufferState::Free;
+                } else {
+                    buffer.state = BufferState::Ready;
+                }
+            });
+            if (rearm) arm_event();
+
+            for (const HashJob& job : pool.takeFinished()) {
+                Slot& slot = slots[job.slot];
+                Buffer& buffer = slot.buffers[job.buffer];
+                slot.hashing = false;
+                slot.hashOffset += buffer.length;
+                buffer.state = BufferState::Free;
+                if (!job.ok) slot.failed = true;
+            }
+
+            // Hand the next in-order chunk of each file to the pool, and retire
+            // files that are fully hashed or failed with nothing outstanding
+            for (size_t s = 0; s < slots.size(); ++s) {
+                Slot& slot = slots[s];
+                if (slot.file == Slot::kNoFile) continue;
+                if (!slot.failed && !slot.hashing) {
+                    for (size_t b = 0; b < 2; ++b) {
+                        Buffer& buffer = slot.buffers[b];
+                        if (buffer.state == BufferState::Ready && buffer.offset == slot.hashOffset) {
+                            buffer.state = BufferState::Hashing;
+                            slot.hashing = true;
+                            pool.push(s, b);
+                            break;
+                        }
+                    }
+                }
+                const bool done = slot.failed ? !slot.busy() : slot.hashOffset == slot.size;
+                if (done) {
+                    if (!slot.failed) digests[slot.file] = slot.hasher->finish();
+                    if (metrics) {
+                        metrics->addFiles(1);
+                        metrics->addBytes(slot.hashOffset);
+                    }
+                    ::close(slot.fd);
+                    for (Buffer& buffer : slot.buffers) buffer.state = BufferState::Free;
+                    slot.file = Slot::kNoFile;
+                    slot.fd = -1;
+                    --open_slots;
+                }
+            }
+        }
+
+        // The kernel may still write into the buffers and the event counter:
+        // the eventfd read is always pending, and after a failed submit so
+        // are file reads. Cancel them all and wait for every completion
+        // before anything is freed; if the ring cannot even do that, leak
+        // the memory rather than free it under the kernel.
+        std::vector<uint64_t> in_flight;
+        if (event_armed) in_flight.push_back(kEventTag);
+        for (size_t s = 0; s < slots.size(); ++s) {
+            for (size_t b = 0; b < 2; ++b) {
+                if (slots[s].buffers[b].state == BufferState::Reading) in_flight.push_back(s * 2 + b);
+            }
+        }
+        size_t outstanding = in_flight.size();
+        bool drained = true;
+        for (uint64_t tag : in_flight) {
+            io_uring_sqe* sqe = ring.getSqe();
+            if (sqe == nullptr && ring.submitAndWait(0)) sqe = ring.getSqe();
+            if (sqe == nullptr) {
+                drained = false;
+                break;
+            }
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = tag;
+            sqe->user_data = kCancelTag;
+            ++outstanding;
+        }
+        while (drained && outstanding > 0) {
+            if (!ring.submitAndWait(1)) {
+                drained = false;
+                break;
+            }
+            ring.drainCompletions([&](uint64_t, int) { --outstanding; });
+        }
+        if (!drained) {
+            std::cerr << "io_uring reads could not be cancelled; keeping their buffers" << std::endl;
+            memory.release();
+        }
+
+        for (Slot& slot : slots) {
+            if (slot.fd >= 0) ::close(slot.fd);
+        }
+    }
+    ::close(event_fd);
+    return ring_ok;
+}
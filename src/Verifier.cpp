@@ -0,0 +1,185 @@
+#include "Verifier.h"
+#include "FileReader.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <system_error>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+// Block compared per step; a group of n files holds n blocks in memory
+constexpr size_t kBlockSize = 64 * 1024;
+
+struct Member {
+    size_t index;  // Position in the caller's file list
+    int fd;
+    uint8_t* block;
+    bool sparse;          // Holes are looked up instead of read
+    bool hole;            // The current block lies in a hole: all zeros, not read
+    uintmax_t dataBegin;  // Next data extent, from the last lookup
+    uintmax_t dataEnd;
+};
+
+void reportError(const std::filesystem::path& file_path, const char* what, int error) {
+    std::cerr << "Error " << what << " " << file_path << " for verification: "
+              << std::error_code(error, std::generic_category()).message() << std::endl;
+}
+
+// Read exactly length bytes at offset; a short read means the file changed
+bool readBlock(int fd, uint8_t* block, size_t length, uintmax_t offset, int& error) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = ::pread(fd, block + done, length - done, static_cast<off_t>(offset + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            error = n < 0 ? errno : EIO;
+            return false;
+        }
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Whether the block at offset lies in a hole of the member's file. Extents
+// are looked up again only once the block passes the end of the last one.
+bool blockInHole(Member& member, uintmax_t offset, size_t length) {
+    if (!member.sparse) return false;
+    if (offset >= member.dataEnd && !nextDataExtent(member.fd, offset, member.dataBegin, member.dataEnd)) {
+        member.sparse = false;
+        return false;
+    }
+    return offset + length <= member.dataBegin;
+}
+
+// Equal blocks: two holes always are, a hole and a block read are when the
+// block is all zeros
+bool sameBlock(const Member& a, const Member& b, size_t length) {
+    if (a.hole || b.hole) {
+        return (a.hole || isZeroBlock(a.block, length)) && (b.hole || isZeroBlock(b.block, length));
+    }
+    return std::memcmp(a.block, b.block, length) == 0;
+}
+
+// Verify one batch with every member open at once. Returns the classes of
+// equal content, singletons included, as positions in the caller's list.
+std::vector<std::vector<size_t>> verifyBatch(const std::vector<std::filesystem::path>& files,
+                                             const std::vector<size_t>& batch, uintmax_t size,
+                                             uintmax_t& bytes_read) {
+    const size_t block_size = static_cast<size_t>(std::min<uintmax_t>(kBlockSize, size));
+    std::unique_ptr<uint8_t[]> blocks(new uint8_t[block_size * batch.size()]);
+
+    std::vector<Member> members;
+    for (size_t index : batch) {
+        int fd = ::open(files[index].c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            reportError(files[index], "opening", errno);
+            continue;
+        }
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        uintmax_t current_size = 0;
+        const bool sparse = mayBeSparse(fd, current_size) && current_size == size;
+        members.push_back({index, fd, blocks.get() + block_size * members.size(), sparse, false, 0, 0});
+    }
+
+    std::vector<std::vector<size_t>> finished;
+    std::vector<std::vector<Member>> classes;
+    if (!members.empty()) classes.push_back(members);
+
+    for (uintmax_t offset = 0; offset < size && !classes.empty(); offset += block_size) {
+        const size_t length = static_cast<size_t>(std::min<uintmax_t>(block_size, size - offset));
+        std::vector<std::vector<Member>> next;
+        for (auto& members_of_class : classes) {
+            // Split this class on the block just read; the first member of
+            // each new class is the one the others are compared against
+            std::vector<std::vector<Member>> split;
+            for (Member& member : members_of_class) {
+                int error = 0;
+                member.hole = blockInHole(member, offset, length);
+                if (!member.hole && !readBlock(member.fd, member.block, length, offset, error)) {
+                    reportError(files[member.index], "reading", error);
+                    ::close(member.fd);
+                    member.fd = -1;
+                    continue;
+                }
+                if (!member.hole) bytes_read += length;
+                auto same = std::find_if(split.begin(), split.end(), [&](const std::vector<Member>& candidate) {
+                    return sameBlock(candidate.front(), member, length);
+                });
+                if (same != split.end()) {
+                    same->push_back(member);
+                } else {
+                    split.push_back({member});
+                }
+            }
+            for (auto& part : split) {
+                if (part.size() < 2) {
+                    // Nothing left to compare against; stop reading it
+                    ::close(part.front().fd);
+                    finished.push_back({part.front().index});
+                } else {
+                    next.push_back(std::move(part));
+                }
+            }
+        }
+        classes = std::move(next);
+    }
+
+    for (auto& members_of_class : classes) {
+        std::vector<size_t> group;
+        for (const Member& member : members_of_class) {
+            ::close(member.fd);
+            group.push_back(member.index);
+        }
+        finished.push_back(std::move(group));
+    }
+    return finished;
+}
+
+} // namespace
+
+// Function to split a group of presumed duplicates into truly identical sets
+VerifyResult verifyIdenticalFiles(const std::vector<std::filesystem::path>& files, uintmax_t size,
+                                  size_t maxOpenFiles) {
+    VerifyResult result;
+    const size_t batch_limit = std::max<size_t>(2, maxOpenFiles);
+
+    std::vector<size_t> pending(files.size());
+    for (size_t i = 0; i < files.size(); ++i) pending[i] = i;
+
+    while (pending.size() > 1) {
+        if (pending.size() <= batch_limit) {
+            // Everything fits at once: one pass settles all classes
+            for (auto& group : verifyBatch(files, pending, size, result.bytesRead)) {
+                if (group.size() > 1) result.groups.push_back(std::move(group));
+            }
+            break;
+        }
+
+        // Too many to open together: gather the members equal to the first
+        // one batch at a time, and leave the rest for the next round
+        const size_t pivot = pending.front();
+        std::vector<size_t> with_pivot = {pivot};
+        std::vector<size_t> rest;
+        for (size_t begin = 1; begin < pending.size(); begin += batch_limit - 1) {
+            const size_t end = std::min(pending.size(), begin + batch_limit - 1);
+            std::vector<size_t> batch = {pivot};
+            batch.insert(batch.end(), pending.begin() + begin, pending.begin() + end);
+
+            for (auto& group : verifyBatch(files, batch, size, result.bytesRead)) {
+                if (group.front() == pivot) {
+                    with_pivot.insert(with_pivot.end(), group.begin() + 1, group.end());
+                } else {
+                    rest.insert(rest.end(), group.begin(), group.end());
+                }
+            }
+        }
+        if (with_pivot.size() > 1) result.groups.push_back(std::move(with_pivot));
+        std::sort(rest.begin(), rest.end());
+        pending = std::move(rest);
+    }
+    return result;
+}
@@ -0,0 +1,183 @@
+#include "WalkFilter.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string_view>
+#include <fnmatch.h>
+
+namespace {
+
+bool hasWildcard(const std::string& text) {
+    return text.find_first_of("*?[\\") != std::string::npos;
+}
+
+// Cheapest tests first: name before path, plain comparisons before
+// fnmatch before regexes
+int cost(bool wholePath, int kind) {
+    return kind * 2 + (wholePath ? 1 : 0);
+}
+
+} // namespace
+
+// Function to add one glob or regex, reduced to the cheapest test that matches the same names
+bool WalkFilter::addPattern(std::vector<Pattern>& patterns, const std::string& text, bool regex,
+                            const std::string& rule) {
+    Pattern pattern{Pattern::Glob, true, text, std::regex(), rules.size()};
+    if (regex) {
+        try {
+            pattern.regex = std::regex(text, std::regex::ECMAScript | std::regex::optimize | std::regex::nosubs);
+        } catch (const std::regex_error& e) {
+            std::cerr << "Invalid regular expression " << text << ": " << e.what() << std::endl;
+            return false;
+        }
+        pattern.kind = Pattern::Regex;
+    } else {
+        if (text.empty()) {
+            std::cerr << "Empty glob pattern" << std::endl;
+            return false;
+        }
+        pattern.wholePath = text.find('/') != std::string::npos;
+        const bool leading = text.front() == '*';
+        const bool trailing = text.size() > 1 && text.back() == '*';
+        const std::string inner = text.substr(leading ? 1 : 0, text.size() - leading - trailing);
+        if (!hasWildcard(inner)) {
+            pattern.text = inner;
+            pattern.kind = leading && trailing ? Pattern::Contains
+                         : leading             ? Pattern::Suffix
+                         : trailing            ? Pattern::Prefix
+                                               : Pattern::Literal;
+        }
+    }
+    patterns.push_back(std::move(pattern));
+    rules.push_back(rule);
+    return true;
+}
+
+// Function to compile filter rules for the walker
+bool WalkFilter::compile(const FilterRules& rulesIn) {
+    minSize = rulesIn.minSize;
+    maxSize = rulesIn.maxSize;
+    sameDevice = rulesIn.oneFileSystem;
+    includes.clear();
+    excludes.clear();
+    rules.clear();
+    for (const auto& glob : rulesIn.excludeGlobs) {
+        if (!addPattern(excludes, glob, false, "exclude " + glob)) return false;
+    }
+    for (const auto& regex : rulesIn.excludeRegexes) {
+        if (!addPattern(excludes, regex, true, "exclude-regex " + regex)) return false;
+    }
+    for (const auto& glob : rulesIn.includeGlobs) {
+        if (!addPattern(includes, glob, false, "include " + glob)) return false;
+    }
+    for (const auto& regex : rulesIn.includeRegexes) {
+        if (!addPattern(includes, regex, true, "include-regex " + regex)) return false;
+    }
+    auto by_cost = [](const Pattern& a, const Pattern& b) {
+        return cost(a.wholePath, a.kind) < cost(b.wholePath, b.kind);
+    };
+    std::stable_sort(excludes.begin(), excludes.end(), by_cost);
+    std::stable_sort(includes.begin(), includes.end(), by_cost);
+
+    includeRule = rules.size();
+    rules.push_back("matched no include");
+    minRule = rules.size();
+    rules.push_back("min-size " + std::to_string(minSize));
+    maxRule = rules.size();
+    rules.push_back("max-size " + std::to_string(maxSize));
+    deviceRule = rules.size();
+    rules.push_back("one-file-system");
+    fileCounts.reset(new std::atomic<uint64_t>[rules.size()]());
+    directoryCounts.reset(new std::atomic<uint64_t>[rules.size()]());
+    return true;
+}
+
+bool WalkFilter::matches(const Pattern& pattern, const char* name, size_t length, const std::string& path) {
+    const char* subject = pattern.wholePath ? path.c_str() : name;
+    const size_t size = pattern.wholePath ? path.size() : length;
+    const std::string& text = pattern.text;
+    switch (pattern.kind) {
+    case Pattern::Literal:
+        return size == text.size() && std::memcmp(subject, text.data(), size) == 0;
+    case Pattern::Prefix:
+        return size >= text.size() && std::memcmp(subject, text.data(), text.size()) == 0;
+    case Pattern::Suffix:
+        return size >= text.size() && std::memcmp(subject + size - text.size(), text.data(), text.size()) == 0;
+    case Pattern::Contains:
+        return std::string_view(subject, size).find(text) != std::string_view::npos;
+    case Pattern::Glob:
+        return ::fnmatch(text.c_str(), subject, 0) == 0;
+    case Pattern::Regex:
+        return std::regex_search(path, pattern.regex);
+    }
+    return false;
+}
+
+int WalkFilter::firstMatch(const std::vector<Pattern>& patterns, const std::filesystem::path& parent,
+                           const char* name, std::string& path) {
+    const size_t length = std::strlen(name);
+    for (size_t i = 0; i < patterns.size(); ++i) {
+        if ((patterns[i].wholePath || patterns[i].kind == Pattern::Regex) && path.empty()) {
+            path = (parent / name).string();
+        }
+        if (matches(patterns[i], name, length, path)) return static_cast<int>(i);
+    }
+    return -1;
+}
+
+void WalkFilter::count(size_t rule, bool directory) const {
+    (directory ? directoryCounts : fileCounts)[rule].fetch_add(1, std::memory_order_relaxed);
+}
+
+// Function to test an entry against the exclude and include patterns
+bool WalkFilter::admits(const std::filesystem::path& parent, const char* name, bool directory) const {
+    std::string path;
+    const int excluded = firstMatch(excludes, parent, name, path);
+    if (excluded >= 0) {
+        count(excludes[excluded].rule, directory);
+        return false;
+    }
+    // Directories are always entered: files below them may match an include
+    if (directory || includes.empty()) return true;
+    if (firstMatch(includes, parent, name, path) >= 0) return true;
+    count(includeRule, false);
+    return false;
+}
+
+bool WalkFilter::admitsSize(uintmax_t size) const {
+    if (size < minSize) {
+        count(minRule, false);
+        return false;
+    }
+    if (size > maxSize) {
+        count(maxRule, false);
+        return false;
+    }
+    return true;
+}
+
+void WalkFilter::countOtherDevice() const {
+    count(deviceRule, true);
+}
+
+std::vector<FilterCount> WalkFilter::counts() const {
+    std::vector<FilterCount> result;
+    for (size_t i = 0; i < rules.size(); ++i) {
+        result.push_back({rules[i], fileCounts[i].load(std::memory_order_relaxed),
+                          directoryCounts[i].load(std::memory_order_relaxed)});
+    }
+    return result;
+}
+
+// Function to print what each filter rule kept out of the walk
+void printFilterCounts(const std::vector<FilterCount>& counts, std::ostream& out) {
+    bool header = false;
+    for (const auto& count : counts) {
+        if (count.files == 0 && count.directories == 0) continue;
+        if (!header) {
+            out << "Filtered out:\n";
+            header = true;
+        }
+        out << "  " << count.rule << ": " << count.files << " files, " << count.directories << " directories\n";
+    }
+}
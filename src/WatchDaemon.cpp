@@ -0,0 +1,450 @@
+#include "WatchDaemon.h"
+#include "DirectoryWalker.h"
+#include "DuplicateIndex.h"
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <set>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+// Events that add, remove or rewrite an entry of a watched directory
+constexpr uint32_t kWatchMask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                                IN_MOVED_TO | IN_ONLYDIR | IN_EXCL_UNLINK;
+
+constexpr size_t kEventBufferSize = 64 * 1024;
+
+// Under constant churn a batch is applied after this many settle periods
+// even if events never go quiet
+constexpr unsigned kMaxSettlePeriods = 10;
+
+void reportError(const std::string& what, int error) {
+    std::cerr << what << ": " << std::error_code(error, std::generic_category()).message() << std::endl;
+}
+
+// Paths are indexed and queried in one absolute, normalised spelling
+std::string normalisePath(const std::string& path) {
+    std::error_code ec;
+    std::filesystem::path absolute = std::filesystem::absolute(path, ec);
+    return (ec ? std::filesystem::path(path) : absolute).lexically_normal().string();
+}
+
+// Reads newline-terminated lines from a socket
+class LineReader {
+public:
+    explicit LineReader(int fd) : fd(fd) {}
+
+    // Returns false at end of stream or on error
+    bool next(std::string& line) {
+        for (;;) {
+            size_t end = buffer.find('\n');
+            if (end != std::string::npos) {
+                line = buffer.substr(0, end);
+                buffer.erase(0, end + 1);
+                return true;
+            }
+            char chunk[4096];
+            ssize_t n = ::read(fd, chunk, sizeof(chunk));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            buffer.append(chunk, static_cast<size_t>(n));
+        }
+    }
+
+private:
+    int fd;
+    std::string buffer;
+};
+
+bool writeAll(int fd, const std::string& data) {
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t n = ::send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+std::string answer(const DuplicateIndex& index, const std::string& file) {
+    std::vector<std::string> others;
+    if (!index.duplicatesOf(normalisePath(file), others)) return "unknown\n";
+    if (others.empty()) return "unique\n";
+    std::string reply = "duplicate " + std::to_string(others.size()) + "\n";
+    for (const auto& other : others) reply += other + '\n';
+    return reply;
+}
+
+// Answers queries from any number of clients on one thread. Lookups are
+// in memory, so a client is never kept waiting behind another's hashing.
+class QueryServer {
+public:
+    QueryServer(int listenFd, const DuplicateIndex& index) : listenFd(listenFd), index(index) {}
+
+    bool start() {
+        stopFd = ::eventfd(0, EFD_CLOEXEC);
+        if (stopFd < 0) {
+            reportError("Cannot create eventfd", errno);
+            return false;
+        }
+        thread = std::thread([this] { serve(); });
+        return true;
+    }
+
+    void stop() {
+        uint64_t one = 1;
+        if (::write(stopFd, &one, sizeof(one)) < 0) reportError("Cannot stop query server", errno);
+        thread.join();
+        ::close(stopFd);
+    }
+
+private:
+    void serve() {
+        std::unordered_map<int, std::string> clients;  // Pending input per connection
+        for (;;) {
+            std::vector<pollfd> fds = {{stopFd, POLLIN, 0}, {listenFd, POLLIN, 0}};
+            for (const auto& client : clients) fds.push_back({client.first, POLLIN, 0});
+            if (::poll(fds.data(), fds.size(), -1) < 0) {
+                if (errno == EINTR) continue;
+                reportError("Query server poll failed", errno);
+                break;
+            }
+            if (fds[0].revents) break;
+            if (fds[1].revents & POLLIN) {
+                int client = ::accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+                if (client >= 0) clients.emplace(client, std::string());
+            }
+            for (size_t i = 2; i < fds.size(); ++i) {
+                if (!fds[i].revents) continue;
+                if (!serveClient(fds[i].fd, clients[fds[i].fd])) {
+                    ::close(fds[i].fd);
+                    clients.erase(fds[i].fd);
+                }
+            }
+        }
+        for (const auto& client : clients) ::close(client.first);
+    }
+
+    // Answer every complete line received; false once the client is gone
+    bool serveClient(int fd, std::string& pending) {
+        char chunk[4096];
+        ssize_t n = ::read(fd, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) return true;
+        if (n <= 0) return false;
+        pending.append(chunk, static_cast<size_t>(n));
+
+        std::string replies;
+        size_t end;
+        while ((end = pending.find('\n')) != std::string::npos) {
+            replies += answer(index, pending.substr(0, end));
+            pending.erase(0, end + 1);
+        }
+        return replies.empty() || writeAll(fd, replies);
+    }
+
+    int listenFd;
+    const DuplicateIndex& index;
+    int stopFd = -1;
+    std::thread thread;
+};
+
+// inotify watches on every indexed directory, by watch descriptor
+class Watches {
+public:
+    explicit Watches(int fd) : fd(fd) {}
+
+    void add(const std::string& directory) {
+        int wd = ::inotify_add_watch(fd, directory.c_str(), kWatchMask);
+        if (wd >= 0) {
+            paths[wd] = directory;
+        } else if (errno == ENOSPC) {
+            if (!warnedLimit) {
+                std::cerr << "Out of inotify watches; raise fs.inotify.max_user_watches. "
+                          << "Changes below " << directory << " and other unwatched directories are missed."
+                          << std::endl;
+                warnedLimit = true;
+            }
+        } else if (errno != ENOENT) {
+            reportError("Cannot watch " + directory, errno);
+        }
+    }
+
+    // Stop watching directory and everything below it
+    void removeUnder(const std::string& directory) {
+        const std::string prefix = directory + '/';
+        for (auto it = paths.begin(); it != paths.end();) {
+            if (it->second == directory || it->second.compare(0, prefix.size(), prefix) == 0) {
+                ::inotify_rm_watch(fd, it->first);
+                it = paths.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void clear() {
+        for (const auto& entry : paths) ::inotify_rm_watch(fd, entry.first);
+        paths.clear();
+    }
+
+    const std::string* find(int wd) const {
+        auto it = paths.find(wd);
+        return it == paths.end() ? nullptr : &it->second;
+    }
+
+    void forget(int wd) { paths.erase(wd); }
+    size_t size() const { return paths.size(); }
+
+private:
+    int fd;
+    std::unordered_map<int, std::string> paths;
+    bool warnedLimit = false;
+};
+
+// Changes gathered from events since the last update
+struct PendingChanges {
+    std::set<std::string> files;                 // Created, rewritten, moved or removed files
+    std::vector<std::string> createdDirectories; // Directories created or moved in
+    std::vector<std::string> removedDirectories; // Directories removed or moved out
+    bool overflowed = false;                     // Events were lost; rebuild from scratch
+
+    bool empty() const {
+        return files.empty() && createdDirectories.empty() && removedDirectories.empty() && !overflowed;
+    }
+};
+
+// Excluded names are dropped as the walk drops them, so a pruned directory
+// is never walked or watched
+void readEvents(int inotify_fd, Watches& watches, const WalkFilter* filter, PendingChanges& changes) {
+    alignas(struct inotify_event) char buffer[kEventBufferSize];
+    for (;;) {
+        ssize_t n = ::read(inotify_fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        for (ssize_t offset = 0; offset < n;) {
+            const auto* event = reinterpret_cast<const struct inotify_event*>(buffer + offset);
+            offset += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                changes.overflowed = true;
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                watches.forget(event->wd);
+                continue;
+            }
+            const std::string* directory = watches.find(event->wd);
+            if (!directory || event->len == 0) continue;
+            const bool is_directory = (event->mask & IN_ISDIR) != 0;
+            if (filter ? !filter->admits(*directory, event->name, is_directory)
+                       : std::strchr(event->name, '$') != nullptr) {
+                continue;
+            }
+
+            std::string path = (std::filesystem::path(*directory) / event->name).string();
+            if (!is_directory) {
+                changes.files.insert(std::move(path));
+            } else if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                changes.createdDirectories.push_back(std::move(path));
+            } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                changes.removedDirectories.push_back(std::move(path));
+            }
+        }
+    }
+}
+
+// Fold pending changes into the index and the watch set
+void applyChanges(PendingChanges& changes, const std::vector<std::string>& roots,
+                  const FinderOptions& options, DuplicateIndex& index, Watches& watches) {
+    if (changes.overflowed) {
+        std::cout << "Event queue overflowed; rescanning" << std::endl;
+        watches.clear();
+        for (const auto& directory : index.build(roots)) watches.add(directory);
+        changes = PendingChanges();
+        return;
+    }
+
+    for (const auto& directory : changes.removedDirectories) {
+        watches.removeUnder(directory);
+        for (auto& file : index.filesUnder(directory)) changes.files.insert(std::move(file));
+    }
+    // A new directory may already hold files (a move, or a copy racing the
+    // watch), so walk it and watch everything below it
+    for (const auto& directory : changes.createdDirectories) {
+        TreeSnapshot tree;
+        FileCatalogue catalogue;
+        WalkOptions walk = options.walk;
+        walk.previous = nullptr;
+        walk.snapshot = &tree;
+        walkDirectories({directory}, walk, catalogue);
+        for (const auto& entry : tree) {
+            watches.add(entry.first);
+            // The snapshot lists files the walk filtered out; update()
+            // applies the size bounds once it has stat'ed the rest
+            for (const auto& file : entry.second.files) {
+                if (options.walk.filter && !options.walk.filter->admits(entry.first, file.first.c_str(), false)) {
+                    continue;
+                }
+                changes.files.insert((std::filesystem::path(entry.first) / file.first).string());
+            }
+        }
+    }
+
+    std::vector<std::string> touched(changes.files.begin(), changes.files.end());
+    index.update(touched);
+    std::cout << "Applied " << touched.size() << " changed paths; "
+              << index.fileCount() << " files indexed" << std::endl;
+    changes = PendingChanges();
+}
+
+int listenOn(const std::string& socketPath) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path too long: " << socketPath << std::endl;
+        return -1;
+    }
+    std::strcpy(address.sun_path, socketPath.c_str());
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        reportError("Cannot create socket", errno);
+        return -1;
+    }
+    ::unlink(socketPath.c_str());
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || ::listen(fd, 64) != 0) {
+        reportError("Cannot listen on " + socketPath, errno);
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+} // namespace
+
+// Function to serve duplicate queries while tracking changes to the roots
+bool runWatchDaemon(const std::vector<std::string>& roots, const FinderOptions& options,
+                    const std::string& socketPath, unsigned settleMs) {
+    // Signals are taken from a signalfd, so block them before any thread starts
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    int signal_fd = ::signalfd(-1, &signals, SFD_CLOEXEC);
+    int inotify_fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (signal_fd < 0 || inotify_fd < 0) {
+        reportError("Cannot set up event sources", errno);
+        if (signal_fd >= 0) ::close(signal_fd);
+        if (inotify_fd >= 0) ::close(inotify_fd);
+        return false;
+    }
+
+    std::vector<std::string> absolute_roots;
+    for (const auto& root : roots) absolute_roots.push_back(normalisePath(root));
+
+    // Changes made during the initial scan of a directory are missed until
+    // the next event there; watches can only be placed once it is known
+    Metrics metrics;
+    DuplicateIndex index(options, metrics);
+    Watches watches(inotify_fd);
+    for (const auto& directory : index.build(absolute_roots)) watches.add(directory);
+
+    int listen_fd = listenOn(socketPath);
+    QueryServer server(listen_fd, index);
+    if (listen_fd < 0 || !server.start()) {
+        if (listen_fd >= 0) ::close(listen_fd);
+        ::close(inotify_fd);
+        ::close(signal_fd);
+        return false;
+    }
+    std::cout << "Indexed " << index.fileCount() << " files in " << watches.size()
+              << " directories; listening on " << socketPath << std::endl;
+
+    PendingChanges changes;
+    auto first_change = std::chrono::steady_clock::now();
+    const auto max_delay = std::chrono::milliseconds(settleMs) * kMaxSettlePeriods;
+    for (;;) {
+        pollfd fds[] = {{signal_fd, POLLIN, 0}, {inotify_fd, POLLIN, 0}};
+        int ready = ::poll(fds, 2, changes.empty() ? -1 : static_cast<int>(settleMs));
+        if (ready < 0 && errno != EINTR) {
+            reportError("Watch poll failed", errno);
+            break;
+        }
+        if (fds[0].revents & POLLIN) break;
+        if (ready > 0 && (fds[1].revents & POLLIN)) {
+            if (changes.empty()) first_change = std::chrono::steady_clock::now();
+            readEvents(inotify_fd, watches, options.walk.filter, changes);
+        }
+        // Apply the batch once events have been quiet for settleMs, or have
+        // kept arriving for too long
+        if (!changes.empty() &&
+            (ready == 0 || std::chrono::steady_clock::now() - first_change >= max_delay)) {
+            applyChanges(changes, absolute_roots, options, index, watches);
+        }
+    }
+
+    std::cout << "Stopping watch daemon" << std::endl;
+    server.stop();
+    ::close(listen_fd);
+    ::unlink(socketPath.c_str());
+    ::close(inotify_fd);
+    ::close(signal_fd);
+    return true;
+}
+
+// Function to query a running watch daemon about each file
+bool queryWatchDaemon(const std::string& socketPath, const std::vector<std::string>& files,
+                      std::ostream& out) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path too long: " << socketPath << std::endl;
+        return false;
+    }
+    std::strcpy(address.sun_path, socketPath.c_str());
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        reportError("Cannot connect to " + socketPath, errno);
+        if (fd >= 0) ::close(fd);
+        return false;
+    }
+
+    LineReader reader(fd);
+    bool ok = true;
+    for (const auto& file : files) {
+        std::string line;
+        if (!writeAll(fd, normalisePath(file) + '\n') || !reader.next(line)) {
+            std::cerr << "Watch daemon closed the connection" << std::endl;
+            ok = false;
+            break;
+        }
+        if (line.rfind("duplicate ", 0) == 0) {
+            out << file << ": duplicate of\n";
+            for (size_t count = std::stoul(line.substr(10)); count > 0 && reader.next(line); --count) {
+                out << "  " << line << '\n';
+            }
+        } else if (line == "unique") {
+            out << file << ": unique\n";
+        } else {
+            out << file << ": not indexed\n";
+        }
+    }
+    ::close(fd);
+    return ok;
+}
@@ -1,49 +1,483 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <type_traits>
 #include <vector>
 #include <string>
 #include <filesystem>
+#include "CatalogueShard.h"
 #include "DuplicateFinder.h"
+#include "ExternalGrouping.h"
+#include "FileCatalogue.h"
 #include "FileUtils.h"
+#include "NearDuplicates.h"
 #include "ProgressBar.h"
+#include "Profiler.h"
+#include "ReferenceIndex.h"
+#include "ResultSink.h"
+#include "Telemetry.h"
+#include "WalkFilter.h"
+#include "WatchDaemon.h"
 
+#include <unistd.h>
 #include <gtest/gtest.h>
 
+static void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " [options] [directory...]\n"
+              << "       " << program << " --query SOCKET file...\n"
+              << "  --hash NAME      Hash engine: xxh3 (default), md5 or sha256\n"
+              << "  --io NAME        Read backend for full hashing: pread (default), mmap, direct, stream\n"
+              << "                   or uring (asynchronous, falls back to pread if unavailable)\n"
+              << "  --queue-depth N  Reads kept in flight by the uring backend (default 64)\n"
+              << "  --hash-threads N Hashing threads for the uring backend (default min(4, cores))\n"
+              << "  --head-bytes N   Bytes hashed from the start of each candidate (default 4096)\n"
+              << "  --tail-bytes N   Bytes hashed from the end of each candidate, 0 to disable (default 4096)\n"
+              << "  --no-partial     Skip the head/tail prefilter and hash candidates in full\n"
+              << "  --chunk-size N   Tree-hash files larger than N bytes in N-byte chunks, hashed in\n"
+              << "                   parallel; a multiple of 1 MiB, 0 to disable (default 64 MiB)\n"
+              << "  --keep-links     Report hard links and reflinked copies as ordinary duplicates\n"
+              << "  --verify         Confirm hash matches byte for byte before reporting them\n"
+              << "  --no-device-scheduling Hash from one shared pool instead of a pool per device\n"
+              << "  --walk-threads N Directory walker threads (default: hardware threads)\n"
+              << "  --min-size N     Skip files smaller than N bytes\n"
+              << "  --max-size N     Skip files larger than N bytes\n"
+              << "  --include GLOB   Only scan files matching GLOB (repeatable); a GLOB with '/' is\n"
+              << "                   matched against the full path, otherwise against the name\n"
+              << "  --exclude GLOB   Skip files and directories matching GLOB (repeatable); excluded\n"
+              << "                   directories are not descended. Names with '$' are always skipped\n"
+              << "  --include-regex RE Only scan files whose path contains a match for RE (repeatable)\n"
+              << "  --exclude-regex RE Skip files and directories whose path contains a match for RE\n"
+              << "  --one-file-system Do not descend into directories on other filesystems than the root\n"
+              << "  --cache FILE     Reuse digests of unchanged files from FILE and update it\n"
+              << "  --snapshot FILE  Skip reading directories unchanged since the tree snapshot in FILE\n"
+              << "                   and update it\n"
+              << "  --format NAME    Result format: text (default), jsonl, csv or binary; machine\n"
+              << "                   formats stream each group as soon as it is confirmed\n"
+              << "  --output FILE    Write results to FILE instead of standard output\n"
+              << "  --stats-json FILE Append a JSON line of progress counters to FILE (- for stderr)\n"
+              << "                   every --stats-interval seconds (default 5)\n"
+              << "  --profile        Report stage times, thread utilisation, per-file latencies and\n"
+              << "                   bytes read per device after the scan\n"
+              << "  --trace FILE     Write a Chrome trace-event timeline of the scan to FILE\n"
+              << "  --watch SOCKET   Stay running: keep a live duplicate index from inotify events\n"
+              << "                   and answer queries on the Unix socket SOCKET\n"
+              << "  --query SOCKET   Ask a running --watch daemon whether each file is a duplicate\n"
+              << "  --near           Report pairs of files sharing content-defined chunks, and the\n"
+              << "                   bytes chunk-level deduplication would reclaim\n"
+              << "  --near-ratio R   Smallest shared share of the larger file to report (default 0.5)\n"
+              << "  --chunk-average N Average content-defined chunk size, a power of two (default 8192)\n"
+              << "  --memory-limit MIB Group through sorted runs on disk, holding at most MIB MiB of\n"
+              << "                   file records in memory; groups are streamed in order of size\n"
+              << "  --spill-dir DIR  Directory for the sorted runs (default: the system temp directory)\n"
+              << "  --shard-out FILE Hash every file under the directories and write a sorted catalogue\n"
+              << "                   shard to FILE instead of reporting duplicates\n"
+              << "  --node NAME      Label for this shard's paths in merged groups (default: host name)\n"
+              << "  --merge-shards   Treat the arguments as shards and report duplicates across them\n"
+              << "  --build-index FILE Hash every file under the directories into a sorted reference\n"
+              << "                   index at FILE instead of reporting duplicates\n"
+              << "  --index FILE     Report files under the directories whose contents are already in\n"
+              << "                   the reference index FILE; only sizes it holds are hashed\n";
+}
+
+// Parse a whole non-negative number; false for junk, a sign or overflow
+template <typename T>
+static bool parseNumber(const char* text, T& value) {
+    if (*text == '\0' || *text == '-' || *text == '+' || std::isspace(static_cast<unsigned char>(*text))) {
+        return false;
+    }
+    char* end = nullptr;
+    errno = 0;
+    if constexpr (std::is_floating_point<T>::value) {
+        const double parsed = std::strtod(text, &end);
+        if (errno != 0 || *end != '\0' || !std::isfinite(parsed)) return false;
+        value = static_cast<T>(parsed);
+    } else {
+        const unsigned long long parsed = std::strtoull(text, &end, 10);
+        if (errno != 0 || *end != '\0' || parsed > std::numeric_limits<T>::max()) return false;
+        value = static_cast<T>(parsed);
+    }
+    return true;
+}
+
+static int invalidValue(const char* program, const std::string& option, const char* value) {
+    std::cerr << "Invalid value for " << option << ": " << value << std::endl;
+    printUsage(program);
+    return 1;
+}
+
+static void printLinkSets(std::ostream& out, const char* title,
+                          const std::vector<std::vector<std::filesystem::path>>& sets) {
+    if (sets.empty()) return;
+    out << title << '\n';
+    for (const auto& set : sets) {
+        for (const auto& file : set) {
+            out << "  " << file << '\n';
+        }
+        out << std::endl;
+    }
+}
+
 int main(int argc, char **argv) {
     std::vector<std::string> directories = {"/mnt/c/", "/mnt/d/"};
     //std::vector<std::string> directories = {"c:", "d:"};
-	if (argc == 3) {
-		directories = std::vector<std::string> { argv[1], argv[2] };
-	}
+    FinderOptions options;
+    std::string cachePath;
+    std::string snapshotPath;
+    std::string watchSocket;
+    std::string querySocket;
+    OutputFormat format = OutputFormat::Text;
+    std::string outputPath;
+    std::string statsPath;
+    double statsInterval = 5;
+    bool profile = false;
+    std::string tracePath;
+    bool near = false;
+    NearDuplicateOptions nearOptions;
+    bool external = false;
+    ExternalOptions externalOptions;
+    std::string shardPath;
+    std::string nodeName;
+    bool mergeShards = false;
+    FilterRules filterRules;
+    std::string buildIndexPath;
+    std::string indexPath;
 
-    ProgressBar scanProgress(directories.size(), "Scanning Directories");
+    // Parse options; any remaining arguments replace the default directories
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--hash" && has_value) {
+            if (!parseHashAlgorithm(argv[++i], options.hashAlgorithm)) {
+                std::cerr << "Unknown hash engine: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (arg == "--io" && has_value) {
+            if (std::string(argv[++i]) == "uring") {
+                options.ioUring = true;
+            } else if (!parseReadBackend(argv[i], options.readBackend)) {
+                std::cerr << "Unknown read backend: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (arg == "--queue-depth" && has_value) {
+            if (!parseNumber(argv[++i], options.uring.queueDepth)) return invalidValue(argv[0], arg, argv[i]);
+        } else if (arg == "--hash-threads" && has_value) {
+            if (!parseNumber(argv[++i], options.uring.hashThreads)) return invalidValue(argv[0], arg, argv[i]);
+        } else if (arg == "--walk-threads" && has_value) {
+            if (!parseNumber(argv[++i], options.walk.threads)) return invalidValue(argv[0], arg, argv[i]);
+        } else if (arg == "--min-size" && has_value) {
+            if (!parseNumber(argv[++i], filterRules.minSize)) return invalidValue(argv[0], arg, argv[i]);
+        } else if (arg == "--max-size" && has_value) {
+            if (!parseNumber(argv[++i], filterRules.maxSize)) return invalidValue(argv[0], arg, argv[i]);
+        } else if (arg == "--include" && has_value) {
+            filterRules.includeGlobs.push_back(argv[++i]);
+        } else if (arg == "--exclude" && has_value) {
+            filterRules.excludeGlobs.push_back(argv[++i]);
+        } else if (arg == "--include-regex" && has_value) {
+            filterRules.includeRegexes.push_back(argv[++i]);
+        } else if (arg == "--exclude-regex" && has_value) {
+            filterRules.excludeRegexes.push_back(argv[++i]);
+        } else if (arg == "--one-file-system") {
+            filterRules.oneFileSystem = true;
+        } else if (arg == "--head-bytes" && has_value) {
+            if (!parseNumber(argv[++i], options.headBlockSize)) return invalidValue(argv[0], arg, argv[i]);
+        } else if (arg == "--tail-bytes" && has_value) {
+            if (!parseNumber(argv[++i], options.tailBlockSize)) return invalidValue(argv[0], arg, argv[i]);
+        } else if (arg == "--chunk-size" && has_value) {
+            if (!parseNumber(argv[++i], options.treeChunkBytes)) return invalidValue(argv[0], arg, argv[i]);
+            if (options.treeChunkBytes % (1 << 20) != 0) {
+                std::cerr << "Chunk size must be a multiple of 1 MiB: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (arg == "--cache" && has_value) {
+            cachePath = argv[++i];
+        } else if (arg == "--snapshot" && has_value) {
+            snapshotPath = argv[++i];
+        } else if (arg == "--format" && has_value) {
+            if (!parseOutputFormat(argv[++i], format)) {
+                std::cerr << "Unknown output format: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (arg == "--output" && has_value) {
+            outputPath = argv[++i];
+        } else if (arg == "--stats-json" && has_value) {
+            statsPath = argv[++i];
+        } else if (arg == "--stats-interval" && has_value) {
+            if (!parseNumber(argv[++i], statsInterval)) return invalidValue(argv[0], arg, argv[i]);
+        } else if (arg == "--trace" && has_value) {
+            tracePath = argv[++i];
+        } else if (arg == "--profile") {
+            profile = true;
+        } else if (arg == "--watch" && has_value) {
+            watchSocket = argv[++i];
+        } else if (arg == "--query" && has_value) {
+            querySocket = argv[++i];
+        } else if (arg == "--no-partial") {
+            options.partialHash = false;
+        } else if (arg == "--keep-links") {
+            options.collapseLinks = false;
+        } else if (arg == "--verify") {
+            options.verify = true;
+        } else if (arg == "--no-device-scheduling") {
+            options.scheduleByDevice = false;
+        } else if (arg == "--near") {
+            near = true;
+        } else if (arg == "--near-ratio" && has_value) {
+            if (!parseNumber(argv[++i], nearOptions.minSharedRatio)) return invalidValue(argv[0], arg, argv[i]);
+        } else if (arg == "--chunk-average" && has_value) {
+            size_t average = 0;
+            if (!parseNumber(argv[++i], average)) return invalidValue(argv[0], arg, argv[i]);
+            if (average < 256 || (average & (average - 1)) != 0) {
+                std::cerr << "Chunk average must be a power of two of at least 256: " << argv[i] << std::endl;
+                return 1;
+            }
+            nearOptions.chunking.averageSize = average;
+            nearOptions.chunking.minSize = average / 4;
+            nearOptions.chunking.maxSize = average * 8;
+        } else if (arg == "--memory-limit" && has_value) {
+            uint64_t mebibytes = 0;
+            if (!parseNumber(argv[++i], mebibytes) || mebibytes > (UINT64_MAX >> 20)) {
+                return invalidValue(argv[0], arg, argv[i]);
+            }
+            if (mebibytes < 16) {
+                std::cerr << "Memory limit must be at least 16 MiB: " << argv[i] << std::endl;
+                return 1;
+            }
+            external = true;
+            externalOptions.memoryLimit = mebibytes << 20;
+        } else if (arg == "--spill-dir" && has_value) {
+            externalOptions.spillDirectory = argv[++i];
+        } else if (arg == "--shard-out" && has_value) {
+            shardPath = argv[++i];
+        } else if (arg == "--node" && has_value) {
+            nodeName = argv[++i];
+        } else if (arg == "--merge-shards") {
+            mergeShards = true;
+        } else if (arg == "--build-index" && has_value) {
+            buildIndexPath = argv[++i];
+        } else if (arg == "--index" && has_value) {
+            indexPath = argv[++i];
+        } else if (arg == "--help" || arg == "-h") {
+            printUsage(argv[0]);
+            return 0;
+        } else if (arg.rfind("--", 0) == 0) {
+            std::cerr << "Unknown or incomplete option: " << arg << std::endl;
+            printUsage(argv[0]);
+            return 1;
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    if (mergeShards && positional.empty()) {
+        std::cerr << "--merge-shards needs at least one shard" << std::endl;
+        printUsage(argv[0]);
+        return 1;
+    }
+    // Every walk applies the filter; it is compiled once and shared by the walker threads
+    WalkFilter filter;
+    if (!filter.compile(filterRules)) {
+        return 1;
+    }
+    options.walk.filter = &filter;
+    if (!querySocket.empty()) {
+        return queryWatchDaemon(querySocket, positional, std::cout) ? 0 : 1;
+    }
+    if (!positional.empty()) {
+        directories = positional;
+    }
+    if (!watchSocket.empty()) {
+        return runWatchDaemon(directories, options, watchSocket) ? 0 : 1;
+    }
+    if (near) {
+        // Near-duplicate mode: chunk every file found instead of comparing whole files
+        for (const auto& dir : directories) {
+            std::cout << "Directory to scan: " << dir << std::endl;
+        }
+        FileCatalogue catalogue;
+        walkDirectories(directories, options.walk, catalogue);
+        std::vector<std::filesystem::path> files;
+        for (FileCatalogue::Index i = 0; i < catalogue.size(); ++i) files.push_back(catalogue.path(i));
+        nearOptions.readBackend = options.readBackend;
+        ProgressBar chunkProgress(0, "Chunking Files", std::cout);
+        NearDuplicateReport report = findNearDuplicates(files, nearOptions, &chunkProgress.metrics());
+        chunkProgress.complete();
+        printNearDuplicates(report, std::cout);
+        return 0;
+    }
+
+    if (!shardPath.empty() && (external || options.verify)) {
+        std::cerr << "--shard-out cannot be combined with --memory-limit or --verify" << std::endl;
+        return 1;
+    }
+    if (!buildIndexPath.empty() && !indexPath.empty()) {
+        std::cerr << "--build-index and --index cannot be combined" << std::endl;
+        return 1;
+    }
+    if ((!buildIndexPath.empty() || !indexPath.empty()) && (!shardPath.empty() || external || options.verify)) {
+        std::cerr << "--build-index and --index cannot be combined with --shard-out, --memory-limit or --verify"
+                  << std::endl;
+        return 1;
+    }
+    if (!shardPath.empty() && nodeName.empty()) {
+        char host[256] = {};
+        if (::gethostname(host, sizeof(host) - 1) == 0) nodeName = host;
+    }
+    if (external && (!cachePath.empty() || !snapshotPath.empty() || options.verify)) {
+        std::cerr << "--memory-limit cannot be combined with --cache, --snapshot or --verify" << std::endl;
+        return 1;
+    }
+
+    // A query hashes the new tree with the engine the index was built with
+    ReferenceIndex referenceIndex;
+    if (!indexPath.empty()) {
+        if (!referenceIndex.open(indexPath)) {
+            return 1;
+        }
+        options.hashAlgorithm = referenceIndex.algorithm();
+        options.treeChunkBytes = referenceIndex.chunkBytes();
+    }
+
+    // Load the digest cache; entries for files not seen in this scan are dropped
+    FileCache cache;
+    if (!cachePath.empty()) {
+        cache = loadCache(cachePath, options.hashAlgorithm);
+        options.cache = &cache;
+        options.pruneCache = true;
+    }
+
+    // Load the previous tree snapshot; the walk records the current one
+    TreeSnapshot previousSnapshot;
+    TreeSnapshot snapshot;
+    if (!snapshotPath.empty()) {
+        previousSnapshot = loadSnapshot(snapshotPath);
+        options.walk.previous = &previousSnapshot;
+        options.walk.snapshot = &snapshot;
+    }
+
+    // Results go to the output file or standard output; when standard
+    // output carries a machine format or streamed text, progress and the
+    // report use stderr
+    std::ofstream outputFile;
+    if (!outputPath.empty()) {
+        outputFile.open(outputPath, std::ios::binary | std::ios::trunc);
+        if (!outputFile) {
+            std::cerr << "Cannot open output file " << outputPath << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& results = outputPath.empty() ? std::cout : outputFile;
+    const bool streamed = external || !indexPath.empty();
+    std::ostream& log = outputPath.empty() && (format != OutputFormat::Text || streamed) ? std::cerr : std::cout;
+
+    // Machine formats stream groups as they are confirmed; the text listing
+    // is printed once the progress bar is done with the terminal, except
+    // when grouping on disk, which never holds all the groups, or querying
+    // a reference index, which reports matches as it finds them
+    std::unique_ptr<ResultSink> sink = createResultSink(format, results, options.hashAlgorithm);
+    if (format != OutputFormat::Text || streamed) {
+        options.sink = sink.get();
+    }
+
+    // Shard merging reads nothing but the shards named on the command line
+    if (mergeShards) {
+        ShardMergeStats mergeStats;
+        if (!mergeCatalogueShards(positional, options.hashAlgorithm, *sink, &mergeStats)) {
+            return 1;
+        }
+        printShardMergeStats(mergeStats, log);
+        return 0;
+    }
 
-    // Scan directories and collect all files
-    std::vector<std::filesystem::path> allFiles;
     for (const auto& dir : directories) {
-        auto files = getAllFiles(dir);
-        allFiles.insert(allFiles.end(), files.begin(), files.end());
-        scanProgress.update(allFiles.size());
+        log << "Directory to scan: " << dir << std::endl;
     }
-    scanProgress.complete();
 
-    // Initialize progress bar for comparison
-    ProgressBar compareProgress(allFiles.size(), "Comparing Files");
+    // Initialize progress bar for comparison. Each stage sets its own file
+    // and byte totals once they are known.
+    ProgressBar compareProgress(0, "Comparing Files", log);
 
-    // Compare files to find duplicates
-    auto duplicates = findDuplicateFiles(allFiles, compareProgress);
+    // Export the same counters for monitoring
+    std::ofstream statsFile;
+    std::unique_ptr<StatsReporter> statsReporter;
+    if (!statsPath.empty()) {
+        if (statsPath != "-") {
+            statsFile.open(statsPath, std::ios::app);
+            if (!statsFile) {
+                std::cerr << "Cannot open stats file " << statsPath << std::endl;
+                return 1;
+            }
+        }
+        const auto interval = std::chrono::milliseconds(static_cast<long long>(std::max(0.1, statsInterval) * 1000));
+        statsReporter = std::make_unique<StatsReporter>(compareProgress.metrics(),
+                                                        statsPath == "-" ? std::cerr : statsFile, interval);
+    }
+
+    // Instrument the scan only when asked; otherwise the hooks are skipped
+    std::unique_ptr<Profiler> profiler;
+    if (profile || !tracePath.empty()) {
+        profiler = std::make_unique<Profiler>(!tracePath.empty());
+        options.profiler = profiler.get();
+    }
+
+    // Walk the directories and compare files to find duplicates
+    PipelineStats stats;
+    std::vector<std::vector<std::filesystem::path>> duplicates;
+    bool grouped = true;
+    ReferenceQueryStats queryStats;
+    if (!buildIndexPath.empty()) {
+        grouped = buildReferenceIndex(directories, buildIndexPath, compareProgress, options, &stats);
+    } else if (!indexPath.empty()) {
+        grouped = queryReferenceIndex(referenceIndex, directories, compareProgress, options, *sink, &stats,
+                                      &queryStats);
+    } else if (!shardPath.empty()) {
+        grouped = writeCatalogueShard(directories, shardPath, nodeName, compareProgress, options, &stats);
+    } else if (external) {
+        grouped = findDuplicatesExternal(directories, compareProgress, options, externalOptions, &stats);
+    } else {
+        duplicates = findDuplicatesInDirectories(directories, compareProgress, options, &stats);
+    }
     compareProgress.complete();
+    if (statsReporter) statsReporter->stop();
 
     // Display duplicate files
-    if (!duplicates.empty()) {
-        std::cout << "Duplicate files found:\n";
-        for (const auto& group : duplicates) {
-            for (const auto& file : group) {
-                std::cout << "  " << file << '\n';
-            }
-            std::cout << std::endl;
+    if (format == OutputFormat::Text && !streamed && shardPath.empty() && buildIndexPath.empty()) {
+        for (auto& files : duplicates) {
+            DuplicateGroup group;
+            group.files = std::move(files);
+            sink->group(group);
         }
-    } else {
-        std::cout << "No duplicate files found." << std::endl;
+        sink->finish();
+    }
+
+    // Display paths that were read once and are not reclaimable duplicates
+    printLinkSets(log, "Hard links (one file under several names):", stats.hardLinks);
+    printLinkSets(log, "Already deduplicated (all extents shared):", stats.reflinks);
+
+    if (!shardPath.empty() && grouped) log << "Wrote catalogue shard " << shardPath << std::endl;
+    if (!buildIndexPath.empty() && grouped) log << "Wrote reference index " << buildIndexPath << std::endl;
+    if (!indexPath.empty()) printReferenceQueryStats(queryStats, log);
+    printFilterCounts(filter.counts(), log);
+    printPipelineStats(stats, log);
+    if (profile) profiler->printReport(log);
+    if (!tracePath.empty() && !profiler->writeTrace(tracePath)) {
+        return 1;
+    }
+    if (!grouped) {
+        return 1;
+    }
+
+    if (!cachePath.empty() && !saveCache(cache, cachePath, options.hashAlgorithm)) {
+        return 1;
+    }
+    if (!snapshotPath.empty() && !saveSnapshot(snapshot, snapshotPath)) {
+        return 1;
     }
 
     return 0;
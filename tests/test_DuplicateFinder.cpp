@@ -1,9 +1,36 @@
 #include <gtest/gtest.h>
 #include "DuplicateFinder.h"
 #include "FileUtils.h"
+#include "FileCatalogue.h"
+#include "Verifier.h"
+#include "DuplicateIndex.h"
+#include "ResultSink.h"
+#include "Telemetry.h"
+#include "Profiler.h"
+#include "IoScheduler.h"
+#include "ContentChunker.h"
+#include "NearDuplicates.h"
+#include "CatalogueShard.h"
+#include "ExternalGrouping.h"
+#include "ReferenceIndex.h"
+#include "WalkFilter.h"
+#include "WatchDaemon.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
 #include <fstream>
 #include <filesystem>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
+#include <sstream>
+#include <cstdio>
+#include <thread>
+#include <omp.h>
+#include <sys/stat.h>
 
 // Test for duplicate file detection
 TEST(DuplicateFinderTest, DetectDuplicateFilesTest) {
@@ -230,3 +257,1518 @@ TEST(DuplicateFinderTest, IdenticalFilesDifferentContent) {
     std::filesystem::remove_all(temp_dir);
 }
 
+
+// Test that files with a unique size are eliminated before hashing
+TEST(DuplicateFinderTest, SizeStageSkipsUniqueSizes) {
+    std::cout << "DuplicateFinderTest SizeStageSkipsUniqueSizes\n";
+
+    // Setup: two identical files, one same-size different file, one unique size
+    std::string temp_dir = "test_dir_size";
+    std::filesystem::create_directory(temp_dir);
+    std::ofstream(temp_dir + "/a.txt") << "Identical content";
+    std::ofstream(temp_dir + "/b.txt") << "Identical content";
+    std::ofstream(temp_dir + "/c.txt") << "Different content";
+    std::ofstream(temp_dir + "/d.txt") << "Unique length content";
+
+    // Execute: run the full pipeline and collect per-stage statistics
+    std::vector<std::filesystem::path> files = getAllFiles(temp_dir);
+    ProgressBar progress(files.size(), "Comparing Files");
+    PipelineStats stats;
+    auto duplicates = findDuplicateFiles(files, progress, &stats);
+
+    // Verify: one group of two, and the unique-size file never reached hashing
+    ASSERT_EQ(duplicates.size(), 1);
+    EXPECT_EQ(duplicates[0].size(), 2);
+
+    ASSERT_GE(stats.stages.size(), 2);
+    EXPECT_EQ(stats.stages[0].name, "size");
+    EXPECT_EQ(stats.stages[0].filesIn, 4);
+    EXPECT_EQ(stats.stages[0].filesEliminated, 1);
+    EXPECT_EQ(stats.stages[0].bytesEliminated, std::string("Unique length content").size());
+    EXPECT_EQ(stats.stages[1].name, "partial hash");
+    EXPECT_EQ(stats.stages[1].filesIn, 3);
+    EXPECT_EQ(stats.stages[1].filesEliminated, 1);
+
+    // Cleanup: Remove the temporary files and directory
+    std::filesystem::remove_all(temp_dir);
+}
+
+// Test that the head/tail prefilter splits buckets before the full hash
+TEST(DuplicateFinderTest, PartialStageSplitsOnHeadAndTail) {
+    std::cout << "DuplicateFinderTest PartialStageSplitsOnHeadAndTail\n";
+
+    // Setup: four same-size files; one differs in the head, one only in the middle
+    std::string temp_dir = "test_dir_partial";
+    std::filesystem::create_directory(temp_dir);
+    std::ofstream(temp_dir + "/a.bin") << "AAAAxxxxBBBB";
+    std::ofstream(temp_dir + "/b.bin") << "AAAAxxxxBBBB";
+    std::ofstream(temp_dir + "/c.bin") << "AAAAyyyyBBBB";
+    std::ofstream(temp_dir + "/d.bin") << "CCCCxxxxBBBB";
+
+    // Execute: use 4-byte head and tail blocks so the middle is never sampled
+    FinderOptions options;
+    options.headBlockSize = 4;
+    options.tailBlockSize = 4;
+    std::vector<std::filesystem::path> files = getAllFiles(temp_dir);
+    ProgressBar progress(files.size(), "Comparing Files");
+    PipelineStats stats;
+    auto duplicates = findDuplicateFiles(files, progress, options, &stats);
+
+    // Verify: d.bin dies in the partial stage, c.bin in the full hash
+    ASSERT_EQ(duplicates.size(), 1);
+    EXPECT_EQ(duplicates[0].size(), 2);
+
+    ASSERT_EQ(stats.stages.size(), 3);
+    EXPECT_EQ(stats.stages[1].filesIn, 4);
+    EXPECT_EQ(stats.stages[1].filesEliminated, 1);
+    EXPECT_EQ(stats.stages[1].bytesRead, 4 * 8);
+    EXPECT_EQ(stats.stages[1].bytesAvoided, 4);
+    EXPECT_EQ(stats.stages[2].filesIn, 3);
+    EXPECT_EQ(stats.stages[2].filesEliminated, 1);
+
+    // Cleanup: Remove the temporary files and directory
+    std::filesystem::remove_all(temp_dir);
+}
+
+// Test that every hash engine yields a fixed-size binary digest
+TEST(DuplicateFinderTest, HashEnginesProduceBinaryDigests) {
+    std::cout << "DuplicateFinderTest HashEnginesProduceBinaryDigests\n";
+
+    // Setup: two files with different content
+    std::string temp_file1 = "test_engine1.txt";
+    std::string temp_file2 = "test_engine2.txt";
+    std::ofstream(temp_file1) << "Test content";
+    std::ofstream(temp_file2) << "Test contenT";
+
+    // Verify: known vectors for the cryptographic engines
+    EXPECT_EQ(computeFileHash(temp_file1, HashAlgorithm::MD5), "8bfa8e0684108f419933a5995264d150");
+    EXPECT_EQ(computeFileHash(temp_file1, HashAlgorithm::SHA256),
+              "9d9595c5d94fb65b824f56e9999527dba9542481580d69feb89056aabaa0aa87");
+
+    // Verify: XXH3 is 128-bit, deterministic and content-sensitive
+    Digest xxh3 = computeFileDigest(temp_file1, HashAlgorithm::XXH3);
+    EXPECT_EQ(xxh3.size, 16);
+    EXPECT_EQ(xxh3, computeFileDigest(temp_file1, HashAlgorithm::XXH3));
+    EXPECT_NE(xxh3, computeFileDigest(temp_file2, HashAlgorithm::XXH3));
+
+    // Verify: a missing file yields an empty digest
+    EXPECT_TRUE(computeFileDigest("no_such_file.txt", HashAlgorithm::XXH3).empty());
+
+    // Cleanup: Remove the temporary files
+    std::filesystem::remove(temp_file1);
+    std::filesystem::remove(temp_file2);
+}
+
+// Test that the digest cache round-trips and is consulted on re-runs
+TEST(DuplicateFinderTest, DigestCacheSkipsUnchangedFiles) {
+    std::cout << "DuplicateFinderTest DigestCacheSkipsUnchangedFiles\n";
+
+    // Setup: two identical files and a same-size different one
+    std::string temp_dir = "test_dir_cache";
+    std::string cache_file = "test_cache.bin";
+    std::filesystem::create_directory(temp_dir);
+    std::ofstream(temp_dir + "/file1.txt") << "Identical content";
+    std::ofstream(temp_dir + "/file2.txt") << "Identical content";
+    std::ofstream(temp_dir + "/file3.txt") << "Different content";
+    std::vector<std::filesystem::path> files = getAllFiles(temp_dir);
+
+    // Execute: first run populates the cache, which is saved and reloaded
+    FileCache cache;
+    FinderOptions options;
+    options.cache = &cache;
+    ProgressBar progress(files.size(), "Comparing Files");
+    PipelineStats first;
+    auto duplicates = findDuplicateFiles(files, progress, options, &first);
+    ASSERT_EQ(duplicates.size(), 1);
+    EXPECT_EQ(first.cacheHits, 0);
+    EXPECT_EQ(cache.size(), 3);
+    ASSERT_TRUE(saveCache(cache, cache_file, options.hashAlgorithm));
+
+    FileCache reloaded = loadCache(cache_file, options.hashAlgorithm);
+    ASSERT_EQ(reloaded.size(), 3);
+    for (const auto& entry : cache) {
+        ASSERT_EQ(reloaded.count(entry.first), 1);
+        EXPECT_EQ(reloaded[entry.first].fileHash, entry.second.fileHash);
+        EXPECT_EQ(reloaded[entry.first].partialHash, entry.second.partialHash);
+        EXPECT_EQ(reloaded[entry.first].inode, entry.second.inode);
+    }
+
+    // Verify: a cache written by another engine is ignored
+    EXPECT_TRUE(loadCache(cache_file, HashAlgorithm::SHA256).empty());
+
+    // Verify: the second run takes every digest from the cache and reads nothing
+    options.cache = &reloaded;
+    PipelineStats second;
+    duplicates = findDuplicateFiles(files, progress, options, &second);
+    ASSERT_EQ(duplicates.size(), 1);
+    EXPECT_EQ(duplicates[0].size(), 2);
+    EXPECT_EQ(second.cacheHits, 3);
+    EXPECT_EQ(second.stages.back().bytesRead, 0);
+
+    // Verify: a modified file is no longer served from the cache
+    std::ofstream(temp_dir + "/file3.txt") << "Identical content";
+    PipelineStats third;
+    duplicates = findDuplicateFiles(files, progress, options, &third);
+    ASSERT_EQ(duplicates.size(), 1);
+    EXPECT_EQ(duplicates[0].size(), 3);
+    EXPECT_EQ(third.cacheHits, 2);
+
+    // Execute: a bucket of large files where the partial stage rules out two,
+    // then rewrite one of those two
+    const std::string large = temp_dir + "/large";
+    std::filesystem::create_directory(large);
+    std::ofstream(large + "/a.bin") << std::string(20000, 'a');
+    std::ofstream(large + "/b.bin") << std::string(20000, 'a');
+    std::ofstream(large + "/c.bin") << 'c' << std::string(19999, 'a');
+    std::ofstream(large + "/d.bin") << 'd' << std::string(19999, 'a');
+    std::vector<std::filesystem::path> large_files = getAllFiles(large);
+    FileCache large_cache;
+    options.cache = &large_cache;
+    findDuplicateFiles(large_files, progress, options);
+    std::ofstream(large + "/c.bin") << 'e' << std::string(19999, 'a');
+    PipelineStats touched;
+    duplicates = findDuplicateFiles(large_files, progress, options, &touched);
+
+    // Verify: only the rewritten file's blocks are read, and nothing in full
+    ASSERT_EQ(duplicates.size(), 1);
+    EXPECT_EQ(duplicates[0].size(), 2);
+    EXPECT_EQ(touched.cacheHits, 2);
+    auto stage = [&](const std::string& name) {
+        return *std::find_if(touched.stages.begin(), touched.stages.end(),
+                             [&](const StageStats& s) { return s.name == name; });
+    };
+    EXPECT_EQ(stage("partial hash").filesIn, 4);
+    EXPECT_EQ(stage("partial hash").filesEliminated, 2);
+    EXPECT_EQ(stage("partial hash").bytesRead, options.headBlockSize + options.tailBlockSize);
+    EXPECT_EQ(stage("full hash").bytesRead, 0);
+
+    // Cleanup: Remove the temporary files, directory and cache
+    std::filesystem::remove_all(temp_dir);
+    std::filesystem::remove(cache_file);
+}
+
+// Test that every read backend feeds the hasher the same bytes
+TEST(DuplicateFinderTest, ReadBackendsProduceSameDigest) {
+    std::cout << "DuplicateFinderTest ReadBackendsProduceSameDigest\n";
+
+    // Setup: a file spanning several read chunks with a ragged tail, and an empty file
+    std::string temp_file = "test_read_backends.bin";
+    std::string empty_file = "test_read_backends_empty.bin";
+    {
+        std::ofstream out(temp_file, std::ios::binary);
+        for (int i = 0; i < 3 * 1024 * 1024 + 123; ++i) {
+            out.put(static_cast<char>(i * 31 + (i >> 12)));
+        }
+    }
+    std::ofstream(empty_file).close();
+
+    // Execute and verify: all backends agree with the stream reader
+    Digest expected = computeFileDigest(temp_file, HashAlgorithm::XXH3, ReadBackend::Stream);
+    Digest expected_empty = computeFileDigest(empty_file, HashAlgorithm::XXH3, ReadBackend::Stream);
+    ASSERT_FALSE(expected.empty());
+    for (ReadBackend backend : {ReadBackend::Pread, ReadBackend::Mmap, ReadBackend::Direct}) {
+        EXPECT_EQ(computeFileDigest(temp_file, HashAlgorithm::XXH3, backend), expected)
+            << readBackendName(backend);
+        EXPECT_EQ(computeFileDigest(empty_file, HashAlgorithm::XXH3, backend), expected_empty)
+            << readBackendName(backend);
+    }
+
+    // Verify: a missing file yields an empty digest rather than a match
+    EXPECT_TRUE(computeFileDigest("test_read_backends_missing.bin", HashAlgorithm::XXH3,
+                                  ReadBackend::Mmap).empty());
+
+    // Cleanup: Remove the temporary files
+    std::filesystem::remove(temp_file);
+    std::filesystem::remove(empty_file);
+}
+
+// Test that the io_uring engine matches synchronous hashing and feeds the pipeline
+TEST(DuplicateFinderTest, UringEngineMatchesSynchronousDigests) {
+    std::cout << "DuplicateFinderTest UringEngineMatchesSynchronousDigests\n";
+
+    // Setup: more files than slots, spanning several chunks, plus an empty one
+    std::string temp_dir = "test_dir_uring";
+    std::filesystem::create_directory(temp_dir);
+    const size_t sizes[] = {0, 1, 4096, 100000, 300000, 300000, 1000001, 1000001};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        std::ofstream out(temp_dir + "/file" + std::to_string(i) + ".bin", std::ios::binary);
+        for (size_t j = 0; j < sizes[i]; ++j) out.put(static_cast<char>((j * 7) ^ (j >> 10)));
+    }
+    std::vector<std::filesystem::path> files = getAllFiles(temp_dir);
+    files.push_back(temp_dir + "/missing.bin");
+
+    UringOptions uring;
+    uring.queueDepth = 4;
+    uring.hashThreads = 2;
+    uring.chunkSize = 64 * 1024;
+    std::vector<Digest> digests;
+    if (!computeFileDigestsUring(files, HashAlgorithm::XXH3, uring, digests)) {
+        std::filesystem::remove_all(temp_dir);
+        GTEST_SKIP() << "io_uring is not available";
+    }
+
+    // Verify: every digest equals the synchronous one, the missing file's is empty
+    ASSERT_EQ(digests.size(), files.size());
+    for (size_t i = 0; i + 1 < files.size(); ++i) {
+        EXPECT_EQ(digests[i], computeFileDigest(files[i], HashAlgorithm::XXH3)) << files[i];
+    }
+    EXPECT_TRUE(digests.back().empty());
+
+    // Verify: the pipeline finds the same-size pairs through the engine
+    files.pop_back();
+    FinderOptions options;
+    options.ioUring = true;
+    options.uring = uring;
+    options.partialHash = false;
+    ProgressBar progress(files.size(), "Comparing Files");
+    auto duplicates = findDuplicateFiles(files, progress, options);
+    EXPECT_EQ(duplicates.size(), 2);
+
+    // Cleanup: Remove the temporary directory
+    std::filesystem::remove_all(temp_dir);
+}
+
+// Test that the parallel walker finds nested files and feeds the pipeline
+TEST(DuplicateFinderTest, ParallelWalkerFindsNestedDuplicates) {
+    std::cout << "DuplicateFinderTest ParallelWalkerFindsNestedDuplicates\n";
+
+    // Setup: a tree wider and deeper than the walker pool, with one
+    // duplicate pair per leaf directory, a skipped '$' entry and a symlink
+    std::string temp_dir = "test_dir_walk";
+    for (int i = 0; i < 8; ++i) {
+        std::string leaf = temp_dir + "/a" + std::to_string(i) + "/b/c";
+        std::filesystem::create_directories(leaf);
+        std::ofstream(leaf + "/one.txt") << "leaf content " << i;
+        std::ofstream(leaf + "/two.txt") << "leaf content " << i;
+    }
+    std::ofstream(temp_dir + "/skip$.txt") << "leaf content 0";
+    std::filesystem::create_symlink("a0/b/c/one.txt", temp_dir + "/link.txt");
+
+    // Execute: list the tree, then find duplicates straight from the walk
+    std::vector<std::filesystem::path> files = getAllFiles(temp_dir);
+    FinderOptions options;
+    options.walk.threads = 4;
+    ProgressBar progress(1, "Comparing Files");
+    PipelineStats stats;
+    auto duplicates = findDuplicatesInDirectories({temp_dir}, progress, options, &stats);
+
+    // Verify: 16 regular files, sorted, and eight pairs
+    ASSERT_EQ(files.size(), 16);
+    EXPECT_TRUE(std::is_sorted(files.begin(), files.end()));
+    EXPECT_EQ(stats.stages.front().filesIn, 16);
+    ASSERT_EQ(duplicates.size(), 8);
+    for (const auto& group : duplicates) {
+        ASSERT_EQ(group.size(), 2);
+        EXPECT_EQ(group[0].parent_path(), group[1].parent_path());
+    }
+
+    // Cleanup: Remove the temporary directory
+    std::filesystem::remove_all(temp_dir);
+}
+
+// Test that grouping by digest across threads keeps every group intact
+TEST(DuplicateFinderTest, FullHashGroupsAcrossThreads) {
+    std::cout << "DuplicateFinderTest FullHashGroupsAcrossThreads\n";
+
+    // Setup: 40 triples and 40 unique files, all the same size, so every
+    // file reaches the full-hash stage
+    std::string temp_dir = "test_dir_groups";
+    std::filesystem::create_directory(temp_dir);
+    for (int i = 0; i < 160; ++i) {
+        int content = i < 120 ? i / 3 : i;
+        char name[32];
+        std::snprintf(name, sizeof(name), "/file%03d.txt", i);
+        std::ofstream(temp_dir + name) << "content " << (1000 + content);
+    }
+    std::vector<std::filesystem::path> files = getAllFiles(temp_dir);
+
+    // Execute: hash with several threads, even on a single core, in one
+    // pool whatever the device
+    FileCache cache;
+    FinderOptions options;
+    options.partialHash = false;
+    options.scheduleByDevice = false;
+    options.cache = &cache;
+    ProgressBar progress(files.size(), "Comparing Files");
+    PipelineStats stats;
+    int saved_threads = omp_get_max_threads();
+    omp_set_num_threads(4);
+    auto duplicates = findDuplicateFiles(files, progress, options, &stats);
+    omp_set_num_threads(saved_threads);
+
+    // Verify: 40 groups of three consecutive files, 40 eliminated, all cached
+    ASSERT_EQ(duplicates.size(), 40);
+    for (const auto& group : duplicates) {
+        ASSERT_EQ(group.size(), 3);
+        EXPECT_TRUE(std::is_sorted(group.begin(), group.end()));
+    }
+    EXPECT_EQ(stats.stages.back().filesEliminated, 40);
+    EXPECT_EQ(cache.size(), 160);
+
+    // Cleanup: Remove the temporary directory
+    std::filesystem::remove_all(temp_dir);
+}
+
+// Test that the file catalogue rebuilds paths and keeps its columns aligned
+TEST(DuplicateFinderTest, FileCatalogueRebuildsPaths) {
+    std::cout << "DuplicateFinderTest FileCatalogueRebuildsPaths\n";
+
+    // Setup: a tree of interned directories, a slash-terminated root and a bare file
+    FileCatalogue catalogue;
+    uint32_t root = catalogue.addDirectory(FileCatalogue::kNoDirectory, "data");
+    uint32_t sub = catalogue.addDirectory(root, "sub");
+    uint32_t abs_root = catalogue.addDirectory(FileCatalogue::kNoDirectory, "/mnt/c/");
+    FileStat st;
+    st.size = 42;
+    st.inode = 7;
+    catalogue.addFile(sub, "a.txt", st);
+    catalogue.addFile(abs_root, "b.txt", FileStat());
+
+    FileColumns batch;
+    batch.add(root, "c.txt", st);
+    batch.add(FileCatalogue::kNoDirectory, "bare.txt", FileStat());
+    catalogue.appendFiles(std::move(batch));
+
+    // Verify: paths match std::filesystem joins and the columns line up
+    ASSERT_EQ(catalogue.size(), 4);
+    EXPECT_EQ(catalogue.directoryCount(), 3);
+    EXPECT_EQ(catalogue.path(0), std::filesystem::path("data") / "sub" / "a.txt");
+    EXPECT_EQ(catalogue.pathString(1), "/mnt/c/b.txt");
+    EXPECT_EQ(catalogue.pathString(2), "data/c.txt");
+    EXPECT_EQ(catalogue.pathString(3), "bare.txt");
+    EXPECT_EQ(catalogue.fileSize(2), 42);
+    EXPECT_EQ(catalogue.stat(0).inode, 7);
+
+    // Verify: the digest column starts empty and takes updates
+    catalogue.allocateDigests();
+    EXPECT_TRUE(catalogue.digest(3).empty());
+    Digest digest;
+    digest.size = 1;
+    digest.bytes[0] = 0xab;
+    catalogue.setDigest(3, digest);
+    EXPECT_EQ(catalogue.digest(3), digest);
+}
+
+// Test that verification splits same-size files on late differences, in batches
+TEST(DuplicateFinderTest, VerifyStageSplitsOnContent) {
+    std::cout << "DuplicateFinderTest VerifyStageSplitsOnContent\n";
+
+    // Setup: six 200 KiB files; two variants differ only in the last block
+    std::filesystem::path temp_dir = std::filesystem::temp_directory_path() / "verify_test";
+    std::filesystem::remove_all(temp_dir);
+    std::filesystem::create_directory(temp_dir);
+    const size_t size = 200 * 1024;
+    std::vector<std::filesystem::path> files;
+    for (int i = 0; i < 6; ++i) {
+        std::string content(size, 'v');
+        if (i % 3 == 1) content[size - 1] = 'x';
+        if (i % 3 == 2) content[size - 1] = 'y';
+        files.push_back(temp_dir / ("file" + std::to_string(i) + ".bin"));
+        std::ofstream(files.back(), std::ios::binary) << content;
+    }
+
+    // Execute: verify directly with at most three files open at a time
+    VerifyResult result = verifyIdenticalFiles(files, size, 3);
+
+    // Verify: {0,3}, {1,4} and {2,5} despite the pairs spanning batches
+    std::vector<std::vector<size_t>> groups = result.groups;
+    for (auto& group : groups) std::sort(group.begin(), group.end());
+    std::sort(groups.begin(), groups.end());
+    ASSERT_EQ(groups.size(), 3);
+    EXPECT_EQ(groups[0], (std::vector<size_t>{0, 3}));
+    EXPECT_EQ(groups[1], (std::vector<size_t>{1, 4}));
+    EXPECT_EQ(groups[2], (std::vector<size_t>{2, 5}));
+
+    // Verify: with enough descriptors every file is read exactly once
+    EXPECT_EQ(verifyIdenticalFiles(files, size, 16).bytesRead, files.size() * size);
+
+    // Execute: the pipeline with the verify stage enabled
+    std::vector<std::filesystem::path> pipeline_files = files;
+    FinderOptions options;
+    options.verify = true;
+    ProgressBar progress(files.size(), "Comparing Files");
+    PipelineStats stats;
+    auto duplicates = findDuplicateFiles(pipeline_files, progress, options, &stats);
+
+    // Verify: the same three pairs, and the verify stage eliminated nothing
+    EXPECT_EQ(duplicates.size(), 3);
+    ASSERT_EQ(stats.stages.back().name, "verify");
+    EXPECT_EQ(stats.stages.back().filesIn, 6);
+    EXPECT_EQ(stats.stages.back().filesEliminated, 0);
+
+    // Cleanup: Remove the temporary directory
+    std::filesystem::remove_all(temp_dir);
+}
+
+// Test that hard links are read once and not reported as duplicates of themselves
+TEST(DuplicateFinderTest, HardLinksCollapseToOneFile) {
+    std::cout << "DuplicateFinderTest HardLinksCollapseToOneFile\n";
+
+    // Setup: one file with two extra links, a real copy, and a lone linked file
+    std::filesystem::path temp_dir = std::filesystem::temp_directory_path() / "hard_link_test";
+    std::filesystem::remove_all(temp_dir);
+    std::filesystem::create_directory(temp_dir);
+    std::ofstream(temp_dir / "original.txt") << "Linked content";
+    std::ofstream(temp_dir / "copy.txt") << "Linked content";
+    std::ofstream(temp_dir / "lonely.txt") << "Lonely content";
+    std::filesystem::create_hard_link(temp_dir / "original.txt", temp_dir / "link1.txt");
+    std::filesystem::create_hard_link(temp_dir / "original.txt", temp_dir / "link2.txt");
+    std::filesystem::create_hard_link(temp_dir / "lonely.txt", temp_dir / "lonely_link.txt");
+
+    // Execute: find duplicates among all six paths
+    std::vector<std::filesystem::path> files = getAllFiles(temp_dir.string());
+    ProgressBar progress(files.size(), "Comparing Files");
+    PipelineStats stats;
+    auto duplicates = findDuplicateFiles(files, progress, FinderOptions(), &stats);
+
+    // Verify: one group of the copy and one path of the linked inode
+    ASSERT_EQ(duplicates.size(), 1);
+    ASSERT_EQ(duplicates[0].size(), 2);
+    EXPECT_EQ(std::count(duplicates[0].begin(), duplicates[0].end(), temp_dir / "copy.txt"), 1);
+    ASSERT_EQ(stats.hardLinks.size(), 2);
+    EXPECT_EQ(stats.hardLinks[0].size() + stats.hardLinks[1].size(), 5);
+    EXPECT_TRUE(stats.reflinks.empty());
+
+    // Verify: the size stage eliminates the three further links, so one
+    // path per inode goes on to be hashed
+    ASSERT_EQ(stats.stages[0].name, "size");
+    EXPECT_EQ(stats.stages[0].filesIn, 6);
+    EXPECT_EQ(stats.stages[0].filesEliminated, 3);
+    EXPECT_EQ(stats.stages[1].filesIn, 3);
+
+    // Verify: with collapsing disabled, every link is a duplicate again
+    FinderOptions options;
+    options.collapseLinks = false;
+    duplicates = findDuplicateFiles(files, progress, options);
+    ASSERT_EQ(duplicates.size(), 2);
+    EXPECT_EQ(duplicates[0].size() + duplicates[1].size(), 6);
+
+    // Cleanup: Remove the temporary directory
+    std::filesystem::remove_all(temp_dir);
+}
+
+// Test that a rescan replays unchanged directories from the tree snapshot
+TEST(DuplicateFinderTest, SnapshotSkipsUnchangedDirectories) {
+    std::cout << "DuplicateFinderTest SnapshotSkipsUnchangedDirectories\n";
+
+    // Setup: four directories holding one duplicate pair
+    std::string temp_dir = "test_dir_snapshot";
+    std::string snapshot_file = "test_snapshot.bin";
+    std::filesystem::create_directories(temp_dir + "/a/b");
+    std::filesystem::create_directories(temp_dir + "/c");
+    std::ofstream(temp_dir + "/a/b/one.txt") << "Snapshot content";
+    std::ofstream(temp_dir + "/c/two.txt") << "Snapshot content";
+    // Backdate the directories; freshly modified ones are never replayed
+    auto an_hour_ago = std::filesystem::file_time_type::clock::now() - std::chrono::hours(1);
+    for (const char* dir : {"", "/a", "/a/b", "/c"}) {
+        std::filesystem::last_write_time(temp_dir + dir, an_hour_ago);
+    }
+
+    // Execute: a first scan records the snapshot, which is saved and reloaded
+    TreeSnapshot first;
+    FinderOptions options;
+    options.walk.snapshot = &first;
+    ProgressBar progress(1, "Comparing Files");
+    PipelineStats stats;
+    auto duplicates = findDuplicatesInDirectories({temp_dir}, progress, options, &stats);
+    ASSERT_TRUE(saveSnapshot(first, snapshot_file));
+    TreeSnapshot previous = loadSnapshot(snapshot_file);
+
+    // Verify: the round trip keeps every directory and its listing
+    ASSERT_EQ(duplicates.size(), 1);
+    ASSERT_EQ(previous.size(), 4);
+    const DirectorySnapshot& leaf = previous.at((std::filesystem::path(temp_dir) / "a" / "b").string());
+    ASSERT_EQ(leaf.files.size(), 1);
+    EXPECT_EQ(leaf.files[0].first, "one.txt");
+    EXPECT_EQ(leaf.files[0].second.size, std::string("Snapshot content").size());
+    EXPECT_EQ(stats.walk.unchanged, 0);
+
+    // Execute: rescan without changes
+    TreeSnapshot second;
+    options.walk.previous = &previous;
+    options.walk.snapshot = &second;
+    PipelineStats rescan_stats;
+    duplicates = findDuplicatesInDirectories({temp_dir}, progress, options, &rescan_stats);
+
+    // Verify: every directory is replayed and the result is unchanged
+    EXPECT_EQ(rescan_stats.walk.directories, 4);
+    EXPECT_EQ(rescan_stats.walk.unchanged, 4);
+    ASSERT_EQ(duplicates.size(), 1);
+    EXPECT_EQ(second.size(), 4);
+
+    // Execute: add a third copy in one directory and rescan
+    std::ofstream(temp_dir + "/c/three.txt") << "Snapshot content";
+    TreeSnapshot third;
+    options.walk.snapshot = &third;
+    PipelineStats changed_stats;
+    duplicates = findDuplicatesInDirectories({temp_dir}, progress, options, &changed_stats);
+
+    // Verify: only the changed directory is read again, and the new file is found
+    EXPECT_EQ(changed_stats.walk.unchanged, 3);
+    ASSERT_EQ(duplicates.size(), 1);
+    EXPECT_EQ(duplicates[0].size(), 3);
+
+    // Cleanup: Remove the temporary directory and snapshot
+    std::filesystem::remove_all(temp_dir);
+    std::filesystem::remove(snapshot_file);
+}
+
+// Test that a file rewritten in place is seen by a rescan that replays its directory
+TEST(DuplicateFinderTest, SnapshotRestatsRewrittenFiles) {
+    std::cout << "DuplicateFinderTest SnapshotRestatsRewrittenFiles\n";
+
+    // Setup: one backdated directory holding a duplicate pair
+    std::string temp_dir = "test_dir_snapshot_rewrite";
+    std::filesystem::create_directory(temp_dir);
+    std::ofstream(temp_dir + "/one.txt") << "Rewrite content A";
+    std::ofstream(temp_dir + "/two.txt") << "Rewrite content A";
+    auto an_hour_ago = std::filesystem::file_time_type::clock::now() - std::chrono::hours(1);
+    std::filesystem::last_write_time(temp_dir + "/one.txt", an_hour_ago);
+    std::filesystem::last_write_time(temp_dir + "/two.txt", an_hour_ago);
+    std::filesystem::last_write_time(temp_dir, an_hour_ago);
+
+    // Execute: a first scan fills the snapshot and the cache
+    TreeSnapshot first;
+    FileCache cache;
+    FinderOptions options;
+    options.walk.snapshot = &first;
+    options.cache = &cache;
+    ProgressBar progress(1, "Comparing Files");
+    auto duplicates = findDuplicatesInDirectories({temp_dir}, progress, options);
+    ASSERT_EQ(duplicates.size(), 1);
+
+    // Execute: rewrite one file in place with contents of the same size,
+    // leaving the directory's mtime as it was
+    std::ofstream(temp_dir + "/two.txt", std::ios::in | std::ios::out) << "Rewrite content B";
+    std::filesystem::last_write_time(temp_dir, an_hour_ago);
+    TreeSnapshot second;
+    options.walk.previous = &first;
+    options.walk.snapshot = &second;
+    PipelineStats stats;
+    duplicates = findDuplicatesInDirectories({temp_dir}, progress, options, &stats);
+
+    // Verify: the directory is replayed, yet the stale digest is not reused
+    EXPECT_EQ(stats.walk.unchanged, 1);
+    EXPECT_TRUE(duplicates.empty());
+    // Verify: the new snapshot holds the rewritten file's new mtime
+    auto mtime_of = [](const TreeSnapshot& snapshot, const std::string& dir, const std::string& name) {
+        for (const auto& file : snapshot.at(dir).files) {
+            if (file.first == name) return file.second.lastModified;
+        }
+        return INT64_MIN;
+    };
+    EXPECT_NE(mtime_of(second, temp_dir, "two.txt"), mtime_of(first, temp_dir, "two.txt"));
+    EXPECT_EQ(mtime_of(second, temp_dir, "one.txt"), mtime_of(first, temp_dir, "one.txt"));
+
+    // Cleanup: Remove the temporary directory
+    std::filesystem::remove_all(temp_dir);
+}
+
+// Test that the live index answers queries and follows file changes
+TEST(DuplicateFinderTest, DuplicateIndexTracksChanges) {
+    std::cout << "DuplicateFinderTest DuplicateIndexTracksChanges\n";
+
+    // Setup: a pair of duplicates and a unique file of the same size
+    std::string temp_dir = (std::filesystem::current_path() / "test_dir_index").string();
+    std::filesystem::create_directories(temp_dir + "/sub");
+    std::string one = temp_dir + "/one.txt";
+    std::string two = temp_dir + "/sub/two.txt";
+    std::string three = temp_dir + "/three.txt";
+    std::ofstream(one) << "Indexed content";
+    std::ofstream(two) << "Indexed content";
+    std::ofstream(three) << "Distinct content";
+
+    // Execute: build the index
+    Metrics metrics;
+    DuplicateIndex index(FinderOptions(), metrics);
+    std::vector<std::string> directories = index.build({temp_dir});
+    std::vector<std::string> others;
+
+    // Verify: both directories are reported and the pair is found
+    EXPECT_EQ(directories.size(), 2);
+    EXPECT_EQ(index.fileCount(), 3);
+    ASSERT_TRUE(index.duplicatesOf(one, others));
+    EXPECT_EQ(others, std::vector<std::string>{two});
+    ASSERT_TRUE(index.duplicatesOf(three, others));
+    EXPECT_TRUE(others.empty());
+    EXPECT_FALSE(index.duplicatesOf(temp_dir + "/missing.txt", others));
+
+    // Execute: rewrite the unique file as a third copy and add a fourth
+    std::string four = temp_dir + "/sub/four.txt";
+    std::ofstream(three) << "Indexed content";
+    std::ofstream(four) << "Indexed content";
+    index.update({three, four});
+
+    // Verify: all four files now form one group
+    ASSERT_TRUE(index.duplicatesOf(four, others));
+    EXPECT_EQ(others.size(), 3);
+
+    // Execute: remove one copy and change another
+    std::filesystem::remove(two);
+    std::ofstream(one) << "Changed content";
+    index.update({two, one});
+
+    // Verify: the removed file is gone and the changed one is unique
+    EXPECT_FALSE(index.duplicatesOf(two, others));
+    ASSERT_TRUE(index.duplicatesOf(one, others));
+    EXPECT_TRUE(others.empty());
+    ASSERT_TRUE(index.duplicatesOf(three, others));
+    EXPECT_EQ(others, std::vector<std::string>{four});
+    EXPECT_EQ(index.filesUnder(temp_dir + "/sub"), std::vector<std::string>{four});
+
+    // Cleanup: Remove the temporary directory
+    std::filesystem::remove_all(temp_dir);
+}
+
+// Test that groups reach the result sink with size, digest and wasted bytes
+TEST(DuplicateFinderTest, ResultSinkStreamsGroups) {
+    std::cout << "DuplicateFinderTest ResultSinkStreamsGroups\n";
+
+    // Setup: an empty pair, a small triple and a pair larger than the partial blocks
+    std::filesystem::path temp_dir = std::filesystem::temp_directory_path() / "sink_test";
+    std::filesystem::remove_all(temp_dir);
+    std::filesystem::create_directory(temp_dir);
+    std::ofstream(temp_dir / "empty1.txt");
+    std::ofstream(temp_dir / "empty2.txt");
+    for (const char* name : {"small1.txt", "small2.txt", "small \"3\",.txt"}) {
+        std::ofstream(temp_dir / name) << "Small content";
+    }
+    const std::string large(20000, 'L');
+    std::ofstream(temp_dir / "large1.bin") << large;
+    std::ofstream(temp_dir / "large2.bin") << large;
+
+    // Execute: stream the results as JSON Lines and CSV
+    std::vector<std::filesystem::path> files = getAllFiles(temp_dir.string());
+    std::ostringstream jsonl;
+    std::ostringstream csv;
+    FinderOptions options;
+    auto json_sink = createResultSink(OutputFormat::JsonLines, jsonl, options.hashAlgorithm);
+    auto csv_sink = createResultSink(OutputFormat::Csv, csv, options.hashAlgorithm);
+    ProgressBar progress(files.size(), "Comparing Files");
+    options.sink = json_sink.get();
+    auto duplicates = findDuplicateFiles(files, progress, options);
+    options.sink = csv_sink.get();
+    findDuplicateFiles(files, progress, options);
+
+    // Verify: one JSON line per group, carrying size, wasted bytes and digest
+    ASSERT_EQ(duplicates.size(), 3);
+    std::vector<std::string> lines;
+    std::istringstream json_lines(jsonl.str());
+    for (std::string line; std::getline(json_lines, line);) lines.push_back(line);
+    std::sort(lines.begin(), lines.end());
+    ASSERT_EQ(lines.size(), 3);
+    EXPECT_EQ(lines[0].rfind("{\"size\":0,\"wasted\":0,", 0), 0);
+    EXPECT_EQ(lines[1].rfind("{\"size\":13,\"wasted\":26,", 0), 0);
+    EXPECT_NE(lines[1].find("small \\\"3\\\",.txt"), std::string::npos);
+    EXPECT_EQ(lines[2].rfind("{\"size\":20000,\"wasted\":20000,", 0), 0);
+    const std::string large_digest = computeFileDigest(temp_dir / "large1.bin", options.hashAlgorithm).toHex();
+    EXPECT_NE(lines[2].find("\"digest\":\"" + large_digest + "\""), std::string::npos);
+    const std::string label = std::string("\"algorithm\":\"") + hashAlgorithmName(options.hashAlgorithm) + "\"";
+    EXPECT_NE(lines[2].find(label), std::string::npos);
+
+    // Verify: a CSV header and one row per file, with awkward names quoted
+    const std::string table = csv.str();
+    EXPECT_EQ(table.rfind("group,size,wasted,digest,path\n", 0), 0);
+    EXPECT_EQ(std::count(table.begin(), table.end(), '\n'), 8);
+    EXPECT_NE(table.find("\"" + (temp_dir / "small \"\"3\"\",.txt").string() + "\""), std::string::npos);
+
+    // Verify: JSON keeps UTF-8 names and escapes bytes that are not UTF-8
+    std::ostringstream escaped;
+    writeJsonString(escaped, "caf\xc3\xa9 \xff\xc3(\xed\xa0\x80\t");
+    EXPECT_EQ(escaped.str(), "\"caf\xc3\xa9 \\u00ff\\u00c3(\\u00ed\\u00a0\\u0080\\u0009\"");
+
+    // Cleanup: Remove the temporary directory
+    std::filesystem::remove_all(temp_dir);
+}
+
+// Test that the pipeline's counters reach the progress bar and the stats line
+TEST(DuplicateFinderTest, MetricsTrackPipelineStages) {
+    std::cout << "DuplicateFinderTest MetricsTrackPipelineStages\n";
+
+    // Setup: two pairs larger than the partial blocks and one unique file
+    std::filesystem::path temp_dir = std::filesystem::temp_directory_path() / "metrics_test";
+    std::filesystem::remove_all(temp_dir);
+    std::filesystem::create_directory(temp_dir);
+    const std::string first(20000, 'A');
+    const std::string second(30000, 'B');
+    std::ofstream(temp_dir / "a1.bin") << first;
+    std::ofstream(temp_dir / "a2.bin") << first;
+    std::ofstream(temp_dir / "b1.bin") << second;
+    std::ofstream(temp_dir / "b2.bin") << second;
+    std::ofstream(temp_dir / "unique.txt") << "Unique";
+
+    // Execute: scan with the bar drawing into a buffer and a stats reporter attached
+    std::ostringstream bar;
+    std::ostringstream json;
+    ProgressBar progress(0, "Comparing Files", bar);
+    StatsReporter reporter(progress.metrics(), json, std::chrono::milliseconds(10));
+    auto duplicates = findDuplicatesInDirectories({temp_dir.string()}, progress, FinderOptions());
+    reporter.stop();
+    const MetricsSnapshot last = progress.metrics().snapshot();
+    progress.complete();
+
+    // Verify: the last stage is the full hash, complete in files and bytes
+    EXPECT_EQ(duplicates.size(), 2);
+    EXPECT_STREQ(last.stage, "full hash");
+    EXPECT_EQ(last.filesDone, 4);
+    EXPECT_EQ(last.filesTotal, 4);
+    EXPECT_EQ(last.bytesDone, 100000);
+    EXPECT_EQ(last.bytesTotal, 100000);
+
+    // Verify: the final frame and stats line report the same counters
+    EXPECT_NE(bar.str().find("100.0 % full hash 4/4 files"), std::string::npos);
+    std::string last_line;
+    std::istringstream lines(json.str());
+    for (std::string line; std::getline(lines, line); last_line = line) {
+        EXPECT_EQ(line.front(), '{');
+        EXPECT_EQ(line.back(), '}');
+    }
+    EXPECT_NE(last_line.find("\"stage\":\"full hash\",\"files_done\":4,\"files_total\":4,"
+                        "\"bytes_done\":100000,\"bytes_total\":100000"), std::string::npos);
+
+    // Cleanup: Remove the temporary directory
+    std::filesystem::remove_all(temp_dir);
+}
+
+// Test that a profiled scan reports its stages, latencies and timeline
+TEST(DuplicateFinderTest, ProfilerReportsStagesAndTrace) {
+    std::cout << "DuplicateFinderTest ProfilerReportsStagesAndTrace\n";
+
+    // Setup: a pair larger than the partial blocks and one unique file
+    std::filesystem::path temp_dir = std::filesystem::temp_directory_path() / "profile_test";
+    std::filesystem::remove_all(temp_dir);
+    std::filesystem::create_directory(temp_dir);
+    const std::string content(20000, 'P');
+    std::ofstream(temp_dir / "p1.bin") << content;
+    std::ofstream(temp_dir / "p2.bin") << content;
+    std::ofstream(temp_dir / "unique.txt") << "Unique";
+
+    // Execute: scan with tracing, then write the report and the trace
+    Profiler profiler(true);
+    FinderOptions options;
+    options.profiler = &profiler;
+    ProgressBar progress(0, "Comparing Files");
+    auto duplicates = findDuplicatesInDirectories({temp_dir.string()}, progress, options);
+    std::ostringstream report;
+    profiler.printReport(report);
+    const std::filesystem::path trace_file = temp_dir / "trace.json";
+    ASSERT_TRUE(profiler.writeTrace(trace_file.string()));
+
+    // Verify: every stage is timed and each hashed file has one sample per phase
+    EXPECT_EQ(duplicates.size(), 1);
+    const std::string text = report.str();
+    for (const char* stage : {"walk", "size", "partial hash", "extent map", "full hash"}) {
+        EXPECT_NE(text.find("\n  " + std::string(stage) + " "), std::string::npos) << stage;
+    }
+    EXPECT_NE(text.find("busy "), std::string::npos);
+    for (const char* operation : {"open", "read", "hash"}) {
+        EXPECT_NE(text.find("    " + std::string(operation) + "          " + std::string(9, ' ') + "2"),
+                  std::string::npos) << operation;
+    }
+    EXPECT_NE(text.find("Bytes read per device:"), std::string::npos);
+
+    // Verify: the trace is a trace-event document naming the hashed files
+    std::ifstream trace_in(trace_file);
+    const std::string trace((std::istreambuf_iterator<char>(trace_in)), std::istreambuf_iterator<char>());
+    EXPECT_EQ(trace.rfind("{\"traceEvents\":[", 0), 0);
+    EXPECT_NE(trace.find("\"name\":\"full hash\",\"cat\":\"work\",\"ph\":\"X\""), std::string::npos);
+    EXPECT_NE(trace.find((temp_dir / "p1.bin").string()), std::string::npos);
+
+    // Verify: histogram percentiles stay within a quarter of the true value
+    LatencyHistogram histogram;
+    for (int64_t value = 1; value <= 1000; ++value) histogram.add(value * 1000);
+    EXPECT_EQ(histogram.count(), 1000);
+    EXPECT_GE(histogram.percentile(0.5), 500000);
+    EXPECT_LE(histogram.percentile(0.5), 625000);
+    EXPECT_EQ(histogram.percentile(1.0), 1000000);
+
+    // Cleanup: Remove the temporary directory
+    std::filesystem::remove_all(temp_dir);
+}
+
+// Test that each device gets its own pool and rotational reads run in offset order
+TEST(DuplicateFinderTest, IoSchedulerPoolsByDevice) {
+    std::cout << "DuplicateFinderTest IoSchedulerPoolsByDevice\n";
+
+    // Setup: a rotational device with shuffled offsets and a four-worker SSD
+    std::vector<IoTask> tasks;
+    for (size_t i = 0; i < 50; ++i) tasks.push_back({i, 1, (i * 37) % 50});
+    for (size_t i = 50; i < 150; ++i) tasks.push_back({i, 2, 0});
+    DeviceProfiler profile = [](uint64_t device) {
+        DeviceProfile result;
+        result.known = true;
+        result.rotational = device == 1;
+        result.workers = device == 1 ? 1 : 4;
+        return result;
+    };
+
+    // Execute: record the order on the disk and the peak concurrency on the SSD
+    std::mutex mutex;
+    std::vector<uint64_t> disk_offsets;
+    std::atomic<int> ssd_active{0};
+    std::atomic<int> ssd_peak{0};
+    std::vector<std::atomic<int>> runs(150);
+    runIoTasks(tasks, profile, [&](size_t item) {
+        runs[item]++;
+        if (item < 50) {
+            std::lock_guard<std::mutex> lock(mutex);
+            disk_offsets.push_back((item * 37) % 50);
+            return;
+        }
+        const int active = ++ssd_active;
+        int peak = ssd_peak.load();
+        while (active > peak && !ssd_peak.compare_exchange_weak(peak, active)) {}
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        --ssd_active;
+    });
+
+    // Verify: every task ran once, the disk in one sweep, the SSD within its pool
+    for (const auto& count : runs) EXPECT_EQ(count.load(), 1);
+    ASSERT_EQ(disk_offsets.size(), 50);
+    EXPECT_TRUE(std::is_sorted(disk_offsets.begin(), disk_offsets.end()));
+    EXPECT_LE(ssd_peak.load(), 4);
+    EXPECT_GE(ssd_peak.load(), 2);
+
+    // Execute: rerun under a budget of three threads, with the disk's
+    // offsets left to the locator
+    for (IoTask& task : tasks) {
+        if (task.device == 1) task.offset = 0;
+    }
+    disk_offsets.clear();
+    ssd_peak = 0;
+    std::atomic<int> located{0};
+    runIoTasks(tasks, profile, [&](size_t item) {
+        if (item < 50) {
+            std::lock_guard<std::mutex> lock(mutex);
+            disk_offsets.push_back((item * 37) % 50);
+            return;
+        }
+        const int active = ++ssd_active;
+        int peak = ssd_peak.load();
+        while (active > peak && !ssd_peak.compare_exchange_weak(peak, active)) {}
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        --ssd_active;
+    }, 3, [&](const IoTask& task) {
+        located++;
+        return static_cast<uint64_t>((task.item * 37) % 50);
+    });
+
+    // Verify: only the disk's tasks are located, and the SSD keeps what the disk leaves
+    EXPECT_EQ(located.load(), 50);
+    EXPECT_TRUE(std::is_sorted(disk_offsets.begin(), disk_offsets.end()));
+    EXPECT_LE(ssd_peak.load(), 2);
+
+    // Verify: probing an unnamed device falls back to the CPU thread count
+    DeviceProfile unknown = probeDevice(0, 3);
+    EXPECT_FALSE(unknown.known);
+    EXPECT_EQ(unknown.workers, 3);
+}
+
+// Test that huge files are tree-hashed in chunks and their chunks are reused
+TEST(DuplicateFinderTest, TreeHashSplitsLargeFiles) {
+    std::cout << "DuplicateFinderTest TreeHashSplitsLargeFiles\n";
+
+    // Setup: seven 16 KiB chunks per file; a and b match, c differs in its last byte
+    const uint64_t chunk_bytes = 16 * 1024;
+    const size_t size = 6 * chunk_bytes + 1000;
+    std::filesystem::path temp_dir = "test_dir_tree_hash";
+    std::string cache_file = "test_tree_cache.bin";
+    std::filesystem::create_directory(temp_dir);
+    std::string content(size, '\0');
+    for (size_t i = 0; i < size; ++i) content[i] = static_cast<char>(i * 7 + (i >> 10));
+    auto write = [&](const std::string& name, size_t flip) {
+        std::string data = content;
+        if (flip < size) data[flip] ^= 0x5A;
+        std::ofstream(temp_dir / name, std::ios::binary).write(data.data(), data.size());
+        return temp_dir / name;
+    };
+    std::vector<std::filesystem::path> files = {write("a.bin", size), write("b.bin", size),
+                                                write("c.bin", size - 1)};
+
+    // Verify: every backend yields the same chunks, folded into a root unlike the flat digest
+    std::vector<Digest> chunks;
+    const Digest root = computeTreeDigest(files[0], size, HashAlgorithm::XXH3, chunk_bytes,
+                                          ReadBackend::Pread, &chunks);
+    ASSERT_EQ(chunks.size(), 7);
+    EXPECT_EQ(root, combineChunkDigests(HashAlgorithm::XXH3, size, chunk_bytes, chunks));
+    EXPECT_NE(root, computeFileDigest(files[0], HashAlgorithm::XXH3));
+    for (ReadBackend backend : {ReadBackend::Stream, ReadBackend::Mmap, ReadBackend::Direct}) {
+        EXPECT_EQ(computeTreeDigest(files[0], size, HashAlgorithm::XXH3, chunk_bytes, backend), root)
+            << readBackendName(backend);
+    }
+
+    // Execute: a first run caches the roots with their chunks
+    FileCache cache;
+    FinderOptions options;
+    options.treeChunkBytes = chunk_bytes;
+    options.cache = &cache;
+    ProgressBar progress(0, "Comparing Files", std::cout);
+    auto first = findDuplicateFiles(files, progress, options);
+    ASSERT_EQ(first.size(), 1);
+    EXPECT_EQ(first[0], std::vector<std::filesystem::path>({files[0], files[1]}));
+    const FileMetadata& cached = cache[files[0].string()];
+    EXPECT_EQ(cached.fileHash, root);
+    EXPECT_EQ(cached.chunkBytes, chunk_bytes);
+    EXPECT_EQ(cached.chunkHashes, chunks);
+    ASSERT_TRUE(saveCache(cache, cache_file, options.hashAlgorithm));
+    FileCache reloaded = loadCache(cache_file, options.hashAlgorithm);
+    EXPECT_EQ(reloaded[files[0].string()].chunkHashes, chunks);
+
+    // Execute: a second run adds d, differing in its first chunk, and e, a copy of a
+    files.push_back(write("d.bin", 10));
+    files.push_back(write("e.bin", size));
+    options.cache = &reloaded;
+    PipelineStats stats;
+    auto second = findDuplicateFiles(files, progress, options, &stats);
+
+    // Verify: a and b come from the cache (c never got past its tail block).
+    // The bucket is split on first chunks, dropping d; c and e then read only
+    // the chunks after their first
+    ASSERT_EQ(second.size(), 1);
+    EXPECT_EQ(second[0], std::vector<std::filesystem::path>({files[0], files[1], files[4]}));
+    EXPECT_EQ(stats.cacheHits, 2);
+    EXPECT_EQ(stats.stages[1].filesIn, 5);
+    EXPECT_EQ(stats.stages[1].filesEliminated, 1);
+    EXPECT_EQ(stats.stages[1].bytesRead, 3 * chunk_bytes);
+    EXPECT_EQ(stats.stages[2].bytesRead, 2 * (size - chunk_bytes));
+
+    // Cleanup: Remove the temporary directory and cache
+    std::filesystem::remove_all(temp_dir);
+    std::filesystem::remove(cache_file);
+}
+
+// Test that content-defined chunks survive an insertion and pair near copies
+TEST(DuplicateFinderTest, ContentChunkingFindsNearDuplicates) {
+    std::cout << "DuplicateFinderTest ContentChunkingFindsNearDuplicates\n";
+
+    // Setup: 1 MiB of random bytes, the same with 100 bytes inserted, and unrelated bytes
+    std::mt19937_64 rng(7);
+    auto random_bytes = [&](size_t size) {
+        std::string data(size, '\0');
+        for (char& c : data) c = static_cast<char>(rng());
+        return data;
+    };
+    const std::string original = random_bytes(1 << 20);
+    std::string shifted = original;
+    shifted.insert(500000, random_bytes(100));
+    const std::string unrelated = random_bytes(1 << 20);
+    ChunkingParams params;
+    auto chunk = [&](const std::string& data, GearKernel kernel, size_t piece) {
+        ContentChunker chunker(params, kernel);
+        std::vector<ContentChunk> chunks;
+        for (size_t offset = 0; offset < data.size(); offset += piece) {
+            chunker.update(data.data() + offset, std::min(piece, data.size() - offset), chunks);
+        }
+        chunker.finish(chunks);
+        return chunks;
+    };
+
+    // Execute: chunk in one piece with the portable kernel
+    const std::vector<ContentChunk> chunks = chunk(original, GearKernel::Portable, original.size());
+
+    // Verify: chunks tile the input within the size bounds
+    ASSERT_GT(chunks.size(), 64);
+    uint64_t next = 0;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        EXPECT_EQ(chunks[i].offset, next);
+        if (i + 1 < chunks.size()) {
+            EXPECT_GE(chunks[i].length, params.minSize);
+        }
+        EXPECT_LE(chunks[i].length, params.maxSize);
+        next += chunks[i].length;
+    }
+    EXPECT_EQ(next, original.size());
+
+    // Verify: the cuts do not depend on how the input is fed or on the kernel
+    auto same = [](const std::vector<ContentChunk>& a, const std::vector<ContentChunk>& b) {
+        return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](const auto& x, const auto& y) {
+            return x.offset == y.offset && x.length == y.length && x.fingerprint == y.fingerprint;
+        });
+    };
+    EXPECT_TRUE(same(chunks, chunk(original, GearKernel::Portable, 7000)));
+    EXPECT_TRUE(same(chunks, chunk(original, GearKernel::Avx2, 1000)));
+    EXPECT_TRUE(same(chunks, chunk(original, GearKernel::Avx2, original.size())));
+    EXPECT_TRUE(same(chunks, chunk(original, GearKernel::Portable, 1)));
+    EXPECT_TRUE(same(chunks, chunk(original, GearKernel::Portable, params.maxSize)));
+    const std::string longer = original + unrelated + original;
+    EXPECT_TRUE(same(chunk(longer, bestGearKernel(), longer.size()), chunk(longer, bestGearKernel(), 4096)));
+
+    // Verify: an insertion only changes the chunks around it
+    std::set<uint64_t> fingerprints;
+    for (const auto& c : chunks) fingerprints.insert(c.fingerprint);
+    size_t kept = 0;
+    for (const auto& c : chunk(shifted, bestGearKernel(), 65536)) kept += fingerprints.count(c.fingerprint);
+    EXPECT_GE(kept, chunks.size() - 3);
+
+    // Execute: index the three files
+    std::filesystem::path temp_dir = "test_dir_near";
+    std::filesystem::create_directory(temp_dir);
+    std::vector<std::filesystem::path> files = {temp_dir / "original.bin", temp_dir / "shifted.bin",
+                                                temp_dir / "unrelated.bin"};
+    std::ofstream(files[0], std::ios::binary) << original;
+    std::ofstream(files[1], std::ios::binary) << shifted;
+    std::ofstream(files[2], std::ios::binary) << unrelated;
+    Metrics metrics;
+    NearDuplicateReport report = findNearDuplicates(files, NearDuplicateOptions(), &metrics);
+
+    // Verify: one pair, nearly all shared, and the shared chunks counted as reclaimable
+    ASSERT_EQ(report.pairs.size(), 1);
+    EXPECT_EQ(report.pairs[0].first, files[0]);
+    EXPECT_EQ(report.pairs[0].second, files[1]);
+    EXPECT_GT(report.pairs[0].ratio, 0.95);
+    EXPECT_EQ(report.reclaimableBytes, report.pairs[0].sharedBytes);
+    EXPECT_EQ(report.bytes, original.size() + shifted.size() + unrelated.size());
+    EXPECT_EQ(metrics.snapshot().filesDone, 3);
+    std::ostringstream text;
+    printNearDuplicates(report, text);
+    EXPECT_NE(text.str().find("Reclaimable by chunk-level deduplication"), std::string::npos);
+
+    // Cleanup: Remove the temporary directory
+    std::filesystem::remove_all(temp_dir);
+}
+
+// Test that grouping through sorted runs on disk finds the same groups
+TEST(DuplicateFinderTest, ExternalGroupingMatchesInMemory) {
+    std::cout << "DuplicateFinderTest ExternalGroupingMatchesInMemory\n";
+
+    // Setup: small and large groups, a same-size near copy, empty files, a
+    // hard link, enough unique and paired files to fill many runs and a
+    // group too large for the budget to hold
+    std::filesystem::path temp_dir = std::filesystem::temp_directory_path() / "external_test";
+    std::filesystem::remove_all(temp_dir);
+    std::filesystem::create_directories(temp_dir / "sub");
+    for (const char* name : {"small1.txt", "small2.txt", "sub/small3.txt"}) {
+        std::ofstream(temp_dir / name) << "Small content";
+    }
+    std::string large(20000, 'L');
+    std::ofstream(temp_dir / "large1.bin") << large;
+    std::ofstream(temp_dir / "sub/large2.bin") << large;
+    large[10000] = 'X';
+    std::ofstream(temp_dir / "near.bin") << large;
+    std::filesystem::create_hard_link(temp_dir / "large1.bin", temp_dir / "large_link.bin");
+    for (const char* name : {"empty1", "empty2", "sub/empty3"}) std::ofstream(temp_dir / name);
+    for (int i = 0; i < 150; ++i) {
+        std::ofstream(temp_dir / ("unique" + std::to_string(i))) << std::string(100 + i, 'u');
+        std::ofstream(temp_dir / ("pair" + std::to_string(i) + "a")) << "pair " << i;
+        std::ofstream(temp_dir / "sub" / ("pair" + std::to_string(i) + "b")) << "pair " << i;
+    }
+    for (int i = 0; i < 300; ++i) std::ofstream(temp_dir / ("copy" + std::to_string(i))) << "Many copies";
+
+    struct CollectingSink : ResultSink {
+        std::vector<DuplicateGroup> groups;
+        bool finished = false;
+        void group(const DuplicateGroup& group) override { groups.push_back(group); }
+        void finish() override { finished = true; }
+    };
+
+    // Execute: group in memory, then on disk with a budget of a few dozen records per run
+    ProgressBar progress(0, "Comparing Files");
+    FinderOptions options;
+    auto expected = findDuplicatesInDirectories({temp_dir.string()}, progress, options);
+    CollectingSink sink;
+    options.sink = &sink;
+    ExternalOptions external;
+    external.memoryLimit = 8 * 1024;
+    PipelineStats stats;
+    ASSERT_TRUE(findDuplicatesExternal({temp_dir.string()}, progress, options, external, &stats));
+
+    // Verify: the same groups, streamed in order of size with their digests
+    EXPECT_TRUE(sink.finished);
+    std::vector<std::vector<std::filesystem::path>> found;
+    for (size_t i = 0; i < sink.groups.size(); ++i) {
+        if (i > 0) {
+            EXPECT_LE(sink.groups[i - 1].size, sink.groups[i].size);
+        }
+        EXPECT_EQ(sink.groups[i].digest, computeFileDigest(sink.groups[i].files.front(), HashAlgorithm::XXH3));
+        found.push_back(sink.groups[i].files);
+        std::sort(found.back().begin(), found.back().end());
+    }
+    std::sort(found.begin(), found.end());
+    EXPECT_EQ(found, expected);
+    EXPECT_EQ(found.size(), 154);
+    EXPECT_TRUE(std::any_of(found.begin(), found.end(), [](const auto& group) { return group.size() == 300; }));
+
+    // Verify: records went through several runs and intermediate merges
+    EXPECT_EQ(stats.hardLinksSkipped, 1);
+    EXPECT_GT(stats.spillRuns, 4);
+    EXPECT_GT(stats.mergePasses, 0);
+    ASSERT_EQ(stats.stages.size(), 3);
+    EXPECT_EQ(stats.stages[0].filesIn, 760);
+    EXPECT_EQ(stats.stages[0].filesEliminated, 150);
+    EXPECT_EQ(stats.stages[2].filesIn, 3);
+    EXPECT_EQ(stats.stages[2].filesEliminated, 1);
+
+    // Cleanup: Remove the temporary directory
+    std::filesystem::remove_all(temp_dir);
+}
+
+// Test that per-node shards merge into the groups a single scan would find
+TEST(DuplicateFinderTest, ShardsMergeIntoGlobalGroups) {
+    std::cout << "DuplicateFinderTest ShardsMergeIntoGlobalGroups\n";
+
+    // Setup: two "nodes", one copy each of a file whose size is unique on
+    // either node, a pair local to one node and an empty file on each
+    std::filesystem::path temp_dir = std::filesystem::temp_directory_path() / "shard_test";
+    std::filesystem::remove_all(temp_dir);
+    std::filesystem::create_directories(temp_dir / "a" / "sub");
+    std::filesystem::create_directories(temp_dir / "b");
+    const std::string shared(20000, 'S');
+    std::ofstream(temp_dir / "a" / "shared.bin") << shared;
+    std::ofstream(temp_dir / "b" / "shared_copy.bin") << shared;
+    std::ofstream(temp_dir / "a" / "local1.txt") << "Local pair";
+    std::ofstream(temp_dir / "a" / "sub" / "local2.txt") << "Local pair";
+    std::ofstream(temp_dir / "b" / "unique.txt") << "Only here";
+    std::ofstream(temp_dir / "a" / "empty");
+    std::ofstream(temp_dir / "b" / "empty");
+
+    struct CollectingSink : ResultSink {
+        std::vector<DuplicateGroup> groups;
+        void group(const DuplicateGroup& group) override { groups.push_back(group); }
+    };
+
+    // Execute: write a shard per node and merge them
+    ProgressBar progress(0, "Comparing Files");
+    FinderOptions options;
+    const std::string shard_a = (temp_dir / "a.shard").string();
+    const std::string shard_b = (temp_dir / "b.shard").string();
+    PipelineStats stats;
+    ASSERT_TRUE(writeCatalogueShard({(temp_dir / "a").string()}, shard_a, "node-a", progress, options, &stats));
+    ASSERT_TRUE(writeCatalogueShard({(temp_dir / "b").string()}, shard_b, "node-b", progress, options));
+    CollectingSink sink;
+    ShardMergeStats merged;
+    ASSERT_TRUE(mergeCatalogueShards({shard_a, shard_b}, HashAlgorithm::XXH3, sink, &merged));
+
+    // Verify: the cross-node pair, the local pair and the empty files, by size
+    ASSERT_EQ(stats.stages.size(), 1);
+    EXPECT_EQ(stats.stages[0].filesIn, 4);
+    EXPECT_EQ(stats.stages[0].bytesRead, 20000 + 2 * 10);
+    EXPECT_EQ(merged.shards, 2);
+    EXPECT_EQ(merged.files, 7);
+    EXPECT_EQ(merged.groups, 3);
+    EXPECT_EQ(merged.wastedBytes, 20000 + 10);
+    ASSERT_EQ(sink.groups.size(), 3);
+    const std::string a = "node-a:" + (temp_dir / "a").string();
+    const std::string b = "node-b:" + (temp_dir / "b").string();
+    EXPECT_EQ(sink.groups[0].files, std::vector<std::filesystem::path>({a + "/empty", b + "/empty"}));
+    EXPECT_EQ(sink.groups[1].files,
+              std::vector<std::filesystem::path>({a + "/local1.txt", a + "/sub/local2.txt"}));
+    EXPECT_EQ(sink.groups[2].files,
+              std::vector<std::filesystem::path>({a + "/shared.bin", b + "/shared_copy.bin"}));
+    EXPECT_EQ(sink.groups[2].digest, computeFileDigest(temp_dir / "b" / "shared_copy.bin", HashAlgorithm::XXH3));
+
+    // Verify: no shards, shards from another engine or a damaged shard are refused
+    options.hashAlgorithm = HashAlgorithm::SHA256;
+    const std::string shard_sha = (temp_dir / "sha.shard").string();
+    ASSERT_TRUE(writeCatalogueShard({(temp_dir / "b").string()}, shard_sha, "node-c", progress, options));
+    CollectingSink rejected;
+    EXPECT_FALSE(mergeCatalogueShards({}, HashAlgorithm::XXH3, rejected));
+    EXPECT_FALSE(mergeCatalogueShards({shard_a, shard_sha}, HashAlgorithm::XXH3, rejected));
+    std::filesystem::resize_file(shard_b, std::filesystem::file_size(shard_b) - 5);
+    EXPECT_FALSE(mergeCatalogueShards({shard_a, shard_b}, HashAlgorithm::XXH3, rejected));
+
+    // Cleanup: Remove the temporary directory
+    std::filesystem::remove_all(temp_dir);
+}
+
+TEST(DuplicateFinderTest, ReferenceIndexFindsExistingFiles) {
+    std::cout << "DuplicateFinderTest ReferenceIndexFindsExistingFiles\n";
+
+    // Setup: an archive holding two copies of a document and a photo, and
+    // an ingest tree with a copy of each, a changed document of the same
+    // size and a file of a size the archive does not have
+    std::filesystem::path temp_dir = std::filesystem::temp_directory_path() / "reference_index_test";
+    std::filesystem::remove_all(temp_dir);
+    std::filesystem::create_directories(temp_dir / "archive" / "sub");
+    std::filesystem::create_directories(temp_dir / "ingest");
+    const std::string photo(20000, 'P');
+    std::ofstream(temp_dir / "archive" / "photo.jpg") << photo;
+    std::ofstream(temp_dir / "archive" / "doc.txt") << "Archived doc";
+    std::ofstream(temp_dir / "archive" / "sub" / "doc_copy.txt") << "Archived doc";
+    std::ofstream(temp_dir / "ingest" / "new_photo.jpg") << photo;
+    std::ofstream(temp_dir / "ingest" / "doc.txt") << "Archived doc";
+    std::ofstream(temp_dir / "ingest" / "edited.txt") << "Archived dox";
+    std::ofstream(temp_dir / "ingest" / "fresh.txt") << "Nothing like it in the archive";
+
+    struct CollectingSink : ResultSink {
+        std::vector<DuplicateGroup> groups;
+        void group(const DuplicateGroup& group) override { groups.push_back(group); }
+    };
+
+    // Execute: index the archive, then query the ingest tree against it
+    ProgressBar progress(0, "Comparing Files");
+    FinderOptions options;
+    const std::string index_path = (temp_dir / "archive.index").string();
+    ASSERT_TRUE(buildReferenceIndex({(temp_dir / "archive").string()}, index_path, progress, options));
+    ReferenceIndex index;
+    ASSERT_TRUE(index.open(index_path));
+    CollectingSink sink;
+    PipelineStats stats;
+    ReferenceQueryStats matches;
+    ASSERT_TRUE(queryReferenceIndex(index, {(temp_dir / "ingest").string()}, progress, options, sink, &stats,
+                                    &matches));
+
+    // Verify: lookups against the mapped index
+    EXPECT_EQ(index.size(), 3);
+    EXPECT_EQ(index.algorithm(), HashAlgorithm::XXH3);
+    EXPECT_TRUE(index.containsSize(20000));
+    EXPECT_FALSE(index.containsSize(30));
+    const std::string archive = (temp_dir / "archive").string();
+    const std::vector<std::string> docs = index.find(12, computeFileDigest(temp_dir / "ingest" / "doc.txt",
+                                                                           HashAlgorithm::XXH3));
+    EXPECT_EQ(std::set<std::string>(docs.begin(), docs.end()),
+              std::set<std::string>({archive + "/doc.txt", archive + "/sub/doc_copy.txt"}));
+    EXPECT_TRUE(index.find(12, computeFileDigest(temp_dir / "ingest" / "edited.txt", HashAlgorithm::XXH3)).empty());
+
+    // Verify: both copies matched, the new-size file was never read
+    ASSERT_EQ(stats.stages.size(), 2);
+    EXPECT_EQ(stats.stages[0].filesEliminated, 1);
+    EXPECT_EQ(stats.stages[0].bytesAvoided, 30);
+    EXPECT_EQ(stats.stages[1].filesIn, 3);
+    EXPECT_EQ(stats.stages[1].bytesRead, 20000 + 2 * 12);
+    EXPECT_EQ(matches.matched, 2);
+    EXPECT_EQ(matches.matchedBytes, 20000 + 12);
+    const std::string ingest = (temp_dir / "ingest").string();
+    ASSERT_EQ(sink.groups.size(), 2);
+    EXPECT_EQ(sink.groups[0].files, std::vector<std::filesystem::path>(
+                                        {ingest + "/doc.txt", archive + "/doc.txt", archive + "/sub/doc_copy.txt"}));
+    EXPECT_EQ(sink.groups[1].files,
+              std::vector<std::filesystem::path>({ingest + "/new_photo.jpg", archive + "/photo.jpg"}));
+
+    // Verify: reopening replaces the mapping, an unknown engine is refused
+    const std::string bad_path = (temp_dir / "bad.index").string();
+    std::filesystem::copy_file(index_path, bad_path);
+    {
+        std::fstream bad(bad_path, std::ios::in | std::ios::out | std::ios::binary);
+        const uint32_t algorithm = 7;
+        bad.seekp(12);
+        bad.write(reinterpret_cast<const char*>(&algorithm), sizeof(algorithm));
+    }
+    ASSERT_TRUE(index.open(index_path));
+    EXPECT_EQ(index.size(), 3);
+    EXPECT_FALSE(index.open(bad_path));
+    EXPECT_EQ(index.size(), 0);
+
+    // Verify: a truncated index is refused
+    std::filesystem::resize_file(index_path, std::filesystem::file_size(index_path) - 40);
+    ReferenceIndex damaged;
+    EXPECT_FALSE(damaged.open(index_path));
+
+    // Cleanup: Remove the temporary directory
+    std::filesystem::remove_all(temp_dir);
+}
+
+TEST(DuplicateFinderTest, WalkFilterPrunesDuringWalk) {
+    std::cout << "DuplicateFinderTest WalkFilterPrunesDuringWalk\n";
+
+    // Setup: files of every kind the rules tell apart, and two directories
+    // that should be pruned whole
+    std::filesystem::path temp_dir = std::filesystem::temp_directory_path() / "walk_filter_test";
+    std::filesystem::remove_all(temp_dir);
+    std::filesystem::create_directories(temp_dir / "sub");
+    std::filesystem::create_directories(temp_dir / ".git" / "objects");
+    std::filesystem::create_directories(temp_dir / "cache" / "deep");
+    std::ofstream(temp_dir / "keep.txt") << "Keep this!";
+    std::ofstream(temp_dir / "sub" / "photo.jpg") << "Photo data";
+    std::ofstream(temp_dir / "small.txt") << "ab";
+    std::ofstream(temp_dir / "big.txt") << std::string(5000, 'B');
+    std::ofstream(temp_dir / "sub" / "notes.md") << "Not included";
+    std::ofstream(temp_dir / "scratch.tmp.txt") << "Temporary!";
+    std::ofstream(temp_dir / "weird$name.txt") << "Dollar sign";
+    std::ofstream(temp_dir / ".git" / "objects" / "aa.txt") << "Git object";
+    std::ofstream(temp_dir / "cache" / "deep" / "c.txt") << "Cached one";
+
+    FilterRules rules;
+    rules.minSize = 5;
+    rules.maxSize = 4096;
+    rules.includeGlobs = {"*.txt", "*.jpg"};
+    rules.excludeGlobs.push_back(".git");
+    rules.excludeGlobs.push_back("scratch.*");
+    rules.excludeRegexes = {"/cache$"};
+    WalkFilter filter;
+    ASSERT_TRUE(filter.compile(rules));
+
+    // Execute: walk the tree with the filter
+    WalkOptions walk;
+    walk.filter = &filter;
+    FileCatalogue catalogue;
+    WalkStats walked = walkDirectories({temp_dir.string()}, walk, catalogue);
+
+    // Verify: only the two wanted files, and the pruned directories never listed
+    std::set<std::filesystem::path> files;
+    for (FileCatalogue::Index i = 0; i < catalogue.size(); ++i) files.insert(catalogue.path(i));
+    EXPECT_EQ(files, std::set<std::filesystem::path>({temp_dir / "keep.txt", temp_dir / "sub" / "photo.jpg"}));
+    EXPECT_EQ(walked.directories, 2);
+    std::map<std::string, std::pair<uint64_t, uint64_t>> pruned;
+    for (const auto& count : filter.counts()) pruned[count.rule] = {count.files, count.directories};
+    EXPECT_EQ(pruned["exclude *$*"], std::make_pair(uint64_t(1), uint64_t(0)));
+    EXPECT_EQ(pruned["exclude .git"], std::make_pair(uint64_t(0), uint64_t(1)));
+    EXPECT_EQ(pruned["exclude scratch.*"], std::make_pair(uint64_t(1), uint64_t(0)));
+    EXPECT_EQ(pruned["exclude-regex /cache$"], std::make_pair(uint64_t(0), uint64_t(1)));
+    EXPECT_EQ(pruned["matched no include"], std::make_pair(uint64_t(1), uint64_t(0)));
+    EXPECT_EQ(pruned["min-size 5"], std::make_pair(uint64_t(1), uint64_t(0)));
+    EXPECT_EQ(pruned["max-size 4096"], std::make_pair(uint64_t(1), uint64_t(0)));
+
+    // Verify: an invalid regex is refused
+    FilterRules invalid;
+    invalid.excludeRegexes = {"("};
+    WalkFilter rejected;
+    EXPECT_FALSE(rejected.compile(invalid));
+
+    // Cleanup: Remove the temporary directory
+    std::filesystem::remove_all(temp_dir);
+}
+
+TEST(DuplicateFinderTest, SparseFilesHashLikeDenseOnes) {
+    std::cout << "DuplicateFinderTest SparseFilesHashLikeDenseOnes\n";
+
+    // Setup: a 4 MiB file that is one hole but for 64 KiB of data in the
+    // middle, a dense copy of it, and a sparse file whose only difference
+    // is a byte in the trailing hole
+    std::filesystem::path temp_dir = std::filesystem::temp_directory_path() / "sparse_test";
+    std::filesystem::remove_all(temp_dir);
+    std::filesystem::create_directories(temp_dir);
+    const uintmax_t size = 4 << 20;
+    const std::string data(64 << 10, 'D');
+    const std::filesystem::path sparse = temp_dir / "sparse.img";
+    const std::filesystem::path dense = temp_dir / "dense.img";
+    const std::filesystem::path other = temp_dir / "other.img";
+    for (const auto& path : {sparse, other}) {
+        std::ofstream(path, std::ios::binary).close();
+        std::filesystem::resize_file(path, size);
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(1 << 20);
+        file.write(data.data(), data.size());
+    }
+    {
+        std::fstream file(other, std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(size - 100);
+        file.put('X');
+    }
+    {
+        std::string contents(size, '\0');
+        contents.replace(1 << 20, data.size(), data);
+        std::ofstream(dense, std::ios::binary) << contents;
+    }
+
+    // Execute: hash with the hole-aware backends and with a dense stream read
+    const Digest streamed = computeFileDigest(sparse, HashAlgorithm::XXH3, ReadBackend::Stream);
+    const Digest preads = computeFileDigest(sparse, HashAlgorithm::XXH3, ReadBackend::Pread);
+    const Digest direct = computeFileDigest(sparse, HashAlgorithm::XXH3, ReadBackend::Direct);
+    const Digest dense_digest = computeFileDigest(dense, HashAlgorithm::XXH3, ReadBackend::Pread);
+    const Digest tree = computeTreeDigest(sparse, size, HashAlgorithm::XXH3, 1 << 20);
+    const Digest dense_tree = computeTreeDigest(dense, size, HashAlgorithm::XXH3, 1 << 20, ReadBackend::Stream);
+    VerifyResult verified = verifyIdenticalFiles({sparse, dense, other}, size, 16);
+
+    // Verify: the same digests as a dense read, at every stage
+    EXPECT_FALSE(streamed.empty());
+    EXPECT_EQ(preads, streamed);
+    EXPECT_EQ(direct, streamed);
+    EXPECT_EQ(dense_digest, streamed);
+    EXPECT_EQ(tree, dense_tree);
+    EXPECT_NE(computeFileDigest(other, HashAlgorithm::XXH3), streamed);
+    EXPECT_EQ(computePartialDigest(sparse, size, 4096, 4096, HashAlgorithm::XXH3),
+              computePartialDigest(dense, size, 4096, 4096, HashAlgorithm::XXH3));
+    EXPECT_NE(computePartialDigest(other, size, 4096, 4096, HashAlgorithm::XXH3),
+              computePartialDigest(dense, size, 4096, 4096, HashAlgorithm::XXH3));
+    ASSERT_EQ(verified.groups.size(), 1);
+    EXPECT_EQ(verified.groups[0], std::vector<size_t>({0, 1}));
+
+    // Verify: where the filesystem keeps the holes, they are not read
+    struct stat sb;
+    ASSERT_EQ(::stat(sparse.c_str(), &sb), 0);
+    if (static_cast<uintmax_t>(sb.st_blocks) * 512 < size) {
+        EXPECT_LT(verified.bytesRead, 2 * size);
+    }
+
+    // Verify: zero-block detection
+    std::vector<char> block(65536, 0);
+    EXPECT_TRUE(isZeroBlock(block.data(), block.size()));
+    EXPECT_TRUE(isZeroBlock(block.data(), 5));
+    block[40000] = 1;
+    EXPECT_FALSE(isZeroBlock(block.data(), block.size()));
+    EXPECT_TRUE(isZeroBlock(block.data(), 40000));
+
+    // Cleanup: Remove the temporary directory
+    std::filesystem::remove_all(temp_dir);
+}
+
+// Test that the watch daemon drops events the walk filter would have pruned
+TEST(DuplicateFinderTest, WatchDaemonFiltersEvents) {
+    std::cout << "DuplicateFinderTest WatchDaemonFiltersEvents\n";
+
+    // Setup: one indexed file beside an excluded copy, a directory to move
+    // in later, and a daemon excluding *.tmp and files under 5 bytes
+    std::filesystem::path temp_dir = std::filesystem::temp_directory_path() / "watch_filter_test";
+    std::filesystem::path staging = std::filesystem::temp_directory_path() / "watch_filter_staging";
+    std::filesystem::remove_all(temp_dir);
+    std::filesystem::remove_all(staging);
+    std::filesystem::create_directories(temp_dir);
+    std::filesystem::create_directories(staging);
+    const std::string original = (temp_dir / "original.txt").string();
+    const std::string startup = (temp_dir / "startup.tmp").string();
+    std::ofstream(original) << "Watched content";
+    std::ofstream(startup) << "Watched content";
+    std::ofstream(staging / "moved.tmp") << "Watched content";
+    std::ofstream(staging / "tiny.txt") << "abc";
+    const std::string socket_path = (std::filesystem::temp_directory_path() / "watch_filter_test.sock").string();
+    std::filesystem::remove(socket_path);
+
+    FilterRules rules;
+    rules.minSize = 5;
+    rules.excludeGlobs.push_back("*.tmp");
+    WalkFilter filter;
+    ASSERT_TRUE(filter.compile(rules));
+    FinderOptions options;
+    options.walk.filter = &filter;
+
+    std::thread daemon([&] { runWatchDaemon({temp_dir.string()}, options, socket_path, 20); });
+    auto ask = [&](const std::string& file) {
+        std::ostringstream answer;
+        return queryWatchDaemon(socket_path, {file}, answer) ? answer.str() : std::string();
+    };
+    auto wait_for = [&](const std::string& file, const std::string& expected) {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (ask(file).find(expected) == std::string::npos && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+    };
+    wait_for(original, "unique");
+
+    // Execute: add an excluded copy, a file too small to index, then a kept copy
+    const std::string excluded = (temp_dir / "copy.tmp").string();
+    const std::string small = (temp_dir / "small.txt").string();
+    const std::string copy = (temp_dir / "copy.txt").string();
+    std::ofstream(excluded) << "Watched content";
+    std::ofstream(small) << "abc";
+    std::ofstream(copy) << "Watched content";
+    wait_for(original, "duplicate of");
+
+    // Verify: only the kept copy joined the index
+    std::string answer = ask(original);
+    EXPECT_NE(answer.find("copy.txt"), std::string::npos);
+    EXPECT_EQ(answer.find("copy.tmp"), std::string::npos);
+    EXPECT_EQ(ask(startup), startup + ": not indexed\n");
+    EXPECT_EQ(ask(excluded), excluded + ": not indexed\n");
+    EXPECT_EQ(ask(small), small + ": not indexed\n");
+
+    // Execute: move in a directory holding only filtered files, then touch
+    // the kept copy so the daemon regroups its bucket after the move
+    std::filesystem::rename(staging, temp_dir / "moved");
+    const std::string moved = (temp_dir / "moved" / "moved.tmp").string();
+    const std::string tiny = (temp_dir / "moved" / "tiny.txt").string();
+    const std::string later = (temp_dir / "later.txt").string();
+    std::ofstream(later) << "Watched content";
+    wait_for(later, "duplicate of");
+
+    // Verify: nothing in the new directory was indexed or reported
+    answer = ask(original);
+    EXPECT_NE(answer.find("later.txt"), std::string::npos);
+    EXPECT_EQ(answer.find(".tmp"), std::string::npos);
+    EXPECT_EQ(ask(moved), moved + ": not indexed\n");
+    EXPECT_EQ(ask(tiny), tiny + ": not indexed\n");
+
+    // Cleanup: Stop the daemon and remove the temporary directory
+    pthread_kill(daemon.native_handle(), SIGTERM);
+    daemon.join();
+    std::filesystem::remove_all(temp_dir);
+}